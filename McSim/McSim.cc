@@ -10,6 +10,7 @@
 #include "PTSXbar.h"
 #include "PTSDirectory.h"
 #include "PTSMemoryController.h"
+#include "PTSParallel.h"
 #include <assert.h>
 #include <glog/logging.h>
 #include <iomanip>
@@ -141,7 +142,11 @@ McSim::McSim(PthreadTimingSimulator * pts_)
   num_used_pages_last(0), num_l1_acc_last(0), num_l1_miss_last(0),
   num_l2_acc_last(0), num_l2_miss_last(0) {
   lsu_process_interval = pts->get_param_uint64("pts.o3core.process_interval", 10);
-  global_q             = new GlobalEventQueue(this);
+  if (pts->get_param_uint64("pts.num_sim_threads", 1) > 1) {
+    global_q = new ParallelEventQueue(this);
+  } else {
+    global_q = new GlobalEventQueue(this);
+  }
   create_comps();
 }
 
@@ -182,7 +187,7 @@ void McSim::show_state(uint64_t addr) {
 std::pair<uint32_t, uint64_t> McSim::resume_simulation(bool must_switch) {
   std::pair<uint32_t, uint64_t> ret_val;  // <thread_id, time>
 
-  if (/*must_switch == true &&*/ global_q->event_queue.empty()) {
+  if (/*must_switch == true &&*/ global_q->empty()) {
     bool any_resumable_thread = false;
     for (uint32_t i = 0; i < o3cores.size(); i++) {
       O3Core * o3core = o3cores[i];
@@ -298,76 +303,117 @@ uint32_t McSim::add_instruction(
     bool     isbarrier,
     uint32_t rr0, uint32_t rr1, uint32_t rr2, uint32_t rr3,
     uint32_t rw0, uint32_t rw1, uint32_t rw2, uint32_t rw3) {
-  // push a new event to the event queue
+  PTSInstr instr{hthreadid_, curr_time_, waddr, wlen, raddr, raddr2, rlen, ip, category,
+    isbranch, isbranchtaken, islock, isunlock, isbarrier,
+    rr0, rr1, rr2, rr3, rw0, rw1, rw2, rw3};
+  return add_instructions(&instr, 1, 0, 0);
+}
+
+
+static inline ins_type classify(const PTSInstr & instr) {
+  return (instr.islock == true && instr.isunlock == true && instr.isbarrier == false) ? ins_notify :
+    (instr.islock == true && instr.isunlock == true && instr.isbarrier == true) ? ins_waitfor :
+    (instr.isbranch && instr.isbranchtaken)  ? ins_branch_taken :
+    (instr.isbranch && !instr.isbranchtaken) ? ins_branch_not_taken :
+    // treat an SSE op as an X87 op
+    (instr.category == XED_CATEGORY_X87_ALU || instr.category == XED_CATEGORY_SSE) ? ins_x87 :
+    (instr.islock == true)                   ? ins_lock :
+    (instr.isunlock == true)                 ? ins_unlock :
+    (instr.isbarrier == true)                ? ins_barrier : no_mem;
+}
+
+
+uint32_t McSim::add_instructions(
+    const PTSInstr * instrs,
+    uint32_t num_instrs,
+    uint32_t htid_offset,
+    uint64_t addr_offset) {
   uint32_t num_available_slot = 0;
-  num_fetched_instrs++;
 
-  O3Core * o3core = o3cores[hthreadid_];
+  for (uint32_t i = 0; i < num_instrs; ) {
+    // a run of instructions of a thread goes to consecutive o3queue entries
+    uint32_t  hthreadid_ = instrs[i].hthreadid_;
+    O3Core  * o3core     = o3cores[htid_offset + hthreadid_];
+    uint32_t  tail       = (o3core->o3queue_head + o3core->o3queue_size) % o3core->o3queue_max_size;
+
+    for (; i < num_instrs && instrs[i].hthreadid_ == hthreadid_; i++) {
+      const PTSInstr & instr = instrs[i];
+      num_fetched_instrs++;
+
+      // push a new event to the event queue
+      if (o3core->o3queue_size == 0 && o3core->resume_time <= instr.curr_time_) {
+        global_q->add_event(instr.curr_time_, o3core);
+        o3core->is_active = true;
+      }
 
-  if (o3core->o3queue_size == 0) {
-    if (o3core->resume_time <= curr_time_) {
-      global_q->add_event(curr_time_, o3core);
-      o3core->is_active = true;
+      o3core->num_instrs++;
+      o3core->num_call_ops += (instr.category == XED_CATEGORY_CALL) ? 1 : 0;
+      if (o3core->o3queue_size >= o3core->o3queue_max_size) {
+        // the frontend did not resume simulation in time; drop it
+        num_available_slot = 0;
+        continue;
+      }
+      O3Queue & o3q_entry  = o3core->o3queue[tail];
+      tail = (tail + 1 == o3core->o3queue_max_size) ? 0 : tail + 1;
+      o3q_entry.state      = o3iqs_not_in_queue;
+      o3q_entry.ready_time = instr.curr_time_;
+      o3q_entry.waddr      = instr.waddr  + (instr.waddr  == 0 ? 0 : addr_offset);
+      o3q_entry.wlen       = instr.wlen;
+      o3q_entry.raddr      = instr.raddr  + (instr.raddr  == 0 ? 0 : addr_offset);
+      o3q_entry.raddr2     = instr.raddr2 + (instr.raddr2 == 0 ? 0 : addr_offset);
+      o3q_entry.rlen       = instr.rlen;
+      o3q_entry.ip         = instr.ip + addr_offset;
+      o3q_entry.type       = classify(instr);
+      if (o3q_entry.type == ins_notify || o3q_entry.type == ins_waitfor) o3core->num_migrate_instrs++;
+      o3q_entry.rr0        = instr.rr0;
+      o3q_entry.rr1        = instr.rr1;
+      o3q_entry.rr2        = instr.rr2;
+      o3q_entry.rr3        = instr.rr3;
+      o3q_entry.rw0        = instr.rw0;
+      o3q_entry.rw1        = instr.rw1;
+      o3q_entry.rw2        = instr.rw2;
+      o3q_entry.rw3        = instr.rw3;
+
+      o3core->o3queue_size++;
+      num_available_slot = ((o3core->o3queue_size + 4 > o3core->o3queue_max_size) ? 0 :
+          (o3core->o3queue_max_size - (o3core->o3queue_size + 4)));
     }
   }
-  ins_type type = (islock == true && isunlock == true && isbarrier == false) ? ins_notify :
-    (islock == true && isunlock == true && isbarrier == true) ? ins_waitfor :
-    (isbranch && isbranchtaken)        ? ins_branch_taken :
-    (isbranch && !isbranchtaken)       ? ins_branch_not_taken :
-    // treat an SSE op as an X87 op
-    (category == XED_CATEGORY_X87_ALU || category == XED_CATEGORY_SSE) ? ins_x87 :
-    (islock == true)                   ? ins_lock :
-    (isunlock == true)                 ? ins_unlock :
-    (isbarrier == true)                ? ins_barrier : no_mem;
-
-  o3core->num_instrs++;
-  o3core->num_call_ops += (category == XED_CATEGORY_CALL) ? 1 : 0;
-  if (o3core->o3queue_size >= o3core->o3queue_max_size) {
-    return 0;
-    LOG(ERROR) << " *_* " << curr_time_;
-    o3core->displayO3Queue();
-    o3core->displayO3ROB();
-    global_q->display();
-    ASSERTX(0);
-  }
-  O3Queue & o3q_entry  = o3core->o3queue[(o3core->o3queue_max_size + o3core->o3queue_head +
-                         o3core->o3queue_size)%o3core->o3queue_max_size];
-  o3q_entry.state      = o3iqs_not_in_queue;
-  o3q_entry.ready_time = curr_time_;
-  o3q_entry.waddr      = waddr;
-  o3q_entry.wlen       = wlen;
-  o3q_entry.raddr      = raddr;
-  o3q_entry.raddr2     = raddr2;
-  o3q_entry.rlen       = rlen;
-  o3q_entry.ip         = ip;
-  o3q_entry.type       = type;
-  o3q_entry.rr0        = rr0;
-  o3q_entry.rr1        = rr1;
-  o3q_entry.rr2        = rr2;
-  o3q_entry.rr3        = rr3;
-  o3q_entry.rw0        = rw0;
-  o3q_entry.rw1        = rw1;
-  o3q_entry.rw2        = rw2;
-  o3q_entry.rw3        = rw3;
-
-  o3core->o3queue_size++;
-
-  if ((raddr != 0 && !is_race_free_application && !o3core->is_private(raddr)) ||
-      (raddr != 0 && !is_race_free_application && !o3core->is_private(raddr2)) ||
-      (waddr != 0 && !is_race_free_application && !o3core->is_private(waddr))) {
-    num_available_slot = 0;
-  }
 
-  // if (ip != 0) {
-  //   cout << curr_time_ << ", " << std::hex << ip << std::dec << ", " << category;
-  //   cout << ", " << xed_category_enum_t2str((xed_category_enum_t) category) << std::endl;
-  // }
+  return num_available_slot;
+}
 
-  // if (o3core->o3queue_size + 4 >= o3core->o3queue_max_size) resume = true;
-  num_available_slot = ((o3core->o3queue_size + 4 > o3core->o3queue_max_size) ? 0 :
-      (o3core->o3queue_max_size - (o3core->o3queue_size + 4)));
 
-  return num_available_slot;
+void McSim::warm_instructions(
+    const PTSInstr * instrs,
+    uint32_t num_instrs,
+    uint32_t htid_offset,
+    uint64_t addr_offset) {
+  if (skip_all_instrs == true) return;
+  O3Core * last_core = nullptr;
+  uint64_t last_line = 0;
+
+  for (uint32_t i = 0; i < num_instrs; i++) {
+    const PTSInstr & instr = instrs[i];
+    O3Core * o3core = o3cores[htid_offset + instr.hthreadid_];
+
+    // like the o3core, fetch a line once for a run of instructions on it
+    uint64_t ip   = instr.ip + addr_offset;
+    uint64_t line = ip >> o3core->cachel1i->set_lsb;
+    if (simulate_only_data_caches == false && (o3core != last_core || line != last_line)) {
+      if (o3core->bypass_tlb == false) o3core->tlbl1i->warm(ip);
+      o3core->cachel1i->warm(line << o3core->cachel1i->set_lsb, false);
+      last_core = o3core;
+      last_line = line;
+    }
+
+    const uint64_t addrs[3] = { instr.raddr, instr.raddr2, instr.waddr };
+    for (uint32_t k = 0; k < 3; k++) {
+      if (addrs[k] == 0) continue;
+      if (o3core->bypass_tlb == false) o3core->tlbl1d->warm(addrs[k] + addr_offset);
+      o3core->cachel1d->warm(addrs[k] + addr_offset, k == 2);
+    }
+  }
 }
 
 
@@ -404,8 +450,7 @@ void McSim::show_l2_cache_summary() {
 
     for (uint32_t j = 0; j < l2s[i]->num_sets; j++) {
       for (uint32_t k = 0; k < l2s[i]->num_ways; k++) {
-        CacheL2::L2Entry * iter = l2s[i]->tags[j][k];
-        switch (iter->type) {
+        switch (l2s[i]->states[j*l2s[i]->num_ways + k]) {
           case cs_invalid:   num_i_cache_lines++;  break;
           case cs_exclusive: num_e_cache_lines++;  break;
           case cs_shared:    num_s_cache_lines++;  break;
@@ -449,6 +494,7 @@ void McSim::show_l2_cache_summary() {
 
 void McSim::update_os_page_req_dist(uint64_t addr) {
   if (mcs[0]->display_os_page_usage == true) {
+    std::lock_guard<std::mutex> lock(os_page_req_dist_mutex);  // parallel engine
     uint64_t page_num = addr / (1 << global_q->page_sz_base_bit);
     std::map<uint64_t, uint64_t>::iterator p_iter = os_page_req_dist.find(page_num);
 
@@ -482,7 +528,15 @@ void McSim::create_comps() {
     mcs.push_back(new MemoryController(ct_memory_controller, i, this));
     dirs.push_back(new Directory(ct_directory, i, this));
   }
-  noc = new Crossbar(ct_crossbar, 0, this, num_hthreads / num_l1_caches_per_l2_cache);
+  std::string noc_type(pts->get_param_str("pts.noc_type"));
+  if (noc_type == "mesh") {
+    noc = new Mesh2D(ct_crossbar, 0, this, num_hthreads / num_l1_caches_per_l2_cache);
+  } else if (noc_type == "ring") {
+    noc = new Ring(ct_crossbar, 0, this, num_hthreads / num_l1_caches_per_l2_cache);
+  } else {
+    CHECK(noc_type == "" || noc_type == "xbar") << "unknown pts.noc_type " << noc_type;
+    noc = new Crossbar(ct_crossbar, 0, this, num_hthreads / num_l1_caches_per_l2_cache);
+  }
   connect_comps();
 }
 
@@ -493,8 +547,6 @@ void McSim::connect_comps() {
     LOG(FATAL) << "the # of memory controllers must not be larger than the # of L2 caches\n";
   }
 
-  std::string   noc_type(pts->get_param_str("pts.noc_type"));
-  assert(noc_type == "xbar");
   // connect o3core and l1s
   for (auto && el : l1is) el->lsus.clear();
   for (auto && el : l1ds) el->lsus.clear();
@@ -533,6 +585,22 @@ void McSim::connect_comps() {
     dirs[i]->cachel2  = (l2s[i]);
     dirs[i]->crossbar = noc;
   }
+
+  // logical processes of the parallel engine: one per L2 cluster and the NoC
+  for (uint32_t i = 0; i < num_hthreads; i++) {
+    o3cores[i]->lp = i / num_l1_caches_per_l2_cache;
+    l1is[i]->lp    = i / num_l1_caches_per_l2_cache;
+    l1ds[i]->lp    = i / num_l1_caches_per_l2_cache;
+    tlbl1ds[i]->lp = i / num_l1_caches_per_l2_cache;
+    tlbl1is[i]->lp = i / num_l1_caches_per_l2_cache;
+  }
+  for (uint32_t i = 0; i < l2s.size(); i++) {
+    l2s[i]->lp  = i;
+    dirs[i]->lp = i;
+    mcs[i]->lp  = i;
+  }
+  noc->lp = l2s.size();
+  global_q->partition(l2s.size() + 1);
 }
 
 }  // namespace PinPthread
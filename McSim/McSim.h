@@ -9,6 +9,7 @@
 #include <iostream>
 #include <list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <stack>
@@ -91,6 +92,18 @@ class McSim {
     bool   isbarrier,
     UINT32 rr0, UINT32 rr1, UINT32 rr2, UINT32 rr3,
     UINT32 rw0, UINT32 rw1, UINT32 rw2, UINT32 rw3);
+  // adds a batch of instructions; the hardware thread of an instruction is
+  // htid_offset + hthreadid_, and addr_offset is added to its ip and non-zero
+  // addresses.  returns the room left in the o3queue of the last one.
+  UINT32 add_instructions(const PTSInstr * instrs, UINT32 num_instrs,
+    UINT32 htid_offset, UINT64 addr_offset);
+  // functional warming: the instruction fetches and the memory accesses of
+  // the instructions go through the TLBs, the caches, and the directories
+  // at once.  no event is made and no stat is counted, so the timing
+  // simulation that follows starts with warm state and fresh stats.  it is
+  // called only before the timing simulation starts.
+  void warm_instructions(const PTSInstr * instrs, UINT32 num_instrs,
+    UINT32 htid_offset, UINT64 addr_offset);
 
   void link_thread(INT32 pth_id, bool * active_, INT32 * spinning_,
     ADDRINT * stack_, ADDRINT * stacksize_);
@@ -126,6 +139,7 @@ class McSim {
   void   show_l2_cache_summary();
 
   std::map<UINT64, UINT64>  os_page_req_dist;
+  std::mutex                os_page_req_dist_mutex;
   void update_os_page_req_dist(UINT64 addr);
   UINT64 num_fetched_instrs;
 
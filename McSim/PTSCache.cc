@@ -22,6 +22,31 @@ extern std::ostream & operator << (std::ostream & output, coherence_state_type c
 extern std::ostream & operator << (std::ostream & output, component_type ct);
 extern std::ostream & operator << (std::ostream & output, event_type et);
 
+std::ostream & operator<<(std::ostream & output, replacement_policy policy) {
+  switch (policy) {
+    case rp_lru:   output << "lru"; break;
+    case rp_plru:  output << "plru"; break;
+    case rp_srrip: output << "srrip"; break;
+    case rp_brrip: output << "brrip"; break;
+    case rp_ship:  output << "ship"; break;
+    default: break;
+  }
+  return output;
+}
+
+// RRIP keeps 2-bit re-reference prediction values (RRPVs): a hit sets 0, a
+// line is evicted at max_rrpv, and lines come in at max_rrpv - 1 (long) or
+// max_rrpv (distant).  brrip inserts one in brrip_long_interval fills long.
+// ship learns per 16KB region whether its lines get hit before they are
+// evicted (SHiP-Mem) and inserts the lines of regions that do not distant.
+static const uint8_t  max_rrpv            = 3;
+static const uint64_t brrip_long_interval = 32;
+static const uint32_t ship_region_lsb     = 14;
+static const uint32_t ship_sig_bits       = 14;
+static const uint8_t  ship_max_count      = 7;
+static const uint16_t ship_valid          = 1 << 14;  // in Cache::signatures
+static const uint16_t ship_reused         = 1 << 15;
+
 
 Cache::Cache(
     component_type type_,
@@ -31,12 +56,125 @@ Cache::Cache(
   set_lsb(get_param_uint64("set_lsb", 6)),
   num_banks(get_param_uint64("num_banks", 1)),
   num_sets_per_subarray(get_param_uint64("num_sets_per_subarray", 1)),
+  replacement(rp_lru),
+  use_prefetch(get_param_bool("use_prefetch", false)),
+  num_pre_entries(get_param_uint64("num_pre_entries", 64)),
+  prefetch_queue_size(get_param_uint64("prefetch_queue_size", 16)),
+  num_mshrs(get_param_uint64("num_mshrs", 0)),
   num_rd_access(0), num_rd_miss(0),
   num_wr_access(0), num_wr_miss(0),
   num_ev_coherency(0), num_ev_capacity(0),
   num_coherency_access(0), num_upgrade_req(0),
-  num_bypass(0), num_nack(0) {
+  num_bypass(0), num_nack(0),
+  num_prefetch_requests(0), num_prefetch_hits(0), num_prefetch_late(0),
+  num_prefetch_uncovered(0), num_prefetch_dropped(0),
+  num_mshr_merged(0), num_mshr_stalls(0),
+  prefetcher(nullptr), prefetched(use_prefetch ? 2 * num_pre_entries : 16),
+  oldest_pre_entry_idx(0),
+  mshrs(num_mshrs, get_param_uint64("num_mshr_targets", 4)) {
   req_qs    = std::vector< std::queue<LocalQueueElement * > >(num_banks);
+
+  const std::string policy = get_param_str("replacement");
+  if (policy == "plru") {
+    replacement = rp_plru;
+  } else if (policy == "srrip") {
+    replacement = rp_srrip;
+  } else if (policy == "brrip") {
+    replacement = rp_brrip;
+  } else if (policy == "ship") {
+    replacement = rp_ship;
+  } else {
+    CHECK(policy.empty() || policy == "lru") << "unknown replacement policy " << policy;
+  }
+
+  if (use_prefetch == true) {
+    CHECK(num_pre_entries > 0 && prefetch_queue_size > 0);
+    std::string type = get_param_str("prefetcher");
+    prefetcher = Prefetcher::create(type.empty() ? "next_line" : type,
+        get_param_uint64("prefetch_degree", 2),
+        get_param_uint64("prefetch_distance", 8),
+        get_param_uint64("prefetch_table_size", 64));
+    pre_lines = std::vector<uint64_t>(num_pre_entries, LineMap<PrefetchEntry>::empty_line);
+  }
+}
+
+
+Cache::~Cache() {
+  const char * name = (type == ct_cachel1d) ? "L1$D[" : (type == ct_cachel1i) ? "L1$I[" : "L2$ [";
+  if (num_mshr_merged > 0 || num_mshr_stalls > 0) {
+    std::cout << "  -- " << name << std::setw(3) << num << "] : MSHR (merged, stalls)=( "
+      << std::setw(8) << num_mshr_merged << ", " << std::setw(8) << num_mshr_stalls << ")" << std::endl;
+  }
+  if (num_prefetch_requests > 0) {
+    uint64_t num_useful = num_prefetch_hits + num_prefetch_late;
+    std::cout << "  -- " << name << std::setw(3) << num << "] : PRE (issued, useful, late, dropped)=( "
+      << std::setw(8) << num_prefetch_requests << ", " << std::setw(8) << num_useful << ", "
+      << std::setw(8) << num_prefetch_late << ", " << std::setw(8) << num_prefetch_dropped << "), "
+      << std::setiosflags(std::ios::fixed) << std::setprecision(2)
+      << "accuracy= " << 100.00*num_useful/num_prefetch_requests << "%, coverage= "
+      << 100.00*num_useful/std::max<uint64_t>(num_useful + num_prefetch_uncovered, 1) << "%"
+      << std::endl;
+  }
+  delete prefetcher;
+}
+
+
+// a demand miss to a line still on the way is a late prefetch; one to a
+// line that came in and left unused is not covered
+void Cache::train_prefetcher(
+    uint64_t curr_time,
+    uint64_t address,
+    uint64_t ip,
+    uint32_t th_id,
+    bool hit) {
+  const uint64_t line = address >> set_lsb;
+  bool first_use = false;
+  PrefetchEntry * entry = prefetched.find(line);
+  if (entry != nullptr && entry->used == false && (hit == true || entry->arrived == false)) {
+    entry->used = true;
+    first_use   = true;
+    (hit == true) ? num_prefetch_hits++ : num_prefetch_late++;
+  } else if (hit == false) {
+    num_prefetch_uncovered++;
+  }
+
+  candidates.clear();
+  prefetcher->access(line, ip, hit == false, first_use, candidates);
+  for (auto && candidate : candidates) {
+    if (candidate >= (UINT64_MAX >> set_lsb)) continue;  // wrapped around
+    if (prefetch_q.size() >= prefetch_queue_size) {
+      num_prefetch_dropped++;
+    } else {
+      prefetch_q.push_back(candidate);
+    }
+  }
+
+  for (uint32_t i = 0; i < prefetcher->degree && prefetch_q.empty() == false; ) {
+    const uint64_t pre_line = prefetch_q.front();
+    prefetch_q.pop_front();
+    PrefetchEntry * pre = prefetched.find(pre_line);
+    if ((pre != nullptr && pre->arrived == false) || has_line(pre_line << set_lsb) ||
+        (num_mshrs > 0 && mshrs.find(pre_line) != nullptr)) {
+      continue;  // on the way or already here
+    }
+    if (num_mshrs > 0 && mshrs.full() == true) {
+      prefetch_q.push_front(pre_line);  // try again on a later access
+      break;
+    }
+    if (pre != nullptr) {
+      *pre = PrefetchEntry();  // prefetched again; it keeps its place in pre_lines
+    } else {
+      if (pre_lines[oldest_pre_entry_idx] != LineMap<PrefetchEntry>::empty_line) {
+        prefetched.erase(pre_lines[oldest_pre_entry_idx]);
+      }
+      prefetched[pre_line] = PrefetchEntry();
+      pre_lines[oldest_pre_entry_idx] = pre_line;
+      oldest_pre_entry_idx = (oldest_pre_entry_idx + 1) % num_pre_entries;
+    }
+    num_prefetch_requests++;
+    send_prefetch(curr_time, pre_line << set_lsb, th_id);
+    i++;
+  }
 }
 
 void Cache::display_event(
@@ -50,6 +188,222 @@ void Cache::display_event(
   }
 }
 
+
+void Cache::init_tags() {
+  CHECK(num_ways > 0 && num_ways <= 64) << "num_ways of " << type << " should be in [1, 64]";
+  CHECK(num_sets > 0) << "num_sets of " << type << " should be positive";
+  num_sets_pow2 = (num_sets & (num_sets - 1)) == 0;
+  num_sets_log2 = __builtin_ctz(num_sets);
+  tags   = std::vector<uint64_t>(num_sets * num_ways, 0);
+  states = std::vector<coherence_state_type>(num_sets * num_ways, cs_invalid);
+  ages   = std::vector<uint8_t>(num_sets * num_ways);
+  for (uint32_t i = 0; i < num_sets * num_ways; i++) {
+    ages[i] = (replacement == rp_lru) ? (i % num_ways) : max_rrpv;
+  }
+  num_fills = 0;
+
+  if (replacement == rp_plru) {
+    CHECK((num_ways & (num_ways - 1)) == 0) << "plru of " << type << " needs a power-of-two num_ways";
+    plru_bits = std::vector<uint64_t>(num_sets, 0);
+  } else if (replacement == rp_ship) {
+    signatures = std::vector<uint16_t>(num_sets * num_ways, 0);
+    shct       = std::vector<uint8_t>(1 << ship_sig_bits, 1);
+  }
+}
+
+
+// the way loops are written without early exits and instantiated for the
+// common 4, 8, and 16 ways (N) besides any number of ways (N == 0), so
+// that the compiler unrolls them into a few vector compares.  the switches
+// on num_ways, which is fixed once the cache is built, pick one.
+#define WAY_KERNEL(kernel, ...)                                    \
+  switch (num_ways) {                                              \
+    case 4:  return kernel<4>(__VA_ARGS__);                        \
+    case 8:  return kernel<8>(__VA_ARGS__);                        \
+    case 16: return kernel<16>(__VA_ARGS__);                       \
+    default: return kernel<0>(__VA_ARGS__);                        \
+  }
+
+template <uint32_t N>
+static inline uint32_t find_way_in(const uint64_t * set_tags,
+    const coherence_state_type * set_states, uint64_t tag, uint32_t num_ways) {
+  const uint32_t n = (N == 0) ? num_ways : N;
+  uint32_t way = n;
+  for (uint32_t i = n; i-- > 0; ) {
+    way = (set_tags[i] == tag && set_states[i] != cs_invalid) ? i : way;
+  }
+  return way;
+}
+
+template <uint32_t N>
+static inline uint32_t lru_way_in(const uint8_t * set_ages, uint32_t num_ways) {
+  const uint32_t n = (N == 0) ? num_ways : N;
+  uint32_t way = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    way = (set_ages[i] == 0) ? i : way;
+  }
+  return way;
+}
+
+// the ways younger than the accessed one get older by one
+template <uint32_t N>
+static inline void update_LRU_in(uint8_t * set_ages, uint32_t way, uint32_t num_ways) {
+  const uint32_t n   = (N == 0) ? num_ways : N;
+  const uint8_t  age = set_ages[way];
+  for (uint32_t i = 0; i < n; i++) {
+    set_ages[i] -= (set_ages[i] > age) ? 1 : 0;
+  }
+  set_ages[way] = n - 1;
+}
+
+template <uint32_t N>
+static inline uint32_t invalid_way_in(const coherence_state_type * set_states, uint32_t num_ways) {
+  const uint32_t n = (N == 0) ? num_ways : N;
+  uint32_t way = n;
+  for (uint32_t i = n; i-- > 0; ) {
+    way = (set_states[i] == cs_invalid) ? i : way;
+  }
+  return way;
+}
+
+// the first way at max_rrpv after aging the set until there is one
+template <uint32_t N>
+static inline uint32_t rrip_way_in(uint8_t * set_ages, uint32_t num_ways) {
+  const uint32_t n = (N == 0) ? num_ways : N;
+  uint8_t oldest = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    oldest = std::max(oldest, set_ages[i]);
+  }
+  if (oldest < max_rrpv) {
+    for (uint32_t i = 0; i < n; i++) {
+      set_ages[i] += max_rrpv - oldest;
+    }
+  }
+  uint32_t way = 0;
+  for (uint32_t i = n; i-- > 0; ) {
+    way = (set_ages[i] == max_rrpv) ? i : way;
+  }
+  return way;
+}
+
+
+uint32_t Cache::find_way(uint32_t set, uint64_t tag) const {
+  WAY_KERNEL(find_way_in, &tags[set * num_ways], &states[set * num_ways], tag, num_ways);
+}
+
+
+uint32_t Cache::lru_way(uint32_t set) const {
+  WAY_KERNEL(lru_way_in, &ages[set * num_ways], num_ways);
+}
+
+
+void Cache::update_LRU(uint32_t set, uint32_t way) {
+  WAY_KERNEL(update_LRU_in, &ages[set * num_ways], way, num_ways);
+}
+
+
+// the ways are the leaves of a binary tree whose node i has children 2i and
+// 2i+1 (the root is 1).  the bit of a node points to the child to evict from.
+uint32_t Cache::plru_way(uint32_t set) const {
+  const uint64_t bits = plru_bits[set];
+  uint32_t node = 1;
+  while (node < num_ways) {
+    node = 2*node + ((bits >> node) & 1);
+  }
+  return node - num_ways;
+}
+
+
+// the nodes on the path to the accessed way point away from it
+void Cache::update_PLRU(uint32_t set, uint32_t way) {
+  uint64_t bits = plru_bits[set];
+  for (uint32_t node = way + num_ways; node > 1; node /= 2) {
+    const uint64_t away = (node & 1) ^ 1;
+    bits = (bits & ~(1ULL << (node / 2))) | (away << (node / 2));
+  }
+  plru_bits[set] = bits;
+}
+
+
+uint32_t Cache::invalid_way(uint32_t set) const {
+  WAY_KERNEL(invalid_way_in, &states[set * num_ways], num_ways);
+}
+
+
+uint32_t Cache::rrip_way(uint32_t set) {
+  WAY_KERNEL(rrip_way_in, &ages[set * num_ways], num_ways);
+}
+
+#undef WAY_KERNEL
+
+
+// lru keeps its victims as they were, invalid lines included; the others
+// take an invalid way first
+uint32_t Cache::victim_way(uint32_t set) {
+  if (replacement == rp_lru) return lru_way(set);
+
+  uint32_t way = invalid_way(set);
+  if (way != num_ways) return way;
+  return (replacement == rp_plru) ? plru_way(set) : rrip_way(set);
+}
+
+
+void Cache::fill(uint32_t set, uint32_t way, uint64_t address) {
+  uint8_t & rrpv = ages[set * num_ways + way];
+
+  switch (replacement) {
+    case rp_lru:   update_LRU(set, way); break;
+    case rp_plru:  update_PLRU(set, way); break;
+    case rp_srrip: rrpv = max_rrpv - 1; break;
+    case rp_brrip:
+      rrpv = (++num_fills % brrip_long_interval == 0) ? max_rrpv - 1 : max_rrpv;
+      break;
+    case rp_ship: {
+      // the line leaving the way was not hit; its region learns from it
+      uint16_t & sig = signatures[set * num_ways + way];
+      if ((sig & ship_valid) != 0 && (sig & ship_reused) == 0) {
+        uint8_t & count = shct[sig & (ship_valid - 1)];
+        count -= (count > 0) ? 1 : 0;
+      }
+      sig  = ((address >> ship_region_lsb) * 0x9E3779B97F4A7C15ULL) >> (64 - ship_sig_bits);
+      rrpv = (shct[sig] == 0) ? max_rrpv : max_rrpv - 1;
+      sig |= ship_valid;
+      break;
+    }
+    default: break;
+  }
+}
+
+
+void Cache::touch(uint32_t set, uint32_t way) {
+  switch (replacement) {
+    case rp_lru:  update_LRU(set, way); break;
+    case rp_plru: update_PLRU(set, way); break;
+    case rp_ship: {
+      uint16_t & sig = signatures[set * num_ways + way];
+      if ((sig & ship_valid) != 0) {
+        uint8_t & count = shct[sig & (ship_valid - 1)];
+        count += (count < ship_max_count) ? 1 : 0;
+        sig   |= ship_reused;
+      }
+      ages[set * num_ways + way] = 0;
+      break;
+    }
+    default: ages[set * num_ways + way] = 0; break;  // srrip, brrip
+  }
+}
+
+
+// an update that is not a demand hit, e.g., an eviction from an L1; the
+// recency-based policies take it, and the RRIP ones do not learn from it
+void Cache::refresh(uint32_t set, uint32_t way) {
+  if (replacement == rp_lru) {
+    update_LRU(set, way);
+  } else if (replacement == rp_plru) {
+    update_PLRU(set, way);
+  }
+}
+
 // in L1, num_sets is the number of sets of all L1 banks.
 // set_lsb still sets the size of a cache line.
 // bank and set numbers are specified like:
@@ -63,26 +417,12 @@ CacheL1::CacheL1(
   l1_to_lsu_t(get_param_uint64("to_lsu_t", 0)),
   l1_to_l2_t(get_param_uint64("to_l2_t", 45)),
   always_hit(get_param_bool("always_hit", false)),
-  l2_set_lsb(get_param_uint64("set_lsb", "pts.l2$.", set_lsb)),
-  use_prefetch(get_param_bool("use_prefetch", false)),
-  num_pre_entries(get_param_uint64("num_pre_entries", 64)),
-  num_prefetch_requests(0), num_prefetch_hits(0), oldest_pre_entry_idx(0) {
+  l2_set_lsb(get_param_uint64("set_lsb", "pts.l2$.", set_lsb)) {
   process_interval = get_param_uint64("process_interval", 10);
   num_sets = get_param_uint64("num_sets", 64);
   num_ways = get_param_uint64("num_ways",  4);
   CHECK(l2_set_lsb >= set_lsb);
-  tags = new l1_tag_pair ** [num_sets];
-  for (uint32_t i = 0; i < num_sets; i++) {
-    tags[i] = new l1_tag_pair * [num_ways];
-    // tags[i][0] = LRU, tags[i][num_ways -1] = MRU
-    for (uint32_t j = 0; j < num_ways; j++) {
-      tags[i][j] = new l1_tag_pair(0, cs_invalid);
-    }
-  }
-  pres = new PrefetchEntry * [num_pre_entries];
-  for (uint32_t i = 0; i < num_pre_entries; i++) {
-    pres[i] = new PrefetchEntry();
-  }
+  init_tags();
 }
 
 
@@ -116,8 +456,8 @@ CacheL1::~CacheL1() {
 
     for (uint32_t j = 0; j < num_sets; j++) {
       for (uint32_t i = 0; i < num_ways; i++) {
-        if (tags[j][i]->second == cs_modified) {
-          uint64_t addr   = ((tags[j][i]->first * num_sets) << set_lsb);
+        if (states[j*num_ways + i] == cs_modified) {
+          uint64_t addr   = ((tags[j*num_ways + i] * num_sets) << set_lsb);
           uint64_t offset = addr >> addr_offset_lsb;
 
           if (dirty_cl_per_offset.find(offset) == dirty_cl_per_offset.end()) {
@@ -142,19 +482,6 @@ CacheL1::~CacheL1() {
       << num_ev_coherency << ", " << std::setw(10) << num_coherency_access << ", " << std::setw(10)
       << num_bypass << ")" << std::endl;
   }
-
-  for (uint32_t i = 0; i < num_sets; i++) {
-    for (uint32_t j = 0; j < num_ways; j++) {
-      delete tags[i][j];
-    }
-    delete[] tags[i];
-  }
-  delete[] tags;
-
-  for (uint32_t i = 0; i < num_pre_entries; i++) {
-    delete pres[i];
-  }
-  delete[] pres;
 }
 
 
@@ -166,7 +493,7 @@ void CacheL1::add_req_event(
     event_time += process_interval - event_time%process_interval;
   } */
   geq->add_event(event_time, this);
-  req_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+  req_event.push(event_time, local_event);
 }
 
 
@@ -178,49 +505,40 @@ void CacheL1::add_rep_event(
     event_time += process_interval - event_time%process_interval;
   } */
   geq->add_event(event_time, this);
-  rep_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+  rep_event.push(event_time, local_event);
 }
 
 
 void CacheL1::show_state(uint64_t address) {
-  uint32_t set = (address >> set_lsb) % num_sets;
-  uint64_t tag = (address >> set_lsb) / num_sets;
-  for (uint32_t i = 0; i < num_ways; i++) {
-    if (tags[set][i]->second != cs_invalid && tags[set][i]->first == tag) {
-      LOG(WARNING) << "  -- L1" << ((type == ct_cachel1d) ? "D[" : "I[") << num
-        << "] : " << tags[set][i]->second << std::endl;
-      break;
-    }
+  uint32_t set = set_of(address);
+  uint64_t tag = tag_of(address);
+  uint32_t way = find_way(set, tag);
+  if (way != num_ways) {
+    LOG(WARNING) << "  -- L1" << ((type == ct_cachel1d) ? "D[" : "I[") << num
+      << "] : " << states[set*num_ways + way] << std::endl;
   }
 }
 
 
 uint32_t CacheL1::process_event(uint64_t curr_time) {
-  std::multimap<uint64_t, LocalQueueElement *>::iterator req_event_iter = req_event.begin();
-  std::multimap<uint64_t, LocalQueueElement *>::iterator rep_event_iter = rep_event.begin();
-  l1_tag_pair * set_it = nullptr;
-
   LocalQueueElement * rep_lqe = nullptr;
   LocalQueueElement * req_lqe = nullptr;
   // event -> queue
   if (rep_q.empty() == false) {
     rep_lqe = rep_q.front();
     rep_q.pop();
-  } else if (rep_event_iter != rep_event.end() && rep_event_iter->first == curr_time) {
-    rep_lqe = rep_event_iter->second;
-    rep_event_iter = rep_event.erase(rep_event_iter);
+  } else {
+    rep_lqe = rep_event.pop(curr_time);
   }
 
-  while (rep_event_iter != rep_event.end() && rep_event_iter->first == curr_time) {
-    rep_q.push(rep_event_iter->second);
-    rep_event_iter = rep_event.erase(rep_event_iter);
+  for (auto lqe = rep_event.pop(curr_time); lqe != nullptr; lqe = rep_event.pop(curr_time)) {
+    rep_q.push(lqe);
   }
 
-  while (req_event_iter != req_event.end() && req_event_iter->first == curr_time) {
+  for (auto lqe = req_event.pop(curr_time); lqe != nullptr; lqe = req_event.pop(curr_time)) {
     // TODO(gajh): do we need some XOR schemes for better distribution across banks?
-    uint32_t bank = (req_event_iter->second->address >> set_lsb) % num_banks;
-    req_qs[bank].push(req_event_iter->second);
-    req_event_iter = req_event.erase(req_event_iter);
+    uint32_t bank = (lqe->address >> set_lsb) % num_banks;
+    req_qs[bank].push(lqe);
   }
 
   // reply events have higher priority than request events
@@ -232,19 +550,13 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
       uint64_t address = ((rep_lqe->address >> l2_set_lsb) << l2_set_lsb) +
         (rep_lqe->address + index*(1 << set_lsb))%(1 << l2_set_lsb);
       // uint64_t address = rep_lqe->address;
-      uint32_t set = (address >> set_lsb) % num_sets;
-      uint64_t tag = (address >> set_lsb) / num_sets;
-      auto tags_set    = tags[set];
+      uint32_t set = set_of(address);
+      uint64_t tag = tag_of(address);
       event_type etype = rep_lqe->type;
 
       // display_event(curr_time, rep_lqe, "P");
-      uint32_t idx = 0;
-      for ( ; idx < num_ways; idx++) {
-        if (tags_set[idx]->second != cs_invalid && tags_set[idx]->first == tag) {
-          set_it = tags_set[idx];
-          break;
-        }
-      }
+      uint32_t idx = find_way(set, tag);
+      coherence_state_type * set_it = (idx == num_ways) ? nullptr : &states[set*num_ways + idx];
 
       switch (etype) {
         case et_nack:
@@ -254,7 +566,12 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
           sent_to_l2 = true;
           num_bypass++;
           rep_lqe->from.pop();
-          add_event_to_lsu(curr_time, rep_lqe);
+          reply_mshr_targets(curr_time, rep_lqe);
+          if (rep_lqe->from.top() == this) {  // a prefetch
+            rep_lqe->release();
+          } else {
+            add_event_to_lsu(curr_time, rep_lqe);
+          }
           break;
 
         case et_evict:
@@ -262,8 +579,8 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
           if (set_it != nullptr) {
             num_ev_coherency++;
 
-            if (set_it->second == cs_modified) {
-              set_it->second = cs_invalid;
+            if (*set_it == cs_modified) {
+              *set_it = cs_invalid;
               if (sent_to_l2 == false) {
                 sent_to_l2 = true;
                 rep_lqe->from.pop();
@@ -272,20 +589,20 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
               }
               break;
             }
-            set_it->second = cs_invalid;
+            *set_it = cs_invalid;
           }
-          if (index == (1 << (l2_set_lsb - set_lsb)) - 1 && sent_to_l2 == false) delete rep_lqe;
+          if (index == (1 << (l2_set_lsb - set_lsb)) - 1 && sent_to_l2 == false) rep_lqe->release();
           break;
 
         case et_m_to_s:
         case et_m_to_m:
           num_coherency_access++;
-          if (set_it != nullptr && set_it->second == cs_modified) {
+          if (set_it != nullptr && *set_it == cs_modified) {
             if (etype == et_m_to_m) {
               num_ev_coherency++;
-              set_it->second = cs_invalid;
+              *set_it = cs_invalid;
             } else {
-              set_it->second = cs_shared;
+              *set_it = cs_shared;
             }
           }
           if (sent_to_l2 == true) break;
@@ -299,21 +616,21 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
           num_coherency_access++;
           if (set_it == nullptr) {
             // oops -- the cache line is already evicted. do nothing.
-            // delete rep_lqe;
+            // rep_lqe->release();
           } else {
             if (sent_to_l2 == true) break;
             sent_to_l2 = true;
-            if (set_it->second != cs_modified) {
+            if (*set_it != cs_modified) {
               show_state(address);
               LOG(FATAL) << *this << *rep_lqe << *geq;
             }
             num_ev_coherency++;
-            set_it->second = cs_exclusive;
+            *set_it = cs_exclusive;
             rep_lqe->type    = et_evict;
             rep_lqe->from.push(this);
             cachel2->add_rep_event(curr_time + l1_to_l2_t, rep_lqe);
           }
-          if (index == (1 << (l2_set_lsb - set_lsb)) - 1 && sent_to_l2 == false) delete rep_lqe;
+          if (index == (1 << (l2_set_lsb - set_lsb)) - 1 && sent_to_l2 == false) rep_lqe->release();
           break;
 
         case et_read:
@@ -322,26 +639,37 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
           if (index != 0) break;
           rep_lqe->from.pop();
           if (set_it == nullptr) {
-            idx = 0;
-            set_it = tags_set[idx];
-            if (set_it->second != cs_invalid) {
+            idx = victim_way(set);
+            set_it = &states[set*num_ways + idx];
+            if (*set_it != cs_invalid) {
               // evicted due to lack of $ capacity
               num_ev_capacity++;
-              auto lqe = new LocalQueueElement(this,
-                  (set_it->second == cs_modified) ? et_evict : et_evict_nd,
-                  ((set_it->first*num_sets + set) << set_lsb), rep_lqe->th_id);
+              auto lqe = LocalQueueElement::acquire(this,
+                  (*set_it == cs_modified) ? et_evict : et_evict_nd,
+                  ((tags[set*num_ways + idx]*num_sets + set) << set_lsb), rep_lqe->th_id);
               cachel2->add_rep_event(curr_time + l1_to_l2_t, lqe);
             }
           } else {
             addr_in_cache = true;
           }
 
-          set_it->first  = tag;
-          set_it->second = (etype == et_read &&
-                            (addr_in_cache == false || set_it->second != cs_modified)) ?
-                           cs_exclusive : cs_modified;
-          update_LRU(idx, tags_set, set_it);
-          add_event_to_lsu(curr_time, rep_lqe);
+          tags[set*num_ways + idx] = tag;
+          *set_it = (etype == et_read && (addr_in_cache == false || *set_it != cs_modified)) ?
+                    cs_exclusive : cs_modified;
+          if (addr_in_cache == false) {
+            fill(set, idx, address);
+          } else if (rep_lqe->from.top() == this) {
+            refresh(set, idx);
+          } else {
+            touch(set, idx);
+          }
+          reply_mshr_targets(curr_time, rep_lqe);
+          if (rep_lqe->from.top() == this) {  // a prefetch
+            prefetch_arrived(address);
+            rep_lqe->release();
+          } else {
+            add_event_to_lsu(curr_time, rep_lqe);
+          }
           break;
 
         case et_e_to_s:
@@ -359,61 +687,76 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
       }
 
       req_lqe = req_q.front();
-      req_q.pop();
       // process the first request event
       const uint64_t & address = req_lqe->address;
-      uint32_t set     = (address >> set_lsb) % num_sets;
-      uint64_t tag     = (address >> set_lsb) / num_sets;
-      auto tags_set    = tags[set];
+      uint32_t set     = set_of(address);
+      uint64_t tag     = tag_of(address);
+      uint32_t idx     = find_way(set, tag);
       event_type etype = req_lqe->type;
       bool hit = always_hit;
       bool is_coherence_miss = false;
 
+      if (num_mshrs > 0 && hit == false &&
+          (idx == num_ways || (etype == et_write && states[set*num_ways + idx] != cs_modified))) {
+        MshrFile::Entry * mshr = mshrs.find(address >> set_lsb);
+        if (mshr != nullptr && mshrs.can_merge(mshr, etype == et_write) == true) {
+          req_q.pop();
+          (etype == et_write) ? num_wr_access++ : num_rd_access++;
+          (etype == et_write) ? num_wr_miss++ : num_rd_miss++;
+          num_mshr_merged++;
+          mshr->targets.push_back(req_lqe);
+          if (etype == et_read && use_prefetch == true) {
+            train_prefetcher(curr_time, address, req_lqe->ip, req_lqe->th_id, false);
+          }
+          continue;
+        } else if (mshr != nullptr || mshrs.full() == true) {
+          num_mshr_stalls++;
+          continue;
+        }
+      }
+      req_q.pop();
+
       // display_event(curr_time, req_lqe, "Q");
       DLOG_IF(FATAL, etype != et_read && etype != et_write)
         << "req_lqe->type should be either et_read or et_write, not " << etype << ".\n";
       if (etype == et_read) {
         num_rd_access++;
-        for (uint32_t idx = 0; idx < num_ways && hit == false; idx++) {
-          auto set_it = tags_set[idx];
-          if (set_it->second == cs_invalid) {
-            continue;
-          } else if (set_it->first == tag) {
-            if (set_it->second == cs_modified || set_it->second == cs_shared ||
-                set_it->second == cs_exclusive) {
-              hit = true;
-              update_LRU(idx, tags_set, set_it);
-            }
-            break;
+        if (hit == false && idx != num_ways) {
+          auto set_it = &states[set*num_ways + idx];
+          if (*set_it == cs_modified || *set_it == cs_shared ||
+              *set_it == cs_exclusive) {
+            hit = true;
+            touch(set, idx);
           }
         }
       } else {
         num_wr_access++;
-        for (uint32_t idx = 0; idx < num_ways && hit == false; idx++) {
-          auto set_it = tags_set[idx];
-          if (set_it->second == cs_invalid) {
-            continue;
-          } else if (set_it->first == tag) {
-            if (set_it->second == cs_modified) {
-              hit = true;
-              update_LRU(idx, tags_set, set_it);
-            } else if (set_it->second == cs_shared || set_it->second == cs_exclusive) {
-              // on a write miss, invalidate the entry so that the following
-              // cache accesses to the address experience misses as well
-              // TODO(gajh): does it mean that there is no MSHR in L1$?
-              num_upgrade_req++;
-              is_coherence_miss = true;
-              set_it->second = cs_invalid;
-            }
-            break;
+        if (hit == false && idx != num_ways) {
+          auto set_it = &states[set*num_ways + idx];
+          if (*set_it == cs_modified) {
+            hit = true;
+            touch(set, idx);
+          } else if (*set_it == cs_shared || *set_it == cs_exclusive) {
+            // on a write miss, invalidate the entry so that the following
+            // cache accesses to the address experience misses as well
+            // TODO(gajh): does it mean that there is no MSHR in L1$?
+            num_upgrade_req++;
+            is_coherence_miss = true;
+            *set_it = cs_invalid;
           }
         }
       }
 
+      const uint64_t req_addr  = address;  // req_lqe is not ours after it is sent
+      const uint64_t req_ip    = req_lqe->ip;
+      const uint32_t req_th_id = req_lqe->th_id;
       if (hit == false) {
         if (is_coherence_miss == false) {
           (etype == et_write) ? num_wr_miss++ : num_rd_miss++;
         }
+        if (num_mshrs > 0) {
+          mshrs.allocate(address >> set_lsb, req_lqe, etype == et_write);
+        }
         req_lqe->from.push(this);
         cachel2->add_req_event(curr_time + l1_to_l2_t, req_lqe);
       } else {
@@ -422,7 +765,7 @@ uint32_t CacheL1::process_event(uint64_t curr_time) {
 
       if (etype == et_read && use_prefetch == true) {
         // currently prefetch is conducted for read requests only.
-        do_prefetch(curr_time, *req_lqe);
+        train_prefetcher(curr_time, req_addr, req_ip, req_th_id, hit);
       }
     }
   }
@@ -451,99 +794,86 @@ void CacheL1::add_event_to_lsu(uint64_t curr_time, LocalQueueElement * lqe) {
 }
 
 
-void CacheL1::do_prefetch(uint64_t curr_time, const LocalQueueElement & req_lqe) {
-  // update the prefetch entries if
-  //  1) current and (previous or next) $ line addresses are in the L1 $
-  //  2) do not cause multiple prefetches to the same $ line (check existing entries)
-  uint64_t address = ((req_lqe.address >> set_lsb) << set_lsb);
-  uint64_t prev_addr = address - (1 << set_lsb);
-  uint64_t next_addr = address + (1 << set_lsb);
-  bool     next_addr_exist = false;
-  bool     prev_addr_exist = false;
-  for (uint32_t idx = 0; idx < num_pre_entries; idx++) {
-    auto pre = pres[idx];
-    if (pre->addr != 0 && pre->addr == next_addr) {
-      pre->hit  = true;
-      next_addr_exist = true;
-      break;
-    }
+// the reply comes back to the L1 with this on the top of from
+void CacheL1::send_prefetch(uint64_t curr_time, uint64_t address, uint32_t th_id) {
+  auto lqe = LocalQueueElement::acquire(this, et_read, address, th_id);
+  lqe->from.push(this);
+  if (num_mshrs > 0) {
+    mshrs.allocate(address >> set_lsb, lqe, false);
   }
-  // check_prev first
-  if (next_addr_exist == false) {
-    uint32_t set = (prev_addr >> set_lsb) % num_sets;
-    uint64_t tag = (prev_addr >> set_lsb) / num_sets;
-    for (uint32_t idx = 0; idx < num_ways; idx++) {
-      auto set_it = tags[set][idx];
-      if (set_it->second == cs_invalid) {
-        continue;
-      } else if (set_it->first == tag) {
-        prev_addr_exist = true;
-        break;
-      }
-    }
-    if (prev_addr_exist == true) {
-      LocalQueueElement * lqe = new LocalQueueElement(this, et_read, next_addr, req_lqe.th_id);
-      cachel2->add_req_event(curr_time + l1_to_l2_t, lqe);
-      // update the prefetch entry
-      if (pres[oldest_pre_entry_idx]->addr != 0) {
-        num_prefetch_requests++;
-        num_prefetch_hits += (pres[oldest_pre_entry_idx]->hit == true) ? 1 : 0;
-      }
-      pres[oldest_pre_entry_idx]->hit  = false;
-      pres[oldest_pre_entry_idx]->addr = next_addr;
-      oldest_pre_entry_idx = (oldest_pre_entry_idx + 1) % num_pre_entries;
+  cachel2->add_req_event(curr_time + l1_to_l2_t, lqe);
+}
+
+
+void CacheL1::reply_mshr_targets(uint64_t curr_time, LocalQueueElement * primary) {
+  if (num_mshrs == 0) return;
+  MshrFile::Entry * mshr = mshrs.find(primary->address >> set_lsb);
+  if (mshr == nullptr || mshr->primary != primary) return;
+
+  for (auto && target : mshr->targets) {
+    if (primary->type == et_nack || primary->type == et_rd_bypass) {
+      target->type = primary->type;
     }
+    add_event_to_lsu(curr_time, target);
   }
-  for (uint32_t idx = 0; idx < num_pre_entries && prev_addr_exist == false; idx++) {
-    auto pre = pres[idx];
-    if (pre->addr != 0 && pre->addr == prev_addr) {
-      pre->hit  = true;
-      prev_addr_exist = true;
-      break;
+  mshrs.free(mshr);
+}
+
+
+void CacheL1::warm(uint64_t address, bool is_write) {
+  if (always_hit == true) return;
+  const uint32_t set = set_of(address);
+  const uint64_t tag = tag_of(address);
+  uint32_t idx = find_way(set, tag);
+
+  if (idx != num_ways) {
+    if (is_write == false || states[set*num_ways + idx] == cs_modified) {
+      touch(set, idx);
+      return;
     }
+    states[set*num_ways + idx] = cs_invalid;  // an upgrade goes to the L2 as a write miss
   }
-  if (prev_addr_exist == false) {
-    next_addr_exist = false;
-    uint32_t set = (next_addr >> set_lsb) % num_sets;
-    uint64_t tag = (next_addr >> set_lsb) / num_sets;
-    for (uint32_t idx = 0; idx < num_ways; idx++) {
-      auto set_it = tags[set][idx];
-      if (set_it->second == cs_invalid) {
-        continue;
-      } else if (set_it->first == tag) {
-        next_addr_exist = true;
-        break;
-      }
-    }
-    if (next_addr_exist == true) {
-      LocalQueueElement * lqe = new LocalQueueElement(this, et_read, prev_addr, req_lqe.th_id);
-      cachel2->add_req_event(curr_time + l1_to_l2_t, lqe);
-      // update the prefetch entry
-      if (pres[oldest_pre_entry_idx]->addr != 0) {
-        num_prefetch_requests++;
-        num_prefetch_hits += (pres[oldest_pre_entry_idx]->hit == true) ? 1 : 0;
-      }
-      pres[oldest_pre_entry_idx]->hit  = false;
-      pres[oldest_pre_entry_idx]->addr = prev_addr;
-      oldest_pre_entry_idx = (oldest_pre_entry_idx + 1) % num_pre_entries;
-    }
+
+  // the L2 may invalidate lines of this set, so the victim is picked after it
+  cachel2->warm(this, address, is_write);
+  idx = victim_way(set);
+  if (states[set*num_ways + idx] != cs_invalid) {
+    cachel2->warm_evict(this, (tags[set*num_ways + idx]*num_sets + set) << set_lsb);
   }
+  tags[set*num_ways + idx]   = tag;
+  states[set*num_ways + idx] = (is_write == true) ? cs_modified : cs_exclusive;
+  fill(set, idx, address);
 }
 
 
-void CacheL1::update_LRU(uint32_t idx, l1_tag_pair ** tags_set, l1_tag_pair * const set_it) {
-  for (uint32_t i = idx; i < num_ways-1; i++) {
-    tags_set[i] = tags_set[i+1];
+void CacheL1::warm_set_state(uint64_t address, coherence_state_type state, bool only_modified) {
+  for (int32_t index = 0; index < (1 << (l2_set_lsb - set_lsb)); index++) {
+    uint64_t l1_address = ((address >> l2_set_lsb) << l2_set_lsb) + ((uint64_t)index << set_lsb);
+    uint32_t set = set_of(l1_address);
+    uint32_t idx = find_way(set, tag_of(l1_address));
+    if (idx != num_ways && (only_modified == false || states[set*num_ways + idx] == cs_modified)) {
+      states[set*num_ways + idx] = state;
+    }
   }
-  tags_set[num_ways-1] = set_it;
+}
+
+
+// the L1$I and the L1$D at position i of cachel1i and cachel1d are sharers
+// 2i and 2i+1, which is also the order McSim::create_comps allocates them in
+uint32_t CacheL2::l1_idx(Component * l1) const {
+  DCHECK(l1->type == ct_cachel1i || l1->type == ct_cachel1d) << *l1;
+  return 2 * (l1->num % cachel1d.size()) + ((l1->type == ct_cachel1d) ? 1 : 0);
+}
+
+
+CacheL1 * CacheL2::l1_of(uint32_t idx) const {
+  return (idx & 1) ? cachel1d[idx >> 1] : cachel1i[idx >> 1];
 }
 
 
 std::ostream & operator<<(std::ostream & out, CacheL2::L2Entry & l2) {
-  out << " l2entry: tag= " << std::hex << l2.tag << std::dec;
-  out << ", type= " << l2.type << ", type_l1l2= " << l2.type_l1l2;
-  out << ", sharedl1=[ ";
-  for (auto && it : l2.sharedl1)  out << *it << ", ";
+  out << " l2entry: type_l1l2= " << l2.type_l1l2;
+  out << ", sharedl1=[ " << l2.sharedl1;
   out << "], first_acc_time= " << l2.first_access_time;
   out << ", last_acc_time= " << l2.last_access_time;
   if (l2.pending != nullptr)  out << ", pending= " << *(l2.pending);
@@ -573,15 +903,15 @@ CacheL2::CacheL2(
   process_interval = get_param_uint64("process_interval", 20);
   num_sets = get_param_uint64("num_sets", 512);
   num_ways = get_param_uint64("num_ways",  8);
-
-  // tags   = vector< list< L2Entry > >(num_sets, list< L2Entry >(num_ways, L2Entry()));
-  tags = new L2Entry ** [num_sets];
-  for (uint32_t i = 0; i < num_sets; i++) {
-    tags[i] = new L2Entry * [num_ways];
-    // tags[i][0] = LRU, tags[i][num_ways -1] = MRU
-    for (uint32_t j = 0; j < num_ways; j++) {
-      tags[i][j] = new L2Entry();
-    }
+  init_tags();
+  lines = std::vector<L2Entry>(num_sets * num_ways);
+
+  stack_distance = nullptr;
+  const uint32_t sd_max_num_ways = get_param_uint64("sd_max_num_ways", 0);
+  if (sd_max_num_ways > 0) {
+    stack_distance = new StackDistance(set_lsb,
+        get_param_uint64("sd_min_num_sets", num_sets),
+        get_param_uint64("sd_max_num_sets", num_sets), sd_max_num_ways);
   }
 }
 
@@ -627,9 +957,9 @@ CacheL2::~CacheL2() {
 
     for (uint32_t j = 0; j < num_sets; j++) {
       for (uint32_t k = 0; k < num_ways; k++) {
-        L2Entry * iter = tags[j][k];
-        if (iter->type == cs_modified) {
-          uint64_t addr   = ((iter->tag * num_sets) << set_lsb);
+        const coherence_state_type type = states[j*num_ways + k];
+        if (type == cs_modified) {
+          uint64_t addr   = ((tags[j*num_ways + k] * num_sets) << set_lsb);
           uint64_t offset = addr >> addr_offset_lsb;
 
           if (dirty_cl_per_offset.find(offset) == dirty_cl_per_offset.end()) {
@@ -638,7 +968,7 @@ CacheL2::~CacheL2() {
             dirty_cl_per_offset[offset]++;
           }
         }
-        switch (iter->type) {
+        switch (type) {
           case cs_invalid:   num_i_cache_lines++;  break;
           case cs_exclusive: num_e_cache_lines++;  break;
           case cs_shared:    num_s_cache_lines++;  break;
@@ -677,14 +1007,12 @@ CacheL2::~CacheL2() {
          (process_interval * num_destroyed_cache_lines)
       << ") L2$ cycles" << std::endl;
   }
-
-  for (uint32_t j = 0; j < num_sets; j++) {
-    for (uint32_t k = 0; k < num_ways; k++) {
-      delete tags[j][k];
-    }
-    delete[] tags[j];
+  if (stack_distance != nullptr) {
+    std::stringstream prefix;
+    prefix << "  -- L2$ [" << std::setw(3) << num << "]";
+    stack_distance->print(std::cout, prefix.str());
+    delete stack_distance;
   }
-  delete[] tags;
 }
 
 
@@ -694,7 +1022,7 @@ void CacheL2::add_req_event(
     Component * from) {
   event_time = ceil_by_y(event_time, process_interval);
   geq->add_event(event_time, this);
-  req_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+  req_event.push(event_time, local_event);
 }
 
 
@@ -704,32 +1032,29 @@ void CacheL2::add_rep_event(
     Component * from) {
   event_time = ceil_by_y(event_time, process_interval);
   geq->add_event(event_time, this);
-  rep_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+  rep_event.push(event_time, local_event);
 }
 
 
 void CacheL2::show_state(uint64_t address) {
-  uint32_t set = (address >> set_lsb) % num_sets;
-  uint64_t tag = (address >> set_lsb) / num_sets;
-
-  for (uint32_t k = 0; k < num_ways; k++) {
-    L2Entry * set_it = tags[set][k];
-    if (set_it->type != cs_invalid && set_it->tag == tag) {
-      std::stringstream ss;
-      ss << "  -- L2 [" << num << "] : " << set_it->type
-        << ", " << set_it->type_l1l2;
-      for (auto && it : set_it->sharedl1) ss << ", " << *it;
-      LOG(WARNING) << ss.str() << std::endl;
-      break;
-    }
+  uint32_t set = set_of(address);
+  uint64_t tag = tag_of(address);
+  uint32_t way = find_way(set, tag);
+
+  if (way != num_ways) {
+    L2Entry * set_it = &lines[set*num_ways + way];
+    std::stringstream ss;
+    ss << "  -- L2 [" << num << "] : " << states[set*num_ways + way]
+      << ", " << set_it->type_l1l2;
+    set_it->sharedl1.for_each([&](uint32_t idx) { ss << ", " << *l1_of(idx); });
+    LOG(WARNING) << ss.str() << std::endl;
   }
 }
 
 
 uint32_t CacheL2::process_event(uint64_t curr_time) {
-  std::multimap<uint64_t, LocalQueueElement *>::iterator req_event_iter = req_event.begin();
-  std::multimap<uint64_t, LocalQueueElement *>::iterator rep_event_iter = rep_event.begin();
   L2Entry * set_it = nullptr;
+  uint32_t  line   = 0;  // of set_it
 
   LocalQueueElement * rep_lqe = nullptr;
   LocalQueueElement * req_lqe = nullptr;
@@ -737,87 +1062,83 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
   if (rep_q.empty() == false) {
     rep_lqe = rep_q.front();
     rep_q.pop();
-  } else if (rep_event_iter != rep_event.end() && rep_event_iter->first == curr_time) {
-    rep_lqe = rep_event_iter->second;
-    rep_event_iter = rep_event.erase(rep_event_iter);
+  } else {
+    rep_lqe = rep_event.pop(curr_time);
   }
 
-  while (rep_event_iter != rep_event.end() && rep_event_iter->first == curr_time) {
-    rep_q.push(rep_event_iter->second);
-    rep_event_iter = rep_event.erase(rep_event_iter);
+  for (auto lqe = rep_event.pop(curr_time); lqe != nullptr; lqe = rep_event.pop(curr_time)) {
+    rep_q.push(lqe);
   }
 
-  while (req_event_iter != req_event.end() && req_event_iter->first == curr_time) {
-    uint32_t bank = (req_event_iter->second->address >> set_lsb) % num_banks;
-    req_qs[bank].push(req_event_iter->second);
-    req_event_iter = req_event.erase(req_event_iter);
+  for (auto lqe = req_event.pop(curr_time); lqe != nullptr; lqe = req_event.pop(curr_time)) {
+    uint32_t bank = (lqe->address >> set_lsb) % num_banks;
+    req_qs[bank].push(lqe);
   }
 
   if (rep_lqe != nullptr) {
     // display_event(curr_time, rep_lqe, "P");
     // reply events have a higher priority than request events
     const uint64_t & address = rep_lqe->address;
-    const uint32_t set = (address >> set_lsb) % num_sets;
-    const uint64_t tag = (address >> set_lsb) / num_sets;
-    auto tags_set    = tags[set];
+    const uint32_t set = set_of(address);
+    const uint64_t tag = tag_of(address);
     const event_type etype = rep_lqe->type;
 
-    uint32_t idx = 0;
     // look for an entry which already has tag
-    for (idx = 0; idx < num_ways; idx++) {
-      set_it = tags_set[idx];
-      if (set_it->type == cs_invalid) {
-        continue;
-      } else if (set_it->tag == tag) {
-        break;
-      }
+    uint32_t idx = find_way(set, tag);
+    if (idx != num_ways) {
+      line   = set*num_ways + idx;
+      set_it = &lines[line];
     }
 
     if (etype == et_write_nd) {
       rep_lqe->from.pop();
-      if (idx == num_ways || set_it->type != cs_tr_to_m) {
+      reply_mshr_targets(curr_time, rep_lqe, set_it);  // nobody waits for a write
+      if (idx == num_ways || states[line] != cs_tr_to_m) {
         rep_lqe->type = et_nack;
         (rep_lqe->from.top())->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
-        auto lqe = new LocalQueueElement(this, et_e_to_i, address, rep_lqe->th_id);
+        auto lqe = LocalQueueElement::acquire(this, et_e_to_i, address, rep_lqe->th_id);
         add_event_to_LL(curr_time, lqe, false);
       } else {
-        req_L1_evict(curr_time, set_it, (set_it->tag*num_sets + set) << set_lsb, rep_lqe, false);
-        set_it->type      = cs_modified;
+        req_L1_evict(curr_time, set_it, (tags[line]*num_sets + set) << set_lsb, rep_lqe, false);
+        states[line]      = cs_modified;
         set_it->type_l1l2 = cs_modified;
-        set_it->tag       = tag;
-        set_it->sharedl1.insert(rep_lqe->from.top());
+        tags[line]        = tag;
+        set_it->sharedl1.insert(l1_idx(rep_lqe->from.top()));
         set_it->last_access_time = curr_time;
-        update_LRU(idx, tags_set, set_it);
+        touch(set, idx);
 
         rep_lqe->type = et_write;
         (rep_lqe->from.top())->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
 
-        auto lqe = new LocalQueueElement(this, et_e_to_m, address, rep_lqe->th_id);
+        auto lqe = LocalQueueElement::acquire(this, et_e_to_m, address, rep_lqe->th_id);
         add_event_to_LL(curr_time, lqe, false);
       }
     } else if (etype == et_e_rd || etype == et_s_rd || etype == et_write) {
       bool bypass = false;
       bool shared = false;
+      const bool filled = (idx == num_ways);
       rep_lqe->from.pop();
       // read miss return traffic
-      if (idx == num_ways) {
-        set_it = tags_set[0];
-        idx    = 0;
-        uint64_t set_addr = ((set_it->tag*num_sets + set) << set_lsb);
-
-        if (set_it->type == cs_tr_to_s || set_it->type == cs_tr_to_m ||
-            set_it->type == cs_tr_to_e || set_it->type == cs_tr_to_i) {
+      if (filled == true) {
+        idx    = victim_way(set);
+        line   = set*num_ways + idx;
+        set_it = &lines[line];
+        uint64_t set_addr = ((tags[line]*num_sets + set) << set_lsb);
+
+        if (states[line] == cs_tr_to_s || states[line] == cs_tr_to_m ||
+            states[line] == cs_tr_to_e || states[line] == cs_tr_to_i) {
           bypass = true;
+          rep_lqe->type = et_nack;
+          reply_mshr_targets(curr_time, rep_lqe, set_it);
           if (rep_lqe->from.size() > 1) {
-            rep_lqe->type = et_nack;
             (rep_lqe->from.top())->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
           }
-          auto lqe = new LocalQueueElement(this, et_evict, rep_lqe->address, rep_lqe->th_id);
+          auto lqe = LocalQueueElement::acquire(this, et_evict, rep_lqe->address, rep_lqe->th_id);
           add_event_to_LL(curr_time, lqe, false);
           if (rep_lqe->from.size() == 1) {
-            delete rep_lqe;
+            rep_lqe->release();
           }
-        } else if (set_it->type != cs_invalid) {
+        } else if (states[line] != cs_invalid) {
           num_ev_capacity++;
           num_destroyed_cache_lines++;
           cache_line_life_time += (curr_time - set_it->first_access_time);
@@ -828,26 +1149,27 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
           req_L1_evict(curr_time, set_it, set_addr, rep_lqe, true);
           // then send eviction event to Directory or Crossbar
           if (set_it->type_l1l2 != cs_modified) {
-            auto lqe = new LocalQueueElement(this, et_evict, set_addr, rep_lqe->th_id);
-            add_event_to_LL(curr_time, lqe, false, set_it->type == cs_modified);
+            auto lqe = LocalQueueElement::acquire(this, et_evict, set_addr, rep_lqe->th_id);
+            add_event_to_LL(curr_time, lqe, false, states[line] == cs_modified);
           }
         } else {
           set_it->first_access_time = curr_time;
           set_it->last_access_time  = curr_time;
         }
       } else {
-        uint64_t set_addr = ((set_it->tag*num_sets + set) << set_lsb);
+        uint64_t set_addr = ((tags[line]*num_sets + set) << set_lsb);
 
         if (etype == et_write) {
           req_L1_evict(curr_time, set_it, set_addr, rep_lqe, false);
         } else if (etype == et_e_rd || etype == et_s_rd) {
-          if (set_it->type == cs_modified || set_it->type == cs_tr_to_e) {
+          if (states[line] == cs_modified || states[line] == cs_tr_to_e) {
             bypass = true;  // this event happened earlier, don't change the state of cache
+            rep_lqe->type = et_rd_bypass;
+            reply_mshr_targets(curr_time, rep_lqe, set_it);
             if (rep_lqe->from.size() > 1) {
-              rep_lqe->type = et_rd_bypass;
               (rep_lqe->from.top())->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
             } else {
-              delete rep_lqe;
+              rep_lqe->release();
             }
           } else if (etype == et_s_rd) {
             shared = true;
@@ -857,25 +1179,31 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
 
       CHECK_NE(idx, num_ways) << *this << *rep_lqe << *geq;
       if (bypass == false) {
-        set_it->type = (etype == et_e_rd) ? cs_exclusive :
+        states[line] = (etype == et_e_rd) ? cs_exclusive :
                        (etype == et_s_rd) ? cs_shared : cs_modified;
         if (rep_lqe->from.size() > 1) {
           set_it->type_l1l2 = (etype == et_write) ? cs_modified :
                               (shared == true) ? cs_shared : cs_exclusive;
-          set_it->tag       = tag;
-          set_it->sharedl1.insert(rep_lqe->from.top());
+          tags[line]       = tag;
+          set_it->sharedl1.insert(l1_idx(rep_lqe->from.top()));
         } else {
           set_it->type_l1l2 = cs_invalid;
-          set_it->tag       = tag;
+          tags[line]       = tag;
         }
         set_it->last_access_time = curr_time;
-        update_LRU(idx, tags_set, set_it);
+        if (filled == true) {
+          fill(set, idx, address);
+        } else {
+          touch(set, idx);
+        }
 
         rep_lqe->type = (etype == et_write) ? et_write : et_read;
+        reply_mshr_targets(curr_time, rep_lqe, set_it);
         if (rep_lqe->from.size() > 1) {
           (rep_lqe->from.top())->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
-        } else {
-          delete rep_lqe;
+        } else {  // a prefetch of this L2
+          prefetch_arrived(address);
+          rep_lqe->release();
         }
       } else {
         num_bypass++;
@@ -885,11 +1213,11 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
       rep_lqe->from.pop();
       num_coherency_access++;
 
-      if (idx != num_ways && set_it->type == cs_tr_to_i && set_it->pending != nullptr) {
+      if (idx != num_ways && states[line] == cs_tr_to_i && set_it->pending != nullptr) {
         num_ev_coherency++;
         switch (set_it->type_l1l2) {
           case cs_tr_to_i:
-            delete rep_lqe;
+            rep_lqe->release();
             break;
           case cs_tr_to_m:
             rep_lqe->type = et_nack;
@@ -898,8 +1226,8 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
           default:  // set_it->type_l1l2 == cs_tr_to_s
             rep_lqe->type = et_nack;
             rep_lqe->from.top()->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
-            set_it->sharedl1.insert(rep_lqe->from.top());
-            req_L1_evict(curr_time, set_it, (set_it->tag*num_sets + set) << set_lsb, rep_lqe, true);
+            set_it->sharedl1.insert(l1_idx(rep_lqe->from.top()));
+            req_L1_evict(curr_time, set_it, (tags[line]*num_sets + set) << set_lsb, rep_lqe, true);
             break;
         }
 
@@ -909,24 +1237,24 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
         time_between_last_access_and_cache_destroy += (curr_time - set_it->last_access_time);
         set_it->pending = nullptr;
         set_it->type_l1l2 = cs_invalid;
-        set_it->type      = cs_invalid;
-        update_LRU(idx, tags_set, set_it);
+        states[line]      = cs_invalid;
+        refresh(set, idx);
       } else if (idx != num_ways &&
                  (set_it->type_l1l2 == cs_tr_to_m || set_it->type_l1l2 == cs_tr_to_s)) {
         num_ev_coherency++;
         set_it->last_access_time = curr_time;
         set_it->type_l1l2 = (set_it->type_l1l2 == cs_tr_to_s) ? cs_shared :
           (set_it->pending == nullptr) ? cs_modified : cs_invalid;
-        set_it->sharedl1.insert(rep_lqe->from.top());
+        set_it->sharedl1.insert(l1_idx(rep_lqe->from.top()));
         rep_lqe->type = (etype == et_m_to_s) ? et_read :
           (set_it->pending == nullptr) ? et_write : et_nack;
         rep_lqe->from.top()->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
         if (set_it->pending != nullptr) {
           add_event_to_LL(curr_time, set_it->pending, true, true);
           set_it->pending = nullptr;
-          set_it->type    = cs_shared;
+          states[line]    = cs_shared;
         }
-        update_LRU(idx, tags_set, set_it);
+        refresh(set, idx);
       } else {
         show_state(rep_lqe->address);
         rep_lqe->from.top()->show_state(rep_lqe->address);
@@ -936,29 +1264,29 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
       num_ev_from_l1++;
       if (idx != num_ways) {
         set_it->last_access_time = curr_time;
-        if (set_it->type == cs_tr_to_s) {
+        if (states[line] == cs_tr_to_s) {
           num_coherency_access++;
-          set_it->type = cs_shared;
+          states[line] = cs_shared;
           add_event_to_LL(curr_time, set_it->pending, true, true);
           set_it->pending = nullptr;
-          set_it->sharedl1.insert(rep_lqe->from.top());
+          set_it->sharedl1.insert(l1_idx(rep_lqe->from.top()));
         } else {
           // cache line is evicted from L1
-          set_it->sharedl1.erase(rep_lqe->from.top());
+          set_it->sharedl1.erase(l1_idx(rep_lqe->from.top()));
           if (set_it->sharedl1.empty() == true && set_it->type_l1l2 != cs_tr_to_s &&
               set_it->type_l1l2 != cs_tr_to_m && set_it->type_l1l2 != cs_tr_to_i) {
             set_it->type_l1l2 = cs_invalid;
           }
-          update_LRU(idx, tags_set, set_it);
+          refresh(set, idx);
         }
-        delete rep_lqe;
+        rep_lqe->release();
       } else {
         num_ev_from_l1_miss++;
         if (etype == et_evict && always_hit == false) {
           rep_lqe->from.push(this);
           add_event_to_LL(curr_time, rep_lqe, true, true);
         } else {
-          delete rep_lqe;
+          rep_lqe->release();
         }
       }
     } else if (etype == et_dir_rd) {
@@ -968,61 +1296,67 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
         // cache line is already evicted -- return now
         add_event_to_LL(curr_time, rep_lqe, false);
       } else {
-        if (set_it->type != cs_modified) {
-          LOG(ERROR) << *set_it << std::endl;
+        if (states[line] != cs_modified) {
+          LOG(ERROR) << line_state(line) << std::endl;
           show_state(rep_lqe->address);
           rep_lqe->from.top()->show_state(rep_lqe->address);
           LOG(FATAL) << *this << *rep_lqe << *geq;
         } else if (set_it->type_l1l2 == cs_invalid ||
             set_it->type_l1l2 == cs_exclusive ||
             set_it->type_l1l2 == cs_shared) {
-          set_it->type      = cs_shared;
+          states[line]      = cs_shared;
           set_it->last_access_time = curr_time;
           add_event_to_LL(curr_time, rep_lqe, true, true);
         } else if (set_it->type_l1l2 == cs_modified) {
           if (set_it->sharedl1.size() != 1) {
-            LOG(FATAL) << *set_it << std::endl << *this << *rep_lqe << *geq;
+            LOG(FATAL) << line_state(line) << std::endl << *this << *rep_lqe << *geq;
           }
           // special case: data is in L1
           set_it->last_access_time = curr_time;
           set_it->type_l1l2 = cs_exclusive;
-          set_it->type      = cs_tr_to_s;
+          states[line]      = cs_tr_to_s;
           set_it->pending   = rep_lqe;
-          auto lqe = new LocalQueueElement(this, et_dir_rd,
-              ((set_it->tag*num_sets + set) << set_lsb), rep_lqe->th_id);
-          (*(set_it->sharedl1.begin()))->add_rep_event(curr_time + l2_to_l1_t, lqe);
+          auto lqe = LocalQueueElement::acquire(this, et_dir_rd,
+              ((tags[line]*num_sets + set) << set_lsb), rep_lqe->th_id);
+          l1_of(set_it->sharedl1.first())->add_rep_event(curr_time + l2_to_l1_t, lqe);
           set_it->sharedl1.clear();
         } else if (set_it->type_l1l2 == cs_tr_to_m || set_it->type_l1l2 == cs_tr_to_s) {
           if (set_it->pending != nullptr) {
-            LOG(FATAL) << *set_it << std::endl << *this << *rep_lqe << *geq;
+            LOG(FATAL) << line_state(line) << std::endl << *this << *rep_lqe << *geq;
           }
           set_it->last_access_time = curr_time;
           set_it->pending          = rep_lqe;
         } else {
           // DIR->L2->L1->L2->DIR traffic -- not implemented yet
-          LOG(FATAL) << *set_it << std::endl << *this << *rep_lqe << *geq;
+          LOG(FATAL) << line_state(line) << std::endl << *this << *rep_lqe << *geq;
         }
       }
     } else if (etype == et_nack) {
       num_nack++;
       num_bypass++;
       rep_lqe->from.pop();
+      if (idx != num_ways && states[line] == cs_tr_to_m) {
+        // a nacked upgrade; otherwise the line stays cs_tr_to_m and every
+        // retry is nacked here
+        states[line] = cs_exclusive;
+      }
+      reply_mshr_targets(curr_time, rep_lqe, set_it);
       if (rep_lqe->from.size() > 1) {
         (rep_lqe->from.top())->add_rep_event(curr_time + l2_to_l1_t, rep_lqe);
       } else {
-        delete rep_lqe;
+        rep_lqe->release();
       }
     } else if (etype == et_e_to_s || etype == et_s_to_s) {
       num_coherency_access++;
 
       if (idx != num_ways) {
-        if (set_it->type != cs_exclusive &&
-            set_it->type != cs_shared && set_it->type != cs_tr_to_m) {
-          LOG(FATAL) << "[" << curr_time << "] " << *set_it << std::endl
+        if (states[line] != cs_exclusive &&
+            states[line] != cs_shared && states[line] != cs_tr_to_m) {
+          LOG(FATAL) << "[" << curr_time << "] " << line_state(line) << std::endl
             << *this << *rep_lqe << *geq;
         }
         set_it->last_access_time = curr_time;
-        set_it->type = cs_shared;
+        states[line] = cs_shared;
         // return to directory
         add_event_to_LL(curr_time, rep_lqe, true, true);
       } else {
@@ -1036,42 +1370,42 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
 
       num_coherency_access++;
       if (idx != num_ways) {
-        if (set_it->type == cs_tr_to_s ||  // set_it->type == cs_tr_to_m ||
-            set_it->type == cs_tr_to_e || set_it->type == cs_tr_to_i) {
+        if (states[line] == cs_tr_to_s ||  // states[line] == cs_tr_to_m ||
+            states[line] == cs_tr_to_e || states[line] == cs_tr_to_i) {
           show_state(rep_lqe->address);
           LOG(FATAL) << *this << *rep_lqe << *geq;
-        } else if (set_it->type == cs_modified && set_it->type_l1l2 == cs_modified) {
+        } else if (states[line] == cs_modified && set_it->type_l1l2 == cs_modified) {
           enter_intermediate_state = true;
           if (set_it->sharedl1.size() != 1) {
-            LOG(FATAL) << *set_it << std:: endl << *this << *rep_lqe << *geq;
+            LOG(FATAL) << line_state(line) << std:: endl << *this << *rep_lqe << *geq;
           }
           // special case: data is in L1
           set_it->last_access_time = curr_time;
           set_it->type_l1l2 = cs_tr_to_i;
-          set_it->type      = cs_tr_to_i;
+          states[line]      = cs_tr_to_i;
           set_it->pending   = rep_lqe;
-          auto lqe = new LocalQueueElement(this, et_m_to_m,
-              ((set_it->tag*num_sets + set) << set_lsb), rep_lqe->th_id);
-          (*(set_it->sharedl1.begin()))->add_rep_event(curr_time + l2_to_l1_t, lqe);
+          auto lqe = LocalQueueElement::acquire(this, et_m_to_m,
+              ((tags[line]*num_sets + set) << set_lsb), rep_lqe->th_id);
+          l1_of(set_it->sharedl1.first())->add_rep_event(curr_time + l2_to_l1_t, lqe);
           set_it->sharedl1.clear();
-        } else if (set_it->type == cs_modified &&
+        } else if (states[line] == cs_modified &&
             (set_it->type_l1l2 == cs_tr_to_m || set_it->type_l1l2 == cs_tr_to_s)) {
           enter_intermediate_state = true;
           if (set_it->pending != nullptr) {
-            LOG(FATAL) << *set_it << std::endl << *this << *rep_lqe << *geq;
+            LOG(FATAL) << line_state(line) << std::endl << *this << *rep_lqe << *geq;
           }
           set_it->last_access_time = curr_time;
-          set_it->type      = cs_tr_to_i;
+          states[line]      = cs_tr_to_i;
           set_it->pending   = rep_lqe;
         } else {
           // evict the corresponding cache lines in L1 and L2 and return
-          req_L1_evict(curr_time, set_it, (set_it->tag*num_sets + set) << set_lsb, rep_lqe, true);
+          req_L1_evict(curr_time, set_it, (tags[line]*num_sets + set) << set_lsb, rep_lqe, true);
 
           num_ev_coherency++;
           num_destroyed_cache_lines++;
           cache_line_life_time += (curr_time - set_it->first_access_time);
           time_between_last_access_and_cache_destroy += (curr_time - set_it->last_access_time);
-          set_it->type      = cs_invalid;
+          states[line]      = cs_invalid;
           set_it->type_l1l2 = cs_invalid;
         }
       } else {
@@ -1083,7 +1417,7 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
         add_event_to_LL(curr_time, rep_lqe, true, rep_lqe->type == et_invalidate);
       }
     } else if (etype == et_nop) {
-      delete rep_lqe;
+      rep_lqe->release();
     } else {
       LOG(FATAL) << *this << *rep_lqe << *geq;
     }
@@ -1097,177 +1431,189 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
       any_request = true;
 
       req_lqe = req_q.front();
-      req_q.pop();
       // process the first request event
       const uint64_t & address = req_lqe->address;
-      uint32_t set = (address >> set_lsb) % num_sets;
-      uint64_t tag = (address >> set_lsb) / num_sets;
-      auto tags_set    = tags[set];
+      uint32_t set = set_of(address);
+      uint64_t tag = tag_of(address);
+      uint32_t idx = find_way(set, tag);
       event_type etype = req_lqe->type;
       bool is_coherence_miss = false;
 
       bool hit = always_hit;
       bool enter_intermediate_state = false;
 
+      if (idx != num_ways) {
+        line   = set*num_ways + idx;
+        set_it = &lines[line];
+      }
+
+      // only reads wait for a line being read; the rest of the requests to
+      // a line on the way stay in the queue until the line comes
+      if (num_mshrs > 0 && hit == false) {
+        MshrFile::Entry * mshr = mshrs.find(address >> set_lsb);
+        if (mshr != nullptr && mshr->is_write == false && mshrs.can_merge(mshr, etype == et_write) == true) {
+          req_q.pop();
+          num_rd_access++;
+          num_rd_miss++;
+          num_mshr_merged++;
+          mshr->targets.push_back(req_lqe);
+          if (use_prefetch == true) {
+            train_prefetcher(curr_time, address, req_lqe->ip, req_lqe->th_id, false);
+          }
+          continue;
+        } else if (mshr != nullptr || (mshrs.full() == true && (idx == num_ways ||
+              (etype == et_write && (states[line] == cs_exclusive || states[line] == cs_shared))))) {
+          num_mshr_stalls++;
+          continue;
+        }
+      }
+      req_q.pop();
+
       DLOG_IF(FATAL, etype != et_read && etype != et_write)
         << "req_lqe->type should be et_read or et_write, not " << etype << ".\n";
       if (etype == et_read) {
         // see if cache hits
         num_rd_access++;
 
-        for (uint32_t idx = 0; idx < num_ways; idx++) {
-          auto set_it = tags_set[idx];
-          if (set_it->type == cs_invalid || set_it->type == cs_tr_to_e) {
-            continue;
-          }
-          if (set_it->tag == tag && req_lqe->from.size() == 1) {
-            hit = true;
-          } else if (set_it->tag == tag) {
-            if (set_it->type_l1l2 == cs_invalid &&
-                (set_it->type == cs_exclusive || set_it->type == cs_shared ||
-                 set_it->type == cs_modified)) {
-              // cache hit, and type_l1l2 will be cs_exclusive
-              set_it->type_l1l2 = cs_exclusive;
-              set_it->sharedl1.insert(req_lqe->from.top());
-            } else if (set_it->type_l1l2 == cs_exclusive &&
-                (set_it->type == cs_exclusive || set_it->type == cs_shared ||
-                 set_it->type == cs_modified)) {
-              // cache hit, and type_l1l2 will be cs_exclusive or cs_shared
-              set_it->sharedl1.insert(req_lqe->from.top());
-              if (set_it->sharedl1.size() > 1) {
-                set_it->type_l1l2 = cs_shared;
-              }
-            } else if (set_it->type_l1l2 == cs_shared &&
-                (set_it->type == cs_exclusive || set_it->type == cs_shared ||
-                 set_it->type == cs_modified)) {
-              // cache hit, and type_l1l2 will be cs_shared
-              set_it->sharedl1.insert(req_lqe->from.top());
-            } else if (set_it->type_l1l2 == cs_modified && set_it->type == cs_modified) {
-              // cache hit, and type_l1l2 will be cs_shared
-              // m_to_s event request will be delivered to L1
-              if (set_it->sharedl1.size() > 1) {
-                LOG(FATAL) << *set_it << std::endl << *this << *req_lqe << *geq;
-              }
+        if (idx != num_ways && req_lqe->from.size() == 1) {
+          hit = true;
+        } else if (idx != num_ways) {
+          if (set_it->type_l1l2 == cs_invalid &&
+              (states[line] == cs_exclusive || states[line] == cs_shared ||
+               states[line] == cs_modified)) {
+            // cache hit, and type_l1l2 will be cs_exclusive
+            set_it->type_l1l2 = cs_exclusive;
+            set_it->sharedl1.insert(l1_idx(req_lqe->from.top()));
+          } else if (set_it->type_l1l2 == cs_exclusive &&
+              (states[line] == cs_exclusive || states[line] == cs_shared ||
+               states[line] == cs_modified)) {
+            // cache hit, and type_l1l2 will be cs_exclusive or cs_shared
+            set_it->sharedl1.insert(l1_idx(req_lqe->from.top()));
+            if (set_it->sharedl1.size() > 1) {
+              set_it->type_l1l2 = cs_shared;
+            }
+          } else if (set_it->type_l1l2 == cs_shared &&
+              (states[line] == cs_exclusive || states[line] == cs_shared ||
+               states[line] == cs_modified)) {
+            // cache hit, and type_l1l2 will be cs_shared
+            set_it->sharedl1.insert(l1_idx(req_lqe->from.top()));
+          } else if (set_it->type_l1l2 == cs_modified && states[line] == cs_modified) {
+            // cache hit, and type_l1l2 will be cs_shared
+            // m_to_s event request will be delivered to L1
+            if (set_it->sharedl1.size() > 1) {
+              LOG(FATAL) << line_state(line) << std::endl << *this << *req_lqe << *geq;
+            }
 
-              if (set_it->sharedl1.size() == 1) {
-                if (*(set_it->sharedl1.begin()) != req_lqe->from.top()) {
-                  enter_intermediate_state = true;
-                  req_lqe->from.push(this);
-                  req_lqe->type = et_m_to_s;
-                  (*(set_it->sharedl1.begin()))->add_rep_event(curr_time + l2_to_l1_t, req_lqe);
-                  set_it->type_l1l2 = cs_tr_to_s;
-                  set_it->sharedl1.clear();
-                }
-              } else {
-                set_it->type_l1l2 = cs_shared;
-                set_it->sharedl1.insert(req_lqe->from.top());
+            if (set_it->sharedl1.size() == 1) {
+              if (l1_of(set_it->sharedl1.first()) != req_lqe->from.top()) {
+                enter_intermediate_state = true;
+                req_lqe->from.push(this);
+                req_lqe->type = et_m_to_s;
+                l1_of(set_it->sharedl1.first())->add_rep_event(curr_time + l2_to_l1_t, req_lqe);
+                set_it->type_l1l2 = cs_tr_to_s;
+                set_it->sharedl1.clear();
               }
-            } else if ((set_it->type_l1l2 == cs_exclusive && set_it->type == cs_tr_to_s) ||
-                set_it->type_l1l2 == cs_tr_to_s || set_it->type_l1l2 == cs_tr_to_m ||
-                set_it->type_l1l2 == cs_tr_to_i || set_it->type == cs_tr_to_m) {
-              req_lqe->type = et_nack;
             } else {
-              LOG(FATAL) << "[" << curr_time << "] " << *set_it << std::endl
-                << *this << *req_lqe << *geq;
+              set_it->type_l1l2 = cs_shared;
+              set_it->sharedl1.insert(l1_idx(req_lqe->from.top()));
             }
-
-            set_it->last_access_time = curr_time;
-            hit = true;
-            update_LRU(idx, tags_set, set_it);
-            break;
+          } else if ((set_it->type_l1l2 == cs_exclusive && states[line] == cs_tr_to_s) ||
+              set_it->type_l1l2 == cs_tr_to_s || set_it->type_l1l2 == cs_tr_to_m ||
+              set_it->type_l1l2 == cs_tr_to_i || states[line] == cs_tr_to_m) {
+            req_lqe->type = et_nack;
+          } else {
+            LOG(FATAL) << "[" << curr_time << "] " << line_state(line) << std::endl
+              << *this << *req_lqe << *geq;
           }
+
+          set_it->last_access_time = curr_time;
+          hit = true;
+          touch(set, idx);
         }
       } else {
         num_wr_access++;
 
-        for (uint32_t idx = 0; idx < num_ways; idx++) {
-          set_it = tags_set[idx];
-          if (set_it->type == cs_exclusive || set_it->type == cs_shared) {
-            if (set_it->tag == tag) {
-              if (set_it->type == cs_exclusive && set_it->sharedl1.size() == 1 &&
-                  (*(set_it->sharedl1.begin()) == req_lqe->from.top())) {
-                set_it->last_access_time = curr_time;
-                set_it->type = cs_tr_to_m;
-              } else {
-                if (set_it->sharedl1.empty() == false) {
-                  set_it->last_access_time = curr_time;
-                  set_it->type = cs_invalid;
-                }
-                req_L1_evict(curr_time, set_it, (set_it->tag*num_sets + set) << set_lsb, req_lqe, false);
-              }
-              num_upgrade_req++;
-              is_coherence_miss = true;
-              break;
-            }
-          } else if (set_it->type == cs_invalid || set_it->type == cs_tr_to_e) {
-            continue;
-          } else if (set_it->tag == tag) {
-            if (set_it->type == cs_modified && set_it->type_l1l2 == cs_invalid) {
-              // cache hit, and type_l1l2 will be cs_modified
-            } else if (set_it->type == cs_modified && set_it->type_l1l2 == cs_modified) {
-              // cache hit, and type_l1l2 will be cs_modified
-              if (set_it->sharedl1.size() != 1) {
-                LOG(FATAL) << "[" << curr_time << "] " << *set_it << std::endl
-                  << *this << *req_lqe << *geq;
-              }
-              if (*(set_it->sharedl1.begin()) != req_lqe->from.top()) {
-                enter_intermediate_state = true;
-                req_lqe->from.push(this);
-                req_lqe->type = et_m_to_m;
-                (*(set_it->sharedl1.begin()))->add_rep_event(curr_time + l2_to_l1_t, req_lqe);
-                set_it->type_l1l2 = cs_tr_to_m;
-                set_it->sharedl1.clear();
-                set_it->last_access_time = curr_time;
-                hit = true;
-                update_LRU(idx, tags_set, set_it);
-                break;
-              }
-            } else if (set_it->type == cs_modified && set_it->type_l1l2 == cs_exclusive) {
-              // cache hit, and type_l1l2 will be cs_modified
-              if (set_it->sharedl1.size() > 1) {
-                LOG(FATAL) << "[" << curr_time << "] " << *set_it << std::endl
-                  << *this << *req_lqe << *geq;
-              }
-
-              if (set_it->sharedl1.empty() == false &&
-                  (*(set_it->sharedl1.begin())) != req_lqe->from.top()) {
-                auto lqe = new LocalQueueElement(this, et_evict,
-                    ((set_it->tag*num_sets + set) << set_lsb), req_lqe->th_id);
-                (*(set_it->sharedl1.begin()))->add_rep_event(curr_time + l2_to_l1_t, lqe);
-                set_it->sharedl1.clear();
-              }
-            } else if (set_it->type == cs_modified && set_it->type_l1l2 == cs_shared) {
-              // cache hit, and type_l1l2 will be cs_modified
-              req_L1_evict(curr_time, set_it, (set_it->tag*num_sets + set) << set_lsb, req_lqe, false);
-            } else if ((set_it->type_l1l2 == cs_exclusive && set_it->type == cs_tr_to_s) ||
-                set_it->type_l1l2 == cs_tr_to_s || set_it->type_l1l2 == cs_tr_to_m ||
-                set_it->type_l1l2 == cs_tr_to_i || set_it->type == cs_tr_to_m) {
+        if (idx == num_ways) {
+          // write miss
+        } else if (states[line] == cs_exclusive || states[line] == cs_shared) {
+          if (states[line] == cs_exclusive && set_it->sharedl1.size() == 1 &&
+              (l1_of(set_it->sharedl1.first()) == req_lqe->from.top())) {
+            set_it->last_access_time = curr_time;
+            states[line] = cs_tr_to_m;
+          } else {
+            if (set_it->sharedl1.empty() == false) {
               set_it->last_access_time = curr_time;
-              req_lqe->type = et_nack;
-              hit = true;
-              update_LRU(idx, tags_set, set_it);
-              break;
-            } else {
-              LOG(FATAL) << "[" << curr_time << "] " << *set_it << std::endl
+              states[line] = cs_invalid;
+            }
+            req_L1_evict(curr_time, set_it, (tags[line]*num_sets + set) << set_lsb, req_lqe, false);
+          }
+          num_upgrade_req++;
+          is_coherence_miss = true;
+        } else {
+          if (states[line] == cs_modified && set_it->type_l1l2 == cs_invalid) {
+            // cache hit, and type_l1l2 will be cs_modified
+          } else if (states[line] == cs_modified && set_it->type_l1l2 == cs_modified) {
+            // cache hit, and type_l1l2 will be cs_modified
+            if (set_it->sharedl1.size() != 1) {
+              LOG(FATAL) << "[" << curr_time << "] " << line_state(line) << std::endl
+                << *this << *req_lqe << *geq;
+            }
+            if (l1_of(set_it->sharedl1.first()) != req_lqe->from.top()) {
+              enter_intermediate_state = true;
+              req_lqe->from.push(this);
+              req_lqe->type = et_m_to_m;
+              l1_of(set_it->sharedl1.first())->add_rep_event(curr_time + l2_to_l1_t, req_lqe);
+              set_it->type_l1l2 = cs_tr_to_m;
+              set_it->sharedl1.clear();
+            }
+          } else if (states[line] == cs_modified && set_it->type_l1l2 == cs_exclusive) {
+            // cache hit, and type_l1l2 will be cs_modified
+            if (set_it->sharedl1.size() > 1) {
+              LOG(FATAL) << "[" << curr_time << "] " << line_state(line) << std::endl
                 << *this << *req_lqe << *geq;
             }
 
-            set_it->last_access_time = curr_time;
+            if (set_it->sharedl1.empty() == false &&
+                l1_of(set_it->sharedl1.first()) != req_lqe->from.top()) {
+              auto lqe = LocalQueueElement::acquire(this, et_evict,
+                  ((tags[line]*num_sets + set) << set_lsb), req_lqe->th_id);
+              l1_of(set_it->sharedl1.first())->add_rep_event(curr_time + l2_to_l1_t, lqe);
+              set_it->sharedl1.clear();
+            }
+          } else if (states[line] == cs_modified && set_it->type_l1l2 == cs_shared) {
+            // cache hit, and type_l1l2 will be cs_modified
+            req_L1_evict(curr_time, set_it, (tags[line]*num_sets + set) << set_lsb, req_lqe, false);
+          } else if ((set_it->type_l1l2 == cs_exclusive && states[line] == cs_tr_to_s) ||
+              set_it->type_l1l2 == cs_tr_to_s || set_it->type_l1l2 == cs_tr_to_m ||
+              set_it->type_l1l2 == cs_tr_to_i || states[line] == cs_tr_to_m) {
+            req_lqe->type = et_nack;
+          } else {
+            LOG(FATAL) << "[" << curr_time << "] " << line_state(line) << std::endl
+              << *this << *req_lqe << *geq;
+          }
+
+          set_it->last_access_time = curr_time;
+          hit = true;
+          touch(set, idx);
+          if (req_lqe->type == et_write) {  // neither sent to the L1 nor nacked
             set_it->type_l1l2 = cs_modified;
-            set_it->sharedl1.insert(req_lqe->from.top());
-            hit = true;
-            update_LRU(idx, tags_set, set_it);
-            break;
+            set_it->sharedl1.insert(l1_idx(req_lqe->from.top()));
           }
         }
       }
 
+      const uint64_t req_addr  = address;  // req_lqe is not ours after it is sent
+      const uint64_t req_ip    = req_lqe->ip;
+      const uint32_t req_th_id = req_lqe->th_id;
       if (enter_intermediate_state == false) {
         if (hit == false) {
           if (is_coherence_miss == false) {
             (etype == et_write) ? num_wr_miss++ : num_rd_miss++;
           }
 
+          if (num_mshrs > 0) {
+            mshrs.allocate(address >> set_lsb, req_lqe, etype == et_write);
+          }
           req_lqe->from.push(this);
           if (geq->which_mc(address) == directory->num) {
             directory->add_req_event(curr_time + l2_to_dir_t, req_lqe);
@@ -1278,10 +1624,14 @@ uint32_t CacheL2::process_event(uint64_t curr_time) {
           req_lqe->from.top()->add_rep_event(curr_time + l2_to_l1_t, req_lqe);
         }
       }
+
+      if (etype == et_read && use_prefetch == true) {
+        train_prefetcher(curr_time, req_addr, req_ip, req_th_id, idx != num_ways);
+      }
     }
 
     if (any_request == false) {
-      LOG(FATAL) << *(req_event_iter->second) << *geq;
+      LOG(FATAL) << *this << *geq;
     }
   }
 
@@ -1318,30 +1668,66 @@ void CacheL2::add_event_to_LL(
 }
 
 
+// sent as if this L2 missed; the reply comes back with only this in from
+void CacheL2::send_prefetch(uint64_t curr_time, uint64_t address, uint32_t th_id) {
+  auto lqe = LocalQueueElement::acquire(this, et_read, address, th_id);
+  lqe->from.push(this);
+  if (num_mshrs > 0) {
+    mshrs.allocate(address >> set_lsb, lqe, false);
+  }
+  if (geq->which_mc(address) == directory->num) {
+    directory->add_req_event(curr_time + l2_to_dir_t, lqe);
+  } else {
+    crossbar->add_req_event(curr_time + l2_to_xbar_t, lqe, this);
+  }
+}
+
+
+void CacheL2::reply_mshr_targets(
+    uint64_t curr_time,
+    LocalQueueElement * primary,
+    L2Entry * set_it) {
+  if (num_mshrs == 0) return;
+  MshrFile::Entry * mshr = mshrs.find(primary->address >> set_lsb);
+  if (mshr == nullptr || mshr->primary != primary) return;
+
+  for (auto && target : mshr->targets) {
+    CHECK(primary->type == et_read || primary->type == et_nack || primary->type == et_rd_bypass)
+      << *this << *primary << *geq;
+    if (primary->type == et_read) {
+      if (set_it->type_l1l2 == cs_invalid) set_it->type_l1l2 = cs_exclusive;
+      set_it->sharedl1.insert(l1_idx(target->from.top()));
+      if (set_it->sharedl1.size() > 1) set_it->type_l1l2 = cs_shared;
+    }
+    target->type = primary->type;
+    target->from.top()->add_rep_event(curr_time + l2_to_l1_t, target);
+  }
+  mshrs.free(mshr);
+}
+
+
 void CacheL2::test_tags(uint32_t set) {
   std::set<uint64_t> tag_set;
   for (uint32_t k = 0; k < num_ways; k++) {
-    L2Entry * iter = tags[set][k];
-
-    if (iter->type != cs_invalid) {
+    if (states[set*num_ways + k] != cs_invalid) {
       std::stringstream ss;
-      if (tag_set.find(iter->tag) != tag_set.end()) {
+      if (tag_set.find(tags[set*num_ways + k]) != tag_set.end()) {
         for (uint32_t kk = 0; kk < num_ways; kk++) {
-          ss << tags[set][kk]->type << tags[set][kk]->tag << ", ";
+          ss << states[set*num_ways + kk] << tags[set*num_ways + kk] << ", ";
         }
         LOG(FATAL) << ss.str() << std::endl;
       }
-      tag_set.insert(iter->tag);
+      tag_set.insert(tags[set*num_ways + k]);
     }
   }
 }
 
 
-void CacheL2::update_LRU(uint32_t idx, L2Entry ** tags_set, L2Entry * const set_it) {
-  for (uint32_t i = idx; i < num_ways-1; i++) {
-    tags_set[i] = tags_set[i+1];
-  }
-  tags_set[num_ways-1] = set_it;
+std::string CacheL2::line_state(uint32_t line) {
+  std::stringstream ss;
+  ss << " l2line: tag= " << std::hex << tags[line] << std::dec
+    << ", type= " << states[line] << "," << lines[line];
+  return ss.str();
 }
 
 
@@ -1351,13 +1737,110 @@ void CacheL2::req_L1_evict(
     uint64_t addr,
     LocalQueueElement * lqe,
     bool always) {
-  for (auto && it : set_it->sharedl1) {
-    if (always == true || it != lqe->from.top()) {
-      auto new_lqe = new LocalQueueElement(this, et_evict, addr, lqe->th_id);
-      it->add_rep_event(curr_time + l2_to_l1_t, new_lqe);
+  set_it->sharedl1.for_each([&](uint32_t idx) {
+    if (always == true || l1_of(idx) != lqe->from.top()) {
+      auto new_lqe = LocalQueueElement::acquire(this, et_evict, addr, lqe->th_id);
+      l1_of(idx)->add_rep_event(curr_time + l2_to_l1_t, new_lqe);
     }
+  });
+  set_it->sharedl1.clear();
+}
+
+
+void CacheL2::warm(CacheL1 * l1, uint64_t address, bool is_write) {
+  if (stack_distance != nullptr) stack_distance->access(address);
+  if (always_hit == true) return;
+  const uint32_t set = set_of(address);
+  const uint64_t tag = tag_of(address);
+  uint32_t idx = find_way(set, tag);
+  const uint32_t sharer = l1_idx(l1);
+
+  if (idx != num_ways) {
+    const uint32_t line = set*num_ways + idx;
+    L2Entry * set_it = &lines[line];
+    if (is_write == true) {
+      if (states[line] != cs_modified) {  // an upgrade
+        mcsim->dirs[geq->which_mc(address)]->warm(num, address, true);
+        states[line] = cs_modified;
+      }
+      set_it->sharedl1.for_each([&](uint32_t i) {
+        if (i != sharer) l1_of(i)->warm_set_state(address, cs_invalid, false);
+      });
+      set_it->sharedl1.clear();
+      set_it->type_l1l2 = cs_modified;
+    } else if (set_it->type_l1l2 == cs_modified) {
+      // the owner keeps a shared copy, as after et_m_to_s
+      if (set_it->sharedl1.contains(sharer) == false) {
+        l1_of(set_it->sharedl1.first())->warm_set_state(address, cs_shared, true);
+        set_it->type_l1l2 = cs_shared;
+      }
+    } else if (set_it->type_l1l2 == cs_invalid) {
+      set_it->type_l1l2 = cs_exclusive;
+    } else if (set_it->sharedl1.contains(sharer) == false) {
+      set_it->type_l1l2 = cs_shared;
+    }
+    set_it->sharedl1.insert(sharer);
+    touch(set, idx);
+    return;
+  }
+
+  const coherence_state_type state = mcsim->dirs[geq->which_mc(address)]->warm(num, address, is_write);
+  idx = victim_way(set);
+  const uint32_t line = set*num_ways + idx;
+  L2Entry * set_it = &lines[line];
+  if (states[line] != cs_invalid) {
+    uint64_t set_addr = ((tags[line]*num_sets + set) << set_lsb);
+    set_it->sharedl1.for_each([&](uint32_t i) { l1_of(i)->warm_set_state(set_addr, cs_invalid, false); });
+    mcsim->dirs[geq->which_mc(set_addr)]->warm_evict(num, set_addr);
+  }
+  tags[line]        = tag;
+  states[line]      = state;
+  set_it->type_l1l2 = (is_write == true) ? cs_modified : cs_exclusive;
+  set_it->sharedl1.clear();
+  set_it->sharedl1.insert(sharer);
+  fill(set, idx, address);
+}
+
+
+void CacheL2::warm_evict(CacheL1 * l1, uint64_t address) {
+  const uint32_t set = set_of(address);
+  const uint32_t idx = find_way(set, tag_of(address));
+  if (idx == num_ways) return;
+
+  L2Entry * set_it = &lines[set*num_ways + idx];
+  set_it->sharedl1.erase(l1_idx(l1));
+  if (set_it->sharedl1.empty() == true) {
+    set_it->type_l1l2 = cs_invalid;
   }
+  refresh(set, idx);
+}
+
+
+void CacheL2::warm_downgrade(uint64_t address) {
+  const uint32_t set = set_of(address);
+  const uint32_t idx = find_way(set, tag_of(address));
+  if (idx == num_ways) return;
+
+  // a modified L1 copy is written back and stays clean, as after et_dir_rd
+  L2Entry * set_it = &lines[set*num_ways + idx];
+  if (set_it->type_l1l2 == cs_modified) {
+    l1_of(set_it->sharedl1.first())->warm_set_state(address, cs_exclusive, true);
+    set_it->type_l1l2 = cs_exclusive;
+  }
+  states[set*num_ways + idx] = cs_shared;
+}
+
+
+void CacheL2::warm_invalidate(uint64_t address) {
+  const uint32_t set = set_of(address);
+  const uint32_t idx = find_way(set, tag_of(address));
+  if (idx == num_ways) return;
+
+  L2Entry * set_it = &lines[set*num_ways + idx];
+  set_it->sharedl1.for_each([&](uint32_t i) { l1_of(i)->warm_set_state(address, cs_invalid, false); });
   set_it->sharedl1.clear();
+  set_it->type_l1l2          = cs_invalid;
+  states[set*num_ways + idx] = cs_invalid;
 }
 
 }  // namespace PinPthread
@@ -5,6 +5,7 @@
 #ifndef MCSIM_PTSCACHE_H_
 #define MCSIM_PTSCACHE_H_
 
+#include <deque>
 #include <list>
 #include <queue>
 #include <set>
@@ -14,18 +15,41 @@
 #include <vector>
 
 #include "McSim.h"
+#include "PTSLineMap.h"
+#include "PTSMshr.h"
+#include "PTSPrefetcher.h"
+#include "PTSSharerSet.h"
+#include "PTSStackDistance.h"
 
 namespace PinPthread {
 
+// set by pts.<cache>.replacement
+enum replacement_policy {
+  rp_lru,    // "lru" (default)
+  rp_plru,   // "plru": tree pseudo-LRU; num_ways has to be a power of two
+  rp_srrip,  // "srrip": static re-reference interval prediction
+  rp_brrip,  // "brrip": bimodal RRIP
+  rp_ship,   // "ship": SRRIP with insertion predicted per memory region
+};
+
+std::ostream & operator<<(std::ostream & output, replacement_policy policy);
+
 class Cache : public Component {
  public:
   Cache(component_type type_, uint32_t num_, McSim * mcsim_);
-  virtual ~Cache() { }
+  virtual ~Cache();
   const uint32_t set_lsb;
   const uint32_t num_banks;
   uint32_t num_sets;
   uint32_t num_ways;
   const uint32_t num_sets_per_subarray;
+  replacement_policy replacement;
+  const bool     use_prefetch;
+  const uint32_t num_pre_entries;      // prefetched lines remembered for the stats
+  const uint32_t prefetch_queue_size;  // candidates waiting to be issued
+  // 0: no MSHRs; a miss to a line on the way goes down again and is
+  // usually nacked below
+  const uint32_t num_mshrs;
   friend class McSim;
 
  protected:
@@ -42,13 +66,96 @@ class Cache : public Component {
   uint64_t num_bypass;
   uint64_t num_nack;
   uint64_t tot_awake_time;
+  uint64_t num_prefetch_requests;   // issued
+  uint64_t num_prefetch_hits;       // first touched by a demand hit
+  uint64_t num_prefetch_late;       // first touched while still on the way
+  uint64_t num_prefetch_uncovered;  // demand misses no prefetch covered
+  uint64_t num_prefetch_dropped;    // candidates that found the queue full
+  uint64_t num_mshr_merged;         // misses that waited for a line on the way
+  uint64_t num_mshr_stalls;         // times a bank waited for an MSHR
+
+  // way w of set s is at [s*num_ways + w] of each array so that a set is
+  // looked up with a few contiguous loads.  with lru, ages orders the ways
+  // of a set from 0 (LRU) to num_ways-1 (MRU); with the RRIP policies, it is
+  // the re-reference prediction value of each way.
+  std::vector<uint64_t>             tags;
+  std::vector<coherence_state_type> states;
+  std::vector<uint8_t>              ages;
+  std::vector<uint64_t>             plru_bits;   // per set; node i of the tree is bit i
+  std::vector<uint16_t>             signatures;  // per way; ship only
+  std::vector<uint8_t>              shct;        // signature history counters of ship
+  uint64_t                          num_fills;   // paces the long insertions of brrip
+
+  bool     num_sets_pow2;
+  uint32_t num_sets_log2;  // if num_sets_pow2
+
+  void init_tags();  // once num_sets and num_ways are known
+  // the set and the tag of an address, without a division for the usual
+  // power-of-two num_sets
+  uint32_t set_of(uint64_t address) const {
+    const uint64_t line = address >> set_lsb;
+    return (num_sets_pow2 == true) ? (line & (num_sets - 1)) : (line % num_sets);
+  }
+  uint64_t tag_of(uint64_t address) const {
+    const uint64_t line = address >> set_lsb;
+    return (num_sets_pow2 == true) ? (line >> num_sets_log2) : (line / num_sets);
+  }
+  // the valid way with the tag, or num_ways on a miss
+  uint32_t find_way(uint32_t set, uint64_t tag) const;
+
+  // the replacement policy sees a miss pick victim_way(set), the new line
+  // of address go in with fill(), each later hit with touch(), and the
+  // other updates of a line with refresh()
+  uint32_t victim_way(uint32_t set);
+  void fill(uint32_t set, uint32_t way, uint64_t address);
+  void touch(uint32_t set, uint32_t way);
+  void refresh(uint32_t set, uint32_t way);
+
+  uint32_t lru_way(uint32_t set) const;
+  void update_LRU(uint32_t set, uint32_t way);
+  uint32_t plru_way(uint32_t set) const;
+  void update_PLRU(uint32_t set, uint32_t way);
+  uint32_t rrip_way(uint32_t set);
+  uint32_t invalid_way(uint32_t set) const;  // num_ways if none
+
+  // prefetcher is nullptr without use_prefetch.  a prefetched line stays in
+  // prefetched until num_pre_entries later prefetches push it out.
+  class PrefetchEntry {
+   public:
+    PrefetchEntry() : arrived(false), used(false) { }
+    bool arrived;  // the line came in
+    bool used;     // a demand access touched it
+  };
+  Prefetcher *               prefetcher;
+  LineMap<PrefetchEntry>     prefetched;
+  std::vector<uint64_t>      pre_lines;  // the lines in prefetched, in issue order
+  uint32_t                   oldest_pre_entry_idx;
+  std::deque<uint64_t>       prefetch_q;
+  std::vector<uint64_t>      candidates;
+
+  bool has_line(uint64_t address) const {
+    return find_way(set_of(address), tag_of(address)) != num_ways;
+  }
+  // called on each demand read with whether it hit; issues the prefetches
+  // through send_prefetch()
+  void train_prefetcher(uint64_t curr_time, uint64_t address, uint64_t ip,
+                        uint32_t th_id, bool hit);
+  virtual void send_prefetch(uint64_t curr_time, uint64_t address, uint32_t th_id) = 0;
+  void prefetch_arrived(uint64_t address) {
+    PrefetchEntry * entry = prefetched.find(address >> set_lsb);
+    if (entry != nullptr) entry->arrived = true;
+  }
+
+  // a miss takes an entry when it goes down and keeps it until its reply
+  // comes back.  a later miss to the line waits in the entry if it can
+  // (see MshrFile::can_merge) and at the head of its bank queue otherwise.
+  MshrFile mshrs;
+
   virtual void show_state(uint64_t) = 0;
   void display_event(uint64_t curr_time, LocalQueueElement *, const std::string &);
 };
 
 
-using l1_tag_pair = std::pair<uint64_t, coherence_state_type>;
-
 class CacheL1 : public Cache {
  public:
   explicit CacheL1(component_type type_, uint32_t num_, McSim * mcsim_);
@@ -59,35 +166,30 @@ class CacheL1 : public Cache {
   uint32_t process_event(uint64_t curr_time);
   void show_state(uint64_t);
 
+  // functional warming (see McSim::warm_instructions): an access updates
+  // the tags, the coherence states, and the replacement state of the L1,
+  // the L2, and the directory at once, without events or stats
+  void warm(uint64_t address, bool is_write);
+  // the lines of the L2 line of address in this L1 become state; with
+  // only_modified, only the modified ones
+  void warm_set_state(uint64_t address, coherence_state_type state, bool only_modified);
+
   std::vector<Component *> lsus;  // uplink
   CacheL2 * cachel2;              // downlink
 
-  class PrefetchEntry {
-   public:
-    PrefetchEntry(): addr(0), hit(false) { }
-    uint64_t addr;
-    bool     hit;
-  };
-
   const uint32_t l1_to_lsu_t;
   const uint32_t l1_to_l2_t;
 
   const bool       always_hit;
   // TODO(gajh): as of now, we only support the case when L1$ line size <= L2$ line size
   const uint32_t   l2_set_lsb;
-  const bool       use_prefetch;
-  const uint32_t   num_pre_entries;
 
  protected:
-  l1_tag_pair  *** tags;       // address + coherence state of a set-associative cache
-  PrefetchEntry ** pres;       // prefetch history info
-  uint64_t         num_prefetch_requests;
-  uint64_t         num_prefetch_hits;
-  uint32_t         oldest_pre_entry_idx;
-
   void add_event_to_lsu(uint64_t curr_time, LocalQueueElement *);
-  void do_prefetch(uint64_t curr_time, const LocalQueueElement &);
-  inline void update_LRU(uint32_t idx, l1_tag_pair ** tags_set, l1_tag_pair * const set_it);
+  void send_prefetch(uint64_t curr_time, uint64_t address, uint32_t th_id);
+  // the requests waiting for the line of primary get a reply of its type
+  // (et_nack or et_rd_bypass) or what they asked for
+  void reply_mshr_targets(uint64_t curr_time, LocalQueueElement * primary);
 };
 
 
@@ -101,20 +203,29 @@ class CacheL2 : public Cache {
   virtual uint32_t process_event(uint64_t curr_time);
   void show_state(uint64_t);
 
+  // functional warming; see CacheL1::warm.  warm() is a miss of l1, and
+  // warm_evict() tells that l1 dropped a line.  the directory makes the
+  // line of another L2 shared with warm_downgrade() or invalid with
+  // warm_invalidate().
+  void warm(CacheL1 * l1, uint64_t address, bool is_write);
+  void warm_evict(CacheL1 * l1, uint64_t address);
+  void warm_downgrade(uint64_t address);
+  void warm_invalidate(uint64_t address);
+
   std::vector<CacheL1 *> cachel1d;   // uplink
   std::vector<CacheL1 *> cachel1i;   // uplink
   Directory * directory;  // downlink
   NoC  * crossbar;        // downlink
 
+  // the tag and the cs_type between L2 and DIR of a line are in Cache::tags
+  // and Cache::states; the rest, which lookups do not touch, is here.
   class L2Entry {
    public:
-    L2Entry() : tag(0), type(cs_invalid), type_l1l2(cs_invalid),  sharedl1(),
+    L2Entry() : type_l1l2(cs_invalid),  sharedl1(),
       pending(nullptr), first_access_time(0), last_access_time(0) { }
 
-    uint64_t tag;
-    coherence_state_type  type;  // cs_type between L2 and DIR
     coherence_state_type  type_l1l2;  // cs_type between L1 and L2
-    std::set<Component *> sharedl1;
+    SharerSet             sharedl1;  // see l1_idx()
     LocalQueueElement *   pending;
     uint64_t first_access_time;
     uint64_t last_access_time;
@@ -131,7 +242,10 @@ class CacheL2 : public Cache {
   const bool     display_life_time;
 
  protected:
-  L2Entry ***    tags;  // address + coherence state of a set-associative cache
+  std::vector<L2Entry> lines;  // in the order of Cache::tags
+  // the LRU stack distances of the accesses from the L1s in warm(); nullptr
+  // unless sd_max_num_ways > 0
+  StackDistance * stack_distance;
   uint64_t       num_ev_from_l1;
   uint64_t       num_ev_from_l1_miss;
   uint64_t       num_destroyed_cache_lines;
@@ -144,7 +258,15 @@ class CacheL2 : public Cache {
     bool check_top,
     bool is_data = false);
   void test_tags(uint32_t set);
-  inline void update_LRU(uint32_t idx, L2Entry ** tags_set, L2Entry * const set_it);
+  void send_prefetch(uint64_t curr_time, uint64_t address, uint32_t th_id);
+  // the reads waiting for the line of primary get a reply of its type;
+  // on et_read, they become sharers of set_it as if they hit
+  void reply_mshr_targets(uint64_t curr_time, LocalQueueElement * primary, L2Entry * set_it);
+  std::string line_state(uint32_t line);  // for error messages
+
+  // sharer numbers of the L1s in L2Entry::sharedl1
+  inline uint32_t  l1_idx(Component * l1) const;
+  inline CacheL1 * l1_of(uint32_t idx) const;
   inline void req_L1_evict(uint64_t curr_time,
     L2Entry * const set_it,
     uint64_t addr,
@@ -0,0 +1,186 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSCHANNEL_H_
+#define MCSIM_PTSCHANNEL_H_
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "PTSInterface.h"
+
+// the shared memory between a frontend process and the backend.  the two
+// sides live in different processes, so everything here works on plain
+// memory with the __atomic builtins and the (non-private) futex syscall.
+
+const uint32_t instr_ring_size = 1 << 14;  // has to be a power of two
+
+// one side bumps seq to hand the message over to the other side.  the waiter
+// spins for a while, gives up the core a few times (the two sides may share
+// one), and then sleeps on seq; num_sleepers tells the other side whether the
+// futex has to be woken up at all.  nudge() wakes the waiter up without
+// handing anything over so that it looks for work again.
+struct alignas(64) PTSDoorbell {
+  uint32_t seq;
+  uint32_t num_sleepers;
+
+  // returns once seq is not seen any more
+  uint32_t wait(uint32_t seen) { return wait(seen, [] { return false; }); }
+
+  // idle() is called while spinning and returns whether it found work to
+  // do, in which case the waiter keeps spinning
+  template <class Idle>
+  uint32_t wait(uint32_t seen, Idle idle) {
+    static const uint32_t max_spin  = 1 << 8;
+    static const uint32_t max_yield = 1 << 6;
+    uint32_t curr;
+    while (true) {
+      for (uint32_t num_spin = 0; num_spin < max_spin + max_yield; num_spin++) {
+        if ((curr = __atomic_load_n(&seq, __ATOMIC_ACQUIRE)) != seen) return curr;
+        if (idle() == true) {
+          num_spin = 0;
+        } else if (num_spin >= max_spin) {
+          sched_yield();
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+          __builtin_ia32_pause();
+#endif
+        }
+      }
+      // the other side is busy (e.g., pin runs a long stretch of code); sleep
+      // unless work showed up after num_sleepers was raised.  a nudge between
+      // idle() and the syscall is missed, which only leaves the work for the
+      // next seq.
+      __atomic_fetch_add(&num_sleepers, 1, __ATOMIC_SEQ_CST);
+      bool has_work = idle();
+      if (has_work == false && __atomic_load_n(&seq, __ATOMIC_SEQ_CST) == seen) {
+        syscall(SYS_futex, &seq, FUTEX_WAIT, seen, nullptr, nullptr, 0);
+      }
+      __atomic_fetch_sub(&num_sleepers, 1, __ATOMIC_SEQ_CST);
+      if ((curr = __atomic_load_n(&seq, __ATOMIC_SEQ_CST)) != seen) break;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return curr;
+  }
+
+  void ring() {
+    __atomic_fetch_add(&seq, 1, __ATOMIC_SEQ_CST);
+    wake();
+  }
+
+  void nudge() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  // what was stored before is seen
+    wake();
+  }
+
+  void wake() {
+    if (__atomic_load_n(&num_sleepers, __ATOMIC_SEQ_CST) > 0) {
+      syscall(SYS_futex, &seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+  }
+};
+
+
+// single-producer single-consumer ring of instructions from the frontend.
+// head and tail only grow and each is written by one side, so they sit in
+// cache lines of their own.
+struct PTSRing {
+  alignas(64) uint64_t head;  // written by the frontend
+  alignas(64) uint64_t tail;  // written by the backend
+  alignas(64) PTSInstr instr[instr_ring_size];
+
+  PTSInstr * slot(uint64_t idx) { return &instr[idx & (instr_ring_size - 1)]; }
+
+  // the frontend fills slot(head), slot(head + 1), ... and then publishes them
+  uint64_t num_free() const {
+    return instr_ring_size - (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+  }
+  void publish(uint64_t num) { __atomic_store_n(&head, head + num, __ATOMIC_RELEASE); }
+
+  // the backend reads slot(tail), slot(tail + 1), ... and then frees them
+  uint64_t num_used() const { return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail; }
+  void consume(uint64_t num) { __atomic_store_n(&tail, tail + num, __ATOMIC_RELEASE); }
+};
+
+
+// the instructions the frontend piled up since its last pts_add_instruction
+// request.  the batch is sent exactly when it used to be: when it may fill
+// the o3queue, reaches max_piled, or cannot be piled further.  in between,
+// every max_unpublished instructions are published without a request so
+// that the backend adds them while the frontend keeps running.  the batch
+// never outgrows the ring because a batch starts only with max_piled free
+// slots (see has_room_for_next).
+struct PTSBatch {
+  uint32_t num_piled       = 0;
+  uint32_t num_published   = 0;  // of num_piled
+  uint32_t max_piled       = 1;  // pts.instr_batch_size
+  uint32_t max_unpublished = 1;  // pts.instr_publish_size
+
+  // where the next instruction goes and where the last one went
+  PTSInstr * next(PTSRing & ring) { return ring.slot(ring.head + num_piled - num_published); }
+  PTSInstr * last(PTSRing & ring) { return ring.slot(ring.head + num_piled - num_published - 1); }
+
+  // piles the instruction at next() and returns whether the batch has to be
+  // sent; num_available_slot is the room the frontend knows of
+  bool pile(PTSRing & ring, bool can_be_piled, uint32_t num_available_slot) {
+    num_piled++;
+    if (can_be_piled == false || num_piled >= max_piled || num_piled >= num_available_slot) {
+      return true;
+    }
+    if (num_piled - num_published >= max_unpublished) {
+      ring.publish(num_piled - num_published);
+      num_published = num_piled;
+    }
+    return false;
+  }
+
+  // publishes the rest and returns the batch size
+  uint32_t send(PTSRing & ring) {
+    uint32_t num = num_piled;
+    ring.publish(num_piled - num_published);
+    num_piled     = 0;
+    num_published = 0;
+    return num;
+  }
+
+  // whether the next batch fits in the ring even if the backend adds
+  // nothing before it is sent; otherwise the frontend has to wait for a reply
+  bool has_room_for_next(const PTSRing & ring) const { return ring.num_free() >= max_piled; }
+};
+
+
+// the room the frontend knows of in the o3queue of a hardware thread.  mcsim
+// frees o3queue entries only while it serves a pts_resume_simulation
+// request, so once a reply reported the room, the room after each further
+// batch of the thread is known without a request (credit-based run-ahead);
+// the next pts_resume_simulation makes it stale again.  a stale room still
+// decides where the first batch ends, so the batches do not change.
+struct PTSCredit {
+  uint32_t num_available_slot = 1;
+  bool     is_exact           = false;
+
+  void reply(uint32_t num) { num_available_slot = num; is_exact = true; }
+  void take(uint32_t num)  { num_available_slot = (num_available_slot > num) ? num_available_slot - num : 0; }
+};
+
+
+// msg carries the requests other than the instructions and all the replies.
+// a batch of instructions (see PTSBatch) whose room is not known (see
+// PTSCredit) is announced with a pts_add_instruction request whose
+// uint32_t_val is the batch size, and the reply tells the room left in the
+// o3queue; the other batches are only published.  the backend adds what the
+// frontends publish while it waits for the next request, and drains the
+// rings before it serves a request.
+struct PTSChannel {
+  PTSMessage  msg;
+  PTSDoorbell request;  // rung by the frontend
+  PTSDoorbell reply;    // rung by the backend
+  PTSRing     ring;
+};
+
+#endif  // MCSIM_PTSCHANNEL_H_
@@ -3,6 +3,10 @@
 // be found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <new>
 #include <sstream>
 
 #include "McSim.h"
@@ -16,32 +20,169 @@ extern std::ostream & operator << (std::ostream & output, component_type ct);
 extern std::ostream & operator << (std::ostream & output, event_type et);
 
 
+// slab allocator behind LocalQueueElement::operator new/delete.  every thread
+// allocates from a pool of its own, and an element goes back to the pool that
+// allocated it: a slab is aligned to its size and starts with its owner.  the
+// other threads (e.g., of the parallel engine, where a request often ends on
+// another thread) push to the remote list of the owner, which the owner takes
+// over when its free list runs dry.  pools and slabs are never returned, so
+// they stay valid until the very end of the program.
+class LQEPool {
+ public:
+  static LQEPool & local() {
+    static thread_local LQEPool * pool = new LQEPool();
+    return *pool;
+  }
+
+  void * allocate() {
+    if (free_list == nullptr) {
+      free_list = remote_list.exchange(nullptr, std::memory_order_acquire);
+      if (free_list == nullptr) grow();
+    }
+    FreeNode * node = free_list;
+    free_list = node->next;
+    return node;
+  }
+
+  static void deallocate(void * ptr) {
+    FreeNode * node  = static_cast<FreeNode *>(ptr);
+    LQEPool  * owner = reinterpret_cast<Slab *>(
+        reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t)(slab_size - 1))->owner;
+    if (owner == &local()) {
+      node->next       = owner->free_list;
+      owner->free_list = node;
+    } else {
+      node->next = owner->remote_list.load(std::memory_order_relaxed);
+      while (owner->remote_list.compare_exchange_weak(node->next, node,
+               std::memory_order_release, std::memory_order_relaxed) == false) { }
+    }
+  }
+
+  static uint64_t num_slabs() { return num_all_slabs.load(std::memory_order_relaxed); }
+
+ private:
+  struct FreeNode { FreeNode * next; };
+  struct Slab { LQEPool * owner; };
+  static const size_t   slab_size   = 1 << 16;
+  static const size_t   slab_header = 64;
+  static const size_t   lqe_size = sizeof(LocalQueueElement) < sizeof(FreeNode) ?
+    sizeof(FreeNode) : sizeof(LocalQueueElement);
+  static const uint32_t num_lqes_per_slab = (slab_size - slab_header) / lqe_size;
+
+  void grow() {
+    char * slab = static_cast<char *>(::operator new(slab_size, std::align_val_t(slab_size)));
+    reinterpret_cast<Slab *>(slab)->owner = this;
+    for (uint32_t i = num_lqes_per_slab; i > 0; i--) {
+      FreeNode * node = reinterpret_cast<FreeNode *>(slab + slab_header + (i - 1) * lqe_size);
+      node->next = free_list;
+      free_list  = node;
+    }
+    num_all_slabs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  FreeNode * free_list = nullptr;
+  alignas(64) std::atomic<FreeNode *> remote_list{nullptr};  // from the other threads
+  static std::atomic<uint64_t> num_all_slabs;
+};
+
+std::atomic<uint64_t> LQEPool::num_all_slabs{0};
+
+
+void * LocalQueueElement::operator new(size_t size) {
+  ASSERTX((size == sizeof(LocalQueueElement)));
+  return LQEPool::local().allocate();
+}
+
+
+void LocalQueueElement::operator delete(void * ptr) {
+  if (ptr != nullptr) LQEPool::deallocate(ptr);
+}
+
+
+uint64_t LocalQueueElement::num_pool_slabs() { return LQEPool::num_slabs(); }
+
+
+void RouteStack::overflow() const {
+  LOG(FATAL) << "a route is deeper than RouteStack::max_depth (" << (UINT32)max_depth << ")" << std::endl;
+}
+
+
 void LocalQueueElement::display() { LOG(WARNING) << *this; }
 
 
 std::ostream & operator<<(std::ostream & out, LocalQueueElement & l) {
   out << "  -- LQE : type = " << l.type << ", addr = 0x" << std::hex << l.address << std::dec;
-  std::stack<Component *> temp;
 
-  while (l.from.empty() == false) {
-    temp.push(l.from.top());
-    l.from.pop();
-    out << *(temp.top()) << ", ";
-  }
-  while (temp.empty() == false) {
-    l.from.push(temp.top());
-    temp.pop();
+  for (uint32_t i = l.from.size(); i > 0; i--) {
+    out << *(l.from[i - 1]) << ", ";
   }
   out << std::endl;
   return out;
 }
 
 
+TimedEventQueue::TimedEventQueue():
+  buckets(num_buckets, Bucket{0, nullptr, nullptr}), overflow(), num_elements(0) { }
+
+
+void TimedEventQueue::push(UINT64 event_time, LocalQueueElement * lqe) {
+  Bucket & bucket = buckets[event_time % num_buckets];
+
+  lqe->next = nullptr;
+  num_elements++;
+  if (bucket.head == nullptr) {
+    bucket.time = event_time;
+    bucket.head = lqe;
+    bucket.tail = lqe;
+  } else if (bucket.time == event_time) {
+    bucket.tail->next = lqe;
+    bucket.tail       = lqe;
+  } else {
+    overflow.insert(std::pair<UINT64, LocalQueueElement *>(event_time, lqe));
+  }
+}
+
+
+LocalQueueElement * TimedEventQueue::pop(UINT64 curr_time) {
+  // an element of curr_time goes to the overflow map only while the bucket is
+  // held by another tick, so the overflowed ones are always older.
+  if (overflow.empty() == false) {
+    auto iter = overflow.lower_bound(curr_time);
+    if (iter != overflow.end() && iter->first == curr_time) {
+      LocalQueueElement * lqe = iter->second;
+      overflow.erase(iter);
+      num_elements--;
+      return lqe;
+    }
+  }
+
+  Bucket & bucket = buckets[curr_time % num_buckets];
+  if (bucket.head == nullptr || bucket.time != curr_time) {
+    return nullptr;
+  }
+  LocalQueueElement * lqe = bucket.head;
+  bucket.head = lqe->next;
+  lqe->next   = nullptr;
+  num_elements--;
+  return lqe;
+}
+
+
+void TimedEventQueue::clear() {
+  for (auto && bucket : buckets) {
+    bucket.head = nullptr;
+    bucket.tail = nullptr;
+  }
+  overflow.clear();
+  num_elements = 0;
+}
+
+
 Component::Component(
     component_type type_,
     uint32_t num_,
     McSim * mcsim_):
-  type(type_), num(num_), mcsim(mcsim_), geq(mcsim_->global_q) { }
+  type(type_), num(num_), mcsim(mcsim_), geq(mcsim_->global_q), lp(0) { }
 
 Component::~Component() { }
 
@@ -108,8 +249,184 @@ uint32_t Component::log2(uint64_t num) {
 }
 
 
+EventCalendar::EventCalendar(UINT32 num_buckets_):
+  num_buckets(num_buckets_), mask(num_buckets_ - 1), base(0), num_ticks(0),
+  buckets(num_buckets_), occupied(num_buckets_ / 64, 0), overflow() {
+  CHECK(num_buckets >= 64 && (num_buckets & mask) == 0)
+    << "the number of event buckets (" << num_buckets
+    << ") should be a power of two no smaller than 64" << std::endl;
+}
+
+
+void EventCalendar::insert(UINT64 event_time, Component * comp) {
+  if (event_time < base) {
+    rebase(event_time);
+  }
+  if (in_wheel(event_time)) {
+    bucket_insert(event_time, comp);
+  } else {
+    overflow.push_back(overflow_entry(event_time, comp));
+    std::push_heap(overflow.begin(), overflow.end(), std::greater<overflow_entry>());
+  }
+}
+
+
+void EventCalendar::bucket_insert(UINT64 event_time, Component * comp) {
+  UINT64 idx = event_time & mask;
+  auto & bucket = buckets[idx];
+  auto iter = std::lower_bound(bucket.begin(), bucket.end(), comp);
+
+  if (iter != bucket.end() && *iter == comp) return;
+  if (bucket.empty()) {
+    occupied[idx >> 6] |= (1ULL << (idx & 63));
+    num_ticks++;
+  }
+  bucket.insert(iter, comp);
+}
+
+
+void EventCalendar::erase(UINT64 event_time, Component * comp) {
+  if (in_wheel(event_time)) {
+    UINT64 idx = event_time & mask;
+    auto & bucket = buckets[idx];
+    auto iter = std::lower_bound(bucket.begin(), bucket.end(), comp);
+
+    if (iter == bucket.end() || *iter != comp) return;
+    bucket.erase(iter);
+    if (bucket.empty()) {
+      occupied[idx >> 6] &= ~(1ULL << (idx & 63));
+      num_ticks--;
+    }
+  } else {
+    auto new_end = std::remove(overflow.begin(), overflow.end(), overflow_entry(event_time, comp));
+    if (new_end != overflow.end()) {
+      overflow.erase(new_end, overflow.end());
+      std::make_heap(overflow.begin(), overflow.end(), std::greater<overflow_entry>());
+    }
+  }
+}
+
+
+bool EventCalendar::contains(UINT64 event_time, Component * comp) const {
+  if (in_wheel(event_time)) {
+    auto & bucket = buckets[event_time & mask];
+    return std::binary_search(bucket.begin(), bucket.end(), comp);
+  }
+  return std::find(overflow.begin(), overflow.end(), overflow_entry(event_time, comp)) != overflow.end();
+}
+
+
+UINT64 EventCalendar::first_occupied() const {
+  UINT64 start    = base & mask;
+  UINT64 num_word = occupied.size();
+  UINT64 widx     = start >> 6;
+  UINT64 word     = occupied[widx] & (~0ULL << (start & 63));
+
+  // the first word is visited twice to cover the buckets that wrapped around
+  for (UINT64 i = 0; i <= num_word; i++) {
+    if (word != 0) {
+      return (((widx << 6) + __builtin_ctzll(word)) - start) & mask;
+    }
+    widx = (widx + 1 == num_word) ? 0 : widx + 1;
+    word = occupied[widx];
+  }
+  ASSERTX(0);
+  return 0;
+}
+
+
+void EventCalendar::migrate() {
+  while (overflow.empty() == false && overflow.front().first - base < num_buckets) {
+    bucket_insert(overflow.front().first, overflow.front().second);
+    std::pop_heap(overflow.begin(), overflow.end(), std::greater<overflow_entry>());
+    overflow.pop_back();
+  }
+}
+
+
+void EventCalendar::rebase(UINT64 new_base) {
+  // an event was scheduled before the wheel (e.g., a logical process of the
+  // parallel engine peeked past the others).  the wheel restarts from
+  // new_base, and only the buckets that it no longer covers spill into the
+  // overflow heap.
+  UINT64 num_spilled = std::min(base - new_base, num_buckets);
+  for (UINT64 event_time = base + num_buckets - num_spilled;
+       num_ticks > 0 && event_time < base + num_buckets; event_time++) {
+    UINT64 idx = event_time & mask;
+    auto & bucket = buckets[idx];
+    if (bucket.empty()) continue;
+    for (auto && comp : bucket) {
+      overflow.push_back(overflow_entry(event_time, comp));
+    }
+    bucket.clear();
+    occupied[idx >> 6] &= ~(1ULL << (idx & 63));
+    num_ticks--;
+  }
+  std::make_heap(overflow.begin(), overflow.end(), std::greater<overflow_entry>());
+  base = new_base;
+  migrate();
+}
+
+
+bool EventCalendar::peek(UINT64 & event_time, Component * & comp) {
+  while (true) {
+    if (overflow.empty() == false && overflow.front().first < base) {
+      rebase(overflow.front().first);
+    }
+    if (num_ticks > 0) {
+      UINT64 offset = first_occupied();
+      if (offset > 0) {
+        base += offset;
+        migrate();
+      }
+      event_time = base;
+      comp       = buckets[base & mask].front();
+      return true;
+    }
+    if (overflow.empty() == true) {
+      return false;
+    }
+    base = overflow.front().first;
+    migrate();
+  }
+}
+
+
+size_t EventCalendar::size() const {
+  std::vector<UINT64> far_ticks;
+  for (auto && el : overflow) far_ticks.push_back(el.first);
+  std::sort(far_ticks.begin(), far_ticks.end());
+  return num_ticks + (std::unique(far_ticks.begin(), far_ticks.end()) - far_ticks.begin());
+}
+
+
+void EventCalendar::clear() {
+  for (auto && bucket : buckets) bucket.clear();
+  std::fill(occupied.begin(), occupied.end(), 0);
+  overflow.clear();
+  num_ticks = 0;
+}
+
+
+std::map<UINT64, std::vector<Component *> > EventCalendar::snapshot() const {
+  std::map<UINT64, std::vector<Component *> > ret_val;
+
+  for (UINT64 idx = 0; idx < num_buckets; idx++) {
+    if (buckets[idx].empty()) continue;
+    ret_val[base + ((idx - base) & mask)] = buckets[idx];
+  }
+  for (auto && el : overflow) {
+    auto & comps = ret_val[el.first];
+    auto iter    = std::lower_bound(comps.begin(), comps.end(), el.second);
+    if (iter == comps.end() || *iter != el.second) comps.insert(iter, el.second);
+  }
+  return ret_val;
+}
+
+
 GlobalEventQueue::GlobalEventQueue(McSim * mcsim_):
-  event_queue(), curr_time(0), mcsim(mcsim_) {
+  event_queue(mcsim_->pts->get_param_uint64("pts.geq_num_buckets", 4096)),
+  curr_time(0), mcsim(mcsim_) {
   num_hthreads = mcsim->pts->get_param_uint64("pts.num_hthreads", max_hthreads);
   num_mcs      = mcsim->pts->get_param_uint64("pts.num_mcs", 2);
   interleave_base_bit = mcsim->pts->get_param_uint64("pts.mc.interleave_base_bit", 12);
@@ -126,7 +443,7 @@ GlobalEventQueue::~GlobalEventQueue() {
 void GlobalEventQueue::add_event(
     uint64_t event_time,
     Component * event_target) {
-  event_queue[event_time].insert(event_target);
+  event_queue.insert(event_time, event_target);
 }
 
 
@@ -135,24 +452,11 @@ uint32_t GlobalEventQueue::process_event() {
   Component * p_comp;
 
   while (true) {
-    auto event_queue_iter = event_queue.begin();
-
-    if (event_queue_iter != event_queue.end()) {
-      curr_time = event_queue_iter->first;
-      auto comp_iter = event_queue_iter->second.begin();
-      if (comp_iter == event_queue_iter->second.end()) {
-        display();  ASSERTX(0);
-      }
-
-      switch ((*comp_iter)->type) {
+    if (event_queue.peek(curr_time, p_comp) == true) {
+      switch (p_comp->type) {
         case ct_core:
         case ct_o3core:
-          p_comp = *comp_iter;
-
-          event_queue_iter->second.erase(comp_iter);
-          if (event_queue_iter->second.empty() == true) {
-            event_queue.erase(event_queue_iter);
-          }
+          event_queue.erase(curr_time, p_comp);
 
           ret_val = p_comp->process_event(curr_time);
           if (ret_val < num_hthreads) {
@@ -167,16 +471,11 @@ uint32_t GlobalEventQueue::process_event() {
         case ct_crossbar:
         case ct_tlbl1d:
         case ct_tlbl1i:
-          p_comp = *comp_iter;
           p_comp->process_event(curr_time);
-
-          event_queue.begin()->second.erase(comp_iter);
-          if (event_queue_iter->second.empty() == true) {
-            event_queue.erase(event_queue_iter);
-          }
+          event_queue.erase(curr_time, p_comp);
           break;
         default:
-          LOG(ERROR) << "  -- unsupported component type " << (*comp_iter)->type << std::endl;
+          LOG(ERROR) << "  -- unsupported component type " << p_comp->type << std::endl;
           exit(1);
           break;
       }
@@ -192,19 +491,16 @@ uint32_t GlobalEventQueue::process_event() {
 void GlobalEventQueue::display() { LOG(WARNING) << *this; }
 
 
-std::ostream & operator<<(std::ostream & out, GlobalEventQueue & g) {
-  auto event_queue_iter = g.event_queue.begin();
-
-  out << "  -- global event queue : at cycle = " << g.curr_time << std::endl;
+std::ostream & GlobalEventQueue::print(std::ostream & out) const {
+  out << "  -- global event queue : at cycle = " << curr_time << std::endl;
 
-  while (event_queue_iter != g.event_queue.end()) {
-    out << event_queue_iter->first << ", ";
+  for (auto && event_queue_iter : event_queue.snapshot()) {
+    out << event_queue_iter.first << ", ";
 
-    for (auto && it : event_queue_iter->second) {
+    for (auto && it : event_queue_iter.second) {
       out << *it << ", ";
     }
     out << std::endl;
-    ++event_queue_iter;
   }
   return out;
 }
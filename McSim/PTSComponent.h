@@ -9,8 +9,9 @@
 #include <map>
 #include <queue>
 #include <set>
-#include <stack>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "PTS.h"
 
@@ -66,27 +67,94 @@ enum event_type {
   et_nop,
 };
 
+// fixed-capacity replacement of std::stack<Component *> that keeps the route
+// of a request inside its LocalQueueElement instead of in a std::deque.
+class RouteStack {
+ public:
+  static const UINT32 max_depth = 16;
+
+  RouteStack() : depth(0) { }
+  void push(Component * comp) {
+    if (depth >= max_depth) overflow();
+    route[depth++] = comp;
+  }
+  void pop() { ASSERTX((depth > 0)); depth--; }
+  Component * top() const { return route[depth - 1]; }
+  bool   empty() const { return depth == 0; }
+  UINT32 size() const { return depth; }
+  Component * operator[](UINT32 idx) const { return route[idx]; }  // 0 is the bottom
+
+ private:
+  Component * route[max_depth];
+  UINT32      depth;
+
+  void overflow() const;  // LOG(FATAL)
+};
+
+
+// LocalQueueElements are recycled through per-thread pools.  the one
+// who holds an element owns it; it either hands it over to another component
+// (add_req_event/add_rep_event) or returns it with release().
 struct LocalQueueElement {
-  std::stack<Component *> from;  // where it is from
+  RouteStack from;  // where it is from
   event_type type;
   UINT64     address;
   UINT32     th_id;
-  bool       dummy;
   INT32      rob_entry;
+  UINT64     ip;    // of the instruction behind the access; 0 if unknown
+  LocalQueueElement * next;  // link in a TimedEventQueue
 
-  LocalQueueElement() : from(), th_id(0), dummy(false), rob_entry(-1) { }
+  LocalQueueElement() : from(), th_id(0), rob_entry(-1), ip(0), next(nullptr) { }
   LocalQueueElement(Component * comp, event_type type_, UINT64 address_, UINT32 th_id_ = 0):
       from(), type(type_), address(address_),
-      th_id(th_id_), dummy(false), rob_entry(-1) {
+      th_id(th_id_), rob_entry(-1), ip(0), next(nullptr) {
     from.push(comp);
   }
 
+  template <typename ... Args>
+  static LocalQueueElement * acquire(Args && ... args) {
+    return new LocalQueueElement(std::forward<Args>(args)...);
+  }
+  void release() { delete this; }
+
+  static void * operator new(size_t size);
+  static void   operator delete(void * ptr);
+  static uint64_t num_pool_slabs();  // taken by the pools of all threads so far
+
   void display();
 
   friend std::ostream& operator<<(std::ostream &out, LocalQueueElement &l);
 };
 
 
+// per-component event queue.  elements of the same tick are chained through
+// LocalQueueElement::next in the bucket indexed by (time % num_buckets) and
+// come out in FIFO order.  when the bucket is taken by another tick, the
+// element falls back to an ordered overflow map.
+class TimedEventQueue {
+ public:
+  static const UINT32 num_buckets = 512;
+
+  TimedEventQueue();
+  void   push(UINT64 event_time, LocalQueueElement *);
+  LocalQueueElement * pop(UINT64 curr_time);  // nullptr if none at curr_time
+  bool   empty() const { return num_elements == 0; }
+  size_t size() const { return num_elements; }
+  void   clear();
+
+ private:
+  struct Bucket {
+    UINT64 time;
+    LocalQueueElement * head;
+    LocalQueueElement * tail;
+  };
+
+  std::vector<Bucket> buckets;
+  std::multimap<UINT64, LocalQueueElement *> overflow;
+  size_t num_elements;
+};
+
+
 class Component {  // meta-class
  public:
   Component(component_type type_, UINT32 num_, McSim * mcsim_);
@@ -97,6 +165,7 @@ class Component {  // meta-class
   UINT32               num;
   McSim              * mcsim;
   GlobalEventQueue   * geq;  // global event queue
+  UINT32               lp;   // logical process that owns it (parallel engine)
 
   virtual void add_req_event(UINT64, LocalQueueElement *, Component * from) { ASSERTX(0); }
   virtual void add_rep_event(UINT64, LocalQueueElement *, Component * from) { ASSERTX(0); }
@@ -107,8 +176,8 @@ class Component {  // meta-class
   virtual void display();
   virtual std::ostream & print(std::ostream & out) const;
 
-  std::multimap<UINT64, LocalQueueElement *> req_event;
-  std::multimap<UINT64, LocalQueueElement *> rep_event;
+  TimedEventQueue req_event;
+  TimedEventQueue rep_event;
   std::queue<LocalQueueElement *> req_q;
   std::queue<LocalQueueElement *> rep_q;
 
@@ -129,7 +198,63 @@ class Component {  // meta-class
 };
 
 
-using event_queue_t = std::map<UINT64, std::set<Component *> >;
+// calendar queue (timing wheel) of component wakeups.  events within
+// [base, base + num_buckets) live in the bucket indexed by (time % num_buckets);
+// the others wait in an overflow min-heap until the wheel reaches them.
+// each bucket holds a sorted, duplicate-free list of components, so a
+// component is woken up at most once per tick and components of the same
+// tick are visited in the same order as the former std::set<Component *>.
+class EventCalendar {
+ public:
+  explicit EventCalendar(UINT32 num_buckets_ = 4096);
+
+  void   insert(UINT64 event_time, Component *);
+  void   erase(UINT64 event_time, Component *);
+  bool   contains(UINT64 event_time, Component *) const;
+  // the earliest (time, component) pair; returns false if there is no event.
+  bool   peek(UINT64 & event_time, Component * & comp);
+  bool   empty() const { return num_ticks == 0 && overflow.empty(); }
+  size_t size() const;  // number of distinct ticks with pending events
+  void   clear();
+  std::map<UINT64, std::vector<Component *> > snapshot() const;
+
+ private:
+  using overflow_entry = std::pair<UINT64, Component *>;
+
+  const UINT64 num_buckets;
+  const UINT64 mask;
+  UINT64 base;       // the earliest tick that the wheel covers
+  UINT64 num_ticks;  // number of non-empty buckets
+  std::vector<std::vector<Component *> > buckets;
+  std::vector<UINT64> occupied;  // one bit per bucket
+  std::vector<overflow_entry> overflow;  // min-heap of far events
+
+  inline bool in_wheel(UINT64 t) const { return t >= base && t - base < num_buckets; }
+  void   bucket_insert(UINT64 event_time, Component *);
+  UINT64 first_occupied() const;  // offset from base of the earliest bucket
+  void   migrate();
+  void   rebase(UINT64 new_base);
+};
+
+using event_queue_t = EventCalendar;
+
+
+// an add_req_event/add_crq_event/add_rep_event call that crosses logical
+// processes in the parallel engine.  the engine holds it and replays it in
+// the order the sequential engine would have made the call.
+struct RemoteEvent {
+  enum remote_event_type { re_req, re_crq, re_rep };
+
+  remote_event_type   type;
+  UINT64              event_time;
+  LocalQueueElement * lqe;
+  Component         * target;
+  Component         * from;
+  UINT32              num_flits;       // 0 when the call has no num_flits
+  Component         * key  = nullptr;  // set by the engine
+  UINT64              time = 0;        // when the call was made; set by the engine
+};
+
 
 class GlobalEventQueue {
  public:
@@ -140,10 +265,16 @@ class GlobalEventQueue {
 
  public:
   explicit GlobalEventQueue(McSim * mcsim_);
-  ~GlobalEventQueue();
-  void add_event(UINT64 event_time, Component *);
-  UINT32 process_event();
+  virtual ~GlobalEventQueue();
+  virtual void add_event(UINT64 event_time, Component *);
+  virtual UINT32 process_event();
+  virtual bool empty() const { return event_queue.empty(); }
+  // called once the components know their logical processes
+  virtual void partition(UINT32 num_lps) { }
+  // returns true if the call crosses logical processes and was taken over
+  virtual bool post_remote(const RemoteEvent &) { return false; }
   void display();
+  virtual std::ostream & print(std::ostream & out) const;
 
   UINT32 num_hthreads;
   UINT32 num_mcs;
@@ -152,7 +283,7 @@ class GlobalEventQueue {
   UINT32 page_sz_base_bit;
   UINT32 which_mc(UINT64);  // which mc does an address belong to?
 
-  friend std::ostream& operator<<(std::ostream &out, GlobalEventQueue &g);
+  friend std::ostream& operator<<(std::ostream &out, GlobalEventQueue &g) { return g.print(out); }
 };
 
 }  // namespace PinPthread
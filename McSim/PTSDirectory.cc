@@ -4,6 +4,7 @@
 
 #include <assert.h>
 #include <glog/logging.h>
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <utility>
@@ -44,13 +45,12 @@ Directory::Directory(
   process_interval        = get_param_uint64("process_interval", 50);
   dir_cache = std::vector< std::list<uint64_t> >(num_sets);
   num_sharer_histogram = std::vector<uint64_t>(mcsim->l2s.size()+1, 0);
+  CHECK(mcsim->l2s.size() <= UINT16_MAX) << "DirEntry::num_sharer is 16 bits" << std::endl;
 }
 
 
 Directory::~Directory() {
-  for (auto && iter : dir) {
-    num_sharer_histogram[iter.second.num_sharer]++;
-  }
+  dir.for_each([&](uint64_t, DirEntry & d_entry) { num_sharer_histogram[d_entry.num_sharer]++; });
 
   if (num_i_to_tr > 0) {
     std::cout << "  -- Dir [" << std::setw(3) << num
@@ -81,16 +81,18 @@ void Directory::show_state(uint64_t address) {
   uint64_t dir_entry = (address >> set_lsb);
   std::stringstream ss;
 
-  if (dir.find(dir_entry) != dir.end()) {
-    ss << "  -- DIR[" << num << "] : " << dir[dir_entry].type;
-    if (dir[dir_entry].not_in_dc == true) {
+  const DirEntry * d_entry = dir.find(dir_entry);
+
+  if (d_entry != nullptr) {
+    ss << "  -- DIR[" << num << "] : " << d_entry->type;
+    if (d_entry->not_in_dc == true) {
       ss << ", not_in_dc";
     }
-    for (auto && iter : dir[dir_entry].sharedl2) {
-      ss << ", (" << iter->type << ", " << iter->num << ") ";
-    }
-    if (dir[dir_entry].pending != nullptr) {
-      LOG(WARNING) << ss.str() << *(dir[dir_entry].pending);
+    d_entry->sharedl2.for_each([&](uint32_t idx) {
+      ss << ", (" << mcsim->l2s[idx]->type << ", " << idx << ") ";
+    });
+    if (d_entry->pending != nullptr) {
+      LOG(WARNING) << ss.str() << *(d_entry->pending);
     } else {
       LOG(WARNING) << ss.str() << std::endl;
     }
@@ -104,7 +106,7 @@ void Directory::add_req_event(
     Component * from) {
   event_time = ceil_by_y(event_time, process_interval);
   geq->add_event(event_time, this);
-  req_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+  req_event.push(event_time, local_event);
 }
 
 
@@ -116,17 +118,14 @@ void Directory::add_rep_event(
   geq->add_event(event_time, this);
 
   if (local_event->type == et_rd_dir_info_req) {
-    req_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+    req_event.push(event_time, local_event);
   } else {
-    rep_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+    rep_event.push(event_time, local_event);
   }
 }
 
 
 uint32_t Directory::process_event(uint64_t curr_time) {
-  auto req_event_iter = req_event.begin();
-  auto rep_event_iter = rep_event.begin();
-
   LocalQueueElement * rep_lqe = nullptr;
   LocalQueueElement * req_lqe = nullptr;
   num_acc++;
@@ -135,14 +134,12 @@ uint32_t Directory::process_event(uint64_t curr_time) {
   if (rep_q.empty() == false) {
     rep_lqe = rep_q.front();
     rep_q.pop();
-  } else if (rep_event_iter != rep_event.end() && rep_event_iter->first == curr_time) {
-    rep_lqe = rep_event_iter->second;
-    rep_event_iter = rep_event.erase(rep_event_iter);
+  } else {
+    rep_lqe = rep_event.pop(curr_time);
   }
 
-  while (rep_event_iter != rep_event.end() && rep_event_iter->first == curr_time) {
-    rep_q.push(rep_event_iter->second);
-    rep_event_iter = rep_event.erase(rep_event_iter);
+  for (auto lqe = rep_event.pop(curr_time); lqe != nullptr; lqe = rep_event.pop(curr_time)) {
+    rep_q.push(lqe);
   }
 
   if (rep_lqe != nullptr) {
@@ -150,16 +147,12 @@ uint32_t Directory::process_event(uint64_t curr_time) {
   } else if (req_q.empty() == false) {
     req_lqe = req_q.front();
     req_q.pop();
-  } else if (req_event_iter != req_event.end() && req_event_iter->first == curr_time) {
-    req_lqe = req_event_iter->second;
-    req_event_iter = req_event.erase(req_event_iter);
-  } else {
-    LOG(FATAL) << *this << *(req_event_iter->second) << *geq;
+  } else if ((req_lqe = req_event.pop(curr_time)) == nullptr) {
+    LOG(FATAL) << *this << *geq;
   }
 
-  while (req_event_iter != req_event.end() && req_event_iter->first == curr_time) {
-    req_q.push(req_event_iter->second);
-    req_event_iter = req_event.erase(req_event_iter);
+  for (auto lqe = req_event.pop(curr_time); lqe != nullptr; lqe = req_event.pop(curr_time)) {
+    req_q.push(lqe);
   }
 
   if (rep_q.empty() == false || req_q.empty() == false) {
@@ -175,11 +168,12 @@ uint32_t Directory::process_event(uint64_t curr_time) {
     const event_type etype = rep_lqe->type;
 
     if (etype == et_evict || etype == et_rd_dir_info_rep) {
-      if (dir.find(dir_entry) == dir.end()) {
-        delete rep_lqe;
+      DirEntry * entry = dir.find(dir_entry);
+      if (entry == nullptr) {
+        rep_lqe->release();
         return 0;
       }
-      DirEntry & d_entry = dir[dir_entry];
+      DirEntry & d_entry = *entry;
 
       if (has_directory_cache == true) {
         // check if the entry exists in the directory cache.
@@ -198,7 +192,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
 
             if (etype == et_rd_dir_info_rep) {
               d_entry.not_in_dc = false;
-              delete rep_lqe;
+              rep_lqe->release();
               return 0;
             } else if (d_entry.not_in_dc == true) {
               // the entry is on its way from memory
@@ -213,16 +207,18 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           num_dir_cache_miss++;
           if (curr_set.size() == num_ways) {
             for (iter = curr_set.begin(); iter != curr_set.end(); ++iter) {
-              coherence_state_type ctype = dir[*iter].type;
+              // the lines in the directory cache are in the directory
+              const DirEntry & victim = *dir.find(*iter);
+              coherence_state_type ctype = victim.type;
 
               if (ctype == cs_tr_to_s || ctype == cs_tr_to_m || ctype == cs_tr_to_i ||
                   ctype == cs_tr_to_e || ctype == cs_m_to_s ||
-                  dir[*iter].pending != nullptr || dir[*iter].not_in_dc == true) {
+                  victim.pending != nullptr || victim.not_in_dc == true) {
                 continue;
               } else {
                 // evict
                 num_dir_evict++;
-                auto lqe = new LocalQueueElement(this, et_dir_evict, address);
+                auto lqe = LocalQueueElement::acquire(this, et_dir_evict, address);
                 memorycontroller->add_req_event(curr_time + dir_to_mc_t, lqe);
 
                 curr_set.erase(iter);
@@ -245,7 +241,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           }
 
           // get the directory information from the memory controller
-          auto lqe = new LocalQueueElement(this, et_rd_dir_info_rep, address);
+          auto lqe = LocalQueueElement::acquire(this, et_rd_dir_info_rep, address);
           memorycontroller->add_req_event(curr_time + dir_to_mc_t, lqe);
           // this->add_rep_event(curr_time + 2 * process_interval, rep_lqe);
           num_dir_cache_retry++;
@@ -260,8 +256,8 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           LOG(ERROR) << "sharedl2.size() = " << d_entry.sharedl2.size() << std::endl;
           LOG(FATAL) << *this << *rep_lqe << *geq;
         }
-        if (d_entry.sharedl2.find(rep_lqe->from.top()) == d_entry.sharedl2.end()) {
-          delete rep_lqe;
+        if (d_entry.sharedl2.contains(rep_lqe->from.top()->num) == false) {
+          rep_lqe->release();
         } else {
           if (d_entry.type == cs_modified) {
             num_m_to_i++;
@@ -269,31 +265,32 @@ uint32_t Directory::process_event(uint64_t curr_time) {
             dir.erase(dir_entry);
             remove_directory_cache_entry(set, dir_entry);
           } else {
-            d_entry.sharedl2.erase(rep_lqe->from.top());
+            d_entry.sharedl2.erase(rep_lqe->from.top()->num);
           }
           rep_lqe->from.push(this);
           memorycontroller->add_req_event(curr_time + dir_to_mc_t, rep_lqe);
         }
       } else if (d_entry.type == cs_tr_to_s) {
-        d_entry.sharedl2.erase(rep_lqe->from.top());
-        delete rep_lqe;
+        d_entry.sharedl2.erase(rep_lqe->from.top()->num);
+        rep_lqe->release();
       } else if (d_entry.type == cs_tr_to_m) {
-        delete rep_lqe;
+        rep_lqe->release();
       } else {
-        d_entry.sharedl2.erase(rep_lqe->from.top());
+        d_entry.sharedl2.erase(rep_lqe->from.top()->num);
 
         if (d_entry.sharedl2.empty() == true) {
           num_sharer_histogram[d_entry.num_sharer]++;
           dir.erase(dir_entry);
           remove_directory_cache_entry(set, dir_entry);
         }
-        delete rep_lqe;
+        rep_lqe->release();
       }
     } else if (etype == et_e_to_i || etype == et_e_to_m) {
-      if (dir.find(dir_entry) == dir.end()) {
-        delete rep_lqe;
+      DirEntry * entry = dir.find(dir_entry);
+      if (entry == nullptr) {
+        rep_lqe->release();
       } else {
-        DirEntry & d_entry = dir[dir_entry];
+        DirEntry & d_entry = *entry;
 
         if (d_entry.type != cs_tr_to_m) {
           LOG(ERROR) << "d_entry.type = " << d_entry.type << std::endl;
@@ -309,13 +306,14 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           d_entry.type = cs_modified;
           d_entry.pending = nullptr;
         }
-        delete rep_lqe;
+        rep_lqe->release();
       }
     } else if (etype == et_invalidate || etype == et_invalidate_nd) {
-      if (dir.find(dir_entry) == dir.end()) {
-        delete rep_lqe;
+      DirEntry * entry = dir.find(dir_entry);
+      if (entry == nullptr) {
+        rep_lqe->release();
       } else {
-        DirEntry & d_entry = dir[dir_entry];
+        DirEntry & d_entry = *entry;
 
         if (d_entry.type != cs_tr_to_m) {
           LOG(ERROR) << "d_entry.type = " << d_entry.type << std::endl;
@@ -324,10 +322,10 @@ uint32_t Directory::process_event(uint64_t curr_time) {
         d_entry.got_cl = (etype == et_invalidate) ? true : d_entry.got_cl;
         // remove sharedl2
         rep_lqe->from.pop();
-        d_entry.sharedl2.erase(rep_lqe->from.top());
+        d_entry.sharedl2.erase(rep_lqe->from.top()->num);
         ASSERTX(d_entry.pending);
         if (d_entry.sharedl2.empty() == true) {
-          d_entry.sharedl2.insert(d_entry.pending->from.top());
+          d_entry.sharedl2.insert(d_entry.pending->from.top()->num);
 
           if (d_entry.got_cl == true) {
             num_tr_to_m++;
@@ -342,15 +340,15 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           }
           d_entry.pending = nullptr;
         }
-        delete rep_lqe;
+        rep_lqe->release();
       }
     } else if (etype == et_e_to_s_nd || etype == et_s_to_s_nd || etype == et_dir_rd_nd) {
-      if (dir.find(dir_entry) == dir.end() ||
-          (dir[dir_entry].type != cs_tr_to_s && dir[dir_entry].type != cs_m_to_s)) {
+      DirEntry * entry = dir.find(dir_entry);
+      if (entry == nullptr || (entry->type != cs_tr_to_s && entry->type != cs_m_to_s)) {
         LOG(ERROR) << "etype = " << etype << std::endl;
         LOG(FATAL) << *this << *rep_lqe << *geq;
       }
-      DirEntry & d_entry = dir[dir_entry];
+      DirEntry & d_entry = *entry;
 
       // change directory entry state to cs_shared
       num_tr_to_s++;
@@ -364,14 +362,14 @@ uint32_t Directory::process_event(uint64_t curr_time) {
         dir.erase(dir_entry);
         remove_directory_cache_entry(set, dir_entry);
       }
-      delete rep_lqe;
+      rep_lqe->release();
     } else if (etype == et_e_to_s || etype == et_s_to_s || etype == et_dir_rd) {
-      if (dir.find(dir_entry) == dir.end() ||
-          (dir[dir_entry].type != cs_m_to_s && dir[dir_entry].type != cs_tr_to_s)) {
+      DirEntry * entry = dir.find(dir_entry);
+      if (entry == nullptr || (entry->type != cs_m_to_s && entry->type != cs_tr_to_s)) {
         LOG(ERROR) << "etype = " << etype << std::endl;
         LOG(FATAL) << *this << *rep_lqe << *geq;
       }
-      DirEntry & d_entry = dir[dir_entry];
+      DirEntry & d_entry = *entry;
 
       // change directory entry state to cs_shared
       num_tr_to_s++;
@@ -379,28 +377,29 @@ uint32_t Directory::process_event(uint64_t curr_time) {
 
       // resume the pending event
       if (etype == et_dir_rd) {
-        auto lqe = new LocalQueueElement(this, et_evict, address, rep_lqe->th_id);
+        auto lqe = LocalQueueElement::acquire(this, et_evict, address, rep_lqe->th_id);
         memorycontroller->add_req_event(curr_time + dir_to_mc_t, lqe);
       }
 
-      d_entry.sharedl2.insert(d_entry.pending->from.top());
+      d_entry.sharedl2.insert(d_entry.pending->from.top()->num);
       d_entry.num_sharer = (d_entry.sharedl2.size() > d_entry.num_sharer) ? d_entry.sharedl2.size() :
                            d_entry.num_sharer;
       d_entry.pending->type = et_s_rd;
       add_event_to_UL(curr_time, d_entry.pending, true);
       d_entry.pending = nullptr;
-      delete rep_lqe;
+      rep_lqe->release();
     } else {
       num_from_mc++;
       rep_lqe->from.pop();
 
-      if (dir.find(dir_entry) != dir.end()) {
-        if (dir[dir_entry].type == cs_tr_to_e && rep_lqe->type == et_e_rd) {
+      DirEntry * d_entry = dir.find(dir_entry);
+      if (d_entry != nullptr) {
+        if (d_entry->type == cs_tr_to_e && rep_lqe->type == et_e_rd) {
           num_tr_to_e++;
-          dir[dir_entry].type = cs_exclusive;
-        } else if (dir[dir_entry].type == cs_tr_to_m && rep_lqe->type == et_e_rd) {
+          d_entry->type = cs_exclusive;
+        } else if (d_entry->type == cs_tr_to_m && rep_lqe->type == et_e_rd) {
           num_tr_to_m++;
-          dir[dir_entry].type = cs_modified;
+          d_entry->type = cs_modified;
           rep_lqe->type = et_write;
         }
       }
@@ -412,7 +411,10 @@ uint32_t Directory::process_event(uint64_t curr_time) {
     const uint32_t set       = dir_entry % num_sets;
     event_type etype         = req_lqe->type;
 
-    if (dir.find(dir_entry) == dir.end()) {
+    bool inserted;
+    DirEntry & d_entry = dir.find_or_insert(dir_entry, inserted);
+
+    if (inserted == true) {
       if (has_directory_cache == true) {
         // evict an oldest directory cache line to the memory
         std::list<uint64_t> & curr_set = dir_cache[set];
@@ -421,15 +423,16 @@ uint32_t Directory::process_event(uint64_t curr_time) {
         if (curr_set.size() == num_ways) {
           std::list<uint64_t>::iterator iter;
           for (iter = curr_set.begin(); iter != curr_set.end(); ++iter) {
-            coherence_state_type ctype = dir[*iter].type;
+            const DirEntry & victim = *dir.find(*iter);
+            coherence_state_type ctype = victim.type;
 
             if (ctype == cs_tr_to_s || ctype == cs_tr_to_m || ctype == cs_tr_to_i ||
                 ctype == cs_tr_to_e || ctype == cs_m_to_s ||
-                dir[*iter].pending != nullptr || dir[*iter].not_in_dc == true) {
+                victim.pending != nullptr || victim.not_in_dc == true) {
               continue;
             } else {  // evict
               num_dir_evict++;
-              auto lqe = new LocalQueueElement(this, et_dir_evict, address);
+              auto lqe = LocalQueueElement::acquire(this, et_dir_evict, address);
               memorycontroller->add_req_event(curr_time + dir_to_mc_t, lqe);
               curr_set.erase(iter);
               curr_set.push_front(dir_entry);
@@ -439,6 +442,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           }
 
           if (iter == curr_set.end()) {  // not possible to evict -- nack!
+            dir.erase(dir_entry);  // the line stays out of the directory
             num_nack++;
             req_lqe->type = et_nack;
             add_event_to_ULpp(curr_time, req_lqe, false);
@@ -449,20 +453,17 @@ uint32_t Directory::process_event(uint64_t curr_time) {
         }
       }
 
-      // add the entry to the directory
+      // set up the entry added to the directory
       // and load the directory information from the memory if there is a directory cache
-      dir.insert(std::pair<uint64_t, DirEntry>(dir_entry, DirEntry()));
-      dir[dir_entry].sharedl2.insert(req_lqe->from.top());
-      dir[dir_entry].num_sharer = 1;
+      d_entry.sharedl2.insert(req_lqe->from.top()->num);
+      d_entry.num_sharer = 1;
 
       num_i_to_tr++;
-      dir[dir_entry].type = (etype == et_read) ? cs_tr_to_e : cs_tr_to_m;
+      d_entry.type = (etype == et_read) ? cs_tr_to_e : cs_tr_to_m;
       req_lqe->type = et_e_rd;
       req_lqe->from.push(this);
       memorycontroller->add_req_event(curr_time + dir_to_mc_t, req_lqe);
     } else {
-      DirEntry & d_entry = dir[dir_entry];
-
       if (has_directory_cache == true) {
         // check if the entry exists in the directory cache.
         // evict an oldest directory cache line to the memory
@@ -478,7 +479,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
 
             if (etype == et_rd_dir_info_req) {
               // replace pending into req_lqe
-              delete req_lqe;
+              req_lqe->release();
               req_lqe = d_entry.pending;
               d_entry.pending   = nullptr;
               d_entry.not_in_dc = false;
@@ -500,19 +501,20 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           if (etype == et_rd_dir_info_req) {
             // directory cache line was evicted while the exact line info
             // is extracted from the memory controller -- quite a corner case
-            delete req_lqe;
+            req_lqe->release();
             ASSERTX(0);
           }
           if (curr_set.size() == num_ways) {
             for (iter = curr_set.begin(); iter != curr_set.end(); ++iter) {
-              coherence_state_type ctype = dir[*iter].type;
+              const DirEntry & victim = *dir.find(*iter);
+              coherence_state_type ctype = victim.type;
 
               if (ctype == cs_tr_to_s || ctype == cs_tr_to_m || ctype == cs_tr_to_i ||
                   ctype == cs_tr_to_e || ctype == cs_m_to_s ||
-                  dir[*iter].pending != nullptr || dir[*iter].not_in_dc == true) {
+                  victim.pending != nullptr || victim.not_in_dc == true) {
                 continue;
               } else {  // evict
-                auto lqe = new LocalQueueElement(this, et_evict, address);
+                auto lqe = LocalQueueElement::acquire(this, et_evict, address);
                 memorycontroller->add_req_event(curr_time + dir_to_mc_t, lqe);
                 curr_set.erase(iter);
                 curr_set.push_front(dir_entry);
@@ -536,7 +538,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           d_entry.pending = req_lqe;
           d_entry.not_in_dc = true;
 
-          auto lqe = new LocalQueueElement(this, et_rd_dir_info_req, address);
+          auto lqe = LocalQueueElement::acquire(this, et_rd_dir_info_req, address);
           memorycontroller->add_req_event(curr_time + dir_to_mc_t, lqe);
 
           return 0;
@@ -552,7 +554,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
         req_lqe->type = et_nack;
         add_event_to_ULpp(curr_time, req_lqe, false);
       } else if (etype == et_read) {
-        if (d_entry.sharedl2.find(req_lqe->from.top()) != d_entry.sharedl2.end()) {
+        if (d_entry.sharedl2.contains(req_lqe->from.top()->num)) {
           // TODO(gajh) -- currently miss after miss is treated as NACK.
           // We can do some optimization here since the L2 already has data.
           num_nack++;
@@ -569,17 +571,17 @@ uint32_t Directory::process_event(uint64_t curr_time) {
           d_entry.type    = (ctype == cs_exclusive) ? cs_tr_to_s : cs_m_to_s;
           (ctype == cs_exclusive) ? num_e_to_tr++ : num_m_to_tr++;
           // generate a request to the L2 to move the state from modified to shared
-          auto lqe = new LocalQueueElement(this,
+          auto lqe = LocalQueueElement::acquire(this,
               (ctype == cs_exclusive) ? et_e_to_s : et_dir_rd, address, req_lqe->th_id);
-          add_event_to_UL(curr_time, *(d_entry.sharedl2.begin()), lqe);
+          add_event_to_UL(curr_time, mcsim->l2s[d_entry.sharedl2.first()], lqe);
         } else if (ctype == cs_shared) {
           // hold the request in the directory and get data from a L2 cache
           // that add the cache line most recently.
           d_entry.pending = req_lqe;
           num_s_to_tr++;
           d_entry.type    = cs_tr_to_s;
-          auto lqe = new LocalQueueElement(this, et_s_to_s, address, req_lqe->th_id);
-          add_event_to_UL(curr_time, *(d_entry.sharedl2.begin()), lqe);
+          auto lqe = LocalQueueElement::acquire(this, et_s_to_s, address, req_lqe->th_id);
+          add_event_to_UL(curr_time, mcsim->l2s[d_entry.sharedl2.first()], lqe);
         } else {
           LOG(ERROR) << "ctype = " << ctype << std::endl;
           LOG(FATAL) << *this << *req_lqe << *geq;
@@ -592,7 +594,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
               LOG(FATAL) << *this << *req_lqe << *geq;
             }
 
-            if (d_entry.sharedl2.find(req_lqe->from.top()) != d_entry.sharedl2.end()) {
+            if (d_entry.sharedl2.contains(req_lqe->from.top()->num)) {
               // move the state of the directory entry into the pending state
               num_e_to_tr++;
               d_entry.type  = cs_tr_to_m;
@@ -607,10 +609,10 @@ uint32_t Directory::process_event(uint64_t curr_time) {
               num_invalidate++;
               d_entry.type    = cs_tr_to_m;
               // generate requests to the L2s to move the state from exclusive to invalid
-              auto lqe = new LocalQueueElement(
-                *(d_entry.sharedl2.begin()), et_invalidate, address, req_lqe->th_id);
+              auto lqe = LocalQueueElement::acquire(
+                mcsim->l2s[d_entry.sharedl2.first()], et_invalidate, address, req_lqe->th_id);
               lqe->from.push(this);
-              add_event_to_UL(curr_time, *(d_entry.sharedl2.begin()), lqe);
+              add_event_to_UL(curr_time, mcsim->l2s[d_entry.sharedl2.first()], lqe);
             }
             break;
 
@@ -629,23 +631,23 @@ uint32_t Directory::process_event(uint64_t curr_time) {
             if (use_limitless == true && limitless_broadcast_threshold < d_entry.sharedl2.size()) {
               for (unsigned int l2idx = 0; l2idx < mcsim->l2s.size(); l2idx++) {
                 num_invalidate++;
-                auto lqe = new LocalQueueElement(mcsim->l2s[l2idx],
-                  (mcsim->l2s[l2idx] == *(d_entry.sharedl2.begin())) ? et_invalidate :
-                    (d_entry.sharedl2.find(mcsim->l2s[l2idx]) != d_entry.sharedl2.end()) ? et_invalidate_nd :
-                    et_nop,
+                auto lqe = LocalQueueElement::acquire(mcsim->l2s[l2idx],
+                  (l2idx == d_entry.sharedl2.first()) ? et_invalidate :
+                    (d_entry.sharedl2.contains(l2idx)) ? et_invalidate_nd : et_nop,
                   address, req_lqe->th_id);
                 lqe->from.push(this);
                 add_event_to_UL(curr_time, mcsim->l2s[l2idx], lqe);
               }
             } else {
-              for (auto l2iter = d_entry.sharedl2.begin(); l2iter != d_entry.sharedl2.end(); ++l2iter) {
+              uint32_t first = d_entry.sharedl2.first();
+              d_entry.sharedl2.for_each([&](uint32_t l2idx) {
                 num_invalidate++;
-                auto lqe = new LocalQueueElement(*l2iter,
-                  (l2iter == d_entry.sharedl2.begin()) ? et_invalidate : et_invalidate_nd,
+                auto lqe = LocalQueueElement::acquire(mcsim->l2s[l2idx],
+                  (l2idx == first) ? et_invalidate : et_invalidate_nd,
                   address, req_lqe->th_id);
                 lqe->from.push(this);
-                add_event_to_UL(curr_time, *l2iter, lqe);
-              }
+                add_event_to_UL(curr_time, mcsim->l2s[l2idx], lqe);
+              });
             }
             break;
 
@@ -657,7 +659,7 @@ uint32_t Directory::process_event(uint64_t curr_time) {
               LOG(FATAL) << *this << *req_lqe << *geq;
             }
 
-            if (d_entry.sharedl2.find(req_lqe->from.top()) != d_entry.sharedl2.end()) {
+            if (d_entry.sharedl2.contains(req_lqe->from.top()->num)) {
               // TODO(gajh) -- currently miss after miss is treated as NACK.
               // We can do some optimization here since the L2 already has data.
               num_nack++;
@@ -672,10 +674,10 @@ uint32_t Directory::process_event(uint64_t curr_time) {
               num_invalidate++;
               d_entry.type = cs_tr_to_m;
               // generate a request to the L2 to move the state from modified to invalid
-              auto lqe = new LocalQueueElement(
-                  *(d_entry.sharedl2.begin()), et_invalidate, address, req_lqe->th_id);
+              auto lqe = LocalQueueElement::acquire(
+                  mcsim->l2s[d_entry.sharedl2.first()], et_invalidate, address, req_lqe->th_id);
               lqe->from.push(this);
-              add_event_to_UL(curr_time, *(d_entry.sharedl2.begin()), lqe);
+              add_event_to_UL(curr_time, mcsim->l2s[d_entry.sharedl2.first()], lqe);
             }
             break;
 
@@ -691,8 +693,8 @@ uint32_t Directory::process_event(uint64_t curr_time) {
     }
   } else {
     geq->display();
-    LOG_IF(ERROR, req_event_iter != req_event.end()) << req_event_iter->first << std::endl;
-    LOG_IF(ERROR, rep_event_iter != rep_event.end()) << rep_event_iter->first << std::endl;
+    LOG_IF(ERROR, req_event.empty() == false) << req_event.size() << " req events left" << std::endl;
+    LOG_IF(ERROR, rep_event.empty() == false) << rep_event.size() << " rep events left" << std::endl;
     CHECK(false);
   }
 
@@ -750,4 +752,63 @@ void Directory::add_event_to_ULpp(uint64_t curr_time, LocalQueueElement * lqe, b
   }
 }
 
+
+coherence_state_type Directory::warm(uint32_t l2, uint64_t address, bool is_write) {
+  const uint64_t dir_entry = (address >> set_lsb);
+  bool inserted;
+  DirEntry & d_entry = dir.find_or_insert(dir_entry, inserted);
+
+  if (has_directory_cache == true) {
+    // the same choice of a victim as a request that misses the directory cache
+    std::list<uint64_t> & curr_set = dir_cache[dir_entry % num_sets];
+    auto iter = std::find(curr_set.begin(), curr_set.end(), dir_entry);
+    if (iter != curr_set.end()) {
+      curr_set.erase(iter);
+    } else if (curr_set.size() == num_ways) {
+      curr_set.pop_front();
+    }
+    curr_set.push_front(dir_entry);
+  }
+
+  if (inserted == true) {
+    d_entry.sharedl2.insert(l2);
+    d_entry.num_sharer = 1;
+    d_entry.type       = (is_write == true) ? cs_modified : cs_exclusive;
+    return d_entry.type;
+  }
+  // nothing is in flight while warming
+  CHECK(d_entry.pending == nullptr && (d_entry.type == cs_exclusive ||
+        d_entry.type == cs_shared || d_entry.type == cs_modified)) << *this;
+
+  if (is_write == true) {
+    d_entry.sharedl2.for_each([&](uint32_t l2idx) {
+      if (l2idx != l2) mcsim->l2s[l2idx]->warm_invalidate(address);
+    });
+    d_entry.sharedl2.clear();
+    d_entry.sharedl2.insert(l2);
+    d_entry.type = cs_modified;
+  } else if (d_entry.sharedl2.contains(l2) == false) {
+    if (d_entry.type != cs_shared) {
+      mcsim->l2s[d_entry.sharedl2.first()]->warm_downgrade(address);
+      d_entry.type = cs_shared;
+    }
+    d_entry.sharedl2.insert(l2);
+    d_entry.num_sharer = std::max<uint32_t>(d_entry.num_sharer, d_entry.sharedl2.size());
+  }
+  return d_entry.type;
+}
+
+
+void Directory::warm_evict(uint32_t l2, uint64_t address) {
+  const uint64_t dir_entry = (address >> set_lsb);
+  DirEntry * entry = dir.find(dir_entry);
+  if (entry == nullptr) return;
+
+  entry->sharedl2.erase(l2);
+  if (entry->sharedl2.empty() == true) {
+    dir.erase(dir_entry);
+    remove_directory_cache_entry(dir_entry % num_sets, dir_entry);
+  }
+}
+
 }  // namespace PinPthread
@@ -13,6 +13,8 @@
 #include <vector>
 
 #include "McSim.h"
+#include "PTSLineMap.h"
+#include "PTSSharerSet.h"
 
 namespace PinPthread {
 
@@ -26,6 +28,11 @@ class Directory : public Component {
   virtual uint32_t process_event(uint64_t curr_time);
   void show_state(uint64_t);
 
+  // functional warming (see CacheL2::warm): an L2 missed the line of
+  // address; returns the state that the L2 gets
+  coherence_state_type warm(uint32_t l2, uint64_t address, bool is_write);
+  void warm_evict(uint32_t l2, uint64_t address);  // the L2 dropped the line
+
   // MemoryController * memorycontroller;  // downlink
   Component * memorycontroller;  // downlink
   CacheL2   * cachel2;    // uplink
@@ -34,15 +41,15 @@ class Directory : public Component {
   class DirEntry {
    public:
     coherence_state_type type;
-    std::set<Component *> sharedl2;
-    LocalQueueElement * pending;
     bool got_cl;  // whether the entry got a cache line during an invalidation
     bool not_in_dc;   // true if the entry is not in the directory cache
-    uint32_t num_sharer;
+    uint16_t num_sharer;
+    SharerSet sharedl2;  // numbers of the L2s
+    LocalQueueElement * pending;
 
     DirEntry() :
-      type(cs_invalid), sharedl2(), pending(NULL),
-      got_cl(false), not_in_dc(false), num_sharer(0) { }
+      type(cs_invalid), got_cl(false), not_in_dc(false), num_sharer(0),
+      sharedl2(), pending(NULL) { }
   };
 
   const uint32_t set_lsb;
@@ -57,7 +64,7 @@ class Directory : public Component {
   const uint32_t limitless_broadcast_threshold;
 
  protected:
-  std::map<uint64_t, DirEntry> dir;
+  LineMap<DirEntry> dir;  // keyed by line address; 48 bytes per slot
   std::vector< std::list<uint64_t> > dir_cache;
   std::vector<uint64_t> num_sharer_histogram;
 
@@ -5,9 +5,14 @@
 #ifndef MCSIM_PTSINTERFACE_H_
 #define MCSIM_PTSINTERFACE_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
-const uint32_t instr_batch_size = 32;
+// a batch never holds more instructions than the free o3queue entries of its
+// hardware thread (at most pts.o3core.o3queue_max_size, 128 in the sample
+// configs), so a larger pts.instr_batch_size makes no difference.
+const uint32_t instr_batch_size   = 128;   // default of pts.instr_batch_size
+const uint32_t instr_publish_size = 16;    // default of pts.instr_publish_size
 
 enum pts_msg_type {
   pts_constructor,
@@ -49,11 +54,6 @@ struct PTSInstr {
   uint32_t rw3;
 };
 
-union instr_n_str {
-  PTSInstr   instr[instr_batch_size];
-  char       str[1024];
-};
-
 struct PTSMessage {
   pts_msg_type type;
   bool         bool_val;
@@ -62,7 +62,38 @@ struct PTSMessage {
   uint64_t     uint64_t_val;
   ADDRINT      stack_val;
   ADDRINT      stacksize_val;
-  instr_n_str  val;
+  char         str[1024];  // the name of a parameter
+};
+
+// a trace file of TraceGen is a sequence of slices, (slice number, compressed
+// length, snappy-compressed PTSInstrTrace[instr_group_size_]), and a footer.
+struct PTSInstrTrace {
+  uint64_t waddr;
+  uint32_t wlen;
+  uint64_t raddr;
+  uint64_t raddr2;
+  uint32_t rlen;
+  uint64_t ip;
+  uint32_t category;
+  bool     isbranch;
+  bool     isbranchtaken;
+  uint32_t rr0;
+  uint32_t rr1;
+  uint32_t rr2;
+  uint32_t rr3;
+  uint32_t rw0;
+  uint32_t rw1;
+  uint32_t rw2;
+  uint32_t rw3;
+};
+
+const uint64_t kTraceMagicNumber = 0x1628efca19620db1ull;
+
+struct PTSTraceFooter {
+  size_t   offset_;  // where the footer starts
+  size_t   total_slice_;
+  uint32_t instr_group_size_;
+  uint64_t magic_number_ = 0;
 };
 
 #endif  // MCSIM_PTSINTERFACE_H_
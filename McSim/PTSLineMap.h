@@ -0,0 +1,149 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSLINEMAP_H_
+#define MCSIM_PTSLINEMAP_H_
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace PinPthread {
+
+// a map from line addresses to T in one flat array of slots.  it is a
+// linear-probing table kept in robin hood order (along a probe sequence,
+// the distances of the slots from their home slots never decrease), so a
+// lookup stops at the first slot closer to home than the line would be, and
+// an erase shifts the following slots back by one instead of leaving a
+// tombstone.  the table doubles when it is 7/8 full, so a line costs
+// between 1.15 * sizeof(Slot) and 2.3 * sizeof(Slot) bytes.
+//
+// insert and erase move slots around; a pointer or a reference returned
+// earlier is valid only until the next find_or_insert or erase.
+template <class T>
+class LineMap {
+ public:
+  struct Slot {
+    uint64_t line;
+    T        value;
+  };
+
+  static constexpr uint64_t empty_line = UINT64_MAX;  // not a valid line address
+
+  explicit LineMap(uint64_t min_num_slots = 1024) : num_lines(0) {
+    uint32_t log2_min = 4;
+    while ((1ULL << log2_min) < min_num_slots) log2_min++;
+    resize(log2_min);
+  }
+
+  uint64_t size() const { return num_lines; }
+  uint64_t num_slots() const { return slots.size(); }
+  uint64_t memory_size() const { return slots.capacity() * sizeof(Slot); }
+
+  // nullptr if the line is not in the map
+  T * find(uint64_t line) {
+    uint64_t idx = find_slot(line);
+    return (idx == slots.size()) ? nullptr : &slots[idx].value;
+  }
+
+  // one probe sequence finds the line or the slot where it goes; a new
+  // line gets a default-constructed T
+  T & find_or_insert(uint64_t line, bool & inserted) {
+    if ((num_lines + 1) * 8 > slots.size() * 7) resize(log2_num_slots + 1);
+
+    for (uint64_t idx = home(line), dist = 0; ; idx = (idx + 1) & mask, dist++) {
+      Slot & slot = slots[idx];
+      if (slot.line == line) {
+        inserted = false;
+        return slot.value;
+      }
+      if (slot.line == empty_line || distance(idx) < dist) {
+        // the line takes this slot; the run up to the next empty slot moves
+        // one slot further from home, which keeps the robin hood order
+        if (slot.line != empty_line) {
+          uint64_t last = idx;
+          while (slots[last].line != empty_line) last = (last + 1) & mask;
+          for (; last != idx; last = (last - 1) & mask) {
+            slots[last] = std::move(slots[(last - 1) & mask]);
+          }
+          slot.value = T();
+        }
+        slot.line = line;
+        num_lines++;
+        inserted  = true;
+        return slot.value;
+      }
+    }
+  }
+
+  T & operator[](uint64_t line) {
+    bool inserted;
+    return find_or_insert(line, inserted);
+  }
+
+  // returns whether the line was in the map
+  bool erase(uint64_t line) {
+    uint64_t idx = find_slot(line);
+    if (idx == slots.size()) return false;
+
+    for (uint64_t next = (idx + 1) & mask;
+         slots[next].line != empty_line && distance(next) > 0;
+         idx = next, next = (next + 1) & mask) {
+      slots[idx] = std::move(slots[next]);
+    }
+    slots[idx].line  = empty_line;
+    slots[idx].value = T();
+    num_lines--;
+    return true;
+  }
+
+  // calls f(line, value) for each line in no particular order; f must not
+  // insert or erase lines
+  template <class F>
+  void for_each(F f) {
+    for (auto && slot : slots) {
+      if (slot.line != empty_line) f(slot.line, slot.value);
+    }
+  }
+
+ private:
+  std::vector<Slot> slots;
+  uint32_t log2_num_slots;
+  uint64_t mask;
+  uint64_t num_lines;
+
+  // fibonacci hashing; line addresses are often consecutive, and the upper
+  // bits of the product spread them over the whole table
+  uint64_t home(uint64_t line) const {
+    return (line * 0x9E3779B97F4A7C15ULL) >> (64 - log2_num_slots);
+  }
+  uint64_t distance(uint64_t idx) const { return (idx - home(slots[idx].line)) & mask; }
+
+  // the index of the slot of the line or slots.size()
+  uint64_t find_slot(uint64_t line) const {
+    for (uint64_t idx = home(line), dist = 0; ; idx = (idx + 1) & mask, dist++) {
+      if (slots[idx].line == line) return idx;
+      if (slots[idx].line == empty_line || distance(idx) < dist) return slots.size();
+    }
+  }
+
+  void resize(uint32_t log2_num_slots_) {
+    std::vector<Slot> old_slots(std::move(slots));
+    slots = std::vector<Slot>(1ULL << log2_num_slots_);
+    for (auto && slot : slots) slot.line = empty_line;
+    log2_num_slots = log2_num_slots_;
+    mask           = slots.size() - 1;
+
+    num_lines = 0;
+    for (auto && old_slot : old_slots) {
+      if (old_slot.line == empty_line) continue;
+      bool inserted;
+      find_or_insert(old_slot.line, inserted) = std::move(old_slot.value);
+    }
+  }
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSLINEMAP_H_
@@ -41,7 +41,7 @@ MemoryController::MemoryController(
     uint32_t num_,
     McSim * mcsim_):
   Component(type_, num_, mcsim_),
-  req_l(),
+  req_l(), wr_l(),
   tRCD(get_param_uint64("tRCD", 10)),
   tRR(get_param_uint64("tRR",  5)),
   tRP(get_param_uint64("tRP",  tRP)),
@@ -53,7 +53,16 @@ MemoryController::MemoryController(
   tRWBUB(get_param_uint64("tRWBUB", 2)),
   tRRBUB(get_param_uint64("tRRBUB", 2)),
   tWTR(get_param_uint64("tWTR", 8)),
+  // refresh_interval is the older name of tREFI, in ticks
+  tREFI(get_param_uint64("tREFI",
+        get_param_uint64("refresh_interval", 0) / get_param_uint64("process_interval", 10))),
+  tRFC(get_param_uint64("tRFC", 0)),
+  max_postponed_refreshes(get_param_uint64("max_postponed_refreshes", 0)),
   req_window_sz(get_param_uint64("req_window_sz", 16)),
+  wq_sz(get_param_uint64("wq_sz", 0)),
+  wq_high(get_param_uint64("wq_high", wq_sz * 3 / 4)),
+  wq_low(get_param_uint64("wq_low", wq_sz / 4)),
+  line_lsb(get_param_uint64("set_lsb", "pts.dir.", 6)),
   mc_to_dir_t(get_param_uint64("to_dir_t", 1000)),
   rank_interleave_base_bit(get_param_uint64("rank_interleave_base_bit", 14)),
   bank_interleave_base_bit(get_param_uint64("bank_interleave_base_bit", 14)),
@@ -74,16 +83,20 @@ MemoryController::MemoryController(
   num_pred_miss(0), num_pred_hit(0), num_global_pred_miss(0),
   num_global_pred_hit(0), pred_history(num_hthreads, 0),
   num_rw_interval(0), num_conflict_interval(0), num_pre_interval(0),
-  curr_refresh_page(0), curr_refresh_bank(0), curr_batch_last(-1),
-  num_req_from_a_th(num_hthreads, 0),
+  next_refresh_time(num_ranks_per_mc, UINT64_MAX), num_postponed(num_ranks_per_mc, 0),
+  num_refresh_postponed(0), refresh_time(0), batch_end(0), num_in_batch(0),
+  num_req_from_a_th(num_hthreads, 0), next_seq(0), num_in_window(0), num_in_wq(0),
+  bank_q(num_ranks_per_mc, std::vector<BankQueue>(num_banks_per_rank, BankQueue{{}, 0})),
+  bank_wq(num_ranks_per_mc, std::vector<BankQueue>(num_banks_per_rank, BankQueue{{}, 0})),
+  draining(false), drain_start_time(0), num_drains(0), num_drained_writes(0),
+  num_wq_forwards(0), drain_time(0),
   bank_status(num_ranks_per_mc, std::vector<BankStatus>(num_banks_per_rank, BankStatus(num_pred_entries))),
   last_activate_time(num_ranks_per_mc, 0),
   last_write_time(num_ranks_per_mc, 0),
   last_read_time(std::pair<uint32_t, uint64_t>(0, 0)),
   last_read_time_rank(num_ranks_per_mc, 0),
   is_last_time_write(num_ranks_per_mc, false),
-  dp_status(), rd_dp_status(), wr_dp_status(),
-  refresh_interval(get_param_uint64("refresh_interval",  0)),
+  bus(), bus_mask(0), last_bus_time(0),
   full_duplex(get_param_bool("full_duplex", false)),
   is_fixed_latency(get_param_bool("is_fixed_latency", false)),
   is_fixed_bw_n_latency(get_param_bool("is_fixed_bw_n_latency", false)),
@@ -91,8 +104,24 @@ MemoryController::MemoryController(
   display_os_page_usage_summary(get_param_bool("display_os_page_usage_summary", false)),
   display_os_page_usage(get_param_bool("display_os_page_usage", false)) {
   process_interval = get_param_uint64("process_interval", 10);
-  // TODO(gajh): refresh implementation should be restored soon.
-  if (refresh_interval != 0) geq->add_event(refresh_interval, this);
+  CHECK(req_window_sz > 0);
+  CHECK(wq_sz == 0 || (wq_high > wq_low && wq_high > 0))
+    << "pts.mc.wq_high (" << wq_high << ") has to be above pts.mc.wq_low (" << wq_low << ")";
+  uint64_t num_bus_slots = 1;
+  while (num_bus_slots <= tCL + tBL + std::max(tWRBUB, tRWBUB)) num_bus_slots <<= 1;
+  bus.assign(num_bus_slots, BusSlot{UINT64_MAX, UINT64_MAX});
+  bus_mask = num_bus_slots - 1;
+  // the ranks take turns to refresh.  the refreshes are not events of their
+  // own: an MC with requests waiting wakes up at each due one, and an idle MC
+  // does not wake up for them.  the ones due while it slept are applied, at
+  // their due times, when it wakes up; the banks of an idle MC do not change
+  // in between, so the result is the same as refreshing on time.
+  if (tREFI > 0 && tRFC > 0) {
+    for (uint32_t i = 0; i < num_ranks_per_mc; i++) {
+      next_refresh_time[i] = ceil_by_y((i + 1) * (uint64_t)tREFI * process_interval / num_ranks_per_mc,
+                                       process_interval);
+    }
+  }
 
   if (get_param_str("scheduling_policy") == "open") {
     policy = mc_scheduling_open;
@@ -128,6 +157,24 @@ MemoryController::~MemoryController() {
          << "local pred (miss,hit)=( " << num_pred_miss << ", " << num_pred_hit
          << "), global pred (miss,hit)=( " << num_global_pred_miss << ", " << num_global_pred_hit
          << ")" << std::endl;
+    if (num_refresh > 0) {
+      std::ostringstream out;  // keeps the fixed format off std::cout
+      out << "  -- MC  [" << std::setw(3) << num << "] : refresh "
+        << "(refreshes, postponed, rank closed time %) = (" << num_refresh << ", "
+        << num_refresh_postponed << ", " << std::setiosflags(std::ios::fixed) << std::setprecision(2)
+        << 100.0 * refresh_time / num_ranks_per_mc / std::max<uint64_t>(last_process_time, 1) << ")" << std::endl;
+      std::cout << out.str();
+    }
+    if (wq_sz > 0) {
+      std::ostringstream out;  // keeps the fixed format off std::cout
+      out << "  -- MC  [" << std::setw(3) << num << "] : write queue "
+        << "(drains, writes/drain, drain_time %, forwarded reads) = (" << num_drains << ", "
+        << std::setiosflags(std::ios::fixed) << std::setprecision(2)
+        << ((num_drains > 0) ? 1.0 * num_drained_writes / num_drains : 0.0) << ", "
+        << ((last_process_time > 0) ? 100.0 * drain_time / last_process_time : 0.0) << ", "
+        << num_wq_forwards << ")" << std::endl;
+      std::cout << out.str();
+    }
   }
   if (display_os_page_usage == true) {
     for (auto && iter : os_page_acc_dist) {
@@ -149,7 +196,7 @@ void MemoryController::add_req_event(
 
   if (is_fixed_latency == true) {
     if (local_event->type == et_evict || local_event->type == et_dir_evict) {
-      delete local_event;
+      local_event->release();
     } else {
       directory->add_rep_event(event_time + mc_to_dir_t, local_event);
     }
@@ -159,14 +206,14 @@ void MemoryController::add_req_event(
 
     if (local_event->type == et_evict || local_event->type == et_dir_evict) {
       num_write++;
-      delete local_event;
+      local_event->release();
     } else {
       num_read++;
       directory->add_rep_event(last_process_time + mc_to_dir_t, local_event);
     }
   } else {
     geq->add_event(event_time, this);
-    req_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+    req_event.push(event_time, local_event);
     // check_bank_status(local_event);
   }
 
@@ -205,17 +252,35 @@ uint64_t MemoryController::get_page_num(uint64_t addr) {
 void MemoryController::show_state(uint64_t curr_time) {
   LOG(INFO) << "  -- MC  [" << num << "] : curr_time = " << curr_time << std::endl;
 
-  uint32_t i = 0;
+  for (uint32_t i = 0; i < num_ranks_per_mc; i++) {
+    for (uint32_t k = 0; k < num_banks_per_rank; k++) {
+      for (auto && req : bank_q[i][k].reqs) {
+        std::cout << "  -- bank_q[" << std::setw(2) << i << "][" << std::setw(2) << k << "] = ("
+          << std::setw(6) << req.seq << ", 0x" << std::hex << req.page_num << std::dec << ") : "
+          << std::hex << reinterpret_cast<uint64_t *>(req.lqe) << std::dec << " : " << *req.lqe;
+      }
+      for (auto && req : bank_wq[i][k].reqs) {
+        std::cout << "  -- bank_wq[" << std::setw(2) << i << "][" << std::setw(2) << k << "] = ("
+          << std::setw(6) << req.seq << ", 0x" << std::hex << req.page_num << std::dec << ") : "
+          << std::hex << reinterpret_cast<uint64_t *>(req.lqe) << std::dec << " : " << *req.lqe;
+      }
+    }
+  }
   for (auto && it : req_l) {
-    uint32_t rank_num = get_rank_num(it->address);
-    uint32_t bank_num = get_bank_num(it->address);
-    std::cout << "  -- req_l[" << std::setw(2) <<  i << "] = (" << rank_num << ", " << bank_num
+    std::cout << "  -- req_l = (" << get_rank_num(it->address) << ", " << get_bank_num(it->address)
       << ", 0x" << std::hex << get_page_num(it->address) << std::dec << ") : " << std::hex
       << reinterpret_cast<uint64_t *>(it) << std::dec << " : " << *it;
-    i++;
   }
-  if (curr_batch_last >= 0) {
-    std::cout << "  -- current batch ends at req_l[" << std::setw(2) << curr_batch_last << "]\n";
+  for (auto && it : wr_l) {
+    std::cout << "  -- wr_l = (" << get_rank_num(it->address) << ", " << get_bank_num(it->address)
+      << ", 0x" << std::hex << get_page_num(it->address) << std::dec << ") : " << std::hex
+      << reinterpret_cast<uint64_t *>(it) << std::dec << " : " << *it;
+  }
+  if (draining == true) {
+    std::cout << "  -- draining the write queue since " << drain_start_time << std::endl;
+  }
+  if (num_in_batch > 0) {
+    std::cout << "  -- current batch: " << num_in_batch << " requests before " << batch_end << std::endl;
   }
 
   for (uint32_t i = 0; i < num_ranks_per_mc; i++) {
@@ -231,244 +296,94 @@ void MemoryController::show_state(uint64_t curr_time) {
     std::cout << "  -- last_act_time[" << i << "] = " << last_activate_time[i] << std::endl;
   }
 
-  auto miter = dp_status.begin();
-  while (miter != dp_status.end()) {
-    std::cout << "  -- data_path_status = ("
-      << miter->first << ", "
-      << miter->second << ")" << std::endl;
-    ++miter;
-  }
-  miter = rd_dp_status.begin();
-  while (miter != rd_dp_status.end()) {
-    std::cout << "  -- rd_dp_status = ("
-      << miter->first << ", "
-      << miter->second << ")" << std::endl;
-    ++miter;
-  }
-  miter = wr_dp_status.begin();
-  while (miter != wr_dp_status.end()) {
-    std::cout << "  -- wr_dp_status = ("
-      << miter->first << ", "
-      << miter->second << ")" << std::endl;
-    ++miter;
+  for (uint64_t t = curr_time; t <= last_bus_time; t += process_interval) {
+    const BusSlot & slot = bus[(t / process_interval) & bus_mask];
+    if (slot.rd_time == t) std::cout << "  -- data_path_status = (" << t << ", RD)" << std::endl;
+    if (slot.wr_time == t) std::cout << "  -- data_path_status = (" << t << ", WR)" << std::endl;
   }
 }
 
 
 uint32_t MemoryController::process_event(uint64_t curr_time) {
   if (last_process_time > 0) {
-    packet_time_in_mc_acc += (curr_time - last_process_time) * req_l.size();
+    packet_time_in_mc_acc += (curr_time - last_process_time) * num_pending();
   }
   last_process_time = curr_time;
 
   pre_processing(curr_time);
-  uint32_t i;
-  std::vector<LocalQueueElement *>::iterator iter, iter2;
-
-  int32_t c_idx    = -1;  // candidate index
-  auto c_iter      = req_l.end();
-  bool    page_hit = false;
-  int32_t num_req_from_the_same_thread = req_l.size() + 1;
-
-  // first, find a request that can be serviced at this cycle
-  for (iter = req_l.begin(), i = 0; iter != req_l.end(); ++iter, ++i) {
-    if (c_idx >= 0 && iter != req_l.begin() && (int32_t)i > curr_batch_last) {
-      // we found a candidate from the ready batch already
-      break;
-    }
-
-    if (i >= req_window_sz)
-      break;
-
-    // check constraints
-    const uint64_t & address  = (*iter)->address;
-    const event_type type   = (*iter)->type;
-    const uint32_t rank_num = get_rank_num(address);
-    const uint32_t bank_num = get_bank_num(address);
-    const uint64_t page_num = get_page_num(address);
-
-    BankStatus & curr_bank = bank_status[rank_num][bank_num];
-    std::map<uint64_t, mc_bank_action>::iterator miter, rd_miter, wr_miter;
-
-    if (curr_bank.action_time > curr_time) {
-      continue;
-    }
-    switch (curr_bank.action_type) {
-      case mc_bank_precharge:
-        if (curr_bank.action_time + tRP*process_interval > curr_time) {
-          break;
+  refresh(curr_time);
+  update_drain(curr_time);
+
+  // first, find a request that can be serviced at this cycle.  in the
+  // current batch, a row hit goes first and then the request of the thread
+  // with the fewest requests (par_bs); without one there, the oldest.  the
+  // write queue is all one batch of the same thread (FR-FCFS).
+  const bool is_wq = serve_writes();
+  std::vector<std::vector<BankQueue>> & queues = (is_wq == true) ? bank_wq : bank_q;
+  struct Candidate {
+    uint32_t rank_num, bank_num, idx;
+    uint64_t seq;
+    int32_t  num_req_from_the_same_thread;
+  };
+  Candidate hit{0, 0, 0, UINT64_MAX, INT32_MAX};
+  Candidate other  = hit;  // activate or precharge in the batch
+  Candidate oldest = hit;
+
+  for (uint32_t rank_num = 0; rank_num < num_ranks_per_mc; rank_num++) {
+    for (uint32_t bank_num = 0; bank_num < num_banks_per_rank; bank_num++) {
+      const BankQueue  & q         = queues[rank_num][bank_num];
+      const BankStatus & curr_bank = bank_status[rank_num][bank_num];
+      if (q.reqs.empty() == true || bank_ready_time(rank_num, curr_bank) > curr_time) continue;
+
+      const bool is_open = (curr_bank.action_type != mc_bank_idle &&
+                            curr_bank.action_type != mc_bank_precharge);
+      bool rd_ok = false, wr_ok = false, pre_ok = false;
+      uint32_t num_batch_hits = 0;
+      if (is_open == true) {
+        rd_ok  = column_ok(rank_num, true, curr_time);
+        wr_ok  = column_ok(rank_num, false, curr_time);
+        // a row miss precharges the bank unless the row still has hits
+        pre_ok = (policy == mc_scheduling_open &&
+                  last_activate_time[rank_num] + tRR*process_interval <= curr_time);
+        if (pre_ok == true && (is_wq == true || num_in_batch > 0)) {
+          num_batch_hits = (is_wq == true) ? q.num_row_hits : num_batch_row_hits(q, curr_bank.page_num);
         }
-      case mc_bank_idle:
-        if (page_hit == false &&  // page_hit has priority 2
-            last_activate_time[rank_num] + tRR*process_interval <= curr_time) {
-          int32_t n_req_from_curr_th = num_req_from_a_th[(*iter)->th_id];
-          if (n_req_from_curr_th < num_req_from_the_same_thread ||
-              (n_req_from_curr_th == num_req_from_the_same_thread && c_idx == -1)) {
-            c_idx  = i;
-            c_iter = iter;
-            num_req_from_the_same_thread = n_req_from_curr_th;
-          }
+      }
+
+      for (uint32_t idx = 0; idx < q.reqs.size(); idx++) {
+        const Request & req = q.reqs[idx];
+        const bool in_batch = (is_wq == true || req.seq < batch_end);
+        bool is_hit = false;
+        bool ready  = true;  // activate
+        if (is_open == true && req.page_num == curr_bank.page_num) {
+          is_hit = true;
+          ready  = (req.is_read == true) ? rd_ok : wr_ok;
+        } else if (is_open == true) {
+          ready  = pre_ok && ((in_batch == true) ? num_batch_hits : q.num_row_hits) == 0;
         }
-        break;
-      case mc_bank_activate:
-        if (curr_bank.action_time + tRCD*process_interval > curr_time) {
-          break;
+        if (ready == false) continue;
+
+        Candidate c{rank_num, bank_num, idx, req.seq,
+                    (is_wq == true) ? 0 : num_req_from_a_th[req.lqe->th_id]};
+        Candidate & best = (in_batch == false) ? oldest : ((is_hit == true) ? hit : other);
+        if ((in_batch == false && c.seq < best.seq) ||
+            (in_batch == true &&
+             (c.num_req_from_the_same_thread < best.num_req_from_the_same_thread ||
+              (c.num_req_from_the_same_thread == best.num_req_from_the_same_thread &&
+               c.seq < best.seq)))) {
+          best = c;
         }
-      case mc_bank_read:
-      case mc_bank_write:
-        if (curr_bank.action_time + tBBL*process_interval > curr_time) {
-          break;
-        }
-        if (curr_bank.page_num != page_num) {  // row miss
-          if (policy == mc_scheduling_open) {
-            uint32_t k = 0;
-            bool need_precharge = true;
-            iter2 = req_l.begin();
-
-            while (iter2 != req_l.end() && k++ < req_window_sz) {
-              if ((int32_t)i <= curr_batch_last && (int32_t)k > curr_batch_last + 1) {
-                break;
-              }
-              if (iter == iter2) {
-                iter2++;
-                continue;
-              }
-              if (rank_num == get_rank_num((*iter2)->address) &&
-                  bank_num == get_bank_num((*iter2)->address) &&
-                  curr_bank.page_num == get_page_num((*iter2)->address)) {
-                need_precharge = false;
-                break;
-              }
-              iter2++;
-            }
-
-            if (need_precharge == true &&
-                page_hit == false &&  // page_hit has priority 2
-                last_activate_time[rank_num] + tRR*process_interval <= curr_time) {
-              int32_t n_req_from_curr_th = num_req_from_a_th[(*iter)->th_id];
-              if (n_req_from_curr_th < num_req_from_the_same_thread ||
-                  (n_req_from_curr_th == num_req_from_the_same_thread && c_idx == -1)) {
-                c_idx  = i;
-                c_iter = iter;
-                num_req_from_the_same_thread = n_req_from_curr_th;
-              }
-            }
-          }
-        } else {  // row hit
-          dp_status.erase(dp_status.begin(), dp_status.lower_bound(curr_time));
-          auto miter = dp_status.lower_bound(curr_time + tCL*process_interval);
-          bool met_constraints = false;
-          switch (type) {
-            case et_rd_dir_info_req:
-            case et_rd_dir_info_rep:
-            case et_read:
-            case et_e_rd:
-            case et_s_rd:
-              // read
-              rd_dp_status.erase(rd_dp_status.begin(), rd_dp_status.lower_bound(curr_time));
-              rd_miter = rd_dp_status.lower_bound(curr_time + tCL*process_interval);
-              if ((full_duplex == false &&
-                    (miter == dp_status.end() ||
-                     miter->first >= curr_time + (tCL+tBL)*process_interval)) ||
-                  (full_duplex == true &&
-                    (rd_miter == rd_dp_status.end() ||
-                     rd_miter->first >= curr_time + (tCL+tBL)*process_interval))) {
-                bool wrbub = false;
-                // WRBUB
-                miter = dp_status.lower_bound(curr_time + tCL*process_interval - tWRBUB*process_interval);
-                while (full_duplex == false &&
-                    miter != dp_status.end() &&
-                    miter->first < curr_time + tCL*process_interval) {
-                  if (miter->second == mc_bank_write) {
-                    wrbub = true;
-                    break;
-                  }
-                  ++miter;
-                }
-
-                if (wrbub == false && tWTR > 0 &&
-                    last_write_time[rank_num] + tWTR*process_interval > curr_time) {
-                  wrbub = true;  // tWTR constraint
-                }
-
-                if (wrbub == false && last_read_time.first != rank_num &&
-                    curr_time < tRRBUB*process_interval + last_read_time.second) {
-                  wrbub = true;  // tRRBUB
-                }
-
-                if (wrbub == false) {  // service the read request
-                  met_constraints = true;
-                }
-              }
-              break;
-            case et_evict:
-            case et_dir_evict:
-            case et_s_rd_wr:
-              // write
-              wr_dp_status.erase(wr_dp_status.begin(), wr_dp_status.lower_bound(curr_time));
-              wr_miter = wr_dp_status.lower_bound(curr_time + tCL*process_interval);
-              if ((full_duplex == false &&
-                    (miter == dp_status.end() ||
-                     miter->first >= curr_time + (tCL+tBL)*process_interval)) ||
-                  (full_duplex == true  &&
-                    (wr_miter == wr_dp_status.end() ||
-                     wr_miter->first >= curr_time + (tCL+tBL)*process_interval))) {
-                bool rwbub = false;
-                // RWBUB
-                miter = dp_status.lower_bound(curr_time + tCL*process_interval - tRWBUB*process_interval);
-                while (full_duplex == false && miter != dp_status.end() &&
-                       miter->first < curr_time + tCL*process_interval) {
-                  if (miter->second == mc_bank_read) {
-                    rwbub = true;
-                    break;
-                  }
-                  ++miter;
-                }
-
-                if (rwbub == false &&
-                    last_read_time_rank[rank_num] + tRWBUB*process_interval > curr_time) {
-                  rwbub = true;  // tRTW constraint
-                }
-
-                if (rwbub == false) {
-                  met_constraints = true;  // service the write request
-                }
-              }
-              break;
-            default:
-              show_state(curr_time);
-              LOG(FATAL) << "currenly at req_l[" << i << "]\n";
-              break;
-          }
-          if (met_constraints == true &&
-              (page_hit == false ||  // this request is page_hit
-               num_req_from_a_th[(*iter)->th_id] < num_req_from_the_same_thread)) {
-            c_idx  = i;
-            c_iter = iter;
-            page_hit = true;
-            num_req_from_the_same_thread = num_req_from_a_th[(*iter)->th_id];
-          }
-        }
-        break;
-      default:
-        show_state(curr_time);
-        LOG(FATAL) << "currenly at req_l[" << i << "]\n";
-        break;
+      }
     }
   }
 
-  if (c_idx >= 0) {
-    i    = c_idx;
-    iter = c_iter;
-    // check bank_status
-    const uint64_t address  = (*iter)->address;
-    const event_type type   = (*iter)->type;
-    const uint32_t rank_num = get_rank_num(address);
-    const uint32_t bank_num = get_bank_num(address);
-    const uint64_t page_num = get_page_num(address);
-    BankStatus & curr_bank = bank_status[rank_num][bank_num];
-
-    std::map<uint64_t, mc_bank_action>::iterator miter, rd_miter, wr_miter;
+  const Candidate & c = (hit.seq != UINT64_MAX) ? hit : ((other.seq != UINT64_MAX) ? other : oldest);
+  if (c.seq != UINT64_MAX) {
+    BankQueue  & q         = queues[c.rank_num][c.bank_num];
+    BankStatus & curr_bank = bank_status[c.rank_num][c.bank_num];
+    const uint32_t rank_num = c.rank_num;
+    const uint64_t page_num = q.reqs[c.idx].page_num;
+    LocalQueueElement * lqe = q.reqs[c.idx].lqe;
 
     switch (curr_bank.action_type) {
       case mc_bank_precharge:
@@ -479,6 +394,12 @@ uint32_t MemoryController::process_event(uint64_t curr_time) {
         last_activate_time[rank_num] = curr_time;
         curr_bank.last_activate_time = curr_time;
         num_activate++;
+        for (auto && bq : { &bank_q[c.rank_num][c.bank_num], &bank_wq[c.rank_num][c.bank_num] }) {
+          bq->num_row_hits = 0;
+          for (auto && req : bq->reqs) {
+            if (req.page_num == page_num) bq->num_row_hits++;
+          }
+        }
         break;
       case mc_bank_activate:
       case mc_bank_read:
@@ -493,61 +414,46 @@ uint32_t MemoryController::process_event(uint64_t curr_time) {
           break;
         } else {  // row hit
           mc_bank_action curr_action_type;
-          if (par_bs == true) num_req_from_a_th[(*iter)->th_id]--;
-          switch (type) {
-            case et_rd_dir_info_req:
-            case et_rd_dir_info_rep:
-            case et_read:
-            case et_e_rd:
-            case et_s_rd:
-              // read
-              if (is_last_time_write[rank_num] == true) {
-                is_last_time_write[rank_num] = false;
-                num_write_to_read_switch++;
-              }
-              num_read++;
-              curr_bank.action_time = curr_time;
+          if (par_bs == true && is_wq == false) num_req_from_a_th[lqe->th_id]--;
+          if (q.reqs[c.idx].is_read == true) {
+            if (is_last_time_write[rank_num] == true) {
+              is_last_time_write[rank_num] = false;
+              num_write_to_read_switch++;
+            }
+            num_read++;
+            curr_bank.action_time = curr_time;
 
-              for (uint32_t j = 0; j < tBL; j++) {
-                uint64_t next_time = curr_time + (tCL+j)*process_interval;
-                dp_status.insert(std::pair{next_time, mc_bank_read});
-                rd_dp_status.insert(std::pair{next_time, mc_bank_read});
-              }
-              last_read_time.first  = rank_num;
-              last_read_time.second = curr_time;  // + (tCL + tBL)*process_interval;
-              last_read_time_rank[rank_num] = curr_time + (tCL + tBL)*process_interval;
-              directory->add_rep_event(curr_time + mc_to_dir_t, *iter);
-
-              curr_action_type = mc_bank_read;
-              break;
-            case et_evict:
-            case et_dir_evict:
-            case et_s_rd_wr:
-              // write
-              is_last_time_write[rank_num] = true;
-              num_write++;
-              curr_bank.action_time = curr_time;
-
-              for (uint32_t j = 0; j < tBL; j++) {
-                uint64_t next_time = curr_time + (tCL+j)*process_interval;
-                dp_status.insert(std::pair{next_time, mc_bank_write});
-                wr_dp_status.insert(std::pair{next_time, mc_bank_write});
-              }
-              last_write_time[rank_num] = curr_time + (tCL+tBL)*process_interval;
+            for (uint32_t j = 0; j < tBL; j++) {
+              uint64_t next_time = curr_time + (tCL+j)*process_interval;
+              bus[(next_time / process_interval) & bus_mask].rd_time = next_time;
+              last_bus_time = std::max(last_bus_time, next_time);
+            }
+            last_read_time.first  = rank_num;
+            last_read_time.second = curr_time;  // + (tCL + tBL)*process_interval;
+            last_read_time_rank[rank_num] = curr_time + (tCL + tBL)*process_interval;
+            directory->add_rep_event(curr_time + mc_to_dir_t, lqe);
 
-              if (type == et_s_rd_wr) {
-                (*iter)->type = et_s_rd;
-                directory->add_rep_event(curr_time + mc_to_dir_t, *iter);
-              } else {
-                delete *iter;
-              }
+            curr_action_type = mc_bank_read;
+          } else {
+            is_last_time_write[rank_num] = true;
+            num_write++;
+            curr_bank.action_time = curr_time;
+
+            for (uint32_t j = 0; j < tBL; j++) {
+              uint64_t next_time = curr_time + (tCL+j)*process_interval;
+              bus[(next_time / process_interval) & bus_mask].wr_time = next_time;
+              last_bus_time = std::max(last_bus_time, next_time);
+            }
+            last_write_time[rank_num] = curr_time + (tCL+tBL)*process_interval;
 
-              curr_action_type = mc_bank_write;
-              break;
-            default:
-              show_state(curr_time);
-              LOG(FATAL) << "currenly at req_l[" << i << "]\n";
-              break;
+            if (lqe->type == et_s_rd_wr) {
+              lqe->type = et_s_rd;
+              directory->add_rep_event(curr_time + mc_to_dir_t, lqe);
+            } else {
+              lqe->release();
+            }
+
+            curr_action_type = mc_bank_write;
           }
           if (policy == mc_scheduling_open) {
             curr_bank.action_type = curr_action_type;
@@ -556,14 +462,9 @@ uint32_t MemoryController::process_event(uint64_t curr_time) {
             curr_bank.action_time = tRP*process_interval +
               std::max(curr_time, tRAS*process_interval + curr_bank.last_activate_time);
             curr_bank.action_type = mc_bank_precharge;
-            iter2 = iter;
-            uint32_t i2 = i;
-            ++iter2;
-            ++i2;
-            for ( ; iter2 != req_l.end() && i2 < req_window_sz; ++iter2, ++i2) {
-              if (rank_num == get_rank_num((*iter2)->address) &&
-                  bank_num == get_bank_num((*iter2)->address) &&
-                  page_num == get_page_num((*iter2)->address)) {
+            // unless a later request of the window hits the row
+            for (uint32_t idx = c.idx + 1; idx < q.reqs.size(); idx++) {
+              if (q.reqs[idx].page_num == page_num) {
                 curr_bank.action_type = curr_action_type;
                 num_precharge--;
                 curr_bank.action_time -= tRP*process_interval;
@@ -572,45 +473,312 @@ uint32_t MemoryController::process_event(uint64_t curr_time) {
             }
           }
 
-          if (par_bs == true && curr_batch_last == (int32_t)i) {
-            if (i == 0) {
-              curr_batch_last = std::min((int32_t)req_window_sz-1, (int32_t)req_l.size()-2);
-            } else {
-              curr_batch_last--;
+          q.reqs.erase(q.reqs.begin() + c.idx);
+          q.num_row_hits--;
+          if (is_wq == true) {
+            num_in_wq--;
+            if (draining == true) num_drained_writes++;
+            if (wr_l.empty() == false) {
+              enqueue(wr_l.front(), true);
+              wr_l.pop_front();
+            }
+          } else {
+            num_in_window--;
+            if (req_l.empty() == false) {
+              enqueue(req_l.front(), false);
+              req_l.pop_front();
+            }
+            if (c.seq < batch_end && --num_in_batch == 0 && par_bs == true) {
+              // the next batch is the whole window
+              batch_end    = next_seq;
+              num_in_batch = num_in_window;
             }
-          } else if (par_bs == true && curr_batch_last > (int32_t)i) {
-            curr_batch_last--;
           }
-          req_l.erase(iter);
         }
         break;
       default:
         show_state(curr_time);
-        LOG(FATAL) << "currenly at req_l[" << i << "]\n";
+        LOG(FATAL) << "currenly at bank_q[" << c.rank_num << "][" << c.bank_num << "]\n";
         break;
     }
   }
 
-  if (req_l.empty() == false) {
-    geq->add_event(curr_time + process_interval, this);
+  update_drain(curr_time);
+  if (num_pending() > 0) {
+    // sleep until a command can issue; a new request wakes it up earlier
+    uint64_t next_time = next_issue_time((serve_writes() == true) ? bank_wq : bank_q,
+                                         serve_writes(), curr_time + process_interval);
+    for (auto && refresh_due : next_refresh_time) next_time = std::min(next_time, refresh_due);
+    geq->add_event((next_time == UINT64_MAX) ? curr_time + process_interval : next_time, this);
   }
   return 0;
 }
 
 
 void MemoryController::pre_processing(uint64_t curr_time) {
-  auto req_event_iter = req_event.begin();
-
-  while (req_event_iter != req_event.end() && req_event_iter->first == curr_time) {
+  for (auto lqe = req_event.pop(curr_time); lqe != nullptr; lqe = req_event.pop(curr_time)) {
+    if (wq_sz > 0 && (lqe->type == et_evict || lqe->type == et_dir_evict)) {
+      if (num_in_wq < wq_sz) {
+        enqueue(lqe, true);
+      } else {
+        wr_l.push_back(lqe);
+      }
+      continue;
+    }
+    if (wq_sz > 0 && forward_write(curr_time, lqe) == true) {
+      continue;
+    }
     if (par_bs == true) {
-      num_req_from_a_th[req_event_iter->second->th_id]++;
+      num_req_from_a_th[lqe->th_id]++;
+    }
+    if (num_in_window < req_window_sz) {
+      enqueue(lqe, false);
+    } else {
+      req_l.push_back(lqe);
+    }
+  }
+  if (par_bs == true && num_in_batch == 0 && num_in_window > 0) {
+    batch_end    = next_seq;
+    num_in_batch = num_in_window;
+  }
+}
+
+
+void MemoryController::refresh(uint64_t curr_time) {
+  for (uint32_t rank_num = 0; rank_num < num_ranks_per_mc; rank_num++) {
+    while (next_refresh_time[rank_num] <= curr_time) {
+      const uint64_t due_time = next_refresh_time[rank_num];
+      next_refresh_time[rank_num] += (uint64_t)tREFI * process_interval;
+
+      // a refresh due before curr_time fell while the MC slept, and it
+      // sleeps only with nothing queued
+      bool has_reqs = false;
+      for (uint32_t bank_num = 0; due_time == curr_time && bank_num < num_banks_per_rank; bank_num++) {
+        has_reqs |= (bank_q[rank_num][bank_num].reqs.empty() == false ||
+                     bank_wq[rank_num][bank_num].reqs.empty() == false);
+      }
+      if (has_reqs == true && num_postponed[rank_num] < max_postponed_refreshes) {
+        num_postponed[rank_num]++;
+        num_refresh_postponed++;
+      } else {
+        refresh_rank(rank_num, due_time, num_postponed[rank_num] + 1);
+        num_postponed[rank_num] = 0;
+      }
+    }
+  }
+}
+
+
+void MemoryController::refresh_rank(uint32_t rank_num, uint64_t due_time, uint32_t num_refreshes) {
+  // the open banks precharge as soon as they can
+  uint64_t start_time = due_time;
+  for (auto && bank : bank_status[rank_num]) {
+    switch (bank.action_type) {
+      case mc_bank_activate:
+      case mc_bank_read:
+      case mc_bank_write:
+        num_precharge++;
+        start_time = std::max(start_time, tRP*process_interval +
+            std::max({due_time, bank_ready_time(rank_num, bank),
+                      tRAS*process_interval + bank.last_activate_time}));
+        break;
+      case mc_bank_precharge:
+        start_time = std::max(start_time, bank.action_time + tRP*process_interval);
+        break;
+      default:
+        start_time = std::max(start_time, bank.action_time);
+        break;
     }
-    req_l.push_back(req_event_iter->second);
-    req_event_iter = req_event.erase(req_event_iter);
   }
-  if (par_bs == true && curr_batch_last == -1 && req_l.size() > 0) {
-    curr_batch_last = std::min(static_cast<uint32_t>(req_l.size()), req_window_sz) - 1;
+  const uint64_t end_time = start_time + (uint64_t)num_refreshes * tRFC * process_interval;
+  for (auto && bank : bank_status[rank_num]) {
+    bank.action_type = mc_bank_idle;
+    bank.action_time = end_time;
+  }
+  num_refresh  += num_refreshes;
+  refresh_time += end_time - due_time;
+}
+
+
+void MemoryController::update_drain(uint64_t curr_time) {
+  const size_t num_writes = num_in_wq + wr_l.size();
+  if (draining == false && wq_sz > 0 && num_writes >= wq_high) {
+    draining         = true;
+    drain_start_time = curr_time;
+    num_drains++;
+  } else if (draining == true && num_writes <= wq_low) {
+    draining    = false;
+    drain_time += curr_time - drain_start_time;
+  }
+}
+
+
+bool MemoryController::forward_write(uint64_t curr_time, LocalQueueElement * lqe) {
+  if (lqe->type != et_read && lqe->type != et_e_rd && lqe->type != et_s_rd) return false;
+  const uint64_t line = lqe->address >> line_lsb;
+  bool has_write = false;
+  for (auto && req : bank_wq[get_rank_num(lqe->address)][get_bank_num(lqe->address)].reqs) {
+    has_write |= ((req.lqe->address >> line_lsb) == line);
+  }
+  for (auto && w : wr_l) {
+    has_write |= ((w->address >> line_lsb) == line);
+  }
+  if (has_write == false) return false;
+
+  num_wq_forwards++;
+  directory->add_rep_event(curr_time + mc_to_dir_t, lqe);
+  return true;
+}
+
+
+void MemoryController::enqueue(LocalQueueElement * lqe, bool to_wq) {
+  bool is_read = true;
+  switch (lqe->type) {
+    case et_rd_dir_info_req:
+    case et_rd_dir_info_rep:
+    case et_read:
+    case et_e_rd:
+    case et_s_rd:
+      break;
+    case et_evict:
+    case et_dir_evict:
+    case et_s_rd_wr:
+      is_read = false;
+      break;
+    default:
+      LOG(FATAL) << "unexpected request to MC [" << num << "] : " << *lqe;
+      break;
+  }
+  const uint32_t rank_num = get_rank_num(lqe->address);
+  const uint32_t bank_num = get_bank_num(lqe->address);
+  const uint64_t page_num = get_page_num(lqe->address);
+  BankQueue & q = (to_wq == true) ? bank_wq[rank_num][bank_num] : bank_q[rank_num][bank_num];
+  q.reqs.push_back(Request{lqe, next_seq++, page_num, is_read});
+  if (page_num == bank_status[rank_num][bank_num].page_num) q.num_row_hits++;
+  if (to_wq == true) {
+    num_in_wq++;
+  } else {
+    num_in_window++;
+  }
+}
+
+
+uint64_t MemoryController::bank_ready_time(uint32_t rank_num, const BankStatus & bank) const {
+  switch (bank.action_type) {
+    case mc_bank_precharge:
+      return std::max(bank.action_time + tRP*process_interval,
+                      last_activate_time[rank_num] + tRR*process_interval);
+    case mc_bank_idle:
+      return std::max(bank.action_time, last_activate_time[rank_num] + tRR*process_interval);
+    case mc_bank_activate:
+      return bank.action_time + std::max(tRCD, tBBL)*process_interval;
+    default:
+      return bank.action_time + tBBL*process_interval;
+  }
+}
+
+
+bool MemoryController::bus_reserved(
+    uint64_t begin,
+    uint64_t end,
+    uint64_t curr_time,
+    bool rd,
+    bool wr) const {
+  for (uint64_t t = std::max(begin, curr_time); t < end && t <= last_bus_time; t += process_interval) {
+    const BusSlot & slot = bus[(t / process_interval) & bus_mask];
+    if ((rd == true && slot.rd_time == t) || (wr == true && slot.wr_time == t)) return true;
+  }
+  return false;
+}
+
+
+bool MemoryController::column_ok(uint32_t rank_num, bool is_read, uint64_t t) const {
+  const uint64_t cas_time = t + tCL*process_interval;
+  if (is_read == true) {
+    return bus_reserved(cas_time, cas_time + tBL*process_interval, t, true, full_duplex == false) == false &&
+           // WRBUB
+           (full_duplex == true ||
+            bus_reserved(cas_time - tWRBUB*process_interval, cas_time, t, false, true) == false) &&
+           // tWTR
+           (tWTR == 0 || last_write_time[rank_num] + tWTR*process_interval <= t) &&
+           // tRRBUB
+           (last_read_time.first == rank_num || t >= tRRBUB*process_interval + last_read_time.second);
+  } else {
+    return bus_reserved(cas_time, cas_time + tBL*process_interval, t, full_duplex == false, true) == false &&
+           // RWBUB
+           (full_duplex == true ||
+            bus_reserved(cas_time - tRWBUB*process_interval, cas_time, t, true, false) == false) &&
+           // tRTW
+           last_read_time_rank[rank_num] + tRWBUB*process_interval <= t;
+  }
+}
+
+
+uint64_t MemoryController::column_time(uint32_t rank_num, bool is_read, uint64_t from) const {
+  // the rank constraints only move forward, and the bus is free after the
+  // last reservation
+  uint64_t t = from;
+  if (is_read == true) {
+    if (tWTR > 0) t = std::max<uint64_t>(t, last_write_time[rank_num] + tWTR*process_interval);
+    if (last_read_time.first != rank_num) {
+      t = std::max<uint64_t>(t, tRRBUB*process_interval + last_read_time.second);
+    }
+  } else {
+    t = std::max<uint64_t>(t, last_read_time_rank[rank_num] + tRWBUB*process_interval);
+  }
+  while (column_ok(rank_num, is_read, t) == false) t += process_interval;
+  return t;
+}
+
+
+uint32_t MemoryController::num_batch_row_hits(const BankQueue & q, uint64_t page_num) const {
+  uint32_t num_hits = 0;
+  for (auto && req : q.reqs) {
+    if (req.seq >= batch_end) break;
+    if (req.page_num == page_num) num_hits++;
+  }
+  return num_hits;
+}
+
+
+uint64_t MemoryController::next_issue_time(
+    const std::vector<std::vector<BankQueue>> & queues,
+    bool is_wq,
+    uint64_t from) const {
+  uint64_t next_time = UINT64_MAX;
+  for (uint32_t rank_num = 0; rank_num < num_ranks_per_mc; rank_num++) {
+    for (uint32_t bank_num = 0; bank_num < num_banks_per_rank; bank_num++) {
+      const BankQueue  & q         = queues[rank_num][bank_num];
+      const BankStatus & curr_bank = bank_status[rank_num][bank_num];
+      if (q.reqs.empty() == true) continue;
+      const uint64_t ready_time = std::max(from, bank_ready_time(rank_num, curr_bank));
+      if (ready_time >= next_time) continue;
+      if (curr_bank.action_type == mc_bank_idle || curr_bank.action_type == mc_bank_precharge) {
+        next_time = ready_time;  // activate
+        continue;
+      }
+
+      bool has_rd_hit = false, has_wr_hit = false, has_pre = false;
+      const uint32_t num_batch_hits = (is_wq == true) ? q.num_row_hits :
+        ((policy == mc_scheduling_open && num_in_batch > 0) ? num_batch_row_hits(q, curr_bank.page_num) : 0);
+      for (auto && req : q.reqs) {
+        if (req.page_num == curr_bank.page_num) {
+          has_rd_hit |= req.is_read;
+          has_wr_hit |= (req.is_read == false);
+        } else if (policy == mc_scheduling_open &&
+                   ((is_wq == true || req.seq < batch_end) ? num_batch_hits : q.num_row_hits) == 0) {
+          has_pre = true;
+        }
+      }
+      if (has_pre == true) {
+        next_time = std::min(next_time,
+            std::max<uint64_t>(ready_time, last_activate_time[rank_num] + tRR*process_interval));
+      }
+      if (has_rd_hit == true) next_time = std::min(next_time, column_time(rank_num, true, ready_time));
+      if (has_wr_hit == true) next_time = std::min(next_time, column_time(rank_num, false, ready_time));
+    }
   }
+  return next_time;
 }
 
 
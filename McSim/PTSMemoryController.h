@@ -5,6 +5,7 @@
 #ifndef MCSIM_PTSMEMORYCONTROLLER_H_
 #define MCSIM_PTSMEMORYCONTROLLER_H_
 
+#include <deque>
 #include <list>
 #include <map>
 #include <stack>
@@ -50,7 +51,11 @@ class MemoryController : public Component {
 
   // Directory * directory;  // uplink
   Component * directory;  // uplink
-  std::vector<LocalQueueElement *> req_l;
+  // requests beyond the scheduling window (req_window_sz), in arrival order;
+  // the ones in the window wait in bank_q
+  std::deque<LocalQueueElement *> req_l;
+  // the same for the write queue (wq_sz) of evictions, if any
+  std::deque<LocalQueueElement *> wr_l;
 
   class BankStatus {
    public:
@@ -64,6 +69,20 @@ class MemoryController : public Component {
     uint64_t last_activate_time;
   };
 
+  struct Request {
+    LocalQueueElement * lqe;
+    uint64_t seq;       // arrival order
+    uint64_t page_num;
+    bool     is_read;
+  };
+
+  // the requests of the window to a bank in arrival order, and how many of
+  // them go to the row of its BankStatus (row hits while it is open)
+  struct BankQueue {
+    std::deque<Request> reqs;
+    uint32_t num_row_hits;
+  };
+
   // The unit of each t* value is "process_interval"
   // assume that RL = WL (in terms of DDRx)
   const uint32_t tRCD;
@@ -78,7 +97,20 @@ class MemoryController : public Component {
   const uint32_t tRWBUB;        // RD->WR bubble between any ranks
   const uint32_t tRRBUB;        // RD->RD bubble between two different ranks
   const uint32_t tWTR;          // WR->RD time in the same rank
+  const uint32_t tREFI;         // refresh interval of a rank (0: no refresh)
+  const uint32_t tRFC;          // refresh cycle time
+  // how many refreshes a rank with waiting requests can put off (up to
+  // tREFI each); the ones put off go together at the next due one
+  const uint32_t max_postponed_refreshes;
   const uint32_t req_window_sz;  // up to how many requests can be considered during scheduling
+  // evictions wait in a write queue of wq_sz (0: with the reads in the
+  // window) and are served when no read waits, or in a drain that starts
+  // with wq_high writes waiting and stops with wq_low.  a read of a line
+  // (line_lsb) with a write in the queue takes its data from the write.
+  const uint32_t wq_sz;
+  const uint32_t wq_high;
+  const uint32_t wq_low;
+  const uint32_t line_lsb;
   const uint32_t mc_to_dir_t;
 
   const uint32_t rank_interleave_base_bit;
@@ -119,23 +151,47 @@ class MemoryController : public Component {
   uint64_t num_conflict_interval;
   uint64_t num_pre_interval;
 
-  uint64_t curr_refresh_page;
-  uint64_t curr_refresh_bank;
+  std::vector<uint64_t> next_refresh_time;    // [rank]
+  std::vector<uint32_t> num_postponed;        // [rank]
+  uint64_t num_refresh_postponed;
+  uint64_t refresh_time;                      // ticks the ranks were closed for refreshes
 
-  int32_t curr_batch_last;
+  // par_bs: the requests that arrived before batch_end and are still
+  // waiting form the current batch
+  uint64_t batch_end;
+  uint32_t num_in_batch;
   std::vector<int32_t> num_req_from_a_th;
 
+  uint64_t next_seq;
+  uint32_t num_in_window;
+  uint32_t num_in_wq;
+  std::vector<std::vector<BankQueue>>  bank_q;       // [rank][bank]
+  std::vector<std::vector<BankQueue>>  bank_wq;      // [rank][bank]
+
+  bool     draining;
+  uint64_t drain_start_time;
+  uint64_t num_drains;
+  uint64_t num_drained_writes;
+  uint64_t num_wq_forwards;
+  uint64_t drain_time;
   std::vector<std::vector<BankStatus>> bank_status;  // [rank][bank]
   std::vector<uint64_t> last_activate_time;          // [rank]
   std::vector<uint64_t> last_write_time;             // [rank]
   std::pair<uint32_t, uint64_t> last_read_time;      // <rank, tick>
   std::vector<uint64_t> last_read_time_rank;         // [rank]
   std::vector<bool>     is_last_time_write;          // [rank]
-  std::map<uint64_t, mc_bank_action> dp_status;      // reuse (RD,WR,IDLE) BankStatus
-  std::map<uint64_t, mc_bank_action> rd_dp_status;   // reuse (RD,WR,IDLE) BankStatus
-  std::map<uint64_t, mc_bank_action> wr_dp_status;   // reuse (RD,WR,IDLE) BankStatus
 
-  const uint64_t refresh_interval;
+  // data bus reservations, a slot per process_interval in a ring that
+  // covers the farthest one (tCL + tBL ahead) and the bubbles before it.
+  // a slot holds the ticks of the read and the write bursts in it.
+  struct BusSlot {
+    uint64_t rd_time;
+    uint64_t wr_time;
+  };
+  std::vector<BusSlot> bus;
+  uint64_t bus_mask;
+  uint64_t last_bus_time;  // of the latest reservation
+
   const bool     full_duplex;
   const bool     is_fixed_latency;       // infinite BW
   const bool     is_fixed_bw_n_latency;  // take care of BW as well
@@ -148,6 +204,32 @@ class MemoryController : public Component {
 
   void pre_processing(uint64_t curr_time);
   void check_bank_status(LocalQueueElement * local_event);
+  size_t num_pending() const { return num_in_window + req_l.size() + num_in_wq + wr_l.size(); }
+  // moves a request into the window (or the write queue)
+  void enqueue(LocalQueueElement * lqe, bool to_wq);
+  bool serve_writes() const { return draining == true || (num_in_window == 0 && num_in_wq > 0); }
+  void update_drain(uint64_t curr_time);
+  // replies to a read from a queued write to its line, if there is one
+  bool forward_write(uint64_t curr_time, LocalQueueElement * lqe);
+  // the refreshes of the ranks due by curr_time, after the requests of
+  // curr_time are queued.  a refresh waits for the banks to precharge and
+  // then closes the rank for tRFC.
+  void refresh(uint64_t curr_time);
+  void refresh_rank(uint32_t rank_num, uint64_t due_time, uint32_t num_refreshes);
+  // the earliest tick that the bank takes an activate (when closed) or a
+  // column command (when open)
+  uint64_t bank_ready_time(uint32_t rank, const BankStatus & bank) const;
+  // whether a read (write) to the rank can take the data bus at t, and the
+  // first t from 'from' on that it can
+  bool     column_ok(uint32_t rank, bool is_read, uint64_t t) const;
+  uint64_t column_time(uint32_t rank, bool is_read, uint64_t from) const;
+  // a read (write) burst in [begin, end); the ones before curr_time are over
+  bool     bus_reserved(uint64_t begin, uint64_t end, uint64_t curr_time, bool rd, bool wr) const;
+  // the reads and writes of the batch to the open row of a bank
+  uint32_t num_batch_row_hits(const BankQueue & q, uint64_t page_num) const;
+  // the earliest tick from 'from' on that a command of the queues can issue
+  uint64_t next_issue_time(const std::vector<std::vector<BankQueue>> & queues, bool is_wq,
+                           uint64_t from) const;
   inline uint32_t get_rank_num(uint64_t addr) {
     return ((addr >> rank_interleave_base_bit) ^ (addr >> interleave_xor_base_bit)) %
             num_ranks_per_mc;
@@ -0,0 +1,83 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSMSHR_H_
+#define MCSIM_PTSMSHR_H_
+
+#include <stdint.h>
+#include <vector>
+
+namespace PinPthread {
+
+struct LocalQueueElement;
+
+// miss status holding registers of a cache.  an entry stands for a line
+// on the way from below: the request that went down (primary) and up to
+// num_targets later requests to the line that wait for it.  like the
+// hardware, a lookup compares the line of every entry, so num_entries is
+// expected to be small.
+class MshrFile {
+ public:
+  struct Entry {
+    uint64_t            line;
+    LocalQueueElement * primary;
+    bool                is_write;  // the line comes back writable
+    std::vector<LocalQueueElement *> targets;
+  };
+
+  MshrFile(uint32_t num_entries, uint32_t num_targets_) :
+      num_targets(num_targets_), entries(num_entries), num_used(0) {
+    for (auto && entry : entries) {
+      entry.primary = nullptr;
+      entry.targets.reserve(num_targets);
+    }
+  }
+
+  bool full() const { return num_used == entries.size(); }
+  uint32_t size() const { return num_used; }
+
+  // nullptr if no entry waits for the line
+  Entry * find(uint64_t line) {
+    for (auto && entry : entries) {
+      if (entry.primary != nullptr && entry.line == line) return &entry;
+    }
+    return nullptr;
+  }
+
+  // the file must not be full
+  Entry * allocate(uint64_t line, LocalQueueElement * primary, bool is_write) {
+    for (auto && entry : entries) {
+      if (entry.primary == nullptr) {
+        entry.line     = line;
+        entry.primary  = primary;
+        entry.is_write = is_write;
+        num_used++;
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  // whether a request can wait for the line instead of going down; a write
+  // needs a writable line
+  bool can_merge(const Entry * entry, bool is_write) const {
+    return (entry->is_write == true || is_write == false) && entry->targets.size() < num_targets;
+  }
+
+  void free(Entry * entry) {
+    entry->primary = nullptr;
+    entry->targets.clear();
+    num_used--;
+  }
+
+  const uint32_t num_targets;
+
+ private:
+  std::vector<Entry> entries;
+  uint32_t           num_used;
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSMSHR_H_
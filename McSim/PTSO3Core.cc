@@ -86,7 +86,7 @@ O3Core::O3Core(
   last_time_no_mem_served(0), last_time_mem_served(0), num_bubbled_slots(0),
   stack(0), stacksize(0), resume_time(0),
   num_instrs(0), num_branch(0), num_branch_miss(0), num_nacks(0),
-  num_consecutive_nacks(0), num_x87_ops(0), num_call_ops(0),
+  num_consecutive_nacks(0), num_x87_ops(0), num_call_ops(0), num_events(0),
   total_mem_wr_time(0), total_mem_rd_time(0),
   branch_miss_penalty(get_param_uint64("branch_miss_penalty", 100)),
   lock_t(get_param_uint64("lock_t", 100)),
@@ -94,7 +94,7 @@ O3Core::O3Core(
   barrier_t(get_param_uint64("barrier_t", 100)),
   sse_t(get_param_uint64("sse_t", 40)),
   o3queue_head(0), o3queue_size(0),
-  o3rob_head(0), o3rob_size(0),
+  o3rob_head(0), o3rob_size(0), o3rob_seq(0), num_migrate_instrs(0),
   latest_ip(0), latest_bmp_time(0) {
   process_interval    = get_param_uint64("process_interval", 80);
   branch_miss_penalty = ceil_by_y(branch_miss_penalty, process_interval);
@@ -111,7 +111,10 @@ O3Core::O3Core(
   }
   for (unsigned int i = 0; i < o3rob_max_size; i++) {
     o3rob[i].state = o3irs_invalid;
+    o3rob[i].seq   = 0;
   }
+  rob_waiters.resize(o3rob_max_size);
+  executable.resize((o3rob_max_size + 63) / 64, 0);
   CHECK(mem_acc.empty());
   CHECK_GE(o3rob_max_size, (uint32_t)4)
     << "as of now, it is assumed that o3rob_max_size >= 4" << std::endl;
@@ -132,6 +135,7 @@ O3Core::~O3Core() {
     std::cout << " nacks= " << num_nacks
       << ", x87_ops= " << num_x87_ops
       << ", call_ops= " << num_call_ops
+      << ", events= " << num_events
       << ", latest_ip= 0x" << std::hex << latest_ip << std::dec
       << ", tot_mem_wr_time= " << total_mem_wr_time
       << ", tot_mem_rd_time= " << total_mem_rd_time << std::endl;
@@ -143,8 +147,60 @@ O3Core::~O3Core() {
 }
 
 
+bool O3Core::needs_global_sync() const {
+  if (active == true &&
+      (mcsim->skip_all_instrs == true || o3queue_size <= (o3queue_max_size >> 1))) {
+    return true;
+  }
+  return o3rob_size > 0 &&
+    (o3rob[o3rob_head].type == ins_notify || o3rob[o3rob_head].type == ins_waitfor);
+}
+
+
+uint64_t O3Core::sync_free_until(uint64_t curr_time) {
+  if (needs_global_sync() == true || mcsim->skip_all_instrs == true) {
+    return curr_time;
+  }
+  // an ins_notify/ins_waitfor may reach the head by the next event
+  if (num_migrate_instrs > 0) {
+    return curr_time + 1;
+  }
+  if (active == false) {
+    return UINT64_MAX;
+  }
+  // each event takes up to max_issue_width instructions from the o3queue
+  uint64_t num_events = (o3queue_size - (o3queue_max_size >> 1) + max_issue_width - 1) / max_issue_width;
+  return ceil_by_y(curr_time, process_interval) + num_events * process_interval;
+}
+
+
+void O3Core::rebuild_deps() {
+  reg_writers.clear();
+  word_accs.clear();
+  branch_misses.clear();
+  completing.clear();
+  for (auto && waiters : rob_waiters) waiters.clear();
+  num_migrate_instrs = 0;
+  for (uint32_t i = 0; i < o3rob_size; i++) {
+    uint32_t rob_idx = (o3rob_head + i) % o3rob_max_size;
+    TrackDeps(rob_idx, 0);
+    if (o3rob[rob_idx].state == o3irs_completed) completing.push_back(o3rob[rob_idx].seq);
+    if (o3rob[rob_idx].type == ins_notify || o3rob[rob_idx].type == ins_waitfor) num_migrate_instrs++;
+  }
+  for (uint32_t i = 0; i < o3queue_size; i++) {
+    ins_type type = o3queue[(o3queue_head + i) % o3queue_max_size].type;
+    if (type == ins_notify || type == ins_waitfor) num_migrate_instrs++;
+  }
+}
+
+
 uint32_t O3Core::process_event(uint64_t curr_time) {
+  num_events++;
   if (mcsim->skip_all_instrs == true) {
+    for (uint32_t i = 0; i < o3queue_size; i++) {
+      ins_type type = o3queue[(o3queue_head + i) % o3queue_max_size].type;
+      if (type == ins_notify || type == ins_waitfor) num_migrate_instrs--;
+    }
     o3queue_size = 0;
     resume_time  = curr_time;
   }
@@ -165,14 +221,28 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
   // check o3queue and send a request to iTLB
   // -- TODO(gajh): can we send multiple requests to an iTLB simultaneously?
   uint64_t addr_to_read = 0;
+  // whether the core polls the next process_interval.  it skips the polls
+  // that would find nothing to do (CanProgress), and sleeps until a reply or
+  // a ready_time of the ROB entries instead.
+  bool     poll_next = false;
   for (unsigned int i = 0; i < o3queue_size; i++) {
     unsigned int idx = (i + o3queue_head) % o3queue_max_size;
 
     if (o3queue[idx].state != o3iqs_not_in_queue) continue;
+    if (mcsim->simulate_only_data_caches == true) {
+      // the fetch always hits, in this cycle and without any event
+      if ((o3queue[idx].ip >> cachel1i->set_lsb) != (addr_to_read >> cachel1i->set_lsb)) {
+        addr_to_read = (o3queue[idx].ip >> cachel1i->set_lsb) << cachel1i->set_lsb;
+        mcsim->update_os_page_req_dist(addr_to_read);
+      }
+      o3queue[idx].state      = o3iqs_ready;
+      o3queue[idx].ready_time = curr_time;
+      continue;
+    }
     if (addr_to_read == 0) {
       addr_to_read = (o3queue[idx].ip >> cachel1i->set_lsb) << cachel1i->set_lsb;
       o3queue[idx].state = o3iqs_being_loaded;
-      auto lqe = new LocalQueueElement(this, et_tlb_rd, addr_to_read, num);
+      auto lqe = LocalQueueElement::acquire(this, et_tlb_rd, addr_to_read, num);
       if (bypass_tlb == true) {
         lqe->type = et_read;
         cachel1i->add_req_event(curr_time + lsu_to_l1i_t, lqe);
@@ -204,42 +274,16 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
       }
 
       int32_t instr_dep  = -1;
-      int32_t branch_dep = -1;
-      for (unsigned int j = 0; j < o3rob_size; j++) {
-        int rob_idx_br = (o3rob_head + o3rob_size - 1 - j) % o3rob_max_size;
-        const O3ROB & o3rob_br = o3rob[rob_idx_br];
-        if (o3rob_br.state == o3irs_completed && o3rob_br.ready_time <= curr_time) continue;
-        if (o3rob_br.branch_miss == true) {
-          branch_dep = rob_idx_br;
-          break;
-        }
-      }
+      int32_t branch_dep = YoungestInFlight(branch_misses, curr_time);
       // register dependency resolution:
       // We assume that false dependencies are resolved by register renaming.
-      int32_t rr0 = -1;
-      int32_t rr1 = -1;
-      int32_t rr2 = -1;
-      int32_t rr3 = -1;
-      for (unsigned int j = 0; j < o3rob_size; j++) {
-        int rob_idx_r = (o3rob_head + o3rob_size - 1 - j) % o3rob_max_size;
-        const O3ROB & o3rob_r = o3rob[rob_idx_r];
-        if (o3rob_r.state == o3irs_completed && o3rob_r.ready_time <= curr_time) continue;
-        if (rr0 == -1 && IsRegDep(o3q_entry.rr0, o3rob_r)) {
-          rr0 = rob_idx_r;
-        }
-        if (rr1 == -1 && IsRegDep(o3q_entry.rr1, o3rob_r)) {
-          rr1 = rob_idx_r;
-        }
-        if (rr2 == -1 && IsRegDep(o3q_entry.rr2, o3rob_r)) {
-          rr2 = rob_idx_r;
-        }
-        if (rr3 == -1 && IsRegDep(o3q_entry.rr3, o3rob_r)) {
-          rr3 = rob_idx_r;
-        }
-      }
+      int32_t rr0 = RegProducer(o3q_entry.rr0, curr_time);
+      int32_t rr1 = RegProducer(o3q_entry.rr1, curr_time);
+      int32_t rr2 = RegProducer(o3q_entry.rr2, curr_time);
+      int32_t rr3 = RegProducer(o3q_entry.rr3, curr_time);
 
       // fill ROB
-      geq->add_event(curr_time + process_interval, this);
+      poll_next = true;
       for (unsigned int k = 0; k < 4; ++k) {  // 0: raddr, 1: raddr2, 2: waddr, 3: no-mem
         O3ROB & o3rob_entry    = o3rob[rob_idx];
         o3rob_entry.state      = o3irs_issued;
@@ -271,14 +315,9 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
         }
 
         if (k < 3) {
-          for (unsigned int j = 0; j < o3rob_size; j++) {
-            int rob_idx_dep = (o3rob_head + o3rob_size - 1 - j) % o3rob_max_size;
-            const O3ROB & o3rob_dep = o3rob[rob_idx_dep];
-            if ((o3rob_dep.state != o3irs_completed || o3rob_dep.ready_time > curr_time) &&
-                (o3rob_dep.memaddr >> word_log) == (memaddr >> word_log)) {
-              mem_dep = rob_idx_dep;
-              break;
-            }
+          auto iter = word_accs.find(memaddr >> word_log);
+          if (iter != word_accs.end()) {
+            mem_dep = YoungestInFlight(iter->second, curr_time);
           }
         }
         o3rob_entry.memaddr    = memaddr;
@@ -296,11 +335,14 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
         o3rob_entry.rw1        = o3q_entry.rw1;
         o3rob_entry.rw2        = o3q_entry.rw2;
         o3rob_entry.rw3        = o3q_entry.rw3;
+        TrackDeps(rob_idx, curr_time);
         instr_dep              = rob_idx;
         rob_idx = (rob_idx + 1) % o3rob_max_size;
         o3rob_size++;
+        if (o3q_entry.type == ins_notify || o3q_entry.type == ins_waitfor) num_migrate_instrs++;
       }
 
+      if (o3q_entry.type == ins_notify || o3q_entry.type == ins_waitfor) num_migrate_instrs--;
       o3queue_size--;
       o3q_entry.state = o3iqs_invalid;
       o3queue_head    = (o3queue_head + 1) % o3queue_max_size;
@@ -315,35 +357,42 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
   int32_t num_ld   = 0;
   int32_t num_st   = 0;
   int32_t num_sse  = 0;
-  for (unsigned int i = 0; i < o3rob_size; i++) {
+  // the other issued entries wait for an instruction, so they are skipped
+  // (or stop an in-order ROB)
+  uint32_t next_in_order = 0;
+  for (int32_t i = NextExecutable(0); i != -1; i = NextExecutable(i + 1)) {
+    if (mimick_inorder == true && (uint32_t)i != next_in_order) break;
+    next_in_order = i + 1;
     int rob_idx = (o3rob_head + i) % o3rob_max_size;
     O3ROB & o3rob_entry = o3rob[rob_idx];
 
-    if (o3rob_entry.state == o3irs_issued && o3rob_entry.ready_time <= curr_time) {
+    if (o3rob_entry.ready_time <= curr_time) {
       if (o3rob_entry.type == ins_notify) {
         if (i == 0) {
           o3rob_entry.state = o3irs_completed;
           o3rob_entry.ready_time = curr_time + barrier_t;
+          SetExecutable(rob_idx, false);
+          completing.push_back(o3rob_entry.seq);
           geq->add_event(o3rob_entry.ready_time, this);
           mcsim->is_migrate_ready[o3rob_entry.rw0] = true;
         } else {
-          geq->add_event(curr_time + process_interval, this);
+          // it runs when the ones ahead of it commit
+          poll_next = true;
           break;
         }
       } else if (o3rob_entry.type == ins_waitfor) {
         if (i == 0 && mcsim->is_migrate_ready[o3rob_entry.rw0] == true) {
           o3rob_entry.state = o3irs_completed;
           o3rob_entry.ready_time = curr_time + process_interval;
+          SetExecutable(rob_idx, false);
+          completing.push_back(o3rob_entry.seq);
           geq->add_event(o3rob_entry.ready_time, this);
           mcsim->is_migrate_ready[o3rob_entry.rw0] = false;
         } else {
-          geq->add_event(curr_time + process_interval, this);
+          poll_next = true;
           break;
         }
-      } else if (o3rob_entry.mem_dep == -1    && o3rob_entry.instr_dep == -1 &&
-                 o3rob_entry.branch_dep == -1 &&
-                 o3rob_entry.rr0 == -1        && o3rob_entry.rr1 == -1 &&
-                 o3rob_entry.rr2 == -1        && o3rob_entry.rr3 == -1) {
+      } else if (IsReady(o3rob_entry)) {
         if (o3rob_entry.memaddr == 0 && num_alu < max_alu &&
             (o3rob_entry.type != ins_x87 || num_sse < max_sse)) {
           o3rob_entry.state = o3irs_completed;
@@ -354,6 +403,8 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
                (o3rob_entry.type == ins_x87) ? sse_t :
                (o3rob_entry.branch_miss == true) ? (branch_miss_penalty + process_interval) :
                process_interval);
+          SetExecutable(rob_idx, false);
+          completing.push_back(o3rob_entry.seq);
           geq->add_event(o3rob_entry.ready_time, this);
           num_alu++;
           num_sse += ((o3rob_entry.type == ins_x87) ? 1 : 0);
@@ -361,8 +412,10 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
                    ((o3rob_entry.isread == true && num_ld < max_ld) ||
                     (o3rob_entry.isread == false && num_st < max_st))) {
           o3rob_entry.state = o3irs_executing;
-          auto lqe = new LocalQueueElement(this, et_tlb_rd, o3rob_entry.memaddr, num);
+          SetExecutable(rob_idx, false);
+          auto lqe = LocalQueueElement::acquire(this, et_tlb_rd, o3rob_entry.memaddr, num);
           lqe->rob_entry = rob_idx;
+          lqe->ip        = o3rob_entry.ip;
           if (bypass_tlb == true) {
             lqe->type = (o3rob_entry.isread == true) ? et_read : et_write;
             cachel1d->add_req_event(curr_time + lsu_to_l1d_t, lqe);
@@ -372,34 +425,35 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
           num_ldst++;
           (o3rob_entry.isread == true) ? num_ld++ : num_st++;
         }
-      } else {
-        if (mimick_inorder == true) {
-          geq->add_event(curr_time + process_interval, this);
-          break;
-        }
-      }
-    } else {
-      if (mimick_inorder == true) {
-        geq->add_event(curr_time + process_interval, this);
-        break;
       }
+    } else if (mimick_inorder == true) {
+      poll_next = true;
+      break;
     }
   }
+  // an in-order ROB waits for the entry at next_in_order
+  if (mimick_inorder == true && next_in_order < o3rob_size) {
+    poll_next = true;
+  }
 
-  for (unsigned int i = 0; i < o3rob_size; i++) {
-    int rob_idx = (o3rob_head + i) % o3rob_max_size;
+  // the entries whose results are ready now release the ones waiting for them
+  for (size_t i = 0; i < completing.size(); ) {
+    uint64_t seq     = completing[i];
+    int32_t  rob_idx = seq % o3rob_max_size;
     O3ROB & o3rob_entry = o3rob[rob_idx];
-    bool already_add_event = false;
+    bool is_valid = (o3rob_entry.seq == seq && InROB(rob_idx) && o3rob_entry.state == o3irs_completed);
 
-    if (o3rob_entry.state == o3irs_completed && o3rob_entry.ready_time == curr_time) {
-      if (already_add_event == false) {
-        already_add_event = true;
-        geq->add_event(curr_time + process_interval, this);
-      }
-      for (unsigned int j = i+1; j < o3rob_size; j++) {
-        int next_idx = (o3rob_head + j) % o3rob_max_size;
+    if (is_valid == true && o3rob_entry.ready_time > curr_time) {
+      i++;
+      continue;
+    }
+    if (is_valid == true && o3rob_entry.ready_time == curr_time) {
+      poll_next = true;
+      for (auto && next_seq : rob_waiters[rob_idx]) {
+        int32_t next_idx = next_seq % o3rob_max_size;
         O3ROB & o3rob_next = o3rob[next_idx];
-        if (o3rob_next.state != o3irs_issued) continue;
+        if (o3rob_next.seq != next_seq || InROB(next_idx) == false ||
+            o3rob_next.state != o3irs_issued) continue;
         if (o3rob_next.mem_dep    == rob_idx) o3rob_next.mem_dep    = -1;
         if (o3rob_next.instr_dep  == rob_idx) o3rob_next.instr_dep  = -1;
         if (o3rob_next.branch_dep == rob_idx) o3rob_next.branch_dep = -1;
@@ -407,8 +461,14 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
         if (o3rob_next.rr1        == rob_idx) o3rob_next.rr1        = -1;
         if (o3rob_next.rr2        == rob_idx) o3rob_next.rr2        = -1;
         if (o3rob_next.rr3        == rob_idx) o3rob_next.rr3        = -1;
+        if (IsReady(o3rob_next) == true) {
+          SetExecutable(next_idx, true);
+        }
       }
+      rob_waiters[rob_idx].clear();
     }
+    completing[i] = completing.back();
+    completing.pop_back();
   }
 
   // check if ready to commit
@@ -417,18 +477,25 @@ uint32_t O3Core::process_event(uint64_t curr_time) {
 
     if (o3rob_entry.state == o3irs_completed && o3rob_entry.ready_time <= curr_time) {
       o3rob_entry.state = o3irs_invalid;
+      if (o3rob_entry.type == ins_notify || o3rob_entry.type == ins_waitfor) num_migrate_instrs--;
+      if (o3rob_entry.memaddr != 0) {
+        auto iter = word_accs.find(o3rob_entry.memaddr >> word_log);
+        if (iter != word_accs.end() && YoungestInFlight(iter->second, curr_time) == -1) {
+          word_accs.erase(iter);
+        }
+      }
       o3rob_size--;
       o3rob_head = (o3rob_head + 1) % o3rob_max_size;
     }
   }
   if (o3rob_size > 0 && o3rob[o3rob_head].state == o3irs_completed &&
       o3rob[o3rob_head].ready_time <= curr_time) {
-    geq->add_event(curr_time + process_interval, this);
+    poll_next = true;
   }
 
-  /* if (o3rob_size != 0) {
+  if (poll_next == true && CanProgress(curr_time + process_interval) == true) {
     geq->add_event(curr_time + process_interval, this);
-  } */
+  }
   return num_hthreads;
 }
 
@@ -469,18 +536,23 @@ void O3Core::add_req_event(
     geq->add_event(aligned_event_time, this);
     num_consecutive_nacks = 0;
 
-    // move the state of O3Queue entries from being_loaded to ready
-    for (unsigned int i = 0; i < o3queue_size; i++) {
-      unsigned int idx = (i + o3queue_head) % o3queue_max_size;
-      if (o3queue[idx].state == o3iqs_being_loaded &&
-          local_event->address >> cachel1i->set_lsb == o3queue[idx].ip >> cachel1i->set_lsb) {
-        o3queue[idx].state      = o3iqs_ready;
-        o3queue[idx].ready_time = aligned_event_time;
-      }
+    fetch_line(local_event->address, aligned_event_time);
+    local_event->release();
+  }
+}
+
+
+// move the state of O3Queue entries from being_loaded to ready
+void O3Core::fetch_line(uint64_t address, uint64_t ready_time) {
+  for (unsigned int i = 0; i < o3queue_size; i++) {
+    unsigned int idx = (i + o3queue_head) % o3queue_max_size;
+    if (o3queue[idx].state == o3iqs_being_loaded &&
+        address >> cachel1i->set_lsb == o3queue[idx].ip >> cachel1i->set_lsb) {
+      o3queue[idx].state      = o3iqs_ready;
+      o3queue[idx].ready_time = ready_time;
     }
-    mcsim->update_os_page_req_dist(local_event->address);
-    delete local_event;
   }
+  mcsim->update_os_page_req_dist(address);
 }
 
 
@@ -529,9 +601,10 @@ void O3Core::add_rep_event(
     o3rob_entry.state      = o3irs_completed;
     o3rob_entry.ready_time = aligned_event_time +
                              ((o3rob_entry.branch_miss == true) ? branch_miss_penalty : 0);
+    completing.push_back(o3rob_entry.seq);
     geq->add_event(o3rob_entry.ready_time, this);
     mcsim->update_os_page_req_dist(local_event->address);
-    delete local_event;
+    local_event->release();
   }
 }
 
@@ -578,9 +651,139 @@ void O3Core::displayO3ROB() {
 }
 
 
-bool O3Core::IsRegDep(uint32_t rr, const O3ROB & o3rob_) {
-  return (rr != 0) &&
-         (rr == o3rob_.rw0 || rr == o3rob_.rw1 || rr == o3rob_.rw2 || rr == o3rob_.rw3);
+// enter a new ROB entry to the producer tables and to the wakeup lists of
+// the entries that it depends on.
+void O3Core::TrackDeps(uint32_t rob_idx, uint64_t curr_time) {
+  O3ROB & o3rob_entry = o3rob[rob_idx];
+
+  // seq % o3rob_max_size is the index of the entry
+  o3rob_entry.seq = o3rob_seq + (rob_idx + o3rob_max_size - o3rob_seq % o3rob_max_size) % o3rob_max_size;
+  o3rob_seq       = o3rob_entry.seq + 1;
+  rob_waiters[rob_idx].clear();
+
+  for (int32_t dep : { o3rob_entry.mem_dep, o3rob_entry.instr_dep, o3rob_entry.branch_dep,
+                       o3rob_entry.rr0, o3rob_entry.rr1, o3rob_entry.rr2, o3rob_entry.rr3 }) {
+    if (dep != -1) rob_waiters[dep].push_back(o3rob_entry.seq);
+  }
+  for (uint32_t rw : { o3rob_entry.rw0, o3rob_entry.rw1, o3rob_entry.rw2, o3rob_entry.rw3 }) {
+    if (rw != 0) AddProducer(reg_writers[rw], o3rob_entry.seq, curr_time);
+  }
+  if (o3rob_entry.memaddr != 0) {
+    AddProducer(word_accs[o3rob_entry.memaddr >> word_log], o3rob_entry.seq, curr_time);
+  }
+  if (o3rob_entry.branch_miss == true) {
+    AddProducer(branch_misses, o3rob_entry.seq, curr_time);
+  }
+  SetExecutable(rob_idx, o3rob_entry.state == o3irs_issued &&
+      (IsReady(o3rob_entry) == true || o3rob_entry.type == ins_notify || o3rob_entry.type == ins_waitfor));
+}
+
+
+void O3Core::SetExecutable(uint32_t rob_idx, bool is_executable) {
+  if (is_executable == true) {
+    executable[rob_idx >> 6] |= (1ULL << (rob_idx & 63));
+  } else {
+    executable[rob_idx >> 6] &= ~(1ULL << (rob_idx & 63));
+  }
+}
+
+
+// the offset from the ROB head of the first executable entry at or after
+// the given offset; -1 if none
+int32_t O3Core::NextExecutable(uint32_t offset) {
+  while (offset < o3rob_size) {
+    uint32_t rob_idx = (o3rob_head + offset) % o3rob_max_size;
+    uint64_t bits    = executable[rob_idx >> 6] >> (rob_idx & 63);
+    if (bits != 0) {
+      offset += __builtin_ctzll(bits);
+      return (offset < o3rob_size) ? (int32_t)offset : -1;
+    }
+    offset += std::min(64 - (rob_idx & 63), o3rob_max_size - rob_idx);
+  }
+  return -1;
+}
+
+
+// the youngest entry of the list that is not completed yet or whose result
+// is not ready yet; the others never become so and are dropped.
+int32_t O3Core::YoungestInFlight(std::vector<uint64_t> & producers, uint64_t curr_time) {
+  while (producers.empty() == false) {
+    int32_t rob_idx = producers.back() % o3rob_max_size;
+    const O3ROB & o3rob_entry = o3rob[rob_idx];
+
+    if (o3rob_entry.seq == producers.back() && InROB(rob_idx) &&
+        (o3rob_entry.state != o3irs_completed || o3rob_entry.ready_time > curr_time)) {
+      return rob_idx;
+    }
+    producers.pop_back();
+  }
+  return -1;
+}
+
+
+void O3Core::AddProducer(std::vector<uint64_t> & producers, uint64_t seq, uint64_t curr_time) {
+  // keeps the list as long as the ROB at most
+  YoungestInFlight(producers, curr_time);
+  producers.push_back(seq);
+}
+
+
+int32_t O3Core::RegProducer(uint32_t rr, uint64_t curr_time) {
+  if (rr == 0) return -1;
+  auto iter = reg_writers.find(rr);
+  return (iter == reg_writers.end()) ? -1 : YoungestInFlight(iter->second, curr_time);
 }
 
+
+bool O3Core::InROB(uint32_t rob_idx) {
+  return (rob_idx + o3rob_max_size - o3rob_head) % o3rob_max_size < o3rob_size;
+}
+
+
+// whether process_event at time would do anything: sync with the frontend,
+// fetch, dispatch, execute, or commit.  what it waits for comes with an
+// event (a reply, a ready_time), except McSim::is_migrate_ready, which an
+// ins_waitfor at the head polls, and the frontend, which only syncs with a
+// core whose o3queue is at most half full.
+bool O3Core::CanProgress(uint64_t time) {
+  if (mcsim->skip_all_instrs == true || o3queue_size <= (o3queue_max_size >> 1)) {
+    return true;
+  }
+  for (uint32_t i = 0; i < o3queue_size; i++) {
+    if (o3queue[(i + o3queue_head) % o3queue_max_size].state == o3iqs_not_in_queue) return true;
+  }
+  const O3Queue & o3q_entry = o3queue[o3queue_head];
+  if (o3q_entry.state == o3iqs_ready && o3q_entry.ready_time <= time &&
+      o3rob_size < o3rob_max_size - 3) {
+    return true;
+  }
+
+  uint32_t next_in_order = 0;
+  for (int32_t i = NextExecutable(0); i != -1; i = NextExecutable(i + 1)) {
+    if (mimick_inorder == true && (uint32_t)i != next_in_order) break;
+    next_in_order = i + 1;
+    const O3ROB & o3rob_entry = o3rob[(o3rob_head + i) % o3rob_max_size];
+    if (o3rob_entry.ready_time > time) {
+      if (mimick_inorder == true) break;
+      continue;
+    }
+    if ((o3rob_entry.type != ins_notify && o3rob_entry.type != ins_waitfor) || i == 0) {
+      return true;
+    }
+    break;  // ins_notify and ins_waitfor run at the head
+  }
+  return o3rob_size > 0 && o3rob[o3rob_head].state == o3irs_completed &&
+         o3rob[o3rob_head].ready_time <= time;
+}
+
+
+// no instruction to wait for
+bool O3Core::IsReady(const O3ROB & o3rob_) {
+  return o3rob_.mem_dep == -1    && o3rob_.instr_dep == -1 &&
+         o3rob_.branch_dep == -1 &&
+         o3rob_.rr0 == -1        && o3rob_.rr1 == -1 &&
+         o3rob_.rr2 == -1        && o3rob_.rr3 == -1;
+}
+
+
 }  // namespace PinPthread
@@ -9,6 +9,7 @@
 #include "PTSComponent.h"
 
 #include <queue>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -68,7 +69,8 @@ class O3ROB {
  public:
   o3_instr_rob_state state;
   uint64_t ready_time;
-  uint64_t ip;  // just for debugging
+  uint64_t seq;  // dispatch order -- tells a stale reference to the entry
+  uint64_t ip;  // also trains the ip-based cache prefetchers
   uint64_t memaddr;  // 0 means no_mem
   bool     isread;
   bool     branch_miss;
@@ -95,6 +97,16 @@ class O3Core : public Component {
   uint32_t process_event(uint64_t curr_time);
   void     add_req_event(uint64_t, LocalQueueElement *, Component * from);
   void     add_rep_event(uint64_t, LocalQueueElement *, Component * from);
+  // whether the next process_event() may yield to the frontend or touch
+  // McSim::is_migrate_ready; the parallel engine runs such a core alone.
+  bool     needs_global_sync() const;
+  // the earliest time that needs_global_sync() may hold at an event when the
+  // frontend does not touch the core until then.  it counts the events
+  // process_interval apart (the parallel engine checks that they are).
+  uint64_t sync_free_until(uint64_t curr_time);
+  // rebuild the dependency tables from the ROB after it is written outside
+  // the pipeline (e.g., by the unit tests)
+  void     rebuild_deps();
 
   CacheL1 * cachel1d;
   CacheL1 * cachel1i;
@@ -148,6 +160,7 @@ class O3Core : public Component {
   uint64_t num_consecutive_nacks;
   uint64_t num_x87_ops;
   uint64_t num_call_ops;
+  uint64_t num_events;  // # of process_event() calls
   uint64_t total_mem_wr_time;
   uint64_t total_mem_rd_time;
 
@@ -164,6 +177,21 @@ class O3Core : public Component {
   O3ROB   * o3rob;
   uint32_t  o3rob_head;
   uint32_t  o3rob_size;
+  uint64_t  o3rob_seq;
+  uint32_t  num_migrate_instrs;  // ins_notify/ins_waitfor in the o3queue and the ROB
+  // producers in the ROB from the oldest to the youngest, by seq: writers of
+  // each register, accesses to each word, and mispredicted branches.
+  // an instruction depends on the youngest one that is still in flight.
+  std::unordered_map<uint32_t, std::vector<uint64_t>> reg_writers;
+  std::unordered_map<uint64_t, std::vector<uint64_t>> word_accs;
+  std::vector<uint64_t> branch_misses;
+  // entries to wake up when an entry completes, by seq
+  std::vector<std::vector<uint64_t>> rob_waiters;
+  // a bit per ROB entry: issued and not waiting for an instruction, or
+  // ins_notify/ins_waitfor (they run at the head)
+  std::vector<uint64_t> executable;
+  // completed entries that have not released the ones waiting for them, by seq
+  std::vector<uint64_t> completing;
   uint64_t  latest_ip;
   uint64_t  latest_bmp_time;  // latest branch miss prediction time
 
@@ -171,7 +199,17 @@ class O3Core : public Component {
 
   void displayO3Queue();
   void displayO3ROB();
-  bool IsRegDep(uint32_t rr, const O3ROB & o3rob_);
+  // the line of address arrived from the L1I
+  void fetch_line(uint64_t address, uint64_t ready_time);
+  bool InROB(uint32_t rob_idx);
+  bool CanProgress(uint64_t time);
+  bool IsReady(const O3ROB & o3rob_);
+  void TrackDeps(uint32_t rob_idx, uint64_t curr_time);
+  void AddProducer(std::vector<uint64_t> & producers, uint64_t seq, uint64_t curr_time);
+  int32_t YoungestInFlight(std::vector<uint64_t> & producers, uint64_t curr_time);
+  int32_t RegProducer(uint32_t rr, uint64_t curr_time);
+  void SetExecutable(uint32_t rob_idx, bool is_executable);
+  int32_t NextExecutable(uint32_t offset);
 };
 
 }  // namespace PinPthread
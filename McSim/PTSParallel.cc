@@ -0,0 +1,412 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <functional>
+
+#include "McSim.h"
+#include "PTSO3Core.h"
+#include "PTSParallel.h"
+#include "PTSXbar.h"
+
+
+namespace PinPthread {
+
+extern std::ostream & operator << (std::ostream & output, component_type ct);
+
+// the logical process that the calling thread is working on; nullptr while
+// the engine itself replays calls between logical processes.
+static thread_local LogicalProcess * curr_lp = nullptr;
+
+static inline bool comp_less(Component * a, Component * b) {
+  return std::less<Component *>()(a, b);
+}
+
+
+LogicalProcess::LogicalProcess(UINT32 num_buckets):
+  calendar(num_buckets), time(0), run_max(nullptr), stalled(nullptr),
+  inbox(), inbox_head(0), outbox() { }
+
+
+ParallelEventQueue::ParallelEventQueue(McSim * mcsim_):
+  GlobalEventQueue(mcsim_),
+  num_sim_threads(mcsim_->pts->get_param_uint64("pts.num_sim_threads", 1)),
+  limit_to_cores(mcsim_->pts->get_param_bool("pts.limit_sim_threads_to_cores", true)),
+  num_buckets(mcsim_->pts->get_param_uint64("pts.geq_num_buckets", 4096)),
+  lookahead(std::min(mcsim_->pts->get_param_uint64("pts.l2$.to_xbar_t", 90),
+                     mcsim_->pts->get_param_uint64("pts.dir.to_xbar_t", 350))),
+  num_threads(1), hub(0), lps(), merged(), bound(nullptr), end(0), unaligned(false),
+  workers(), mtx(), cv(), generation(0), num_running(0), quit(false),
+  num_phases(0), num_windows(0), num_sync_points(0) {
+  // the NoC has to be at least a tick away from the L2s and the directories
+  const std::string noc_type(mcsim->pts->get_param_str("pts.noc_type"));
+  const bool is_xbar = (noc_type == "" || noc_type == "xbar");
+  CHECK(mcsim->pts->get_param_uint64("pts.l2$.to_xbar_t", 90) > 0 &&
+        mcsim->pts->get_param_uint64("pts.dir.to_xbar_t", 350) > 0 &&
+        (is_xbar == false || mcsim->pts->get_param_uint64("pts.xbar.to_dir_t", 90) > 0) &&
+        (is_xbar == true  || mcsim->pts->get_param_uint64("pts.noc.to_dir_t", 10) > 0))
+    << "pts.num_sim_threads > 1 needs non-zero to_xbar_t and xbar.to_dir_t (noc.to_dir_t)" << std::endl;
+}
+
+
+ParallelEventQueue::~ParallelEventQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    quit = true;
+    generation.fetch_add(1, std::memory_order_release);
+  }
+  cv.notify_all();
+  for (auto && worker : workers) worker.join();
+
+  if (num_phases > 0) {
+    std::cout << "  -- parallel engine : " << num_threads << " threads, "
+      << lps.size() << " logical processes, lookahead = " << lookahead
+      << ", (phases, windows, sync points) = ("
+      << num_phases << ", " << num_windows << ", " << num_sync_points << ")" << std::endl;
+  }
+}
+
+
+void ParallelEventQueue::partition(UINT32 num_lps) {
+  CHECK(num_lps >= 2) << "wrong number of logical processes" << std::endl;
+  if (lps.empty() == false) {
+    // connect_comps() is called again (e.g., after replacing components)
+    CHECK(lps.size() == num_lps) << "the number of logical processes changed" << std::endl;
+    return;
+  }
+  lps.reserve(num_lps);
+  for (UINT32 i = 0; i < num_lps; i++) {
+    lps.emplace_back(num_buckets);
+  }
+  hub = num_lps - 1;
+
+  // events posted by the constructors go to their logical processes
+  for (auto && event : event_queue.snapshot()) {
+    for (auto && comp : event.second) {
+      lps[comp->lp].calendar.insert(event.first, comp);
+    }
+  }
+  event_queue.clear();
+
+  // more threads than the host cores would only spin against each other,
+  // but they still give the same results (which the tests check)
+  num_threads = std::min(num_sim_threads, hub);
+  if (limit_to_cores == true && std::thread::hardware_concurrency() > 0) {
+    num_threads = std::min(num_threads, std::thread::hardware_concurrency());
+  }
+  for (UINT32 tid = 1; tid < num_threads; tid++) {
+    workers.push_back(std::thread(&ParallelEventQueue::worker_loop, this, tid));
+  }
+}
+
+
+void ParallelEventQueue::add_event(UINT64 event_time, Component * event_target) {
+  if (event_target->type == ct_o3core && event_time % event_target->process_interval != 0) {
+    unaligned.store(true, std::memory_order_relaxed);
+  }
+  if (lps.empty()) {
+    event_queue.insert(event_time, event_target);
+  } else {
+    lps[event_target->lp].calendar.insert(event_time, event_target);
+  }
+}
+
+
+bool ParallelEventQueue::empty() const {
+  for (auto && lp : lps) {
+    if (lp.calendar.empty() == false) return false;
+  }
+  return event_queue.empty();
+}
+
+
+bool ParallelEventQueue::post_remote(const RemoteEvent & remote_event) {
+  LogicalProcess * src = curr_lp;
+  if (src == nullptr) return false;
+
+  LogicalProcess & dst = lps[remote_event.target->lp];
+  if (&dst == src) return false;
+
+  CHECK(src == &lps[hub] || &dst == &lps[hub])
+    << "logical processes of L2 clusters talk only through the NoC" << std::endl;
+  RemoteEvent held(remote_event);
+  held.key  = src->run_max;
+  held.time = src->time;
+  if (src == &lps[hub]) {
+    dst.inbox.push_back(held);
+  } else {
+    src->outbox.push_back(held);
+  }
+  return true;
+}
+
+
+void ParallelEventQueue::replay(const RemoteEvent & remote_event) {
+  Component * target = remote_event.target;
+
+  if (target->type == ct_crossbar) {
+    NoC * noc = static_cast<NoC *>(target);
+    switch (remote_event.type) {
+      case RemoteEvent::re_req:
+        noc->add_req_event(remote_event.event_time, remote_event.lqe, remote_event.from);
+        break;
+      case RemoteEvent::re_crq:
+        if (remote_event.num_flits > 0) {
+          noc->add_crq_event(remote_event.event_time, remote_event.lqe,
+              remote_event.num_flits, remote_event.from);
+        } else {
+          noc->add_crq_event(remote_event.event_time, remote_event.lqe, remote_event.from);
+        }
+        break;
+      case RemoteEvent::re_rep:
+        if (remote_event.num_flits > 0) {
+          noc->add_rep_event(remote_event.event_time, remote_event.lqe,
+              remote_event.num_flits, remote_event.from);
+        } else {
+          noc->add_rep_event(remote_event.event_time, remote_event.lqe, remote_event.from);
+        }
+        break;
+    }
+  } else if (remote_event.type == RemoteEvent::re_req) {
+    target->add_req_event(remote_event.event_time, remote_event.lqe);
+  } else {
+    target->add_rep_event(remote_event.event_time, remote_event.lqe);
+  }
+}
+
+
+// replays the calls from the NoC before the component key of tick time (all
+// of the tick if key is nullptr)
+void ParallelEventQueue::drain_inbox(LogicalProcess & lp, UINT64 time, Component * key) {
+  while (lp.inbox_head < lp.inbox.size() &&
+         (lp.inbox[lp.inbox_head].time < time ||
+          (lp.inbox[lp.inbox_head].time == time &&
+           (key == nullptr || comp_less(lp.inbox[lp.inbox_head].key, key))))) {
+    replay(lp.inbox[lp.inbox_head++]);
+  }
+  if (lp.inbox_head == lp.inbox.size()) {
+    lp.inbox.clear();
+    lp.inbox_head = 0;
+  }
+}
+
+
+void ParallelEventQueue::merge_outboxes() {
+  for (auto && lp : lps) {
+    merged.insert(merged.end(), lp.outbox.begin(), lp.outbox.end());
+    lp.outbox.clear();
+  }
+  // the keys of different logical processes never tie, and the calls of a
+  // logical process are already in order
+  std::stable_sort(merged.begin(), merged.end(),
+    [](const RemoteEvent & a, const RemoteEvent & b) {
+      return (a.time != b.time) ? (a.time < b.time) : comp_less(a.key, b.key); });
+  for (auto && remote_event : merged) {
+    replay(remote_event);
+  }
+  merged.clear();
+}
+
+
+void ParallelEventQueue::run_lp(LogicalProcess & lp) {
+  UINT64 event_time;
+  Component * comp;
+
+  curr_lp = &lp;
+  while (true) {
+    bool any_event = (lp.calendar.peek(event_time, comp) == true && event_time < end);
+    // the NoC calls that the rest of this tick and the ticks up to the next
+    // event see; they may add events before it
+    if (lp.inbox_head < lp.inbox.size() &&
+        (any_event == false || lp.inbox[lp.inbox_head].time < event_time)) {
+      if (lp.inbox[lp.inbox_head].time != lp.time) {
+        lp.time    = lp.inbox[lp.inbox_head].time;
+        lp.run_max = nullptr;
+      }
+      drain_inbox(lp, lp.time, nullptr);
+      continue;
+    }
+    if (any_event == false) break;
+
+    if (event_time != lp.time) {
+      lp.time    = event_time;
+      lp.run_max = nullptr;
+    }
+    Component * key = (lp.run_max != nullptr && comp_less(comp, lp.run_max)) ? lp.run_max : comp;
+    if (bound != nullptr && comp_less(key, bound) == false) break;
+
+    if (comp->type == ct_o3core) {
+      if (static_cast<O3Core *>(comp)->needs_global_sync() == true) {
+        lp.stalled = comp;
+        break;
+      }
+      lp.run_max = key;
+      drain_inbox(lp, event_time, key);
+      lp.calendar.erase(event_time, comp);
+      CHECK(comp->process_event(event_time) >= num_hthreads);
+    } else {
+      lp.run_max = key;
+      drain_inbox(lp, event_time, key);
+      comp->process_event(event_time);
+      lp.calendar.erase(event_time, comp);
+    }
+  }
+  // the NoC messages of this phase come before whatever is left
+  drain_inbox(lp, end, nullptr);
+  curr_lp = nullptr;
+}
+
+
+void ParallelEventQueue::run_phase(UINT32 tid) {
+  for (UINT32 i = tid; i < hub; i += num_threads) {
+    run_lp(lps[i]);
+  }
+}
+
+
+void ParallelEventQueue::worker_loop(UINT32 tid) {
+  static const UINT32 max_spin = 1 << 14;
+  UINT64 seen = 0;
+
+  while (true) {
+    UINT64 gen;
+    UINT32 num_spin = 0;
+    while ((gen = generation.load(std::memory_order_acquire)) == seen) {
+      if (++num_spin < max_spin) {
+        std::this_thread::yield();
+        continue;
+      }
+      // the frontend may keep the main thread for long; stop spinning
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [&] { return generation.load(std::memory_order_acquire) != seen; });
+    }
+    seen = gen;
+    if (quit == true) return;
+
+    run_phase(tid);
+    num_running.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+
+bool ParallelEventQueue::next_time(UINT64 & event_time) {
+  bool any_event = false;
+  for (auto && lp : lps) {
+    UINT64 lp_time;
+    Component * comp;
+    if (lp.calendar.peek(lp_time, comp) == true && (any_event == false || lp_time < event_time)) {
+      event_time = lp_time;
+      any_event  = true;
+    }
+  }
+  return any_event;
+}
+
+
+Component * ParallelEventQueue::find_sync_point() {
+  Component * sync_point = nullptr;
+  for (auto && o3core : mcsim->o3cores) {
+    if ((sync_point == nullptr || comp_less(o3core, sync_point)) &&
+        lps[o3core->lp].calendar.contains(curr_time, o3core) &&
+        o3core->needs_global_sync() == true) {
+      sync_point = o3core;
+    }
+  }
+  return sync_point;
+}
+
+
+// the end of the window from curr_time: the calls to the NoC arrive after
+// it, and no core needs a global sync before it.  sync_free_until counts the
+// events of a core process_interval apart; if one is ever scheduled off that
+// grid, the engine falls back to a tick at a time.
+UINT64 ParallelEventQueue::window_end() {
+  UINT64 window_end = curr_time + 1;
+  if (lookahead > 1 && unaligned.load(std::memory_order_relaxed) == false) {
+    window_end = curr_time + lookahead;
+    for (auto && o3core : mcsim->o3cores) {
+      window_end = std::min(window_end, o3core->sync_free_until(curr_time));
+      if (window_end <= curr_time + 1) break;
+    }
+  }
+  return std::max(window_end, curr_time + 1);
+}
+
+
+uint32_t ParallelEventQueue::process_event() {
+  CHECK(lps.empty() == false) << "McSim::connect_comps did not partition the components" << std::endl;
+
+  while (true) {
+    UINT64 event_time = 0;
+    if (next_time(event_time) == false) {
+      LOG(INFO) << "  -- event became empty at cycle = " << curr_time << std::endl;
+      return num_hthreads;
+    }
+    curr_time = event_time;
+    end       = window_end();
+    // a core that needs a global sync closes the window at a tick
+    bound     = (end == curr_time + 1) ? find_sync_point() : nullptr;
+    num_phases++;
+    num_windows += (end > curr_time + 1) ? 1 : 0;
+
+    for (auto && lp : lps) {
+      lp.time    = curr_time;
+      lp.run_max = nullptr;
+    }
+    // the NoC goes first so that the others see its calls of this phase
+    run_lp(lps[hub]);
+
+    num_running.store(num_threads - 1, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      generation.fetch_add(1, std::memory_order_release);
+    }
+    cv.notify_all();
+    run_phase(0);
+    while (num_running.load(std::memory_order_acquire) != 0) {
+      std::this_thread::yield();
+    }
+
+    merge_outboxes();
+    for (auto && lp : lps) {
+      if (lp.stalled != nullptr) {
+        LOG(FATAL) << *(lp.stalled) << " has to synchronize in the middle of a window at cycle = "
+          << curr_time << "; use pts.num_sim_threads = 1 for zero-latency configurations" << std::endl;
+      }
+    }
+
+    if (bound != nullptr) {
+      // everything before the core has been processed; it runs alone
+      num_sync_points++;
+      LogicalProcess & lp = lps[bound->lp];
+      curr_lp = &lp;
+      lp.calendar.erase(curr_time, bound);
+      uint32_t ret_val = bound->process_event(curr_time);
+      curr_lp = nullptr;
+      if (ret_val < num_hthreads) {
+        return ret_val;
+      }
+    }
+  }
+}
+
+
+std::ostream & ParallelEventQueue::print(std::ostream & out) const {
+  out << "  -- parallel event queue : at cycle = " << curr_time << std::endl;
+
+  for (UINT32 i = 0; i < lps.size(); i++) {
+    for (auto && event_queue_iter : lps[i].calendar.snapshot()) {
+      out << "[" << i << "] " << event_queue_iter.first << ", ";
+
+      for (auto && it : event_queue_iter.second) {
+        out << *it << ", ";
+      }
+      out << std::endl;
+    }
+  }
+  return out;
+}
+
+}  // namespace PinPthread
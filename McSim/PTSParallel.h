@@ -0,0 +1,100 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSPARALLEL_H_
+#define MCSIM_PTSPARALLEL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "PTSComponent.h"
+
+namespace PinPthread {
+
+// a part of the component graph with its own event calendar -- the cores,
+// TLBs, L1s, L2, directory and memory controller of an L2 cluster, or the NoC.
+class alignas(64) LogicalProcess {
+ public:
+  explicit LogicalProcess(UINT32 num_buckets);
+
+  EventCalendar calendar;
+  UINT64      time;      // the tick it is processing
+  Component * run_max;   // the largest component processed in this tick and phase
+  Component * stalled;   // a core that had to synchronize but was not expected to
+  std::vector<RemoteEvent> inbox;   // from the NoC, in (tick, key) order
+  size_t                   inbox_head;
+  std::vector<RemoteEvent> outbox;  // to the NoC, in (tick, key) order
+};
+
+
+// conservative parallel engine.  the logical processes are connected only
+// through the NoC, and what an L2 cluster sends to the NoC arrives at least
+// lookahead (the to_xbar_t latencies) later.  so they run the ticks of a
+// window, [curr_time, curr_time + lookahead), concurrently: first the NoC,
+// whose calls the clusters replay when they reach them, and then the
+// clusters, whose calls the NoC replays after the window.  a window ends
+// before any core may need a global sync (O3Core::sync_free_until).
+//
+// the sequential engine visits the components of a tick in address order.
+// restricted to one logical process it is the same order, and across logical
+// processes it is the order of the largest address visited so far in the
+// tick of each (run_max).  calls through the NoC carry that key and their
+// tick, and are replayed in (tick, key) order.  a core that talks to the
+// frontend or to the other cores (O3Core::needs_global_sync) gets a window
+// of one tick that is split into phases: everything before it runs in
+// parallel, then it runs alone and may return to the frontend.
+class ParallelEventQueue : public GlobalEventQueue {
+ public:
+  explicit ParallelEventQueue(McSim * mcsim_);
+  ~ParallelEventQueue();
+
+  void   add_event(UINT64 event_time, Component *) override;
+  UINT32 process_event() override;
+  bool   empty() const override;
+  void   partition(UINT32 num_lps) override;
+  bool   post_remote(const RemoteEvent &) override;
+  std::ostream & print(std::ostream & out) const override;
+
+ private:
+  const UINT32 num_sim_threads;
+  const bool   limit_to_cores;  // no more threads than the host cores
+  const UINT32 num_buckets;
+  const UINT64 lookahead;
+  UINT32 num_threads;  // including the main thread
+  UINT32 hub;          // the logical process of the NoC
+  std::vector<LogicalProcess> lps;
+  std::vector<RemoteEvent>    merged;
+  Component * bound;   // the components from it on wait for the next phase
+  UINT64      end;     // of the window
+  std::atomic<bool> unaligned;  // a core event off its process_interval
+
+  std::vector<std::thread> workers;
+  std::mutex               mtx;
+  std::condition_variable  cv;
+  std::atomic<UINT64>      generation;
+  std::atomic<UINT32>      num_running;
+  bool                     quit;
+
+  UINT64 num_phases;
+  UINT64 num_windows;  // of more than a tick
+  UINT64 num_sync_points;
+
+  bool   next_time(UINT64 & event_time);
+  Component * find_sync_point();
+  UINT64 window_end();
+  void   run_phase(UINT32 tid);
+  void   run_lp(LogicalProcess &);
+  void   drain_inbox(LogicalProcess &, UINT64 time, Component * key);
+  void   merge_outboxes();
+  void   replay(const RemoteEvent &);
+  void   worker_loop(UINT32 tid);
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSPARALLEL_H_
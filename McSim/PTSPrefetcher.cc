@@ -0,0 +1,192 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <glog/logging.h>
+#include <string.h>
+#include <algorithm>
+
+#include "PTSPrefetcher.h"
+
+
+namespace PinPthread {
+
+Prefetcher * Prefetcher::create(
+    const std::string & type,
+    uint32_t degree,
+    uint32_t distance,
+    uint32_t table_size) {
+  CHECK(degree > 0 && table_size > 0);
+  if (type == "next_line") {
+    return new NextLinePrefetcher(degree);
+  } else if (type == "stride") {
+    return new StridePrefetcher(degree, table_size);
+  } else if (type == "stream") {
+    return new StreamPrefetcher(degree, distance, table_size);
+  } else if (type == "ip_delta") {
+    return new IPDeltaPrefetcher(degree, table_size);
+  }
+  LOG(FATAL) << "unknown prefetcher " << type;
+  return nullptr;
+}
+
+
+// ips of x86 instructions are not aligned, so fold the upper bits in
+static inline uint32_t ip_to_idx(uint64_t ip, size_t table_size) {
+  return (ip ^ (ip >> 16)) % table_size;
+}
+
+
+void NextLinePrefetcher::access(
+    uint64_t line,
+    uint64_t ip,
+    bool miss,
+    bool prefetched,
+    std::vector<uint64_t> & lines) {
+  if (miss == false && prefetched == false) return;
+  for (uint32_t i = 1; i <= degree; i++) {
+    lines.push_back(line + i);
+  }
+}
+
+
+StridePrefetcher::StridePrefetcher(uint32_t degree_, uint32_t table_size):
+  Prefetcher(degree_), table(table_size, Entry{0, 0, 0, 0}) {
+}
+
+
+void StridePrefetcher::access(
+    uint64_t line,
+    uint64_t ip,
+    bool miss,
+    bool prefetched,
+    std::vector<uint64_t> & lines) {
+  if (ip == 0) return;
+  Entry & entry = table[ip_to_idx(ip, table.size())];
+  if (entry.ip != ip) {
+    entry = Entry{ip, line, 0, 0};
+    return;
+  }
+
+  const int64_t stride = line - entry.last_line;
+  if (stride == 0) return;  // another access to the same line
+  entry.last_line = line;
+  if (stride == entry.stride) {
+    entry.confidence = std::min(entry.confidence + 1, 3u);
+  } else if (entry.confidence > 0) {
+    entry.confidence--;
+  } else {
+    entry.stride = stride;
+  }
+
+  if (entry.confidence >= 2) {
+    for (uint32_t i = 1; i <= degree; i++) {
+      lines.push_back(line + i * entry.stride);
+    }
+  }
+}
+
+
+StreamPrefetcher::StreamPrefetcher(uint32_t degree_, uint32_t distance_, uint32_t num_streams):
+  Prefetcher(degree_), distance(distance_),
+  streams(num_streams, Stream{0, 0, 0, 0, 0, false}), num_accesses(0) {
+}
+
+
+void StreamPrefetcher::access(
+    uint64_t line,
+    uint64_t ip,
+    bool miss,
+    bool prefetched,
+    std::vector<uint64_t> & lines) {
+  if (miss == false && prefetched == false) return;
+  num_accesses++;
+
+  Stream * lru = &streams[0];
+  for (auto && stream : streams) {
+    const int64_t delta = line - stream.last_line;
+    if (stream.valid == true && delta != 0 && delta > -window && delta < window) {
+      const int64_t dir = (delta > 0) ? 1 : -1;
+      stream.confidence = (dir == stream.dir) ? stream.confidence + 1 : 1;
+      stream.dir        = dir;
+      stream.last_line  = line;
+      stream.last_use   = num_accesses;
+      if (stream.confidence < 2) return;
+
+      // continue from where the stream left off unless the accesses passed it
+      if ((int64_t)(stream.next_line - line) * dir <= 0) {
+        stream.next_line = line + dir;
+      }
+      for (uint32_t i = 0; i < degree && (int64_t)(stream.next_line - line) * dir <= distance; i++) {
+        lines.push_back(stream.next_line);
+        stream.next_line += dir;
+      }
+      return;
+    }
+    if (stream.valid == false || (lru->valid == true && stream.last_use < lru->last_use)) {
+      lru = &stream;
+    }
+  }
+  *lru = Stream{line, line, 0, 0, num_accesses, true};
+}
+
+
+IPDeltaPrefetcher::IPDeltaPrefetcher(uint32_t degree_, uint32_t table_size):
+  Prefetcher(degree_), table(table_size) {
+  for (auto && entry : table) {
+    entry.ip  = 0;
+    entry.num = 0;
+  }
+}
+
+
+void IPDeltaPrefetcher::access(
+    uint64_t line,
+    uint64_t ip,
+    bool miss,
+    bool prefetched,
+    std::vector<uint64_t> & lines) {
+  if (ip == 0) return;
+  Entry & entry = table[ip_to_idx(ip, table.size())];
+  if (entry.ip != ip) {
+    entry.ip        = ip;
+    entry.last_line = line;
+    entry.num       = 0;
+    return;
+  }
+
+  const int64_t delta = line - entry.last_line;
+  if (delta == 0) return;
+  entry.last_line = line;
+  if (delta != (int32_t)delta) {  // a jump too far to be a pattern
+    entry.num = 0;
+    return;
+  }
+  if (entry.num == num_deltas) {
+    memmove(&entry.deltas[0], &entry.deltas[1], sizeof(int32_t) * (num_deltas - 1));
+    entry.num--;
+  }
+  entry.deltas[entry.num++] = delta;
+  if (entry.num < 3) return;
+
+  // the latest earlier occurrence of the last two deltas
+  const int32_t d0 = entry.deltas[entry.num - 2];
+  const int32_t d1 = entry.deltas[entry.num - 1];
+  uint32_t match = 0;
+  for (uint32_t i = entry.num - 1; i-- > 1; ) {
+    if (entry.deltas[i - 1] == d0 && entry.deltas[i] == d1) {
+      match = i;
+      break;
+    }
+  }
+  if (match == 0) return;
+
+  // replay what followed, over and over if degree asks for more
+  uint64_t next = line;
+  for (uint32_t i = 0, j = match + 1; i < degree; i++, j = (j + 1 < entry.num) ? j + 1 : match + 1) {
+    next += entry.deltas[j];
+    lines.push_back(next);
+  }
+}
+
+}  // namespace PinPthread
@@ -0,0 +1,117 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSPREFETCHER_H_
+#define MCSIM_PTSPREFETCHER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PinPthread {
+
+// a prefetcher watches the demand accesses of a cache and suggests the lines
+// (address >> set_lsb) to bring in.  the cache drops the suggestions that it
+// already has or has recently asked for, and issues up to degree lines per
+// access (see Cache::train_prefetcher).
+class Prefetcher {
+ public:
+  explicit Prefetcher(uint32_t degree_) : degree(degree_) { }
+  virtual ~Prefetcher() { }
+
+  // miss: the access missed.  prefetched: it is the first access to a line
+  // that was prefetched.  the suggestions are appended to lines.
+  virtual void access(uint64_t line, uint64_t ip, bool miss, bool prefetched,
+                      std::vector<uint64_t> & lines) = 0;
+
+  // type is "next_line", "stride", "stream", or "ip_delta"; distance bounds
+  // how far a stream runs ahead of the accesses, and table_size is the
+  // number of ips the stride and ip_delta prefetchers track.
+  static Prefetcher * create(const std::string & type, uint32_t degree,
+                             uint32_t distance, uint32_t table_size);
+
+  const uint32_t degree;
+};
+
+
+// the next degree lines on a miss or on the first access to a prefetched
+// line (tagged prefetching)
+class NextLinePrefetcher : public Prefetcher {
+ public:
+  explicit NextLinePrefetcher(uint32_t degree_) : Prefetcher(degree_) { }
+  void access(uint64_t line, uint64_t ip, bool miss, bool prefetched,
+              std::vector<uint64_t> & lines);
+};
+
+
+// reference prediction table: the last line and the stride of each ip.  a
+// stride seen twice in a row is prefetched degree strides ahead.
+class StridePrefetcher : public Prefetcher {
+ public:
+  StridePrefetcher(uint32_t degree_, uint32_t table_size);
+  void access(uint64_t line, uint64_t ip, bool miss, bool prefetched,
+              std::vector<uint64_t> & lines);
+
+ private:
+  struct Entry {
+    uint64_t ip;
+    uint64_t last_line;
+    int64_t  stride;
+    uint32_t confidence;  // saturates at 3; prefetches from 2
+  };
+  std::vector<Entry> table;
+};
+
+
+// tracks up to num_streams ascending or descending streams of misses.  two
+// misses within a window of a stream in the same direction confirm it, and
+// then each miss or first access to a prefetched line of the stream
+// extends the prefetched lines up to distance lines ahead.
+class StreamPrefetcher : public Prefetcher {
+ public:
+  StreamPrefetcher(uint32_t degree_, uint32_t distance_, uint32_t num_streams);
+  void access(uint64_t line, uint64_t ip, bool miss, bool prefetched,
+              std::vector<uint64_t> & lines);
+
+ private:
+  static const int64_t window = 16;  // lines around the last line of a stream
+  struct Stream {
+    uint64_t last_line;
+    uint64_t next_line;   // to prefetch next
+    int64_t  dir;         // +1, -1, or 0 if not known yet
+    uint32_t confidence;
+    uint64_t last_use;    // for LRU replacement
+    bool     valid;
+  };
+  const uint32_t      distance;
+  std::vector<Stream> streams;
+  uint64_t            num_accesses;
+};
+
+
+// delta correlation per ip: the last num_deltas line deltas of each ip are
+// kept, and when the latest two deltas appeared before in the same order,
+// the deltas that followed them are replayed from the current line.  it
+// catches repeating patterns such as +1, +3, +1, +3 that have no single
+// stride.
+class IPDeltaPrefetcher : public Prefetcher {
+ public:
+  IPDeltaPrefetcher(uint32_t degree_, uint32_t table_size);
+  void access(uint64_t line, uint64_t ip, bool miss, bool prefetched,
+              std::vector<uint64_t> & lines);
+
+ private:
+  static const uint32_t num_deltas = 8;
+  struct Entry {
+    uint64_t ip;
+    uint64_t last_line;
+    int32_t  deltas[num_deltas];  // from the oldest
+    uint32_t num;
+  };
+  std::vector<Entry> table;
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSPREFETCHER_H_
@@ -38,9 +38,8 @@ ProcessDescription::ProcessDescription(const std::string & runfile):
 
       pts_processes.back().num_threads = toml::find<toml::integer>(run, "num_threads");
     } else if (type == "trace") {
+      // path and arg are needed only when the pintool plays the trace
       CHECK(run.contains("trace_file")) << "A 'trace' type should include trace_file.\n";
-      CHECK(run.contains("path")) << "A 'pintool' type entry should include path.\n";
-      CHECK(run.contains("arg")) << "A 'pintool' type entry should include arg.\n";
 
       pts_processes.back().num_threads = 1;
       pts_processes.back().trace_name = toml::find<toml::string>(run, "trace_file");
@@ -49,9 +48,9 @@ ProcessDescription::ProcessDescription(const std::string & runfile):
     }
 
     curr_process.num_instrs_to_skip_first = toml::find_or(run, "num_instrs_to_skip_first", 0);
-    curr_process.directory = toml::find<toml::string>(run, "path");
+    curr_process.directory = toml::find_or<std::string>(run, "path", "");
     // curr_process.prog_n_argv.push_back(toml::find<toml::string>(run, "arg"));
-    std::istringstream ss(toml::find<toml::string>(run, "arg"));
+    std::istringstream ss(toml::find_or<std::string>(run, "arg", ""));
 
     do {
       std::string word;
@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "PTS.h"
+#include "PTSChannel.h"
 
 extern int main(int, char**);
 
@@ -25,8 +26,9 @@ struct PTSProcess {
   PTSMessage * buffer;
   int pid;
   int mmap_fd;  // communicate with pintool through an mmaped file
-  volatile bool * mmap_flag;
-  char * pmmap;
+  PTSChannel * channel;
+  uint32_t num_requests;  // from the pintool so far
+  uint32_t num_available_slot;  // in the o3queue after the last instruction added
 };
 
 
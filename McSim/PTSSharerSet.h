@@ -0,0 +1,118 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSSHARERSET_H_
+#define MCSIM_PTSSHARERSET_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <ostream>
+#include <utility>
+
+namespace PinPthread {
+
+// the sharers of a cache line as bits indexed by component number.  the
+// first 64 sharers live in the object; an array for the rest is allocated
+// only when a sharer beyond them shows up, so that even with 1024 sharers
+// a line costs 24 bytes plus at most 120 bytes on the heap.
+class SharerSet {
+ public:
+  SharerSet() : word(0), num_more(0), more(nullptr) { }
+  SharerSet(const SharerSet & s) : word(s.word), num_more(s.num_more), more(nullptr) {
+    if (num_more > 0) {
+      more = new uint64_t[num_more];
+      memcpy(more, s.more, sizeof(uint64_t) * num_more);
+    }
+  }
+  SharerSet(SharerSet && s) : word(s.word), num_more(s.num_more), more(s.more) {
+    s.num_more = 0;
+    s.more     = nullptr;
+  }
+  SharerSet & operator=(SharerSet s) {
+    word = s.word;
+    std::swap(num_more, s.num_more);
+    std::swap(more, s.more);
+    return *this;
+  }
+  ~SharerSet() { delete[] more; }
+
+  bool empty() const {
+    uint64_t any = word;
+    for (uint32_t i = 0; i < num_more; i++) any |= more[i];
+    return any == 0;
+  }
+
+  uint32_t size() const {
+    uint32_t num = __builtin_popcountll(word);
+    for (uint32_t i = 0; i < num_more; i++) num += __builtin_popcountll(more[i]);
+    return num;
+  }
+
+  bool contains(uint32_t idx) const {
+    if (idx < 64) return ((word >> idx) & 1) != 0;
+    return (idx >> 6) <= num_more && ((more[(idx >> 6) - 1] >> (idx & 63)) & 1) != 0;
+  }
+
+  void insert(uint32_t idx) {
+    if (idx < 64) {
+      word |= (1ULL << idx);
+      return;
+    }
+    if ((idx >> 6) > num_more) grow(idx >> 6);
+    more[(idx >> 6) - 1] |= (1ULL << (idx & 63));
+  }
+
+  void erase(uint32_t idx) {
+    if (idx < 64) {
+      word &= ~(1ULL << idx);
+    } else if ((idx >> 6) <= num_more) {
+      more[(idx >> 6) - 1] &= ~(1ULL << (idx & 63));
+    }
+  }
+
+  void clear() {
+    word = 0;
+    if (num_more > 0) memset(more, 0, sizeof(uint64_t) * num_more);
+  }
+
+  // the lowest sharer; the set must not be empty
+  uint32_t first() const {
+    if (word != 0) return __builtin_ctzll(word);
+    for (uint32_t i = 0; i < num_more; i++) {
+      if (more[i] != 0) return ((i + 1) << 6) + __builtin_ctzll(more[i]);
+    }
+    return UINT32_MAX;
+  }
+
+  // calls f(idx) for each sharer from the lowest; f must not change the set
+  template <class F>
+  void for_each(F f) const {
+    for (uint64_t w = word; w != 0; w &= w - 1) f(__builtin_ctzll(w));
+    for (uint32_t i = 0; i < num_more; i++) {
+      for (uint64_t w = more[i]; w != 0; w &= w - 1) f(((i + 1) << 6) + __builtin_ctzll(w));
+    }
+  }
+
+  friend std::ostream & operator<<(std::ostream & out, const SharerSet & s) {
+    s.for_each([&](uint32_t idx) { out << idx << ", "; });
+    return out;
+  }
+
+ private:
+  uint64_t   word;      // sharers 0 to 63
+  uint32_t   num_more;  // words in more
+  uint64_t * more;      // sharers from 64
+
+  void grow(uint32_t num_words) {
+    uint64_t * grown = new uint64_t[num_words]();
+    if (num_more > 0) memcpy(grown, more, sizeof(uint64_t) * num_more);
+    delete[] more;
+    more     = grown;
+    num_more = num_words;
+  }
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSSHARERSET_H_
@@ -0,0 +1,90 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <glog/logging.h>
+#include <iomanip>
+
+#include "PTSStackDistance.h"
+
+
+namespace PinPthread {
+
+StackDistance::StackDistance(
+    uint32_t set_lsb_,
+    uint32_t min_num_sets,
+    uint32_t max_num_sets,
+    uint32_t max_num_ways_):
+  set_lsb(set_lsb_), max_num_ways(max_num_ways_), stacks(), accesses(0) {
+  CHECK(min_num_sets > 0 && (min_num_sets & (min_num_sets - 1)) == 0)
+    << "min_num_sets (" << min_num_sets << ") has to be a power of two";
+  CHECK(min_num_sets <= max_num_sets && max_num_ways > 0);
+  for (uint64_t num_sets = min_num_sets; num_sets <= max_num_sets; num_sets <<= 1) {
+    stacks.push_back(Stacks{(uint32_t)num_sets,
+        std::vector<uint64_t>(num_sets * max_num_ways, empty_line),
+        std::vector<uint64_t>(max_num_ways, 0)});
+  }
+}
+
+
+void StackDistance::access(uint64_t address) {
+  const uint64_t line = address >> set_lsb;
+  accesses++;
+
+  for (auto && st : stacks) {
+    uint64_t * stack = &st.lines[(line & (st.num_sets - 1)) * max_num_ways];
+    // the line moves to the top; the lines above its old place go down by
+    // one, and the bottom one drops out when the line was not in the stack
+    uint32_t depth = 0;
+    uint64_t prev  = line;
+    for (; depth < max_num_ways; depth++) {
+      uint64_t curr = stack[depth];
+      stack[depth]  = prev;
+      if (curr == line) break;
+      if (curr == empty_line) {
+        depth = max_num_ways;
+        break;
+      }
+      prev = curr;
+    }
+    if (depth < max_num_ways) st.hits[depth]++;
+  }
+}
+
+
+uint64_t StackDistance::num_misses(uint32_t num_sets, uint32_t num_ways) const {
+  CHECK(num_ways <= max_num_ways);
+  for (auto && st : stacks) {
+    if (st.num_sets != num_sets) continue;
+    uint64_t num_hits = 0;
+    for (uint32_t d = 0; d < num_ways; d++) num_hits += st.hits[d];
+    return accesses - num_hits;
+  }
+  LOG(FATAL) << "num_sets " << num_sets << " is not profiled";
+  return 0;
+}
+
+
+void StackDistance::print(std::ostream & out, const std::string & prefix) const {
+  if (accesses == 0) return;
+  const uint64_t line_size = 1ULL << set_lsb;
+  const std::ios_base::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << prefix << " : stack distance of " << accesses
+    << " accesses, miss rate (%) by ways 1.." << max_num_ways << std::endl;
+  for (auto && st : stacks) {
+    out << prefix << " : " << std::setw(7) << st.num_sets << " sets ("
+      << std::setw(7) << st.num_sets * line_size / 1024 << " KB/way) :";
+    uint64_t num_hits = 0;
+    for (uint32_t w = 0; w < max_num_ways; w++) {
+      num_hits += st.hits[w];
+      out << " " << std::setiosflags(std::ios::fixed) << std::setprecision(2)
+        << 100.0 * (accesses - num_hits) / accesses;
+    }
+    out << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace PinPthread
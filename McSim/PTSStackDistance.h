@@ -0,0 +1,54 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSSTACKDISTANCE_H_
+#define MCSIM_PTSSTACKDISTANCE_H_
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace PinPthread {
+
+// per-set LRU stack distances (Mattson) of the accesses to a cache.  one
+// pass gives the misses of every LRU cache with the same line size (set_lsb)
+// and the set index of Cache::set_of (line % num_sets), for each
+// power-of-two num_sets from min_num_sets to max_num_sets and each
+// associativity up to max_num_ways.  an access at depth d of the stack of
+// its set hits in the caches with more than d ways.
+class StackDistance {
+ public:
+  StackDistance(uint32_t set_lsb_, uint32_t min_num_sets, uint32_t max_num_sets,
+                uint32_t max_num_ways_);
+
+  void access(uint64_t address);
+
+  uint64_t num_accesses() const { return accesses; }
+  // of the cache with num_sets (one of the profiled ones) and num_ways
+  uint64_t num_misses(uint32_t num_sets, uint32_t num_ways) const;
+
+  // a line per num_sets with the miss rates from 1 to max_num_ways ways
+  void print(std::ostream & out, const std::string & prefix) const;
+
+  const uint32_t set_lsb;
+  const uint32_t max_num_ways;
+
+ private:
+  static constexpr uint64_t empty_line = UINT64_MAX;  // not a valid line address
+
+  struct Stacks {
+    uint32_t num_sets;
+    // the stack of set s is at [s*max_num_ways ...], from the MRU line
+    std::vector<uint64_t> lines;
+    // hits[d]: the accesses at depth d
+    std::vector<uint64_t> hits;
+  };
+  std::vector<Stacks> stacks;  // from the fewest sets
+  uint64_t accesses;
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSSTACKDISTANCE_H_
@@ -21,7 +21,7 @@ TLBL1::TLBL1(
   page_sz_log2(get_param_uint64("page_sz_log2", 13)),  // 8192 bytes
   miss_penalty(get_param_uint64("miss_penalty", 100)),
   speedup(get_param_uint64("speedup", 1)),
-  num_access(0), num_miss(0) {
+  num_access(0), num_miss(0), num_lookups(0) {
   process_interval = get_param_uint64("process_interval", 10);
 }
 
@@ -43,19 +43,15 @@ void TLBL1::add_req_event(
     LocalQueueElement * local_event,
     Component * from) {
   geq->add_event(event_time, this);
-  req_event.insert(std::pair<uint64_t, LocalQueueElement *>(event_time, local_event));
+  req_event.push(event_time, local_event);
 }
 
 uint32_t TLBL1::process_event(uint64_t curr_time) {
-  auto req_event_iter = req_event.begin();
-
   LocalQueueElement * req_lqe = NULL;
   // event -> queue
-  while (req_event_iter != req_event.end() && req_event_iter->first == curr_time) {
-    req_q.push(req_event_iter->second);
-    ++req_event_iter;
+  for (auto lqe = req_event.pop(curr_time); lqe != nullptr; lqe = req_event.pop(curr_time)) {
+    req_q.push(lqe);
   }
-  req_event.erase(curr_time);
 
   for (uint32_t i = 0; i < speedup; i++) {
     if (req_q.empty() == true) break;
@@ -68,31 +64,19 @@ uint32_t TLBL1::process_event(uint64_t curr_time) {
     uint64_t page_num = (address >> page_sz_log2);
 
     num_access++;
-    if (entries.find(page_num) == entries.end()) {
+    if (lookup(page_num, curr_time) == false) {
       num_miss++;
       if (type == ct_tlbl1i) {
         (req_lqe->from.top())->add_req_event(curr_time + l1_to_lsu_t + miss_penalty, req_lqe);
       } else {
         (req_lqe->from.top())->add_rep_event(curr_time + l1_to_lsu_t + miss_penalty, req_lqe);
       }
-      if (LRU.size() >= num_entries) {
-        entries.erase(LRU.begin()->second);
-        LRU.erase(LRU.begin());
-      }
-      LRU.insert(
-        std::pair<uint64_t, std::map<uint64_t, uint64_t>::iterator>(
-          curr_time, entries.insert(std::pair<uint64_t, uint64_t>(page_num, curr_time)).first));
     } else {
       if (type == ct_tlbl1i) {
         (req_lqe->from.top())->add_req_event(curr_time + l1_to_lsu_t, req_lqe);
       } else {
         (req_lqe->from.top())->add_rep_event(curr_time + l1_to_lsu_t, req_lqe);
       }
-      LRU.erase(entries[page_num]);
-      entries[page_num] = curr_time;
-      LRU.insert(
-        std::pair<uint64_t, std::map<uint64_t, uint64_t>::iterator>(
-          curr_time, entries.find(page_num)));
     }
   }
 
@@ -103,4 +87,27 @@ uint32_t TLBL1::process_event(uint64_t curr_time) {
   return 0;
 }
 
+
+void TLBL1::warm(uint64_t address) {
+  lookup(address >> page_sz_log2, geq->curr_time);
+}
+
+
+bool TLBL1::lookup(uint64_t page_num, uint64_t curr_time) {
+  auto iter = entries.find(page_num);
+  bool hit  = (iter != entries.end());
+  if (hit == true) {
+    LRU.erase(iter->second.first);
+    iter->second = std::make_pair(num_lookups, curr_time);
+  } else {
+    if (LRU.size() >= num_entries) {
+      entries.erase(LRU.begin()->second);
+      LRU.erase(LRU.begin());
+    }
+    iter = entries.insert(std::make_pair(page_num, std::make_pair(num_lookups, curr_time))).first;
+  }
+  LRU.insert(std::make_pair(num_lookups++, iter));
+  return hit;
+}
+
 }  // namespace PinPthread
@@ -10,6 +10,7 @@
 #include <map>
 #include <queue>
 #include <stack>
+#include <utility>
 #include <vector>
 
 namespace PinPthread {
@@ -20,6 +21,8 @@ class TLBL1 : public Component {
   virtual ~TLBL1();
   void add_req_event(uint64_t, LocalQueueElement *, Component * from = NULL);
   uint32_t process_event(uint64_t curr_time);
+  // functional warming; see McSim::warm_instructions
+  void warm(uint64_t address);
 
   const uint32_t num_entries;
   const uint32_t l1_to_lsu_t;
@@ -30,10 +33,17 @@ class TLBL1 : public Component {
  protected:
   uint64_t num_access;
   uint64_t num_miss;
+  uint64_t num_lookups;
 
-  // currently it is assumed that L1 TLBs are fully-associative
-  std::map<uint64_t, uint64_t> entries;  // <page_num, time>
-  std::map<uint64_t, std::map<uint64_t, uint64_t>::iterator> LRU;
+  // currently it is assumed that L1 TLBs are fully-associative.  LRU is
+  // ordered by the lookups rather than by the times, which do not advance
+  // while warming and may repeat with speedup > 1.
+  using Entries = std::map<uint64_t, std::pair<uint64_t, uint64_t>>;  // <page_num, <lookup, time>>
+  Entries entries;
+  std::map<uint64_t, Entries::iterator> LRU;  // <lookup, entry>
+
+  // makes page_num the MRU entry; returns whether it was there
+  bool lookup(uint64_t page_num, uint64_t curr_time);
 };
 
 }  // namespace PinPthread
@@ -0,0 +1,95 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "PTSTrace.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+
+#include "snappy.h"
+
+namespace PinPthread {
+
+TraceReader::TraceReader(const std::string & trace_name_, bool repeat_):
+  trace_name(trace_name_), repeat(repeat_),
+  trace_file(trace_name_.c_str(), std::ios::binary), footer(),
+  instrs(), compressed(), instr_idx(0), num_slices_read(0) {
+  CHECK(trace_file.good()) << "failed to open " << trace_name << std::endl;
+
+  trace_file.seekg(0, std::ios::end);
+  size_t total_size = trace_file.tellg();
+  CHECK(total_size >= sizeof(PTSTraceFooter)) << trace_name << " is too short" << std::endl;
+  size_t offset = total_size - sizeof(PTSTraceFooter);
+
+  trace_file.seekg(offset, std::ios::beg);
+  trace_file.read(reinterpret_cast<char *>(&footer), sizeof(PTSTraceFooter));
+  CHECK(footer.magic_number_ == kTraceMagicNumber) << "invalid magic number in " << trace_name << std::endl;
+  CHECK(footer.offset_ == offset) << "invalid offset in " << trace_name << std::endl;
+  CHECK(footer.total_slice_ > 0) << "invalid slice counts in " << trace_name << std::endl;
+  CHECK(footer.instr_group_size_ > 0) << "invalid slice size in " << trace_name << std::endl;
+
+  instrs.resize(footer.instr_group_size_);
+  instr_idx = instrs.size();
+  trace_file.seekg(0, std::ios::beg);
+}
+
+
+const PTSInstrTrace * TraceReader::next() {
+  if (instr_idx == instrs.size() && read_slice(true) == false) {
+    return nullptr;
+  }
+  return &instrs[instr_idx++];
+}
+
+
+void TraceReader::skip(uint64_t num_instrs) {
+  while (num_instrs > 0) {
+    if (instr_idx < instrs.size()) {
+      uint64_t num_skipped = std::min<uint64_t>(num_instrs, instrs.size() - instr_idx);
+      instr_idx  += num_skipped;
+      num_instrs -= num_skipped;
+    } else if (read_slice(num_instrs < instrs.size()) == false) {
+      return;
+    } else if (num_instrs >= instrs.size()) {
+      num_instrs -= instrs.size();
+      instr_idx   = instrs.size();
+    }
+  }
+}
+
+
+bool TraceReader::read_slice(bool decompress) {
+  if (num_slices_read == footer.total_slice_) {
+    if (repeat == false) return false;
+    trace_file.clear();
+    trace_file.seekg(0, std::ios::beg);
+    num_slices_read = 0;
+  }
+
+  size_t slice_count       = 0;
+  size_t compressed_length = 0;
+  trace_file.read(reinterpret_cast<char *>(&slice_count), sizeof(size_t));
+  trace_file.read(reinterpret_cast<char *>(&compressed_length), sizeof(size_t));
+  CHECK(trace_file.good() && compressed_length <= footer.offset_)
+    << trace_name << " is corrupted at slice " << num_slices_read << std::endl;
+
+  if (decompress == true) {
+    size_t length = 0;
+    compressed.resize(compressed_length);
+    trace_file.read(compressed.data(), compressed_length);
+    CHECK(trace_file.good() &&
+          snappy::GetUncompressedLength(compressed.data(), compressed_length, &length) == true &&
+          length == sizeof(PTSInstrTrace) * instrs.size() &&
+          snappy::RawUncompress(compressed.data(), compressed_length,
+                                reinterpret_cast<char *>(instrs.data())) == true)
+      << trace_name << " is corrupted at slice " << num_slices_read << std::endl;
+  } else {
+    trace_file.seekg(compressed_length, std::ios::cur);
+  }
+  num_slices_read++;
+  instr_idx = 0;
+  return true;
+}
+
+}  // namespace PinPthread
@@ -0,0 +1,45 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MCSIM_PTSTRACE_H_
+#define MCSIM_PTSTRACE_H_
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "PTS.h"
+
+namespace PinPthread {
+
+// reads the instructions of a TraceGen trace file one slice at a time so
+// that the backend can play it without the pintool.
+class TraceReader {
+ public:
+  explicit TraceReader(const std::string & trace_name_, bool repeat_ = false);
+  ~TraceReader() { }
+
+  // the next instruction; nullptr at the end of the trace
+  const PTSInstrTrace * next();
+  // whole slices are skipped without decompressing them
+  void skip(uint64_t num_instrs);
+
+  const std::string trace_name;
+  const bool        repeat;  // start over at the end of the trace
+
+ private:
+  std::ifstream  trace_file;
+  PTSTraceFooter footer;
+  std::vector<PTSInstrTrace> instrs;  // the current slice
+  std::vector<char>          compressed;
+  size_t   instr_idx;        // the next one in instrs
+  size_t   num_slices_read;
+
+  bool read_slice(bool decompress);
+};
+
+}  // namespace PinPthread
+
+#endif  // MCSIM_PTSTRACE_H_
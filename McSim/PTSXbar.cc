@@ -3,6 +3,7 @@
 // be found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <glog/logging.h>
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 
@@ -31,13 +32,39 @@ NoC::~NoC() {
 }
 
 
+Component * NoC::rep_destination(LocalQueueElement * lqe) {
+  if (lqe->type == et_evict ||
+      lqe->type == et_invalidate ||
+      lqe->type == et_invalidate_nd ||
+      lqe->type == et_nop ||
+      lqe->type == et_e_to_i ||
+      lqe->type == et_e_to_m) {
+    return directory[geq->which_mc(lqe->address)];
+  }
+  return lqe->from.top();
+}
+
+
+void NoC::forward(uint64_t event_time, noc_priority priority, LocalQueueElement * lqe, Component * to) {
+  if (priority == noc_req) {
+    if (geq->post_remote(RemoteEvent{RemoteEvent::re_req, event_time, lqe, to, this, 0}) == false) {
+      to->add_req_event(event_time, lqe);
+    }
+  } else {
+    if (geq->post_remote(RemoteEvent{RemoteEvent::re_rep, event_time, lqe, to, this, 0}) == false) {
+      to->add_rep_event(event_time, lqe);
+    }
+  }
+}
+
+
 Crossbar::Crossbar(
     component_type type_,
     uint32_t num_,
     McSim * mcsim_,
     uint32_t num_ports_):
   NoC(type_, num_, mcsim_),
-  queues(num_ports_), already_sent(num_ports_),
+  queues(num_ports_), busy_until(num_ports_, 0),
   xbar_to_dir_t(get_param_uint64("to_dir_t", 90)),
   xbar_to_l2_t(get_param_uint64("to_l2_t", 90)),
   num_ports(num_ports_),
@@ -50,18 +77,26 @@ Crossbar::~Crossbar() {
 }
 
 
+uint64_t Crossbar::arrival_time(uint64_t event_time) {
+  if (event_time % process_interval != 0) {
+    event_time = event_time + process_interval - event_time%process_interval;
+  }
+  geq->add_event(event_time, this);
+  return event_time;
+}
+
+
 void Crossbar::add_req_event(
     uint64_t event_time,
     LocalQueueElement * local_event,
     Component * from) {
   ASSERTX(from);
-  if (event_time % process_interval != 0) {
-    event_time = event_time + process_interval - event_time%process_interval;
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_req, event_time, local_event, this, from, 0})) {
+    return;
   }
   num_req++;
   num_flits++;
-  geq->add_event(event_time, this);
-  req_events.insert(std::pair<uint64_t, EventPair>(event_time, EventPair(local_event, from)));
+  req_events.insert(std::pair<uint64_t, Packet>(arrival_time(event_time), Packet{local_event, from, 1}));
 }
 
 
@@ -70,34 +105,28 @@ void Crossbar::add_crq_event(
     LocalQueueElement * local_event,
     Component * from) {
   ASSERTX(from);
-  if (event_time % process_interval != 0) {
-    event_time = event_time + process_interval - event_time%process_interval;
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_crq, event_time, local_event, this, from, 0})) {
+    return;
   }
   num_crq++;
   num_flits++;
-  geq->add_event(event_time, this);
-  crq_events.insert(std::pair<uint64_t, EventPair>(event_time, EventPair(local_event, from)));
+  crq_events.insert(std::pair<uint64_t, Packet>(arrival_time(event_time), Packet{local_event, from, 1}));
 }
 
 
 void Crossbar::add_crq_event(
     uint64_t event_time,
     LocalQueueElement * local_event,
-    uint32_t num_flits,
+    uint32_t num_flits_,
     Component * from) {
-  for (uint32_t i = 0; i < num_flits - 1; i++) {
-    LocalQueueElement * dummy_lqe = new LocalQueueElement();
-    dummy_lqe->dummy = true;
-    dummy_lqe->from  = local_event->from;
-    dummy_lqe->type  = local_event->type;
-    dummy_lqe->address = local_event->address;
-    dummy_lqe->th_id   = local_event->th_id;
-    add_crq_event(event_time, dummy_lqe, from);
-    ++num_crq;
-  }
-
-  add_crq_event(event_time, local_event, from);
+  ASSERTX(from);
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_crq, event_time, local_event, this, from, num_flits_})) {
+    return;
+  }
+  num_crq   += num_flits_;
+  num_flits += num_flits_;
   num_data_transfers++;
+  crq_events.insert(std::pair<uint64_t, Packet>(arrival_time(event_time), Packet{local_event, from, num_flits_}));
 }
 
 
@@ -106,34 +135,28 @@ void Crossbar::add_rep_event(
     LocalQueueElement * local_event,
     Component * from) {
   ASSERTX(from);
-  if (event_time % process_interval != 0) {
-    event_time = event_time + process_interval - event_time%process_interval;
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_rep, event_time, local_event, this, from, 0})) {
+    return;
   }
   num_rep++;
   num_flits++;
-  geq->add_event(event_time, this);
-  rep_events.insert(std::pair<uint64_t, EventPair>(event_time, EventPair(local_event, from)));
+  rep_events.insert(std::pair<uint64_t, Packet>(arrival_time(event_time), Packet{local_event, from, 1}));
 }
 
 
 void Crossbar::add_rep_event(
     uint64_t event_time,
     LocalQueueElement * local_event,
-    uint32_t num_flits,
+    uint32_t num_flits_,
     Component * from) {
-  for (uint32_t i = 0; i < num_flits - 1; i++) {
-    LocalQueueElement * dummy_lqe = new LocalQueueElement();
-    dummy_lqe->dummy = true;
-    dummy_lqe->from  = local_event->from;
-    dummy_lqe->type  = local_event->type;
-    dummy_lqe->address = local_event->address;
-    dummy_lqe->th_id   = local_event->th_id;
-    add_rep_event(event_time, dummy_lqe, from);
-    ++num_rep;
-  }
-
-  add_rep_event(event_time, local_event, from);
+  ASSERTX(from);
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_rep, event_time, local_event, this, from, num_flits_})) {
+    return;
+  }
+  num_rep   += num_flits_;
+  num_flits += num_flits_;
   num_data_transfers++;
+  rep_events.insert(std::pair<uint64_t, Packet>(arrival_time(event_time), Packet{local_event, from, num_flits_}));
 }
 
 
@@ -143,46 +166,28 @@ uint32_t Crossbar::process_event(uint64_t curr_time) {
   auto crq_event_iter = crq_events.begin();
 
   while (rep_event_iter != rep_events.end() && rep_event_iter->first == curr_time) {
-    if (rep_event_iter->second.first->type == et_evict ||
-        rep_event_iter->second.first->type == et_invalidate ||
-        rep_event_iter->second.first->type == et_invalidate_nd ||
-        rep_event_iter->second.first->type == et_nop ||
-        rep_event_iter->second.first->type == et_e_to_i ||
-        rep_event_iter->second.first->type == et_e_to_m) {
-      uint32_t which_mc = geq->which_mc(rep_event_iter->second.first->address);
-      queues[rep_event_iter->second.second->num].insert(
-        std::pair<noc_priority, EventPair>(
-          noc_rep, EventPair(
-            rep_event_iter->second.first,
-            directory[which_mc])));
-    } else {
-      queues[rep_event_iter->second.second->num].insert(
-        std::pair<noc_priority, EventPair>(
-          noc_rep, EventPair(
-            rep_event_iter->second.first,
-            rep_event_iter->second.first->from.top())));
-    }
+    const Packet & packet = rep_event_iter->second;
+    queues[packet.node->num][noc_rep].push_back(
+      Packet{packet.lqe, rep_destination(packet.lqe), packet.num_flits});
     ++rep_event_iter;
   }
 
   while (crq_event_iter != crq_events.end() && crq_event_iter->first == curr_time) {
     // special case --  from.top() is the target L2
-    queues[crq_event_iter->second.second->num].insert(
-      std::pair<noc_priority, EventPair>(
-        noc_crq, EventPair(
-          crq_event_iter->second.first,
-          crq_event_iter->second.first->from.top())));
-    crq_event_iter->second.first->from.pop();
+    const Packet & packet = crq_event_iter->second;
+    queues[packet.node->num][noc_crq].push_back(
+      Packet{packet.lqe, packet.lqe->from.top(), packet.num_flits});
+    packet.lqe->from.pop();
     ++crq_event_iter;
   }
 
   while (req_event_iter != req_events.end() && req_event_iter->first == curr_time) {
     // process the first request event
     // TODO(gajh) : it is assumed that (directory[i]->num == i)
-    uint32_t which_mc  = geq->which_mc(req_event_iter->second.first->address);
-    queues[req_event_iter->second.second->num].insert(
-      std::pair<noc_priority, EventPair>(
-        noc_req, EventPair(req_event_iter->second.first, directory[which_mc])));
+    const Packet & packet = req_event_iter->second;
+    uint32_t which_mc = geq->which_mc(packet.lqe->address);
+    queues[packet.node->num][noc_req].push_back(
+      Packet{packet.lqe, directory[which_mc], packet.num_flits});
     ++req_event_iter;
   }
 
@@ -191,46 +196,28 @@ uint32_t Crossbar::process_event(uint64_t curr_time) {
   rep_events.erase(curr_time);  // add_rep_event
 
 
-  // send events to destinations
-  for (uint32_t i = 0; i < num_ports; i++) {
-    already_sent[i] = false;
-  }
-
+  // send flits to destinations; a port sends up to two flits, the first
+  // packet and then the next one, to destinations that took nothing else
+  // in this cycle.  the flits of a packet go to the same destination, so a
+  // packet with flits left hides the packets behind it.
   for (uint32_t i = 0; i < num_ports; i++) {
     uint32_t idx = top_priority + num_ports;
     idx += ((clockwise == true) ? i : (0-i));
     idx %= num_ports;
 
-    auto iter = queues[idx].begin();
-    if (iter != queues[idx].end()) {
-      if (already_sent[iter->second.second->num] == false) {
-        already_sent[iter->second.second->num] = true;
-        if (iter->second.first->dummy == true) {
-          delete iter->second.first;
-        } else if (iter->first == noc_req) {
-          iter->second.second->add_req_event(curr_time + xbar_to_dir_t, iter->second.first);
-        } else {
-          iter->second.second->add_rep_event(curr_time + xbar_to_dir_t, iter->second.first);
-        }
-        queues[idx].erase(iter);
-        iter = queues[idx].begin();
-      } else {
-        ++iter;
-      }
+    noc_priority priority;
+    uint32_t     pos;
+    if (nth_packet(idx, 0, priority, pos) == false) continue;
 
-      if (iter != queues[idx].end()) {
-        if (already_sent[iter->second.second->num] == false) {
-          already_sent[iter->second.second->num] = true;
-          if (iter->second.first->dummy == true) {
-            delete iter->second.first;
-          } else if (iter->first == noc_req) {
-            iter->second.second->add_req_event(curr_time + xbar_to_dir_t, iter->second.first);
-          } else {
-            iter->second.second->add_rep_event(curr_time + xbar_to_dir_t, iter->second.first);
-          }
-          queues[idx].erase(iter);
-        }
-      }
+    bool check_next;
+    const Packet & packet = queues[idx][priority][pos];
+    if (busy_until[packet.node->num] <= curr_time) {
+      check_next = send_flit(curr_time, idx, priority, pos) && nth_packet(idx, 0, priority, pos);
+    } else {
+      check_next = packet.num_flits == 1 && nth_packet(idx, 1, priority, pos);
+    }
+    if (check_next == true && busy_until[queues[idx][priority][pos].node->num] <= curr_time) {
+      send_flit(curr_time, idx, priority, pos);
     }
   }
   if (clockwise == true) {
@@ -240,8 +227,10 @@ uint32_t Crossbar::process_event(uint64_t curr_time) {
     top_priority = (top_priority + 1)%num_ports;
   }
 
+  noc_priority priority;
+  uint32_t     pos;
   for (uint32_t i = 0; i < num_ports; i++) {
-    if (queues[i].empty() == false) {
+    if (nth_packet(i, 0, priority, pos) == true) {
       geq->add_event(curr_time + process_interval, this);
       break;
     }
@@ -250,4 +239,392 @@ uint32_t Crossbar::process_event(uint64_t curr_time) {
   return 0;
 }
 
+
+bool Crossbar::nth_packet(uint32_t port, uint32_t n, noc_priority & priority, uint32_t & pos) {
+  for (uint32_t p = noc_rep; p <= noc_req; p++) {
+    const auto & queue = queues[port][p];
+    if (n < queue.size()) {
+      priority = (noc_priority)p;
+      pos      = n;
+      return true;
+    }
+    n -= queue.size();
+  }
+  return false;
+}
+
+
+bool Crossbar::send_flit(uint64_t curr_time, uint32_t port, noc_priority priority, uint32_t pos) {
+  auto & queue = queues[port][priority];
+  Packet & packet = queue[pos];
+  busy_until[packet.node->num] = curr_time + process_interval;
+  if (--packet.num_flits > 0) return false;
+
+  forward(curr_time + xbar_to_dir_t, priority, packet.lqe, packet.node);
+  queue.erase(queue.begin() + pos);
+  return true;
+}
+
+
+RouterNoC::RouterNoC(
+    component_type type_,
+    uint32_t num_,
+    McSim * mcsim_,
+    uint32_t num_nodes_,
+    uint32_t num_router_ports_):
+  NoC(type_, num_, mcsim_),
+  num_nodes(num_nodes_), num_router_ports(num_router_ports_),
+  hop_t(get_param_uint64("hop_t", "pts.noc.", 20)),
+  to_dir_t(get_param_uint64("to_dir_t", "pts.noc.", 10)),
+  to_l2_t(get_param_uint64("to_l2_t", "pts.noc.", 10)),
+  buffer_sz(get_param_uint64("buffer_sz", "pts.noc.", 0)),
+  display_links(mcsim_->pts->get_param_bool("pts.noc.display_links", false)),
+  name("NoC"), routers(num_nodes_), injections(), num_in_flight(0),
+  num_packets(0), tot_hops(0), tot_latency(0), max_buffered(0), num_credit_stalls(0),
+  last_time(0) {
+  process_interval = get_param_uint64("process_interval", "pts.noc.", 10);
+  CHECK(num_nodes > 0 && hop_t > 0 && process_interval > 0);
+  CHECK(buffer_sz == 0 || buffer_sz >= 2)
+    << "pts.noc.buffer_sz (" << buffer_sz << ") has to be 0 or at least 2";
+  for (auto && router : routers) {
+    router.inputs.resize(num_router_ports);
+    router.busy_until.assign(num_router_ports, 0);
+    router.next_input.assign(num_router_ports, 0);
+    router.num_flits.assign(num_router_ports, 0);
+    router.num_buffered = 0;
+  }
+}
+
+
+RouterNoC::~RouterNoC() {
+}
+
+
+void RouterNoC::print_stats() const {
+  if (num_packets == 0) return;
+  // a local stream keeps the fixed format off std::cout
+  std::ostringstream out;
+  out << "  -- " << name << " [" << std::setw(3) << num
+    << "] : (packets, avg_hops, avg_latency, max_buffered) = (" << num_packets << ", "
+    << std::setiosflags(std::ios::fixed) << std::setprecision(2)
+    << 1.0 * tot_hops / num_packets << ", " << 1.0 * tot_latency / num_packets << ", "
+    << max_buffered << ")" << std::endl;
+  if (buffer_sz > 0) {
+    out << "  -- " << name << " [" << std::setw(3) << num
+      << "] : buffer_sz = " << buffer_sz << ", cycles waited for a buffer slot = "
+      << num_credit_stalls << std::endl;
+  }
+
+  // the flits of a link over the flits it could have carried
+  const double   num_cycles = std::max<uint64_t>(last_time / process_interval, 1);
+  const uint32_t num_links  = [&]() {
+    uint32_t n = 0;
+    for (uint32_t node = 0; node < num_nodes; node++) {
+      for (uint32_t port = 1; port < num_router_ports; port++) {
+        if (neighbor(node, port) < num_nodes) n++;
+      }
+    }
+    return n;
+  }();
+  uint64_t tot_flits = 0, max_flits = 0, max_local_flits = 0;
+  uint32_t max_node  = 0, max_port  = 0;
+  for (uint32_t node = 0; node < num_nodes; node++) {
+    const Router & router = routers[node];
+    max_local_flits = std::max(max_local_flits, router.num_flits[local_port]);
+    for (uint32_t port = 1; port < num_router_ports; port++) {
+      tot_flits += router.num_flits[port];
+      if (router.num_flits[port] > max_flits) {
+        max_flits = router.num_flits[port];
+        max_node  = node;
+        max_port  = port;
+      }
+    }
+  }
+  out << "  -- " << name << " [" << std::setw(3) << num
+    << "] : link utilization (avg, max) = ("
+    << 100.0 * tot_flits / std::max<uint32_t>(num_links, 1) / num_cycles << "%, "
+    << 100.0 * max_flits / num_cycles << "% at " << max_node << "." << port_name(max_port)
+    << "), max ejection utilization = " << 100.0 * max_local_flits / num_cycles << "%" << std::endl;
+
+  if (display_links == true) {
+    for (uint32_t node = 0; node < num_nodes; node++) {
+      out << "  -- " << name << " [" << std::setw(3) << num << "] : router "
+        << std::setw(3) << node << " utilization (%) =";
+      for (uint32_t port = 0; port < num_router_ports; port++) {
+        if (port != local_port && neighbor(node, port) >= num_nodes) continue;
+        out << " " << port_name(port) << ": " << 100.0 * routers[node].num_flits[port] / num_cycles;
+      }
+      out << std::endl;
+    }
+  }
+  std::cout << out.str();
+}
+
+
+void RouterNoC::inject(
+    uint64_t event_time,
+    LocalQueueElement * lqe,
+    Component * from,
+    Component * to,
+    uint32_t num_flits_,
+    noc_priority priority) {
+  event_time = ceil_by_y(event_time, process_interval);
+  geq->add_event(event_time, this);
+  injections.insert(std::make_pair(event_time, std::make_pair(from->num,
+      Packet{lqe, to, priority, num_flits_, event_time, event_time, 0})));
+  num_in_flight++;
+}
+
+
+void RouterNoC::add_req_event(
+    uint64_t event_time,
+    LocalQueueElement * local_event,
+    Component * from) {
+  ASSERTX(from);
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_req, event_time, local_event, this, from, 0})) {
+    return;
+  }
+  num_req++;
+  num_flits++;
+  inject(event_time, local_event, from, directory[geq->which_mc(local_event->address)], 1, noc_req);
+}
+
+
+void RouterNoC::add_crq_event(
+    uint64_t event_time,
+    LocalQueueElement * local_event,
+    Component * from) {
+  add_crq_event(event_time, local_event, 1, from);
+  num_data_transfers--;
+}
+
+
+void RouterNoC::add_crq_event(
+    uint64_t event_time,
+    LocalQueueElement * local_event,
+    uint32_t num_flits_,
+    Component * from) {
+  ASSERTX(from);
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_crq, event_time, local_event, this, from, num_flits_})) {
+    return;
+  }
+  num_crq   += num_flits_;
+  num_flits += num_flits_;
+  num_data_transfers++;
+  // special case --  from.top() is the target L2
+  Component * to = local_event->from.top();
+  local_event->from.pop();
+  inject(event_time, local_event, from, to, num_flits_, noc_crq);
+}
+
+
+void RouterNoC::add_rep_event(
+    uint64_t event_time,
+    LocalQueueElement * local_event,
+    Component * from) {
+  add_rep_event(event_time, local_event, 1, from);
+  num_data_transfers--;
+}
+
+
+void RouterNoC::add_rep_event(
+    uint64_t event_time,
+    LocalQueueElement * local_event,
+    uint32_t num_flits_,
+    Component * from) {
+  ASSERTX(from);
+  if (geq->post_remote(RemoteEvent{RemoteEvent::re_rep, event_time, local_event, this, from, num_flits_})) {
+    return;
+  }
+  num_rep   += num_flits_;
+  num_flits += num_flits_;
+  num_data_transfers++;
+  inject(event_time, local_event, from, rep_destination(local_event), num_flits_, noc_rep);
+}
+
+
+uint32_t RouterNoC::process_event(uint64_t curr_time) {
+  auto iter = injections.begin();
+  for (; iter != injections.end() && iter->first == curr_time; ++iter) {
+    Router & router = routers[iter->second.first];
+    router.inputs[local_port][iter->second.second.priority].push_back(iter->second.second);
+    router.num_buffered++;
+  }
+  injections.erase(injections.begin(), iter);
+
+  for (uint32_t node = 0; node < num_nodes; node++) {
+    Router & router = routers[node];
+    if (router.num_buffered == 0) continue;
+    for (uint32_t out = 0; out < num_router_ports; out++) {
+      if (router.busy_until[out] <= curr_time) arbitrate(curr_time, node, out);
+    }
+  }
+  last_time = curr_time;
+
+  if (num_in_flight > injections.size()) {  // some are in the routers
+    geq->add_event(curr_time + process_interval, this);
+  }
+  return 0;
+}
+
+
+bool RouterNoC::arbitrate(uint64_t curr_time, uint32_t node, uint32_t out) {
+  Router & router = routers[node];
+  for (uint32_t i = 0; i < num_router_ports; i++) {
+    const uint32_t in = (router.next_input[out] + i) % num_router_ports;
+    for (uint32_t p = noc_rep; p <= noc_req; p++) {
+      auto & buffer = router.inputs[in][p];
+      if (buffer.empty() == true || buffer.front().ready_time > curr_time ||
+          route(node, buffer.front().to->num) != out) {
+        continue;
+      }
+      if (out != local_port && buffer_sz > 0 &&
+          routers[neighbor(node, out)].inputs[opposite(out)][p].size() +
+          ((in == local_port) ? 2 : 1) > buffer_sz) {
+        num_credit_stalls++;
+        continue;
+      }
+      Packet packet = buffer.front();
+      buffer.pop_front();
+      router.num_buffered--;
+      router.next_input[out]  = (in + 1) % num_router_ports;
+      router.busy_until[out]  = curr_time + packet.num_flits * process_interval;
+      router.num_flits[out]  += packet.num_flits;
+
+      const uint64_t tail_time = curr_time + (packet.num_flits - 1) * process_interval;
+      if (out == local_port) {
+        const uint64_t event_time = tail_time +
+          ((packet.to->type == ct_directory) ? to_dir_t : to_l2_t);
+        num_in_flight--;
+        num_packets++;
+        tot_hops    += packet.num_hops;
+        tot_latency += event_time - packet.inject_time;
+        forward(event_time, packet.priority, packet.lqe, packet.to);
+      } else {
+        packet.ready_time = tail_time + hop_t;
+        packet.num_hops++;
+        Router & next = routers[neighbor(node, out)];
+        auto & next_buffer = next.inputs[opposite(out)][packet.priority];
+        next_buffer.push_back(packet);
+        next.num_buffered++;
+        max_buffered = std::max<uint64_t>(max_buffered, next_buffer.size());
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// the largest divisor of num_nodes up to its square root unless given
+static uint32_t mesh_width(McSim * mcsim, uint32_t num_nodes) {
+  uint32_t width = mcsim->pts->get_param_uint64("pts.noc.mesh_width", 0);
+  if (width == 0) {
+    for (width = 1; (width + 1) * (width + 1) <= num_nodes; width++) { }
+    while (num_nodes % width != 0) width--;
+  }
+  CHECK(width > 0 && num_nodes % width == 0)
+    << "pts.noc.mesh_width (" << width << ") has to divide the number of L2s (" << num_nodes << ")";
+  return width;
+}
+
+
+Mesh2D::Mesh2D(
+    component_type type_,
+    uint32_t num_,
+    McSim * mcsim_,
+    uint32_t num_nodes_):
+  RouterNoC(type_, num_, mcsim_, num_nodes_, 5),
+  width(mesh_width(mcsim_, num_nodes_)) {
+  name = "Mesh";
+}
+
+
+Mesh2D::~Mesh2D() {
+  print_stats();
+}
+
+
+uint32_t Mesh2D::route(uint32_t node, uint32_t dest) const {
+  if (dest % width > node % width) return mesh_east;
+  if (dest % width < node % width) return mesh_west;
+  if (dest / width > node / width) return mesh_south;
+  if (dest / width < node / width) return mesh_north;
+  return mesh_local;
+}
+
+
+uint32_t Mesh2D::neighbor(uint32_t node, uint32_t port) const {
+  switch (port) {
+    case mesh_east:  return (node % width + 1 < width) ? node + 1 : num_nodes;
+    case mesh_west:  return (node % width > 0) ? node - 1 : num_nodes;
+    case mesh_north: return (node >= width) ? node - width : num_nodes;
+    case mesh_south: return (node + width < num_nodes) ? node + width : num_nodes;
+    default:         return node;
+  }
+}
+
+
+uint32_t Mesh2D::opposite(uint32_t port) const {
+  switch (port) {
+    case mesh_east:  return mesh_west;
+    case mesh_west:  return mesh_east;
+    case mesh_north: return mesh_south;
+    case mesh_south: return mesh_north;
+    default:         return mesh_local;
+  }
+}
+
+
+const char * Mesh2D::port_name(uint32_t port) const {
+  static const char * names[] = { "local", "E", "W", "N", "S" };
+  return names[port];
+}
+
+
+Ring::Ring(
+    component_type type_,
+    uint32_t num_,
+    McSim * mcsim_,
+    uint32_t num_nodes_):
+  RouterNoC(type_, num_, mcsim_, num_nodes_, 3) {
+  name = "Ring";
+}
+
+
+Ring::~Ring() {
+  print_stats();
+}
+
+
+uint32_t Ring::route(uint32_t node, uint32_t dest) const {
+  if (dest == node) return ring_local;
+  const uint32_t cw_hops = (dest + num_nodes - node) % num_nodes;
+  return (cw_hops <= num_nodes - cw_hops) ? ring_cw : ring_ccw;
+}
+
+
+uint32_t Ring::neighbor(uint32_t node, uint32_t port) const {
+  switch (port) {
+    case ring_cw:  return (node + 1) % num_nodes;
+    case ring_ccw: return (node + num_nodes - 1) % num_nodes;
+    default:       return node;
+  }
+}
+
+
+uint32_t Ring::opposite(uint32_t port) const {
+  switch (port) {
+    case ring_cw:  return ring_ccw;
+    case ring_ccw: return ring_cw;
+    default:       return ring_local;
+  }
+}
+
+
+const char * Ring::port_name(uint32_t port) const {
+  static const char * names[] = { "local", "cw", "ccw" };
+  return names[port];
+}
+
 }  // namespace PinPthread
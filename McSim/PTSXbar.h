@@ -5,6 +5,8 @@
 #ifndef MCSIM_PTSXBAR_H_
 #define MCSIM_PTSXBAR_H_
 
+#include <array>
+#include <deque>
 #include <list>
 #include <map>
 #include <queue>
@@ -35,6 +37,13 @@ class NoC : public Component {
   virtual void add_rep_event(uint64_t, LocalQueueElement *, Component * from = NULL) = 0;
   virtual void add_rep_event(uint64_t, LocalQueueElement *, uint32_t num_flits, Component * from = NULL) = 0;
   virtual uint32_t process_event(uint64_t curr_time) = 0;
+
+ protected:
+  // a reply of these types goes to the directory of its address; the rest
+  // go to from.top()
+  Component * rep_destination(LocalQueueElement * lqe);
+  // hand an event over to its destination
+  void forward(uint64_t event_time, noc_priority priority, LocalQueueElement * lqe, Component * to);
 };
 
 
@@ -43,13 +52,25 @@ class Crossbar : public NoC {
   explicit Crossbar(component_type type_, uint32_t num_, McSim * mcsim_, uint32_t num_ports_);
   ~Crossbar();
 
+  // a packet is a single entry however many flits it has; num_flits counts
+  // the flits that have not crossed yet, and the event goes to its
+  // destination with the last one.
+  struct Packet {
+    LocalQueueElement * lqe;
+    Component * node;  // where it is from while arriving, where it goes in a queue
+    uint32_t    num_flits;
+  };
+
   // not sure if req_queue and rep_queue are enough to avoid deadlock (due to
   // circular dependency with finite buffer size) or more queues are necessary.
-  std::multimap<uint64_t, EventPair> crq_events;  // <event, from>
-  std::multimap<uint64_t, EventPair> req_events;
-  std::multimap<uint64_t, EventPair> rep_events;
-  std::vector< std::multimap<noc_priority, EventPair> > queues;  // <event, to>
-  std::vector<bool> already_sent;
+  std::multimap<uint64_t, Packet> crq_events;  // <event, from>
+  std::multimap<uint64_t, Packet> req_events;
+  std::multimap<uint64_t, Packet> rep_events;
+  // per input port, a FIFO per noc_priority; <event, to>
+  std::vector< std::array<std::deque<Packet>, 3> > queues;
+  // a destination takes a flit per process_interval; indexed by the num of
+  // the destination, so a directory and an L2 of the same num share one
+  std::vector<uint64_t> busy_until;
 
   const uint32_t xbar_to_dir_t;
   const uint32_t xbar_to_l2_t;
@@ -65,6 +86,136 @@ class Crossbar : public NoC {
   void add_rep_event(uint64_t, LocalQueueElement *, Component * from = NULL);
   void add_rep_event(uint64_t, LocalQueueElement *, uint32_t num_flits, Component * from = NULL);
   uint32_t process_event(uint64_t curr_time);
+
+ private:
+  // aligns event_time to the next cycle and wakes the crossbar up then
+  uint64_t arrival_time(uint64_t event_time);
+  // the n-th packet of an input port in the order of noc_priority is at
+  // queues[port][priority][pos]; false if there are not that many
+  bool nth_packet(uint32_t port, uint32_t n, noc_priority & priority, uint32_t & pos);
+  // a flit of the packet crosses; with the last one, the event goes to its
+  // destination, the packet leaves the queue, and it returns true
+  bool send_flit(uint64_t curr_time, uint32_t port, noc_priority priority, uint32_t pos);
+};
+
+
+// a network of routers, one per L2 cluster.  node i is the router of L2 i
+// and directory i.  port 0 of a router is the local one, and the topology
+// gives the other ports and the route.  a packet waits in the input buffer
+// of a router (a FIFO per noc_priority and input port) until it wins its
+// output port.  an output link carries a flit per process_interval, and a
+// packet moves as a whole (store and forward): its last flit reaches the
+// next router hop_t after its first one leaves.  each output port serves
+// its input ports round robin.
+// the buffers between routers hold buffer_sz packets (0: as many as
+// needed); a packet takes a slot of the next buffer when it leaves (a
+// credit) and gives it back when it leaves that buffer, and waits while
+// there is none.  a packet from the local port needs two free slots so that
+// a ring always keeps one (bubble flow control) and cannot deadlock.
+class RouterNoC : public NoC {
+ public:
+  RouterNoC(component_type type_, uint32_t num_, McSim * mcsim_,
+            uint32_t num_nodes_, uint32_t num_router_ports_);
+  virtual ~RouterNoC();
+
+  void add_req_event(uint64_t, LocalQueueElement *, Component * from = NULL);
+  void add_crq_event(uint64_t, LocalQueueElement *, Component * from = NULL);  // coherence request
+  void add_crq_event(uint64_t, LocalQueueElement *, uint32_t num_flits, Component * from = NULL);
+  void add_rep_event(uint64_t, LocalQueueElement *, Component * from = NULL);
+  void add_rep_event(uint64_t, LocalQueueElement *, uint32_t num_flits, Component * from = NULL);
+  uint32_t process_event(uint64_t curr_time);
+
+  static const uint32_t local_port = 0;
+
+  const uint32_t num_nodes;
+  const uint32_t num_router_ports;
+  const uint32_t hop_t;      // router and link of a hop
+  const uint32_t to_dir_t;   // from the local port of a router
+  const uint32_t to_l2_t;
+  const uint32_t buffer_sz;  // packets per input buffer of a link
+  const bool     display_links;
+
+ protected:
+  // the output port toward dest, or local_port at dest
+  virtual uint32_t route(uint32_t node, uint32_t dest) const = 0;
+  // the router at the other end of an output port and the input port there
+  virtual uint32_t neighbor(uint32_t node, uint32_t port) const = 0;
+  virtual uint32_t opposite(uint32_t port) const = 0;
+  virtual const char * port_name(uint32_t port) const = 0;
+  const char * name;  // in the stats
+
+  struct Packet {
+    LocalQueueElement * lqe;
+    Component * to;
+    noc_priority priority;
+    uint32_t    num_flits;
+    uint64_t    ready_time;   // when it is all in the input buffer
+    uint64_t    inject_time;
+    uint32_t    num_hops;
+  };
+  struct Router {
+    // [input port][noc_priority]
+    std::vector< std::array<std::deque<Packet>, 3> > inputs;
+    std::vector<uint64_t> busy_until;  // per output port
+    std::vector<uint32_t> next_input;  // per output port, round robin
+    std::vector<uint64_t> num_flits;   // per output port
+    uint32_t num_buffered;
+  };
+  std::vector<Router> routers;
+  // packets entering the network, <time, (node, packet)>
+  std::multimap<uint64_t, std::pair<uint32_t, Packet> > injections;
+  uint64_t num_in_flight;
+
+  // stats
+  uint64_t num_packets;
+  uint64_t tot_hops;
+  uint64_t tot_latency;     // from the injection to the local port of dest
+  uint64_t max_buffered;    // packets in an input buffer
+  uint64_t num_credit_stalls;  // cycles a packet at the head waited for a slot
+  uint64_t last_time;
+
+  void inject(uint64_t event_time, LocalQueueElement * lqe, Component * from,
+              Component * to, uint32_t num_flits, noc_priority priority);
+  // the packet of an input port that wins output port out of node moves on;
+  // false if none can
+  bool arbitrate(uint64_t curr_time, uint32_t node, uint32_t out);
+  // from the destructors of the subclasses, which still know the topology
+  void print_stats() const;
+};
+
+
+// pts.noc_type = "mesh": width x (num_nodes / width) routers with XY routing;
+// node i is at (i % width, i / width).
+class Mesh2D : public RouterNoC {
+ public:
+  Mesh2D(component_type type_, uint32_t num_, McSim * mcsim_, uint32_t num_nodes_);
+  ~Mesh2D();
+
+  enum mesh_port { mesh_local, mesh_east, mesh_west, mesh_north, mesh_south };
+  const uint32_t width;
+
+ protected:
+  uint32_t route(uint32_t node, uint32_t dest) const;
+  uint32_t neighbor(uint32_t node, uint32_t port) const;
+  uint32_t opposite(uint32_t port) const;
+  const char * port_name(uint32_t port) const;
+};
+
+
+// pts.noc_type = "ring": a bidirectional ring; a packet takes the shorter
+// way, clockwise (to node + 1) on a tie.
+class Ring : public RouterNoC {
+ public:
+  Ring(component_type type_, uint32_t num_, McSim * mcsim_, uint32_t num_nodes_);
+  ~Ring();
+
+  enum ring_port { ring_local, ring_cw, ring_ccw };
+
+ protected:
+  uint32_t route(uint32_t node, uint32_t dest) const;
+  uint32_t neighbor(uint32_t node, uint32_t port) const;
+  uint32_t opposite(uint32_t port) const;
+  const char * port_name(uint32_t port) const;
 };
 
 }  // namespace PinPthread
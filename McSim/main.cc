@@ -6,6 +6,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <wait.h>
 #include <arpa/inet.h>
@@ -17,6 +18,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 
+#include <algorithm>
 #include <experimental/filesystem>
 #include <fstream>
 #include <iostream>
@@ -29,6 +31,7 @@
 #include "McSim.h"
 #include "PTS.h"
 #include "PTSProcessDescription.h"
+#include "PTSTrace.h"
 
 #ifdef LOG_TRACE
 using std::hex;
@@ -45,6 +48,7 @@ DEFINE_string(mdfile, "md.toml", "Machine Description file: TOML format is used.
 DEFINE_string(runfile, "run.toml", "How to run applications: TOML format is used.");
 DEFINE_string(instrs_skip, "0", "# of instructions to skip before timing simulation starts.");
 DEFINE_bool(run_manually, false, "Whether to run the McSimA+ frontend manually or not.");
+DEFINE_bool(trace_with_pin, false, "Whether to play traces through the pintool instead of in the backend.");
 
 
 #ifdef LOG_TRACE
@@ -82,6 +86,133 @@ static void sig_handler(const int sig) {
     LOG(INFO) << "[" << strsignal(sig) << "] Frontend process (" << pid << ") killed" << std::endl;
 }
 
+// when every process is a trace, the backend plays them by itself -- no Pin
+// and no handshake through the mmaped files.  a trace runs on its own hthread.
+static void play_traces(
+    PinPthread::PthreadTimingSimulator * pts,
+    std::vector<std::unique_ptr<PinPthread::TraceReader>> & traces,
+    uint64_t max_total_instrs,
+    uint64_t num_instrs_per_th,
+    int32_t  addr_offset_lsb,
+    int32_t  interleave_base_bit) {
+  PinPthread::McSim * mcsim = pts->mcsim;
+  uint32_t num_traces = traces.size();
+  uint32_t nactive    = num_traces;
+  uint32_t num_th_passed_instr_count = 0;
+  std::vector<uint64_t> num_fetched_instrs(num_traces, 0);
+
+  // fill the o3queue of a thread like the frontend does -- one instruction
+  // to learn the room left and then up to one entry short of full
+  std::vector<PTSInstr> instrs;
+  auto feed = [&](uint32_t htid, uint64_t curr_time) {
+    uint64_t addr_offset = (((uint64_t)htid) << addr_offset_lsb) + (((uint64_t)htid) << interleave_base_bit);
+    uint32_t num_to_add  = 1;
+
+    while (traces[htid] != nullptr && num_to_add > 0) {
+      instrs.clear();
+      while (instrs.size() < num_to_add) {
+        const PTSInstrTrace * instr = traces[htid]->next();
+        if (instr == nullptr) break;
+        instrs.push_back(PTSInstr{htid, curr_time, instr->waddr, instr->wlen,
+            instr->raddr, instr->raddr2, instr->rlen, instr->ip, instr->category,
+            instr->isbranch, instr->isbranchtaken, false, false, false,
+            instr->rr0, instr->rr1, instr->rr2, instr->rr3,
+            instr->rw0, instr->rw1, instr->rw2, instr->rw3});
+      }
+
+      uint32_t num_available_slot = mcsim->add_instructions(instrs.data(), instrs.size(), 0, addr_offset);
+      uint64_t num_fetched        = num_fetched_instrs[htid];
+      num_fetched_instrs[htid]   += instrs.size();
+      if (num_fetched < num_instrs_per_th && num_fetched_instrs[htid] >= num_instrs_per_th) {
+        num_th_passed_instr_count++;
+        LOG(INFO) << "  -- hthread " << htid << " executed " << num_instrs_per_th
+          << " instrs at cycle " << curr_time << std::endl;
+      }
+
+      if (instrs.size() < num_to_add) {
+        LOG(INFO) << "  -- hthread " << htid << " reached the end of "
+          << traces[htid]->trace_name << " at cycle " << curr_time << std::endl;
+        traces[htid].reset();
+        mcsim->set_active(htid, false);
+        nactive--;
+        break;
+      }
+      num_to_add = (num_available_slot > 1) ? num_available_slot - 1 : 0;
+    }
+  };
+
+  for (uint32_t htid = 0; htid < num_traces; htid++) {
+    mcsim->set_active(htid, true);
+    feed(htid, 0);
+  }
+
+  while (nactive > 0 && mcsim->num_fetched_instrs < max_total_instrs &&
+         num_th_passed_instr_count < num_traces) {
+    //       <thread_id, time   >
+    std::pair<uint32_t, uint64_t> ret = mcsim->resume_simulation(false);
+    if (ret.first >= num_traces) break;  // no more events
+    feed(ret.first, ret.second);
+  }
+}
+
+
+// with pts.warm_skipped_instrs, the instructions to skip warm the caches
+// instead of being dropped.  the traces take turns so that they share the
+// L2s and the directories as they would in the timing simulation.
+static void warm_traces(
+    PinPthread::PthreadTimingSimulator * pts,
+    std::vector<std::unique_ptr<PinPthread::TraceReader>> & traces,
+    const std::vector<uint64_t> & num_instrs_to_warm,
+    int32_t  addr_offset_lsb,
+    int32_t  interleave_base_bit) {
+  const uint32_t num_instrs_per_turn = 1024;
+  PinPthread::McSim * mcsim = pts->mcsim;
+  std::vector<uint64_t> num_warmed(traces.size(), 0);
+  std::vector<PTSInstr> instrs;
+  uint64_t num_total_warmed = 0;
+  struct timeval start;
+  gettimeofday(&start, NULL);
+
+  for (bool any_warmed = true; any_warmed == true; ) {
+    any_warmed = false;
+    for (uint32_t htid = 0; htid < traces.size(); htid++) {
+      uint64_t addr_offset = (((uint64_t)htid) << addr_offset_lsb) + (((uint64_t)htid) << interleave_base_bit);
+      instrs.clear();
+      while (instrs.size() < num_instrs_per_turn && num_warmed[htid] < num_instrs_to_warm[htid]) {
+        const PTSInstrTrace * instr = traces[htid]->next();
+        if (instr == nullptr) break;
+        num_warmed[htid]++;
+        instrs.push_back(PTSInstr{htid, 0, instr->waddr, instr->wlen,
+            instr->raddr, instr->raddr2, instr->rlen, instr->ip, instr->category,
+            instr->isbranch, instr->isbranchtaken, false, false, false,
+            instr->rr0, instr->rr1, instr->rr2, instr->rr3,
+            instr->rw0, instr->rw1, instr->rw2, instr->rw3});
+      }
+      if (instrs.empty() == true) continue;
+      mcsim->warm_instructions(instrs.data(), instrs.size(), 0, addr_offset);
+      num_total_warmed += instrs.size();
+      any_warmed = true;
+    }
+  }
+
+  struct timeval finish;
+  gettimeofday(&finish, NULL);
+  double msec = (finish.tv_sec*1000 + finish.tv_usec/1000) -
+                (start.tv_sec*1000 + start.tv_usec/1000);
+  LOG(INFO) << "  -- warmed the caches with " << num_total_warmed << " instrs in "
+    << msec/1000 << " sec" << std::endl;
+}
+
+
+static void print_simulation_time(const struct timeval & start) {
+  struct timeval finish;
+  gettimeofday(&finish, NULL);
+  double msec = (finish.tv_sec*1000 + finish.tv_usec/1000) -
+                (start.tv_sec*1000 + start.tv_usec/1000);
+  LOG(INFO) << "simulation time(sec) = " << msec/1000 << std::endl;
+}
+
+
 void setupSignalHandlers(void) {
   signal(SIGINT, sig_handler);  // Interrupt from keyboard
   signal(SIGHUP, sig_handler);  // Hangup detected on controlling terminal
@@ -109,7 +240,7 @@ int main(int argc, char * argv[]) {
 #endif
 
   uint32_t nactive = 0;
-  struct timeval start, finish;
+  struct timeval start;
   gettimeofday(&start, NULL);
 
   auto pts{ std::make_unique<PinPthread::PthreadTimingSimulator>(FLAGS_mdfile) };
@@ -123,6 +254,44 @@ int main(int argc, char * argv[]) {
 
   auto pd{ std::make_unique<PinPthread::ProcessDescription>(FLAGS_runfile) };
 
+  if (FLAGS_trace_with_pin == false &&
+      std::all_of(pd->pts_processes.begin(), pd->pts_processes.end(),
+        [](const PinPthread::PTSProcess & p) { return p.trace_name.size() > 0; })) {
+    CHECK(pd->num_hthreads <= pts->get_num_hthreads())
+      << "more traces (" << pd->num_hthreads << ") than the number of threads ("
+      << pts->get_num_hthreads() << ") specified in " << FLAGS_mdfile << std::endl;
+    std::vector<std::unique_ptr<PinPthread::TraceReader>> traces;
+    std::vector<uint64_t> num_instrs_to_warm;
+    bool warm_skipped_instrs = pts->get_param_bool("pts.warm_skipped_instrs", false);
+    for (auto && curr_process : pd->pts_processes) {
+      traces.emplace_back(std::make_unique<PinPthread::TraceReader>(
+          curr_process.trace_name, pts->get_param_bool("pts.repeat_playing", false)));
+      uint64_t num_instrs_to_skip = (curr_process.num_instrs_to_skip_first > 0) ?
+          curr_process.num_instrs_to_skip_first : std::stoull(FLAGS_instrs_skip);
+      if (warm_skipped_instrs == true) {
+        num_instrs_to_warm.push_back(num_instrs_to_skip);
+      } else {
+        traces.back()->skip(num_instrs_to_skip);
+      }
+    }
+    if (warm_skipped_instrs == true) {
+      warm_traces(pts.get(), traces, num_instrs_to_warm, addr_offset_lsb, interleave_base_bit);
+    }
+    if (pts->get_param_bool("pts.stack_distance_only", false) == true) {
+      // the whole run goes through the functional caches for the stack
+      // distances of the L2s (pts.l2$.sd_max_num_ways); no timing
+      num_instrs_to_warm.assign(traces.size(), (num_instrs_per_th > 0) ?
+          num_instrs_per_th : max_total_instrs / traces.size());
+      warm_traces(pts.get(), traces, num_instrs_to_warm, addr_offset_lsb, interleave_base_bit);
+      print_simulation_time(start);
+      return 0;
+    }
+    play_traces(pts.get(), traces, max_total_instrs, num_instrs_per_th,
+        addr_offset_lsb, interleave_base_bit);
+    print_simulation_time(start);
+    return 0;
+  }
+
   // it is assumed that pin and pintool names are listed in the first two lines
   char * pin_ptr     = getenv("PIN");
   char * pintool_ptr = getenv("PINTOOL");
@@ -161,17 +330,18 @@ int main(int argc, char * argv[]) {
     // shared memory setup
     curr_process.mmap_fd = open(curr_process.tmp_shared_name.c_str(), O_RDWR | O_CREAT, 0666);
     CHECK(curr_process.mmap_fd >= 0) << "ERROR: open syscall" << std::endl;
-    CHECK_EQ(ftruncate(curr_process.mmap_fd, sizeof(PTSMessage) + 2), 0) << "ftruncate failed\n";
+    CHECK_EQ(ftruncate(curr_process.mmap_fd, sizeof(PTSChannel)), 0) << "ftruncate failed\n";
 
-    curr_process.pmmap = reinterpret_cast<char *>(mmap(0, sizeof(PTSMessage) + 2,
-            PROT_READ | PROT_WRITE, MAP_SHARED, curr_process.mmap_fd, 0));
-    CHECK_NE(curr_process.pmmap, MAP_FAILED) << "ERROR: mmap syscall" << std::endl;
+    void * pmmap = mmap(0, sizeof(PTSChannel), PROT_READ | PROT_WRITE, MAP_SHARED, curr_process.mmap_fd, 0);
+    CHECK_NE(pmmap, MAP_FAILED) << "ERROR: mmap syscall" << std::endl;
 
     close(curr_process.mmap_fd);
 
-    curr_process.mmap_flag = reinterpret_cast<bool*>(curr_process.pmmap) + sizeof(PTSMessage);
-    (curr_process.mmap_flag)[0] = true;
-    (curr_process.mmap_flag)[1] = true;
+    // the file may be left over from an earlier run
+    memset(pmmap, 0, sizeof(PTSChannel));
+    curr_process.channel            = reinterpret_cast<PTSChannel *>(pmmap);
+    curr_process.num_requests       = 0;
+    curr_process.num_available_slot = 0;
   }
 
   // error checkings
@@ -279,12 +449,74 @@ int main(int argc, char * argv[]) {
   bool any_thread = true;
   uint32_t num_th_passed_instr_count = 0;
 
+  // adds what the pintool of a process published to its ring and returns
+  // how many; the process keeps the room left after the last one
+  auto drain_ring = [&](int curr_pid) -> uint64_t {
+    PinPthread::PTSProcess * curr_p = &(pd->pts_processes[curr_pid]);
+    PTSRing & ring = curr_p->channel->ring;
+    uint64_t num_instrs  = ring.num_used();
+    uint64_t addr_offset = (((uint64_t)curr_pid) << addr_offset_lsb) +
+                           (((uint64_t)curr_pid) << interleave_base_bit);
+
+    // at most two runs of consecutive slots, split where the ring wraps
+    for (uint64_t i = 0; i < num_instrs; ) {
+      PTSInstr * instrs = ring.slot(ring.tail + i);
+      uint64_t   num    = std::min<uint64_t>(num_instrs - i, ring.slot(0) + instr_ring_size - instrs);
+      curr_p->num_available_slot = pts->mcsim->add_instructions(instrs, num, curr_p->tid_to_htid, addr_offset);
+
+      for (PTSInstr * ptsinstr = instrs; ptsinstr != instrs + num; ptsinstr++) {
+        uint32_t htid = curr_p->tid_to_htid + ptsinstr->hthreadid_;
+#ifdef LOG_TRACE
+        if (ptsinstr->wlen != 0 && ptsinstr->rlen != 0) {
+          record_inst(ptsinstr, ptsinstr->waddr, "RW");
+        } else if (ptsinstr->wlen == 0 && ptsinstr->rlen !=0) {
+          if (ptsinstr->raddr2 != 0)
+            record_inst(ptsinstr, ptsinstr->raddr2, "R2");
+          else
+            record_inst(ptsinstr, ptsinstr->raddr, "R1");
+        } else if (ptsinstr->wlen != 0 && ptsinstr->rlen == 0) {
+          record_inst(ptsinstr, ptsinstr->waddr, "W");
+        } else if (ptsinstr->wlen == 0 && ptsinstr->rlen == 0 && ptsinstr->isbranch !=0) {
+          record_inst(ptsinstr, 0, "B");
+        } else {
+          record_inst(ptsinstr, 0, "E");
+        }
+#endif
+        if (++num_fetched_instrs[htid] == num_instrs_per_th && num_instrs_per_th > 0) {
+          num_th_passed_instr_count++;
+          LOG(INFO) << "  -- hthread " << htid << " executed " << num_instrs_per_th
+            << " instrs at cycle " << ptsinstr->curr_time_ << std::endl;
+        }
+      }
+      i += num;
+    }
+#ifdef LOG_TRACE
+    if (num_instrs > 0) {
+      InstTraceFile << setw(12) << num_instrs << "                    transfer complete !!!"
+        << std::endl;
+    }
+#endif
+    ring.consume(num_instrs);
+    return num_instrs;
+  };
+  // a pintool runs ahead of its requests while its credits last (see
+  // PTSCredit), so every ring is polled, not only the one of curr_pid
+  auto drain_rings = [&]() -> uint64_t {
+    uint64_t num_instrs = 0;
+    for (int pid = 0; pid < static_cast<int>(pd->pts_processes.size()); pid++) {
+      num_instrs += drain_ring(pid);
+    }
+    return num_instrs;
+  };
+
   while (any_thread) {
     PinPthread::PTSProcess * curr_p = &(pd->pts_processes[curr_pid]);
-    // recvfrom => shared recv
-    while ((curr_p->mmap_flag)[0]) {}
-    (curr_p->mmap_flag)[0] = true;
-    memcpy(curr_p->buffer, reinterpret_cast<PTSMessage *>(curr_p->pmmap), sizeof(PTSMessage));
+    // the pintool runs ahead until it sends a request; meanwhile add what the
+    // pintools publish, and whatever is left before serving the request
+    curr_p->num_requests = curr_p->channel->request.wait(curr_p->num_requests,
+        [&] { return drain_rings() > 0; });
+    drain_rings();
+    memcpy(curr_p->buffer, &(curr_p->channel->msg), offsetof(PTSMessage, str));
     PTSMessage * pts_m = curr_p->buffer;
 
     if (pts->mcsim->num_fetched_instrs >= max_total_instrs ||
@@ -323,95 +555,20 @@ int main(int argc, char * argv[]) {
           //     << ", curr_time = " << ret.second << std::endl;
           break;
         }
-      case pts_add_instruction: {
-          uint32_t num_instrs = pts_m->uint32_t_val;
-          uint32_t num_available_slot = 0;
-          assert(num_instrs > 0);
-          for (uint32_t i = 0; i < num_instrs; i++) {
-            PTSInstr * ptsinstr = &(pts_m->val.instr[i]);
-            num_available_slot = pts->mcsim->add_instruction(
-                curr_p->tid_to_htid + ptsinstr->hthreadid_,
-                ptsinstr->curr_time_,
-                ptsinstr->waddr + (ptsinstr->waddr  == 0 ? 0 :
-                  ((((uint64_t)curr_pid) << addr_offset_lsb) +
-                   (((uint64_t)curr_pid) << interleave_base_bit))),
-                ptsinstr->wlen,
-                ptsinstr->raddr + (ptsinstr->raddr  == 0 ? 0 :
-                  ((((uint64_t)curr_pid) << addr_offset_lsb) +
-                   (((uint64_t)curr_pid) << interleave_base_bit))),
-                ptsinstr->raddr2 + (ptsinstr->raddr2 == 0 ? 0 :
-                  ((((uint64_t)curr_pid) << addr_offset_lsb) +
-                   (((uint64_t)curr_pid) << interleave_base_bit))),
-                ptsinstr->rlen,
-                ptsinstr->ip +
-                  ((((uint64_t)curr_pid) << addr_offset_lsb) +
-                   (((uint64_t)curr_pid) << interleave_base_bit)),
-                ptsinstr->category,
-                ptsinstr->isbranch,
-                ptsinstr->isbranchtaken,
-                ptsinstr->islock,
-                ptsinstr->isunlock,
-                ptsinstr->isbarrier,
-                ptsinstr->rr0,
-                ptsinstr->rr1,
-                ptsinstr->rr2,
-                ptsinstr->rr3,
-                ptsinstr->rw0,
-                ptsinstr->rw1,
-                ptsinstr->rw2,
-                ptsinstr->rw3);
-#ifdef LOG_TRACE
-            if (ptsinstr->wlen != 0 && ptsinstr->rlen != 0) {
-              record_inst(ptsinstr, ptsinstr->waddr, "RW");
-            } else if (ptsinstr->wlen == 0 && ptsinstr->rlen !=0) {
-              if (ptsinstr->raddr2 != 0)
-                record_inst(ptsinstr, ptsinstr->raddr2, "R2");
-              else
-                record_inst(ptsinstr, ptsinstr->raddr, "R1");
-            } else if (ptsinstr->wlen != 0 && ptsinstr->rlen == 0) {
-              record_inst(ptsinstr, ptsinstr->waddr, "W");
-            } else if (ptsinstr->wlen == 0 && ptsinstr->rlen == 0 && ptsinstr->isbranch !=0) {
-              record_inst(ptsinstr, 0, "B");
-            } else {
-              record_inst(ptsinstr, 0, "E");
-            }
-#endif
-            // if (ptsinstr->isbarrier == true)
-            // {
-            //   pts->mcsim->resume_simulation(false);
-            // }
-          }
-#ifdef LOG_TRACE
-          InstTraceFile << setw(12) << num_instrs << "                    transfer complete !!!"
-            << std::endl;
-#endif
-          if (num_instrs_per_th > 0) {
-            if (num_fetched_instrs[curr_p->tid_to_htid + pts_m->val.instr[0].hthreadid_] < num_instrs_per_th &&
-                num_fetched_instrs[curr_p->tid_to_htid + pts_m->val.instr[0].hthreadid_] + num_instrs >= num_instrs_per_th) {
-              num_th_passed_instr_count++;
-              LOG(INFO) << "  -- hthread " << curr_p->tid_to_htid + pts_m->val.instr[0].hthreadid_
-                << " executed " << num_instrs_per_th << " instrs at cycle "
-                << pts_m->val.instr[0].curr_time_ << std::endl;
-            }
-          }
-          num_fetched_instrs[curr_p->tid_to_htid + pts_m->val.instr[0].hthreadid_] += num_instrs;
-          // PTSInstr * ptsinstr = &(pts_m->val.instr[0]);
-          // if (ptsinstr->curr_time_ >= 12100000)
-          //   std::cout << "add  tid = " << curr_p->tid_to_htid + ptsinstr->hthreadid_
-          //        << ", pid = " << curr_pid << ", curr_time = " << ptsinstr->curr_time_
-          //        << ", num_instr = " << num_instrs
-          //        << ", num_avilable_slot = " << num_available_slot << std::endl;
-          pts_m->uint32_t_val = num_available_slot;
-          break;
-        }
+      case pts_add_instruction:
+        // the batch was added while waiting or right above; the reply is the
+        // room left after its last instruction
+        CHECK(pts_m->uint32_t_val > 0) << "process " << curr_pid << " sent an empty batch" << std::endl;
+        pts_m->uint32_t_val = curr_p->num_available_slot;
+        break;
       case pts_get_num_hthreads:
         pts_m->uint32_t_val = pts->get_num_hthreads();
         break;
       case pts_get_param_uint64:
-        pts_m->uint64_t_val = pts->get_param_uint64(pts_m->val.str, pts_m->uint64_t_val);
+        pts_m->uint64_t_val = pts->get_param_uint64(curr_p->channel->msg.str, pts_m->uint64_t_val);
         break;
       case pts_get_param_bool:
-        pts_m->bool_val = pts->get_param_bool(pts_m->val.str, pts_m->bool_val);
+        pts_m->bool_val = pts->get_param_bool(curr_p->channel->msg.str, pts_m->bool_val);
         break;
       case pts_get_curr_time:
         pts_m->uint64_t_val = pts->get_curr_time();
@@ -447,11 +604,8 @@ int main(int argc, char * argv[]) {
         break;
     }
 
-    memcpy(
-      reinterpret_cast<PTSMessage *>(curr_p->pmmap),
-      curr_p->buffer,
-      sizeof(PTSMessage)-sizeof(instr_n_str));
-    (curr_p->mmap_flag)[1] = false;
+    memcpy(&(curr_p->channel->msg), curr_p->buffer, offsetof(PTSMessage, str));
+    curr_p->channel->reply.ring();
   }
 
   // {gajh}: comment out the for loop below because cores display
@@ -461,16 +615,13 @@ int main(int argc, char * argv[]) {
   //     << htid_to_tid[i] << " fetched " << num_fetched_instrs[i] << " instrs" << std::endl;
   // }
 
-  gettimeofday(&finish, NULL);
-  double msec = (finish.tv_sec*1000 + finish.tv_usec/1000) -
-                (start.tv_sec*1000 + start.tv_usec/1000);
-  LOG(INFO) << "simulation time(sec) = " << msec/1000 << std::endl;
+  print_simulation_time(start);
 
 #ifdef LOG_TRACE
   InstTraceFile.close();
 #endif
   for (auto && curr_process : pd->pts_processes) {
-    munmap(curr_process.pmmap, sizeof(PTSMessage)+2);
+    munmap(curr_process.channel, sizeof(PTSChannel));
     remove(curr_process.tmp_shared_name.c_str());
   }
 
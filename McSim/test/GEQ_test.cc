@@ -0,0 +1,347 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "GEQ_test.h"
+#include "gtest/gtest.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#include "../McSim.h"
+
+namespace PinPthread {
+namespace GEQTest {
+
+/* 1. START of EventCalendar Testing */
+TEST_F(EventCalendarTest, IsEmptyInitially) {
+  EventCalendar calendar(64);
+  UINT64 time;
+  Component * comp;
+
+  EXPECT_TRUE(calendar.empty());
+  EXPECT_EQ((size_t)0, calendar.size());
+  EXPECT_FALSE(calendar.peek(time, comp));
+}
+
+TEST_F(EventCalendarTest, DedupPerTick) {
+  EventCalendar calendar(64);
+  calendar.insert(10, comps[1]);
+  calendar.insert(10, comps[0]);
+  calendar.insert(10, comps[1]);
+  calendar.insert(20, comps[1]);
+  EXPECT_EQ((size_t)2, calendar.size());
+
+  UINT64 time;
+  Component * comp;
+  // components of a tick are visited in the order of std::set<Component *>
+  ASSERT_TRUE(calendar.peek(time, comp));
+  EXPECT_EQ((UINT64)10, time);
+  EXPECT_EQ(comps[0], comp);
+  calendar.erase(time, comp);
+  ASSERT_TRUE(calendar.peek(time, comp));
+  EXPECT_EQ((UINT64)10, time);
+  EXPECT_EQ(comps[1], comp);
+  calendar.erase(time, comp);
+  ASSERT_TRUE(calendar.peek(time, comp));
+  EXPECT_EQ((UINT64)20, time);
+  calendar.erase(time, comp);
+  EXPECT_TRUE(calendar.empty());
+}
+
+TEST_F(EventCalendarTest, FarAndPastEvents) {
+  EventCalendar calendar(64);
+  calendar.insert(100000, comps[2]);  // beyond the wheel
+  calendar.insert(100000, comps[2]);
+  calendar.insert(30, comps[0]);
+  EXPECT_EQ((size_t)2, calendar.size());
+
+  UINT64 time;
+  Component * comp;
+  ASSERT_TRUE(calendar.peek(time, comp));
+  EXPECT_EQ((UINT64)30, time);
+  calendar.erase(time, comp);
+
+  // an event scheduled before the current tick is still the next one
+  calendar.insert(5, comps[1]);
+  ASSERT_TRUE(calendar.peek(time, comp));
+  EXPECT_EQ((UINT64)5, time);
+  EXPECT_EQ(comps[1], comp);
+  calendar.erase(time, comp);
+
+  ASSERT_TRUE(calendar.peek(time, comp));
+  EXPECT_EQ((UINT64)100000, time);
+  EXPECT_EQ(comps[2], comp);
+  calendar.erase(time, comp);
+  EXPECT_TRUE(calendar.empty());
+}
+
+TEST_F(EventCalendarTest, PastEventInFullWheel) {
+  EventCalendar calendar(64);
+  calendar.insert(100, comps[0]);
+  calendar.insert(130, comps[1]);
+  calendar.insert(160, comps[2]);
+
+  UINT64 time;
+  Component * comp;
+  ASSERT_TRUE(calendar.peek(time, comp));  // the wheel covers [100, 164)
+  EXPECT_EQ((UINT64)100, time);
+
+  // the wheel moves back to [60, 124), and 130 and 160 wait in the heap
+  calendar.insert(60, comps[3]);
+  EXPECT_EQ((size_t)4, calendar.size());
+  EXPECT_TRUE(calendar.contains(160, comps[2]));
+  const UINT64 times[] = { 60, 100, 130, 160 };
+  const uint32_t order[] = { 3, 0, 1, 2 };
+  for (uint32_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(calendar.peek(time, comp));
+    EXPECT_EQ(times[i], time);
+    EXPECT_EQ(comps[order[i]], comp);
+    calendar.erase(time, comp);
+  }
+  EXPECT_TRUE(calendar.empty());
+}
+
+TEST_F(EventCalendarTest, Contains) {
+  EventCalendar calendar(64);
+  calendar.insert(10, comps[3]);
+  calendar.insert(100000, comps[4]);  // beyond the wheel
+
+  EXPECT_TRUE(calendar.contains(10, comps[3]));
+  EXPECT_FALSE(calendar.contains(10, comps[4]));
+  EXPECT_FALSE(calendar.contains(20, comps[3]));
+  EXPECT_TRUE(calendar.contains(100000, comps[4]));
+  calendar.erase(10, comps[3]);
+  EXPECT_FALSE(calendar.contains(10, comps[3]));
+}
+
+TEST_F(EventCalendarTest, TimedEventQueueFIFO) {
+  TimedEventQueue queue;
+  LocalQueueElement lqes[4];
+  const UINT64 far = 10 + TimedEventQueue::num_buckets;  // same bucket as tick 10
+
+  queue.push(far, &lqes[0]);   // takes the bucket
+  queue.push(10, &lqes[1]);    // overflows
+  queue.push(20, &lqes[2]);
+  queue.push(20, &lqes[3]);
+  EXPECT_EQ((size_t)4, queue.size());
+
+  EXPECT_EQ(nullptr, queue.pop(15));
+  EXPECT_EQ(&lqes[1], queue.pop(10));
+  EXPECT_EQ(nullptr, queue.pop(10));
+  EXPECT_EQ(&lqes[2], queue.pop(20));
+  EXPECT_EQ(&lqes[3], queue.pop(20));
+  EXPECT_EQ(&lqes[0], queue.pop(far));
+  EXPECT_TRUE(queue.empty());
+}
+
+// the parallel engine often releases an element on another thread than the
+// one that allocated it; the element goes back to the allocating thread
+TEST_F(LQEPoolTest, ReleasedByAnotherThread) {
+  const uint32_t num_lqes = 20000;
+  std::vector<LocalQueueElement *> lqes;
+  for (uint32_t round = 0; round < 4; round++) {
+    for (uint32_t i = 0; i < num_lqes; i++) {
+      lqes.push_back(LocalQueueElement::acquire(nullptr, et_read, i));
+    }
+    uint64_t num_slabs = LocalQueueElement::num_pool_slabs();
+    std::thread releaser([&] { for (auto && lqe : lqes) lqe->release(); });
+    releaser.join();
+    lqes.clear();
+
+    for (uint32_t i = 0; i < num_lqes; i++) {
+      lqes.push_back(LocalQueueElement::acquire(nullptr, et_read, i));
+    }
+    EXPECT_EQ(num_slabs, LocalQueueElement::num_pool_slabs());
+    for (auto && lqe : lqes) lqe->release();
+    lqes.clear();
+  }
+}
+
+TEST_F(LQEPoolTest, RouteTooDeep) {
+  const UINT32 max_depth = RouteStack::max_depth;
+  LocalQueueElement * lqe = LocalQueueElement::acquire();
+  for (uint32_t i = 0; i < max_depth; i++) lqe->from.push(nullptr);
+  EXPECT_EQ(max_depth, lqe->from.size());
+  EXPECT_DEATH(lqe->from.push(nullptr), "deeper than RouteStack::max_depth");
+  lqe->release();
+}
+
+/* 2. START of EventCalendar vs. std::map */
+// every component keeps rescheduling itself, mostly a few cycles ahead and
+// sometimes far away (e.g., DRAM refresh).  both queues must visit exactly
+// the same (time, component) sequence.
+template <typename PushFn, typename PopFn>
+static uint64_t run_events(uint64_t num_events, const std::vector<Component *> & comps,
+    PushFn push, PopFn pop, uint64_t & checksum) {
+  static const uint64_t latencies[] = { 0, 10, 10, 20, 40, 100, 300, 10, 20, 200000 };
+  uint64_t rng = 12345;
+  uint64_t time = 0;
+  Component * comp = nullptr;
+
+  for (uint32_t i = 0; i < comps.size(); i++) push(i * 10, comps[i]);
+  checksum = 0;
+  for (uint64_t i = 0; i < num_events; i++) {
+    pop(time, comp);
+    checksum = checksum * 31 + time + reinterpret_cast<uintptr_t>(comp);
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    push(time + latencies[(rng >> 33) % 10], comp);
+    push(time + latencies[(rng >> 45) % 9], comp);
+  }
+  return num_events;
+}
+
+static uint64_t run_map_queue(uint64_t num_events, const std::vector<Component *> & comps,
+    uint64_t & checksum) {
+  MapEventQueue map_queue;
+  return run_events(num_events, comps,
+      [&](UINT64 t, Component * c) { map_queue[t].insert(c); },
+      [&](UINT64 & t, Component * & c) {
+        auto iter = map_queue.begin();
+        t = iter->first;
+        c = *(iter->second.begin());
+        iter->second.erase(iter->second.begin());
+        if (iter->second.empty()) map_queue.erase(iter);
+      }, checksum);
+}
+
+static uint64_t run_calendar(uint64_t num_events, const std::vector<Component *> & comps,
+    uint64_t & checksum) {
+  EventCalendar calendar;
+  return run_events(num_events, comps,
+      [&](UINT64 t, Component * c) { calendar.insert(t, c); },
+      [&](UINT64 & t, Component * & c) {
+        calendar.peek(t, c);
+        calendar.erase(t, c);
+      }, checksum);
+}
+
+TEST_F(EventCalendarTest, SameOrderAsMap) {
+  uint64_t map_checksum = 0;
+  uint64_t calendar_checksum = 0;
+  run_map_queue(200000, comps, map_checksum);
+  run_calendar(200000, comps, calendar_checksum);
+  EXPECT_EQ(map_checksum, calendar_checksum);
+}
+
+// a benchmark; run it with --gtest_also_run_disabled_tests
+TEST_F(EventCalendarTest, DISABLED_Throughput) {
+  const uint64_t num_events = 2000000;
+  uint64_t map_checksum = 0;
+  uint64_t calendar_checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  run_map_queue(num_events, comps, map_checksum);
+  double map_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  run_calendar(num_events, comps, calendar_checksum);
+  double calendar_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  EXPECT_EQ(map_checksum, calendar_checksum);
+  std::cout << "  -- std::map<set> : " << num_events / map_sec / 1e6 << " M events/sec" << std::endl;
+  std::cout << "  -- EventCalendar : " << num_events / calendar_sec / 1e6 << " M events/sec" << std::endl;
+}
+
+
+std::string ParallelEventQueueTest::simulate(uint32_t num_sim_threads, uint64_t num_instrs_per_thread) {
+  std::string md_name = "/tmp/" + std::to_string(getpid()) + "_parallel_test.toml";
+  {
+    std::ifstream md_base("../Apps/md/test/test-md.toml");
+    std::ofstream md_file(md_name.c_str());
+    md_file << md_base.rdbuf()
+      << "\npts.num_sim_threads = " << num_sim_threads
+      << "\npts.limit_sim_threads_to_cores = false\n";
+  }
+
+  int fds[2];
+  EXPECT_EQ(pipe(fds), 0);
+  std::cout.flush();
+  pid_t child = fork();
+  if (child == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    {
+      PthreadTimingSimulator pts(md_name);
+      McSim * mcsim = pts.mcsim;
+      uint32_t num_hthreads = mcsim->get_num_hthreads();
+      std::vector<uint64_t> num_sent(num_hthreads, 0);
+      std::vector<uint64_t> seed(num_hthreads);
+      // a private and a shared region per thread, some branches and reads/writes
+      auto feed = [&](uint32_t htid, uint64_t curr_time) {
+        uint32_t num_available_slot = 2;
+        while (num_available_slot > 1 && num_sent[htid] < num_instrs_per_thread) {
+          seed[htid] = seed[htid] * 6364136223846793005ULL + 1442695040888963407ULL;
+          uint64_t x     = seed[htid] >> 20;
+          bool     share = (x % 7 == 0);
+          uint64_t addr  = (share ? 0x10000000ULL : 0x100000000ULL * (htid + 1)) +
+                           (x >> 8) % (share ? 4096 : 65536) * 64;
+          uint64_t raddr = (x % 3 == 0) ? addr : 0;
+          uint64_t waddr = (x % 5 == 0) ? addr + 8 : 0;
+          bool     br    = (x % 6 == 1);
+          num_available_slot = mcsim->add_instruction(htid, curr_time,
+              waddr, waddr ? 8 : 0, raddr, 0, raddr ? 8 : 0, 0x400000 + num_sent[htid] % 2000 * 4, 0,
+              br, br && ((x >> 3) & 1), false, false, false,
+              (x >> 10) % 16, (x >> 14) % 16, 0, 0, (x >> 18) % 16, 0, 0, 0);
+          num_sent[htid]++;
+        }
+        if (num_sent[htid] == num_instrs_per_thread) mcsim->set_active(htid, false);
+      };
+      for (uint32_t htid = 0; htid < num_hthreads; htid++) {
+        seed[htid] = 1000 + htid;
+        mcsim->set_active(htid, true);
+        feed(htid, 0);
+      }
+      while (true) {
+        std::pair<uint32_t, uint64_t> ret = mcsim->resume_simulation(false);
+        if (ret.first >= num_hthreads) break;
+        feed(ret.first, ret.second);
+      }
+      std::cout << "  -- final cycle : " << mcsim->get_curr_time() << std::endl;
+    }
+    std::cout.flush();
+    _exit(0);
+  }
+  close(fds[1]);
+  std::string out;
+  char buf[4096];
+  for (ssize_t num; (num = read(fds[0], buf, sizeof(buf))) > 0; ) {
+    out.append(buf, num);
+  }
+  close(fds[0]);
+  int status;
+  waitpid(child, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  remove(md_name.c_str());
+
+  // the engine reports itself, and how often a core was visited depends on
+  // the windows; everything else has to match
+  std::stringstream lines(out);
+  std::string line, stats;
+  while (std::getline(lines, line)) {
+    if (line.find("parallel engine") != std::string::npos) continue;
+    stats += std::regex_replace(line, std::regex("events= *[0-9]+, "), "") + "\n";
+  }
+  return stats;
+}
+
+
+TEST_F(ParallelEventQueueTest, SameAsSequential) {
+  const uint64_t num_instrs_per_thread = 1000;
+  std::string sequential = simulate(1, num_instrs_per_thread);
+  ASSERT_NE(sequential.find("final cycle"), std::string::npos);
+  for (uint32_t num_sim_threads : {2u, 4u}) {
+    EXPECT_EQ(simulate(num_sim_threads, num_instrs_per_thread), sequential)
+      << "with " << num_sim_threads << " threads";
+  }
+}
+
+}
+}
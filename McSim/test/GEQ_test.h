@@ -0,0 +1,50 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef GEQ_TEST_H_
+#define GEQ_TEST_H_
+
+#include "gtest/gtest.h"
+
+#include "../PTSComponent.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace PinPthread {
+namespace GEQTest {
+
+// the former global event queue, kept as a reference model
+using MapEventQueue = std::map<UINT64, std::set<Component *> >;
+
+class EventCalendarTest : public ::testing::Test {
+  protected:
+    static const uint32_t NUM_COMPS = 64;
+
+    virtual void SetUp() override {
+      // components are only used as keys, so fake addresses are enough
+      for (uintptr_t i = 1; i <= NUM_COMPS; i++) {
+        comps.push_back(reinterpret_cast<Component *>(i * 64));
+      }
+    }
+
+    std::vector<Component *> comps;
+};
+
+class LQEPoolTest : public ::testing::Test { };
+
+class ParallelEventQueueTest : public ::testing::Test {
+  protected:
+    // runs the same instruction stream on test-md.toml with num_sim_threads
+    // host threads in a child process, so that every run starts from the
+    // same heap, and returns what it printed
+    std::string simulate(uint32_t num_sim_threads, uint64_t num_instrs_per_thread);
+};
+
+}
+}
+
+#endif // GEQ_TEST_H_
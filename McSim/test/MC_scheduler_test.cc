@@ -20,6 +20,10 @@ std::shared_ptr<PthreadTimingSimulator> MCSchedTest::test_pts;
 MemoryControllerForTest* MCSchedTest::test_mc;
 std::vector<uint64_t> MCSchedTest::row_A_addresses;
 std::vector<uint64_t> MCSchedTest::row_B_addresses;
+std::shared_ptr<PthreadTimingSimulator> MCWriteQueueTest::wq_pts;
+MemoryControllerForTest* MCWriteQueueTest::wq_mc;
+DirectoryRecorder* MCWriteQueueTest::wq_dir;
+std::shared_ptr<PthreadTimingSimulator> MCRefreshTest::refresh_pts;
 
 /* 1. START of MC Build && Fixture Build Testing */
 TEST_F(MCSchedTest, CheckBuild) {
@@ -127,6 +131,226 @@ TEST_F(MCSchedTest, MCSchedulingOpen) {
   delete event_B_3;
 }
 
+// 2.4) The MC sleeps until the next command can issue
+TEST_F(MCSchedTest, MCNextIssueTime) {
+  AddressGen addrgen(test_pts);
+  // bank[0][1] is idle
+  LocalQueueElement * event = create_read_event(addrgen.generate(0, 1, 0x30) + 0xa);
+  EXPECT_EQ((uint32_t)1, test_mc->bank_num(event->address));
+
+  const UINT64 start_time = 1000 * test_mc->process_interval;
+  UINT64 curr_time = 0;
+  Component * curr_comp = nullptr;
+  clear_geq();
+  test_mc->add_req_event(start_time, event, NULL);
+  ASSERT_TRUE(test_mc->geq->event_queue.peek(curr_time, curr_comp));
+  EXPECT_EQ(start_time, curr_time);
+  test_mc->process_event(curr_time);  // activate
+  test_mc->geq->event_queue.erase(curr_time, curr_comp);
+  EXPECT_EQ(mc_bank_activate, test_mc->get_bank_status(0, 1).action_type);
+
+  // no wakeup until tRCD is over
+  ASSERT_TRUE(test_mc->geq->event_queue.peek(curr_time, curr_comp));
+  EXPECT_EQ(test_mc, curr_comp);
+  EXPECT_EQ(start_time + std::max(test_mc->tRCD, test_mc->tBBL) * test_mc->process_interval, curr_time);
+  geq_process_event();
+  EXPECT_EQ((uint64_t)9, test_mc->get_num_read());
+  EXPECT_EQ(mc_bank_read, test_mc->get_bank_status(0, 1).action_type);
+
+  delete event;
+}
+
+/* 3. START of MC write queue Testing */
+// 3.1) the writes drain from wq_high down to wq_low ahead of a waiting read
+TEST_F(MCWriteQueueTest, DrainFromHighToLow) {
+  AddressGen addrgen(wq_pts);
+  LocalQueueElement * read = create_read_event(addrgen.generate(0, 0, 0x10));
+  const UINT64 start_time = 1000 * wq_mc->process_interval;
+  UINT64 curr_time = 0;
+  Component * curr_comp = nullptr;
+  wq_mc->add_req_event(start_time, read, NULL);
+  for (uint32_t bank = 1; bank <= 5; bank++) {
+    wq_mc->add_req_event(start_time, create_write_event(addrgen.generate(0, bank, 0x10)), NULL);
+  }
+  ASSERT_TRUE(wq_mc->geq->event_queue.peek(curr_time, curr_comp));
+  EXPECT_EQ(start_time, curr_time);
+  wq_mc->process_event(curr_time);
+  wq_mc->geq->event_queue.erase(curr_time, curr_comp);
+  // 5 writes are below wq_high, so the read goes first
+  EXPECT_FALSE(wq_mc->is_draining());
+  EXPECT_EQ((uint64_t)0, wq_mc->get_num_drains());
+  EXPECT_EQ((uint32_t)5, wq_mc->get_num_in_wq());
+  EXPECT_EQ(mc_bank_activate, wq_mc->get_bank_status(0, 0).action_type);
+
+  // the 6th one starts a drain before the read can issue
+  const UINT64 sixth_time = start_time + wq_mc->process_interval;
+  wq_mc->add_req_event(sixth_time, create_write_event(addrgen.generate(0, 6, 0x10)), NULL);
+  ASSERT_TRUE(wq_mc->geq->event_queue.peek(curr_time, curr_comp));
+  EXPECT_EQ(sixth_time, curr_time);
+  wq_mc->process_event(curr_time);
+  wq_mc->geq->event_queue.erase(curr_time, curr_comp);
+  EXPECT_TRUE(wq_mc->is_draining());
+  EXPECT_EQ((uint64_t)1, wq_mc->get_num_drains());
+
+  geq_process_event();
+  EXPECT_FALSE(wq_mc->is_draining());
+  EXPECT_EQ((uint64_t)1, wq_mc->get_num_drains());
+  EXPECT_EQ((uint64_t)4, wq_mc->get_num_drained_writes());
+  EXPECT_EQ((uint64_t)1, wq_mc->get_num_read());
+  EXPECT_EQ((uint64_t)6, wq_mc->get_num_write());
+  EXPECT_EQ((uint32_t)0, wq_mc->get_num_in_wq());
+  // the read went out after the drain, ahead of the 2 writes left
+  ASSERT_EQ((size_t)1, wq_dir->replies.size());
+  EXPECT_EQ(read, wq_dir->replies[0].second);
+  EXPECT_EQ((uint64_t)4, wq_dir->num_write_at_reply[0]);
+}
+
+// 3.2) a read of a line with a queued write takes the data of the write
+TEST_F(MCWriteQueueTest, ReadAfterWrite) {
+  AddressGen addrgen(wq_pts);
+  const uint64_t address = addrgen.generate(0, 2, 0x20);
+  const UINT64 write_time = 2000 * wq_mc->process_interval;
+  const UINT64 read_time  = write_time + wq_mc->process_interval;
+  const uint64_t num_read  = wq_mc->get_num_read();
+  const uint64_t num_write = wq_mc->get_num_write();
+  const size_t num_replies = wq_dir->replies.size();
+
+  wq_mc->add_req_event(write_time, create_write_event(address), NULL);
+  LocalQueueElement * same_line  = create_read_event(address + 0x8);
+  LocalQueueElement * other_line = create_read_event(address + 0x40);
+  wq_mc->add_req_event(read_time, same_line, NULL);
+  wq_mc->add_req_event(read_time, other_line, NULL);
+  geq_process_event();
+
+  EXPECT_EQ((uint64_t)1, wq_mc->get_num_wq_forwards());
+  EXPECT_EQ(num_read + 1, wq_mc->get_num_read());  // only other_line reads the DRAM
+  EXPECT_EQ(num_write + 1, wq_mc->get_num_write());
+  ASSERT_EQ(num_replies + 2, wq_dir->replies.size());
+  EXPECT_EQ(same_line, wq_dir->replies[num_replies].second);
+  EXPECT_EQ(read_time + wq_mc->mc_to_dir_t, wq_dir->replies[num_replies].first);
+  EXPECT_EQ(other_line, wq_dir->replies[num_replies + 1].second);
+}
+/* END of 3. */
+
+/* 4. START of MC refresh Testing */
+// 4.1) the ranks take turns, tREFI / num_ranks_per_mc apart
+TEST_F(MCRefreshTest, RanksStaggered) {
+  EXPECT_EQ(ticks(50), refresh_mc->get_next_refresh_time(0));
+  EXPECT_EQ(ticks(100), refresh_mc->get_next_refresh_time(1));
+
+  refresh_mc->refresh(ticks(50));
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_refresh());
+  EXPECT_EQ(ticks(150), refresh_mc->get_next_refresh_time(0));
+  EXPECT_EQ(ticks(100), refresh_mc->get_next_refresh_time(1));
+  refresh_mc->refresh(ticks(100));
+  EXPECT_EQ((uint64_t)2, refresh_mc->get_num_refresh());
+  EXPECT_EQ(ticks(200), refresh_mc->get_next_refresh_time(1));
+}
+
+// 4.2) a refresh closes its rank for tRFC, and only its rank
+TEST_F(MCRefreshTest, RankClosedForTRFC) {
+  LocalQueueElement * read = create_read_event(address_in_rank(0));
+  const uint32_t bank = refresh_mc->bank_num(read->address);
+  UINT64 curr_time = 0;
+  Component * curr_comp = nullptr;
+  refresh_mc->add_req_event(ticks(51), read, NULL);
+  ASSERT_TRUE(refresh_mc->geq->event_queue.peek(curr_time, curr_comp));
+  refresh_mc->process_event(curr_time);  // the refresh due at 50 goes before the read
+  refresh_mc->geq->event_queue.erase(curr_time, curr_comp);
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_refresh());
+  EXPECT_EQ((uint64_t)0, refresh_mc->get_num_refresh_postponed());
+  EXPECT_EQ(ticks(20), refresh_mc->get_refresh_time());
+  for (uint32_t b = 0; b < refresh_mc->num_banks_per_rank; b++) {
+    EXPECT_EQ(ticks(70), refresh_mc->get_bank_status(0, b).action_time);
+    EXPECT_EQ((uint64_t)0, refresh_mc->get_bank_status(1, b).action_time);
+  }
+
+  // the read activates once the rank opens again
+  ASSERT_TRUE(refresh_mc->geq->event_queue.peek(curr_time, curr_comp));
+  EXPECT_EQ(ticks(70), curr_time);
+  refresh_mc->process_event(curr_time);
+  refresh_mc->geq->event_queue.erase(curr_time, curr_comp);
+  EXPECT_EQ(mc_bank_activate, refresh_mc->get_bank_status(0, bank).action_type);
+  EXPECT_EQ(ticks(70), refresh_mc->get_bank_status(0, bank).last_activate_time);
+  geq_process_event();
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_read());
+}
+
+// 4.3) a rank with waiting requests puts off up to max_postponed_refreshes
+// refreshes, and the next due one does them all
+TEST_F(MCRefreshTest, PostponedUpToMax) {
+  refresh_mc->add_req_event(ticks(10), create_read_event(address_in_rank(0)), NULL);
+  refresh_mc->pre_processing(ticks(10));  // waits in bank_q
+  clear_geq();
+
+  refresh_mc->refresh(ticks(50));
+  EXPECT_EQ((uint32_t)1, refresh_mc->get_num_postponed(0));
+  refresh_mc->refresh(ticks(150));
+  EXPECT_EQ((uint32_t)2, refresh_mc->get_num_postponed(0));
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_refresh());  // rank 1 at 100
+  EXPECT_EQ((uint64_t)0, refresh_mc->get_bank_status(0, 0).action_time);  // still open
+
+  refresh_mc->refresh(ticks(250));  // forced
+  EXPECT_EQ((uint32_t)0, refresh_mc->get_num_postponed(0));
+  EXPECT_EQ((uint64_t)2, refresh_mc->get_num_refresh_postponed());
+  EXPECT_EQ((uint64_t)5, refresh_mc->get_num_refresh());  // 3 of rank 0, 2 of rank 1
+  for (uint32_t b = 0; b < refresh_mc->num_banks_per_rank; b++) {
+    EXPECT_EQ(ticks(250 + 3 * 20), refresh_mc->get_bank_status(0, b).action_time);
+  }
+
+  refresh_mc->geq->add_event(ticks(250), refresh_mc);
+  geq_process_event();
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_read());
+  ASSERT_EQ((size_t)1, refresh_dir->replies.size());
+  EXPECT_LT(ticks(310), refresh_dir->replies[0].first);
+}
+
+// 4.4) a request that arrives on the due tick of its rank counts toward
+// postponing the refresh
+TEST_F(MCRefreshTest, PostponedByRequestOfSameTick) {
+  refresh_mc->add_req_event(ticks(50), create_read_event(address_in_rank(0)), NULL);
+  refresh_mc->process_event(ticks(50));
+  EXPECT_EQ((uint32_t)1, refresh_mc->get_num_postponed(0));
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_refresh_postponed());
+  EXPECT_EQ((uint64_t)0, refresh_mc->get_num_refresh());
+  clear_geq();
+}
+
+// 4.5) the refreshes due while the MC slept are applied when it wakes up
+TEST_F(MCRefreshTest, CatchUpAfterIdle) {
+  LocalQueueElement * read = create_read_event(address_in_rank(1));
+  refresh_mc->add_req_event(ticks(550), read, NULL);
+  geq_process_event();
+
+  // rank 0 at 50, 150, ..., 550 and rank 1 at 100, 200, ..., 500
+  EXPECT_EQ((uint64_t)11, refresh_mc->get_num_refresh());
+  EXPECT_EQ((uint64_t)0, refresh_mc->get_num_refresh_postponed());
+  EXPECT_EQ(ticks(11 * 20), refresh_mc->get_refresh_time());
+  EXPECT_EQ(ticks(650), refresh_mc->get_next_refresh_time(0));
+  EXPECT_EQ(ticks(600), refresh_mc->get_next_refresh_time(1));
+  // rank 1 is open by then, so the read does not wait
+  EXPECT_EQ(ticks(550), refresh_mc->get_bank_status(1, refresh_mc->bank_num(read->address)).last_activate_time);
+  EXPECT_EQ((uint64_t)1, refresh_mc->get_num_read());
+}
+/* END of 4. */
+
+uint64_t MCRefreshTest::address_in_rank(uint32_t rank) {
+  AddressGen addrgen(refresh_pts);
+  for (uint32_t bank = 0; bank < refresh_mc->num_banks_per_rank; bank++) {
+    const uint64_t address = addrgen.generate(0, bank, 0x10);
+    if (refresh_mc->rank_num(address) == rank) return address;
+  }
+  ADD_FAILURE() << "no address in rank " << rank;
+  return 0;
+}
+
+LocalQueueElement * MCWriteQueueTest::create_write_event(uint64_t _address) {
+  LocalQueueElement * event_return = new LocalQueueElement();
+  event_return->type = event_type::et_evict;
+  event_return->address = _address;
+  return event_return;
+}
+
 LocalQueueElement * MCSchedTest::create_read_event(uint64_t _address) {
   LocalQueueElement * event_return = new LocalQueueElement();
   event_return->type = event_type::et_read;
@@ -136,23 +360,13 @@ LocalQueueElement * MCSchedTest::create_read_event(uint64_t _address) {
 
 void MCSchedTest::geq_process_event() {
   UINT64 curr_time = 0;
-  while (true) {
-    auto event_queue_iter = test_mc->geq->event_queue.begin();
-    if (event_queue_iter != test_mc->geq->event_queue.end()) {
-      curr_time = event_queue_iter->first;
-      auto curr_comp = event_queue_iter->second.begin();
-      if (curr_comp == event_queue_iter->second.end()) break;
-      switch ((*curr_comp)->type) {
-      case ct_memory_controller:
-        (*curr_comp)->process_event(curr_time);
-      default:
-        event_queue_iter->second.erase(curr_comp);
-        if (event_queue_iter->second.empty()) {
-          test_mc->geq->event_queue.erase(curr_time);
-        }
-        break;
-      }
-    } else {
+  Component * curr_comp = nullptr;
+  while (test_mc->geq->event_queue.peek(curr_time, curr_comp)) {
+    switch (curr_comp->type) {
+    case ct_memory_controller:
+      curr_comp->process_event(curr_time);
+    default:
+      test_mc->geq->event_queue.erase(curr_time, curr_comp);
       break;
     }
   }
@@ -31,6 +31,35 @@ class MemoryControllerForTest : public MemoryController {
   uint64_t get_num_activate() { return num_activate; };
   uint64_t get_num_precharge() { return num_precharge; };
   BankStatus get_bank_status(uint rank, uint bank) { return bank_status[rank][bank]; }
+  bool is_draining() { return draining; }
+  uint32_t get_num_in_wq() { return num_in_wq; }
+  uint64_t get_num_drains() { return num_drains; }
+  uint64_t get_num_drained_writes() { return num_drained_writes; }
+  uint64_t get_num_wq_forwards() { return num_wq_forwards; }
+  uint64_t get_next_refresh_time(uint rank) { return next_refresh_time[rank]; }
+  uint32_t get_num_postponed(uint rank) { return num_postponed[rank]; }
+  uint64_t get_num_refresh() { return num_refresh; }
+  uint64_t get_num_refresh_postponed() { return num_refresh_postponed; }
+  uint64_t get_refresh_time() { return refresh_time; }
+  using MemoryController::refresh;
+  using MemoryController::pre_processing;
+};
+
+// stands in for the directory and records the replies of the MC, with how
+// many writes the MC had done when each one was sent
+class DirectoryRecorder : public Component {
+ public:
+  explicit DirectoryRecorder(McSim * mcsim_, MemoryControllerForTest * mc_) :
+    Component(ct_directory, 0, mcsim_), mc(mc_) { }
+  void add_rep_event(uint64_t event_time, LocalQueueElement * lqe, Component * from) override {
+    replies.push_back(std::make_pair(event_time, lqe));
+    num_write_at_reply.push_back(mc->get_num_write());
+  }
+  using Component::add_rep_event;
+  uint32_t process_event(uint64_t curr_time) override { return 0; }
+  MemoryControllerForTest * mc;
+  std::vector<std::pair<uint64_t, LocalQueueElement *>> replies;
+  std::vector<uint64_t> num_write_at_reply;
 };
 
 class MCSchedTest : public ::testing::Test {
@@ -69,6 +98,78 @@ class MCSchedTest : public ::testing::Test {
     void geq_process_event();
 };
 
+// the MC with a write queue (wq_sz 8, wq_high 6, wq_low 2)
+class MCWriteQueueTest : public MCSchedTest {
+  protected:
+    static std::shared_ptr<PinPthread::PthreadTimingSimulator> wq_pts;
+    static MemoryControllerForTest* wq_mc;
+    static DirectoryRecorder* wq_dir;
+
+    static void SetUpTestSuite() {
+      wq_pts = std::make_unique<PthreadTimingSimulator>("../Apps/md/test/test-mc-wq.toml");
+
+      wq_mc = new MemoryControllerForTest(ct_memory_controller, 0, wq_pts->mcsim);
+      auto temp_mc = wq_pts->mcsim->mcs[0];
+      wq_pts->mcsim->mcs[0] = wq_mc;
+
+      wq_pts->mcsim->connect_comps();
+      delete temp_mc;
+      wq_dir = new DirectoryRecorder(wq_pts->mcsim, wq_mc);
+      wq_mc->directory = wq_dir;
+    }
+
+    static void TearDownTestSuite() {
+      for (auto && reply : wq_dir->replies) delete reply.second;
+      delete wq_dir;
+    }
+
+    // the tests of this suite run the MC with the write queue
+    void SetUp() override {
+      saved_mc = test_mc;
+      test_mc  = wq_mc;
+      clear_geq();
+    }
+    void TearDown() override { test_mc = saved_mc; }
+
+    LocalQueueElement * create_write_event(uint64_t _address);
+
+    MemoryControllerForTest * saved_mc;
+};
+
+// a new MC with refreshes (2 ranks, tREFI 100, tRFC 20, up to 2 postponed)
+// for each test
+class MCRefreshTest : public MCSchedTest {
+  protected:
+    static std::shared_ptr<PinPthread::PthreadTimingSimulator> refresh_pts;
+
+    static void SetUpTestSuite() {
+      refresh_pts = std::make_unique<PthreadTimingSimulator>("../Apps/md/test/test-mc-refresh.toml");
+    }
+
+    void SetUp() override {
+      refresh_mc  = new MemoryControllerForTest(ct_memory_controller, 0, refresh_pts->mcsim);
+      refresh_dir = new DirectoryRecorder(refresh_pts->mcsim, refresh_mc);
+      refresh_mc->directory = refresh_dir;
+      saved_mc = test_mc;
+      test_mc  = refresh_mc;
+      clear_geq();
+    }
+
+    void TearDown() override {
+      test_mc = saved_mc;
+      for (auto && reply : refresh_dir->replies) delete reply.second;
+      delete refresh_dir;
+      delete refresh_mc;
+    }
+
+    uint64_t address_in_rank(uint32_t rank);
+    uint64_t ticks(uint64_t t) { return t * refresh_mc->process_interval; }
+
+    MemoryControllerForTest * refresh_mc;
+    DirectoryRecorder * refresh_dir;
+    MemoryControllerForTest * saved_mc;
+};
+
 }
 }
 
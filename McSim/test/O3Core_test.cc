@@ -80,6 +80,87 @@ TEST_F(O3CoreTest, Fetch) {
   EXPECT_EQ(o3iqs_being_loaded, test_o3queue[3].state);  // also being_loaded!
 }
 
+TEST_F(O3CoreTest, FetchOnlyData) {
+  O3Queue* test_o3queue = test_o3core->get_o3queue();
+  O3ROB* test_o3rob = test_o3core->get_o3rob();
+  uint64_t process_interval = test_o3core->process_interval;
+
+  // with pts.simulate_only_data_caches, the fetch always hits in the same
+  // cycle: the instructions of every line are dispatched right away, without
+  // any request to the iTLB or the L1I and without a fetch event
+  test_pts->mcsim->simulate_only_data_caches = true;
+  test_tlbl1i->req_event.clear();
+  test_cachel1i->req_event.clear();
+  for (uint32_t i = 0; i < 3; i++) {
+    test_o3queue[i].state  = o3iqs_not_in_queue;
+    test_o3queue[i].type   = no_mem;
+    test_o3queue[i].raddr  = 0;
+    test_o3queue[i].raddr2 = 0;
+    test_o3queue[i].waddr  = 0;
+  }
+  test_o3queue[0].ip = TEST_ADDR_I;
+  test_o3queue[1].ip = TEST_ADDR_I + (1 << test_cachel1i->set_lsb);
+  test_o3queue[2].ip = TEST_ADDR_I;
+  test_o3core->set_o3queue_size(3);
+  test_o3core->set_o3queue_head(0);
+
+  test_o3core->process_event(process_interval);
+  test_pts->mcsim->simulate_only_data_caches = false;
+
+  EXPECT_TRUE(test_tlbl1i->req_event.empty());
+  EXPECT_TRUE(test_cachel1i->req_event.empty());
+  EXPECT_EQ((uint32_t)0, test_o3core->get_o3queue_size());
+  ASSERT_EQ((uint32_t)3, test_o3core->get_o3rob_size());
+  EXPECT_EQ(TEST_ADDR_I + (1 << test_cachel1i->set_lsb), test_o3rob[1].ip);
+  // the only wakeup is the next cycle of the pipeline
+  UINT64 event_time;
+  Component * comp;
+  ASSERT_TRUE(test_o3core->geq->event_queue.peek(event_time, comp));
+  EXPECT_EQ(2 * process_interval, event_time);
+  EXPECT_EQ((size_t)1, test_o3core->geq->event_queue.size());
+}
+
+TEST_F(O3CoreTest, AddInstructions) {
+  O3Queue* test_o3queue = test_o3core->get_o3queue();
+  uint32_t max_size = test_o3core->o3queue_max_size;
+  const uint64_t addr_offset = 0x1000000;
+
+  // a batch fills consecutive o3queue entries, wrapping around the end
+  PTSInstr instrs[3] = {};
+  instrs[0].ip = TEST_ADDR_I;      instrs[0].raddr = TEST_ADDR_D;
+  instrs[1].ip = TEST_ADDR_I + 4;  instrs[1].isbranch = true;  instrs[1].isbranchtaken = true;
+  instrs[2].ip = TEST_ADDR_I + 8;  instrs[2].waddr = TEST_ADDR_D;  instrs[2].islock = true;
+  for (auto && instr : instrs) instr.curr_time_ = 10;
+  test_o3core->set_o3queue_head(max_size - 1);
+
+  EXPECT_EQ(max_size - (3 + 4), test_pts->mcsim->add_instructions(instrs, 3, 0, addr_offset));
+  EXPECT_EQ((uint32_t)3, test_o3core->get_o3queue_size());
+  EXPECT_TRUE(test_o3core->geq->event_queue.contains(10, test_o3core));
+
+  O3Queue & first = test_o3queue[max_size - 1];
+  EXPECT_EQ(o3iqs_not_in_queue, first.state);
+  EXPECT_EQ(no_mem, first.type);
+  EXPECT_EQ(TEST_ADDR_I + addr_offset, first.ip);
+  EXPECT_EQ(TEST_ADDR_D + addr_offset, first.raddr);
+  EXPECT_EQ((uint64_t)0, first.waddr);  // zero addresses stay zero
+  EXPECT_EQ(ins_branch_taken, test_o3queue[0].type);
+  EXPECT_EQ(ins_lock, test_o3queue[1].type);
+  EXPECT_EQ(TEST_ADDR_D + addr_offset, test_o3queue[1].waddr);
+
+  // the same as adding them one by one
+  test_o3core->set_o3queue_head(max_size - 1);
+  test_o3core->set_o3queue_size(0);
+  for (auto && instr : instrs) {
+    test_pts->mcsim->add_instruction(0, instr.curr_time_, instr.waddr, instr.wlen,
+        instr.raddr, instr.raddr2, instr.rlen, instr.ip, instr.category,
+        instr.isbranch, instr.isbranchtaken, instr.islock, instr.isunlock, instr.isbarrier,
+        0, 0, 0, 0, 0, 0, 0, 0);
+  }
+  EXPECT_EQ((uint64_t)TEST_ADDR_I, first.ip);
+  EXPECT_EQ(ins_branch_taken, test_o3queue[0].type);
+  EXPECT_EQ(ins_lock, test_o3queue[1].type);
+}
+
 TEST_F(O3CoreTest, Dispatch) {
   O3Queue* test_o3queue = test_o3core->get_o3queue();
   O3ROB* test_o3rob = test_o3core->get_o3rob();
@@ -112,6 +193,7 @@ TEST_F(O3CoreTest, Dispatch) {
   test_o3core->set_o3rob_head(0);
   test_o3core->set_o3rob_size(1);
 
+  test_o3core->rebuild_deps();
   test_o3core->geq->add_event(10, test_o3core);
   test_o3core->process_event(10);
 
@@ -178,6 +260,7 @@ TEST_F(O3CoreTest, Execute) {
 
   curr_time += process_interval;
   // call o3core->process_event instead of geq->process_event
+  test_o3core->rebuild_deps();
   test_o3core->process_event(curr_time);
 
   EXPECT_EQ(o3irs_completed, test_o3rob[0].state);
@@ -218,6 +301,7 @@ TEST_F(O3CoreTest, Execute) {
   test_o3core->set_o3rob_size(6);
 
   curr_time = process_interval;
+  test_o3core->rebuild_deps();
   test_o3core->process_event(curr_time);
 
   EXPECT_EQ(o3irs_executing, test_o3rob[0].state);
@@ -253,6 +337,7 @@ TEST_F(O3CoreTest, Commit) {
   test_o3core->set_o3rob_head(0);
 
   // CHECK in-order commit
+  test_o3core->rebuild_deps();
   test_o3core->geq->add_event(10, test_o3core);
   test_o3core->process_event(10);
 
@@ -267,6 +352,7 @@ TEST_F(O3CoreTest, Commit) {
 
   // CHECK time constraints
   test_o3rob[2].state = o3irs_completed;
+  test_o3core->rebuild_deps();
   test_o3core->geq->add_event(20, test_o3core);
   test_o3core->process_event(20);
 
@@ -470,6 +556,7 @@ TEST_F(O3CoreTest, Scenario1) {
 
   test_o3rob[0].state = o3irs_completed;
   test_o3rob[0].ready_time = 30;
+  test_o3core->rebuild_deps();
   test_o3core->process_event(30);
   // make rob[0] completed and run process_event()
   EXPECT_EQ(o3irs_invalid, test_o3rob[0].state);  // commited
@@ -504,5 +591,128 @@ TEST_F(O3CoreTest, Scenario1) {
   EXPECT_EQ((uint32_t)4, test_o3core->get_o3rob_head());
 }
 
+// a core waiting on memory sleeps until the reply
+TEST_F(O3CoreTest, Wakeup) {
+  O3ROB* test_o3rob = test_o3core->get_o3rob();
+  uint64_t process_interval = test_o3core->process_interval;
+
+  test_o3rob[0].state = o3irs_executing;       // LOAD F2 (memaddr)
+  test_o3rob[0].ready_time = 10;
+  test_o3rob[0].isread = true;
+  test_o3rob[0].branch_miss = false;
+  test_o3rob[1].type = no_mem;                 // ADD F6 F2 F4
+  test_o3rob[1].state = o3irs_issued;
+  test_o3rob[1].ready_time = 10;
+  test_o3rob[1].memaddr = 0;
+  test_o3rob[1].rr0 = 0;                       // true dep.: rob[0]
+  test_o3rob[1].rr1 = -1;
+  test_o3rob[1].rr2 = -1;
+  test_o3rob[1].rr3 = -1;
+  test_o3rob[1].mem_dep = -1;
+  test_o3rob[1].instr_dep = -1;
+  test_o3rob[1].branch_dep = -1;
+  test_o3rob[1].branch_miss = false;
+  test_o3core->set_o3rob_head(0);
+  test_o3core->set_o3rob_size(2);
+
+  test_o3core->rebuild_deps();
+  test_o3core->process_event(20);
+  EXPECT_TRUE(test_o3core->geq->event_queue.empty());  // nothing to do until the reply
+
+  // the reply wakes up the core at the ready_time of rob[0]
+  reply_events.push_back(new LocalQueueElement(test_cachel1d, et_read, TEST_ADDR_D, 0));
+  reply_events.back()->rob_entry = 0;
+  test_o3core->add_rep_event(400, reply_events.back(), test_cachel1d);
+  EXPECT_EQ((uint64_t)400, test_o3rob[0].ready_time);
+  EXPECT_TRUE(test_o3core->geq->event_queue.contains(400, test_o3core));
+
+  // rob[1] is released at 400 and executed in the next process_interval
+  clear_geq();
+  test_o3core->process_event(400);
+  EXPECT_EQ((int32_t)-1, test_o3rob[1].rr0);
+  EXPECT_TRUE(test_o3core->geq->event_queue.contains(400 + process_interval, test_o3core));
+
+  clear_geq();
+  test_o3core->process_event(400 + process_interval);
+  EXPECT_EQ(o3irs_completed, test_o3rob[1].state);
+  EXPECT_TRUE(test_o3core->geq->event_queue.contains(400 + 2*process_interval, test_o3core));
+}
+
+// an ins_notify behind the head used to poll every process_interval; the
+// polls are skipped unless the core can do something, like syncing with
+// the frontend once its o3queue is half empty
+TEST_F(O3CoreTest, SkipIdlePolls) {
+  O3Queue* test_o3queue = test_o3core->get_o3queue();
+  O3ROB* test_o3rob = test_o3core->get_o3rob();
+  uint64_t process_interval = test_o3core->process_interval;
+
+  for (unsigned int i = 0; i < test_o3core->o3queue_max_size; i++) {
+    test_o3queue[i].state = o3iqs_being_loaded;  // waiting for the L1I
+  }
+  test_o3core->set_o3queue_head(0);
+  test_o3core->set_o3queue_size(test_o3core->o3queue_max_size);
+
+  test_o3rob[0].state = o3irs_executing;       // LOAD F2 (memaddr)
+  test_o3rob[0].ready_time = 10;
+  test_o3rob[0].isread = true;
+  test_o3rob[0].branch_miss = false;
+  test_o3rob[1].type = ins_notify;
+  test_o3rob[1].state = o3irs_issued;
+  test_o3rob[1].ready_time = 10;
+  test_o3rob[1].memaddr = 0;
+  test_o3rob[1].rr0 = -1;
+  test_o3rob[1].rr1 = -1;
+  test_o3rob[1].rr2 = -1;
+  test_o3rob[1].rr3 = -1;
+  test_o3rob[1].mem_dep = -1;
+  test_o3rob[1].instr_dep = -1;
+  test_o3rob[1].branch_dep = -1;
+  test_o3rob[1].branch_miss = false;
+  test_o3core->set_o3rob_head(0);
+  test_o3core->set_o3rob_size(2);
+  test_pts->mcsim->set_active(0, false);
+  test_o3core->rebuild_deps();
+
+  test_o3core->process_event(20);
+  EXPECT_EQ(o3irs_issued, test_o3rob[1].state);
+  EXPECT_TRUE(test_o3core->geq->event_queue.empty());  // nothing to do until the reply
+
+  test_o3core->set_o3queue_size(test_o3core->o3queue_max_size >> 1);
+  test_o3core->process_event(30);
+  EXPECT_TRUE(test_o3core->geq->event_queue.contains(30 + process_interval, test_o3core));
+}
+
+// the parallel engine runs a core without a global sync up to the event
+// that may take the o3queue down to half, or that may reach an ins_notify
+TEST_F(O3CoreTest, SyncFreeUntil) {
+  O3ROB* test_o3rob = test_o3core->get_o3rob();
+  uint64_t process_interval = test_o3core->process_interval;
+  uint32_t max_size = test_o3core->o3queue_max_size;
+  uint32_t width = test_o3core->max_issue_width;
+
+  test_pts->mcsim->set_active(0, false);
+  EXPECT_EQ(UINT64_MAX, test_o3core->sync_free_until(25));
+
+  test_pts->mcsim->set_active(0, true);
+  test_o3core->set_o3queue_size(max_size);
+  uint64_t num_events = (max_size - (max_size >> 1) + width - 1) / width;
+  uint64_t next_event = (25 + process_interval - 1) / process_interval * process_interval;
+  EXPECT_EQ(next_event + num_events * process_interval, test_o3core->sync_free_until(25));
+
+  test_o3rob[0].state = o3irs_executing;
+  test_o3rob[0].type  = no_mem;
+  test_o3rob[1].state = o3irs_issued;
+  test_o3rob[1].type  = ins_notify;
+  test_o3core->set_o3rob_head(0);
+  test_o3core->set_o3rob_size(2);
+  test_o3core->rebuild_deps();
+  EXPECT_FALSE(test_o3core->needs_global_sync());
+  EXPECT_EQ((uint64_t)26, test_o3core->sync_free_until(25));
+
+  test_o3core->set_o3queue_size(max_size >> 1);
+  EXPECT_EQ((uint64_t)25, test_o3core->sync_free_until(25));
+  test_pts->mcsim->set_active(0, false);
+}
+
 }
 }
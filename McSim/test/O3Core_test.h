@@ -90,6 +90,7 @@ class O3CoreTest : public ::testing::Test {
       }
       test_o3core->set_o3rob_head(0);
       test_o3core->set_o3rob_size(0);
+      test_o3core->rebuild_deps();
     }
     
     void clear_geq() { test_o3core->geq->event_queue.clear(); }
@@ -35,7 +35,7 @@ class TLBL1ForTest : public TLBL1 {
   uint64_t get_num_miss()   { return num_miss; }
   uint64_t get_size_of_LRU()   { return entries.size(); }
   uint64_t get_size_of_entries()   { return LRU.size(); }
-  uint64_t get_LRU_time()   { return LRU.begin()->first; }
+  uint64_t get_LRU_time()   { return LRU.begin()->second->second.second; }
 };
 
 class TLBTest : public ::testing::Test {
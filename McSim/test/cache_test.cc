@@ -4,6 +4,10 @@
 
 #include "cache_test.h"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
 #include <vector>
 #include <iostream>
 
@@ -16,6 +20,10 @@ CacheL1ForTest* CacheTest::test_l1i;
 CacheL1ForTest* CacheTest::test_l1d;
 CacheL2ForTest* CacheTest::test_l2;
 std::vector<LocalQueueElement *> CacheTest::events;
+std::unique_ptr<PinPthread::PthreadTimingSimulator> CacheMshrTest::test_pts;
+CacheL1ForTest* CacheMshrTest::test_l1d;
+CacheL2ForTest* CacheMshrTest::test_l2;
+ReplyRecorder* CacheMshrTest::test_lsu;
 
 /* 1. START of Cache Build && Fixture Build Testing */
 TEST_F(CacheTest, CheckBuild) {
@@ -59,9 +67,10 @@ TEST_F(CacheTest, BasicCase) {
 
   test_l1d->process_event(curr_time);
 
+  // the miss and the next-line prefetches of the two lines after it
   EXPECT_EQ((unsigned int)0, test_l1d->req_event.size());
   EXPECT_EQ((unsigned int)1, test_l1d->get_num_rd_miss());
-  EXPECT_EQ((unsigned int)1, test_l2->req_event.size());
+  EXPECT_EQ((unsigned int)3, test_l2->req_event.size());
 
   EXPECT_EQ((unsigned int)0, test_l2->get_num_rd_access());
   EXPECT_EQ((unsigned int)0, test_l2->get_num_rd_miss());
@@ -69,13 +78,394 @@ TEST_F(CacheTest, BasicCase) {
   curr_time += 40;  // l1_to_l2_t == 40
   test_l2->process_event(curr_time);
   
-  EXPECT_EQ((unsigned int)1, test_l2->get_num_rd_access());
-  EXPECT_EQ((unsigned int)1, test_l2->get_num_rd_miss());
+  EXPECT_EQ((unsigned int)3, test_l2->get_num_rd_access());
+  EXPECT_EQ((unsigned int)3, test_l2->get_num_rd_miss());
 
-  EXPECT_EQ((unsigned int)1, test_l2->crossbar->num_req);
+  // the three misses and the L2 prefetches of lines + 1 to + 4
+  EXPECT_EQ((unsigned int)7, test_l2->crossbar->num_req);
   
   delete test_event;
 }
 
+TEST_F(CacheTest, LRUOrder) {
+  uint32_t num_ways = test_l1d->num_ways;
+  test_l1d->reset_tags(4);
+
+  // ways start in the order of LRU (way 0) to MRU (way 3)
+  EXPECT_EQ((uint32_t)0, test_l1d->get_lru_way(1));
+  EXPECT_EQ((uint32_t)4, test_l1d->get_way(1, 0x10));
+  for (uint32_t way = 0; way < 4; way++) {
+    test_l1d->put_line(1, way, 0x10 + way);
+    test_l1d->touch(1, way);
+  }
+  EXPECT_EQ((uint32_t)2, test_l1d->get_way(1, 0x12));
+  EXPECT_EQ((uint32_t)4, test_l1d->get_way(0, 0x12));
+
+  // 0x11 and then 0x10 become the most recently used ones
+  test_l1d->touch(1, 1);
+  test_l1d->touch(1, 0);
+  EXPECT_EQ((uint32_t)2, test_l1d->get_lru_way(1));
+  test_l1d->touch(1, 2);
+  EXPECT_EQ((uint32_t)3, test_l1d->get_lru_way(1));
+  test_l1d->touch(1, 3);
+  EXPECT_EQ((uint32_t)1, test_l1d->get_lru_way(1));
+
+  test_l1d->reset_tags(num_ways);
+}
+
+TEST_F(CacheTest, ReplacementPolicies) {
+  uint32_t num_ways = test_l1d->num_ways;
+
+  // plru: the tree points away from the last touched ways
+  test_l1d->reset_tags(4, rp_plru);
+  for (uint32_t way = 0; way < 4; way++) test_l1d->put_line(1, way, 0x10 + way);
+  EXPECT_EQ((uint32_t)0, test_l1d->victim_way(1));
+  test_l1d->touch(1, 0);
+  EXPECT_EQ((uint32_t)2, test_l1d->victim_way(1));
+  test_l1d->touch(1, 2);
+  EXPECT_EQ((uint32_t)1, test_l1d->victim_way(1));
+
+  // srrip: new lines come in long and a hit makes a line the last to go
+  test_l1d->reset_tags(4, rp_srrip);
+  for (uint32_t way = 0; way < 4; way++) test_l1d->put_line(1, way, 0x10 + way);
+  EXPECT_EQ((uint32_t)0, test_l1d->victim_way(1));
+  test_l1d->fill(1, 0, 0x1000);
+  EXPECT_EQ((uint32_t)1, test_l1d->victim_way(1));
+  for (uint32_t way = 1; way < 4; way++) test_l1d->fill(1, way, 0x1000 + 64*way);
+  test_l1d->touch(1, 2);
+  EXPECT_EQ((uint32_t)0, test_l1d->victim_way(1));  // after aging the set
+  EXPECT_EQ((uint8_t)1, test_l1d->get_age(1, 2));
+
+  // brrip: one in 32 fills is long
+  test_l1d->reset_tags(4, rp_brrip);
+  for (uint32_t i = 1; i < 32; i++) {
+    test_l1d->fill(1, 0, 0x1000);
+    EXPECT_EQ((uint8_t)3, test_l1d->get_age(1, 0));
+  }
+  test_l1d->fill(1, 0, 0x1000);
+  EXPECT_EQ((uint8_t)2, test_l1d->get_age(1, 0));
+
+  // ship: a region whose lines leave without a hit gets distant insertions
+  test_l1d->reset_tags(4, rp_ship);
+  test_l1d->fill(1, 0, 0x40000);
+  EXPECT_EQ((uint8_t)2, test_l1d->get_age(1, 0));
+  test_l1d->fill(1, 0, 0x40040);
+  EXPECT_EQ((uint8_t)3, test_l1d->get_age(1, 0));
+  test_l1d->touch(1, 0);
+  test_l1d->fill(1, 0, 0x40080);
+  EXPECT_EQ((uint8_t)2, test_l1d->get_age(1, 0));
+
+  // the policies other than lru take an invalid way first
+  test_l1d->reset_tags(4, rp_srrip);
+  for (uint32_t way = 0; way < 3; way++) test_l1d->put_line(1, way, 0x10 + way);
+  EXPECT_EQ((uint32_t)3, test_l1d->victim_way(1));
+
+  test_l1d->reset_tags(num_ways);
+}
+
+TEST_F(CacheTest, SharerSet) {
+  SharerSet sharers;
+  EXPECT_TRUE(sharers.empty());
+
+  // sharers beyond the first 64 go to the heap array
+  for (uint32_t idx : {1000, 3, 64, 63, 3}) sharers.insert(idx);
+  EXPECT_EQ((uint32_t)4, sharers.size());
+  EXPECT_EQ((uint32_t)3, sharers.first());
+  EXPECT_TRUE(sharers.contains(1000));
+  EXPECT_FALSE(sharers.contains(999));
+  EXPECT_FALSE(sharers.contains(2000));
+
+  std::vector<uint32_t> idxs;
+  sharers.for_each([&](uint32_t idx) { idxs.push_back(idx); });
+  EXPECT_EQ(std::vector<uint32_t>({3, 63, 64, 1000}), idxs);
+
+  SharerSet copied(sharers);
+  sharers.erase(3);
+  sharers.erase(63);
+  EXPECT_EQ((uint32_t)64, sharers.first());
+  EXPECT_EQ((uint32_t)4, copied.size());
+  sharers.clear();
+  EXPECT_TRUE(sharers.empty());
+  EXPECT_FALSE(copied.empty());
+}
+
+TEST_F(CacheTest, LineMap) {
+  // few slots so that the table grows and the probe sequences wrap around
+  LineMap<uint64_t> lines(16);
+  std::map<uint64_t, uint64_t> ref;
+  std::mt19937_64 rng(1);
+
+  for (uint64_t i = 0; i < 200000; i++) {
+    uint64_t line = rng() % 4096;
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(ref.erase(line) == 1, lines.erase(line));
+    } else {
+      bool inserted;
+      uint64_t & value = lines.find_or_insert(line, inserted);
+      EXPECT_EQ(ref.find(line) == ref.end(), inserted);
+      if (inserted == true) {
+        EXPECT_EQ((uint64_t)0, value);
+      }
+      value = ref[line] = i;
+    }
+  }
+
+  EXPECT_EQ(ref.size(), lines.size());
+  uint64_t num_lines = 0;
+  lines.for_each([&](uint64_t line, uint64_t & value) {
+    EXPECT_EQ(ref[line], value);
+    num_lines++;
+  });
+  EXPECT_EQ(ref.size(), num_lines);
+  for (uint64_t line = 0; line < 4096; line++) {
+    uint64_t * value = lines.find(line);
+    EXPECT_EQ(ref.find(line) != ref.end(), value != nullptr);
+  }
+}
+
+TEST_F(CacheTest, LineMapErase) {
+  // lines that share a home slot in a table of 16 slots (LineMap::home)
+  auto home = [](uint64_t line) { return (line * 0x9E3779B97F4A7C15ULL) >> 60; };
+  std::vector<uint64_t> same_home, next_home, far_home;
+  for (uint64_t line = 0; same_home.size() < 4 || next_home.empty() || far_home.empty(); line++) {
+    if (home(line) == 3 && same_home.size() < 4) same_home.push_back(line);
+    if (home(line) == 4 && next_home.empty()) next_home.push_back(line);
+    if (home(line) == 8 && far_home.empty()) far_home.push_back(line);
+  }
+
+  // slots 3..7 hold the run a0 a1 a2 a3 b0, and c0 sits at its home slot 8
+  LineMap<uint64_t> lines(16);
+  const uint64_t a0 = same_home[0], a1 = same_home[1], a2 = same_home[2], a3 = same_home[3];
+  const uint64_t b0 = next_home[0], c0 = far_home[0];
+  for (uint64_t line : {a0, a1, a2, b0, a3, c0}) lines[line] = line + 1;
+  EXPECT_EQ((uint64_t)16, lines.num_slots());
+  EXPECT_EQ((uint64_t)6, lines.size());
+
+  auto check = [&](std::initializer_list<uint64_t> present, std::initializer_list<uint64_t> absent) {
+    for (uint64_t line : present) {
+      ASSERT_NE(nullptr, lines.find(line)) << line;
+      EXPECT_EQ(line + 1, *lines.find(line));
+    }
+    for (uint64_t line : absent) EXPECT_EQ(nullptr, lines.find(line)) << line;
+    uint64_t num_lines = 0;
+    lines.for_each([&](uint64_t, uint64_t &) { num_lines++; });
+    EXPECT_EQ(lines.size(), num_lines);
+  };
+
+  // erasing in the middle of the run shifts a2, a3, and b0 back, not c0
+  EXPECT_TRUE(lines.erase(a1));
+  EXPECT_FALSE(lines.erase(a1));
+  check({a0, a2, b0, a3, c0}, {a1});
+
+  // the head and the tail of the run
+  EXPECT_TRUE(lines.erase(a0));
+  check({a2, b0, a3, c0}, {a0, a1});
+  EXPECT_TRUE(lines.erase(a3));
+  check({a2, b0, c0}, {a0, a1, a3});
+
+  // reinserted lines start from a default value
+  bool inserted = false;
+  EXPECT_EQ((uint64_t)0, lines.find_or_insert(a1, inserted));
+  EXPECT_TRUE(inserted);
+  lines[a1] = a1 + 1;
+  lines.find_or_insert(a1, inserted);
+  EXPECT_FALSE(inserted);
+  lines[a0] = a0 + 1;
+  lines[a3] = a3 + 1;
+  check({a0, a1, a2, b0, a3, c0}, {});
+  EXPECT_EQ((uint64_t)16, lines.num_slots());
+}
+
+// a benchmark; run it with --gtest_also_run_disabled_tests
+TEST_F(CacheTest, DISABLED_LineMapScale) {
+  // the footprint and the lookup rate of the directory with the lines of
+  // a contiguous working set; the line addresses are looked up at random
+  for (uint64_t num_lines : {1000000ULL, 10000000ULL}) {
+    std::vector<uint64_t> order(num_lines);
+    std::mt19937_64 rng(num_lines);
+    for (auto && line : order) line = (0x7F0000000000ULL >> 6) + rng() % num_lines;
+
+    LineMap<Directory::DirEntry> lines;
+    for (uint64_t i = 0; i < num_lines; i++) lines[(0x7F0000000000ULL >> 6) + i].num_sharer = 1;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t num_sharers = 0;
+    for (auto && line : order) num_sharers += lines.find(line)->num_sharer;
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    EXPECT_EQ(num_lines, num_sharers);
+
+    std::cout << "  -- " << num_lines << " lines : " << lines.memory_size() / num_lines
+      << " bytes/line, " << num_lines / sec / 1e6 << " M lookups/sec" << std::endl;
+  }
+
+  // 100M lines do not fit in a test machine; an estimate from the slot size
+  // at the 7/8 load limit, not a measurement
+  const uint64_t num_lines = 100000000ULL;
+  uint64_t num_slots = 16;
+  while (num_lines * 8 > num_slots * 7) num_slots <<= 1;
+  std::cout << "  -- " << num_lines << " lines : about "
+    << num_slots * sizeof(LineMap<Directory::DirEntry>::Slot) / num_lines
+    << " bytes/line (estimated, not measured)" << std::endl;
+}
+
+TEST_F(CacheTest, Prefetchers) {
+  std::vector<uint64_t> lines;
+  std::unique_ptr<Prefetcher> next_line(Prefetcher::create("next_line", 2, 8, 64));
+  next_line->access(100, 0, false, false, lines);  // a plain hit
+  EXPECT_TRUE(lines.empty());
+  next_line->access(100, 0, true, false, lines);
+  EXPECT_EQ(std::vector<uint64_t>({101, 102}), lines);
+
+  // the stride of an ip is trusted once it is seen twice in a row
+  std::unique_ptr<Prefetcher> stride(Prefetcher::create("stride", 2, 8, 64));
+  lines.clear();
+  for (uint64_t line = 1000; line < 1012; line += 3) stride->access(line, 0x400100, true, false, lines);
+  EXPECT_EQ(std::vector<uint64_t>({1012, 1015}), lines);
+  lines.clear();
+  stride->access(2000, 0x400204, true, false, lines);  // another ip has its own entry
+  stride->access(1012, 0x400100, false, true, lines);
+  EXPECT_EQ(std::vector<uint64_t>({1015, 1018}), lines);
+
+  // a descending stream runs ahead up to distance lines
+  std::unique_ptr<Prefetcher> stream(Prefetcher::create("stream", 4, 6, 4));
+  lines.clear();
+  stream->access(500, 0, true, false, lines);
+  stream->access(499, 0, true, false, lines);
+  EXPECT_TRUE(lines.empty());
+  stream->access(498, 0, true, false, lines);
+  EXPECT_EQ(std::vector<uint64_t>({497, 496, 495, 494}), lines);
+  lines.clear();
+  stream->access(497, 0, false, true, lines);
+  EXPECT_EQ(std::vector<uint64_t>({493, 492, 491}), lines);
+
+  // +1, +3 repeats without a single stride
+  std::unique_ptr<Prefetcher> ip_delta(Prefetcher::create("ip_delta", 3, 8, 64));
+  lines.clear();
+  uint64_t line = 10;
+  ip_delta->access(line, 0x400300, true, false, lines);
+  for (int64_t delta : {1, 3, 1, 3}) {
+    line += delta;
+    ip_delta->access(line, 0x400300, true, false, lines);
+  }
+  EXPECT_EQ(std::vector<uint64_t>({19, 22, 23}), lines);
+}
+
+TEST_F(CacheTest, MshrFile) {
+  MshrFile mshrs(2, 2);
+  LocalQueueElement rd0, rd1, rd2, wr0;
+  EXPECT_EQ(nullptr, mshrs.find(100));
+
+  auto entry = mshrs.allocate(100, &rd0, false);
+  EXPECT_EQ(entry, mshrs.find(100));
+  EXPECT_EQ(&rd0, entry->primary);
+  // reads wait for a line being read, and writes for a writable one
+  EXPECT_TRUE(mshrs.can_merge(entry, false));
+  EXPECT_FALSE(mshrs.can_merge(entry, true));
+  entry->targets.push_back(&rd1);
+  entry->targets.push_back(&rd2);
+  EXPECT_FALSE(mshrs.can_merge(entry, false));  // out of targets
+
+  EXPECT_FALSE(mshrs.full());
+  auto wr_entry = mshrs.allocate(200, &wr0, true);
+  EXPECT_TRUE(mshrs.full());
+  EXPECT_TRUE(mshrs.can_merge(wr_entry, false));
+  EXPECT_TRUE(mshrs.can_merge(wr_entry, true));
+
+  mshrs.free(entry);
+  EXPECT_EQ(nullptr, mshrs.find(100));
+  EXPECT_EQ(wr_entry, mshrs.find(200));
+  EXPECT_EQ((unsigned int)1, mshrs.size());
+  entry = mshrs.allocate(300, &rd0, false);
+  EXPECT_TRUE(entry->targets.empty());
+}
+
+TEST_F(CacheTest, StackDistance) {
+  const uint32_t max_num_ways = 8;
+  StackDistance sd(6, 4, 16, max_num_ways);
+
+  // a line comes back at depth 2 of its set: it hits with 3 ways or more
+  for (uint64_t line : {0, 4, 8, 0}) sd.access(line << 6);
+  EXPECT_EQ((uint64_t)4, sd.num_accesses());
+  EXPECT_EQ((uint64_t)4, sd.num_misses(4, 2));
+  EXPECT_EQ((uint64_t)3, sd.num_misses(4, 3));
+  EXPECT_EQ((uint64_t)3, sd.num_misses(8, 2));  // 0 and 8 only in the set
+
+  // the same misses as LRU caches of each shape
+  StackDistance sd2(6, 4, 16, max_num_ways);
+  std::mt19937_64 gen(7);
+  std::vector<uint64_t> lines;
+  for (uint32_t i = 0; i < 20000; i++) {
+    lines.push_back((i % 3 == 0) ? gen() % 1024 : gen() % 64);
+    sd2.access((lines.back() << 6) + gen() % 64);
+  }
+  for (uint32_t num_sets = 4; num_sets <= 16; num_sets <<= 1) {
+    for (uint32_t num_ways = 1; num_ways <= max_num_ways; num_ways++) {
+      std::vector<std::vector<uint64_t>> sets(num_sets);  // from the MRU line
+      uint64_t num_misses = 0;
+      for (auto && line : lines) {
+        auto & set  = sets[line % num_sets];
+        auto   iter = std::find(set.begin(), set.end(), line);
+        if (iter == set.end()) {
+          num_misses++;
+          if (set.size() == num_ways) set.pop_back();
+        } else {
+          set.erase(iter);
+        }
+        set.insert(set.begin(), line);
+      }
+      EXPECT_EQ(num_misses, sd2.num_misses(num_sets, num_ways));
+    }
+  }
+}
+
+TEST_F(CacheMshrTest, SecondaryMissMerged) {
+  test_pts->mcsim->global_q->event_queue.clear();
+  // two reads to a line in the same bank; the second one finds the first
+  // on the way and waits for it in its MSHR
+  auto primary   = read(0, 0x10000);
+  auto secondary = read(0, 0x10008);
+  test_pts->mcsim->global_q->process_event();
+
+  EXPECT_EQ((uint64_t)1, test_l1d->get_num_mshr_merged());
+  EXPECT_EQ((uint64_t)0, test_l1d->get_num_nack());
+  EXPECT_EQ((size_t)1, l2_arrivals(0x10000).size());
+
+  // both are answered by the reply of the primary
+  ASSERT_EQ((size_t)2, test_lsu->replies.size());
+  EXPECT_NE((uint64_t)0, reply_time(primary));
+  EXPECT_EQ(reply_time(primary), reply_time(secondary));
+  EXPECT_NE(et_nack, primary->type);
+  EXPECT_NE(et_nack, secondary->type);
+  EXPECT_EQ((uint32_t)0, test_l1d->get_num_mshrs_used());
+}
+
+TEST_F(CacheMshrTest, FullMshrsStallBank) {
+  test_pts->mcsim->global_q->event_queue.clear();
+  // three misses to lines of bank 0; the third one waits in the bank queue
+  // until a reply frees an MSHR
+  const uint64_t start_time = 100000;
+  const uint64_t num_stalls = test_l1d->get_num_mshr_stalls();
+  auto first  = read(start_time, 0x20000);
+  auto second = read(start_time, 0x20100);
+  auto third  = read(start_time, 0x20200);
+  test_pts->mcsim->global_q->process_event();
+
+  EXPECT_LT(num_stalls, test_l1d->get_num_mshr_stalls());
+  EXPECT_EQ((uint64_t)0, test_l1d->get_num_nack());
+  ASSERT_EQ((size_t)3, test_lsu->replies.size());
+  ASSERT_EQ((size_t)1, l2_arrivals(0x20000).size());
+  ASSERT_EQ((size_t)1, l2_arrivals(0x20100).size());
+  ASSERT_EQ((size_t)1, l2_arrivals(0x20200).size());
+
+  // the first two go down back to back, and the third one after the first
+  // reply comes back
+  const uint64_t first_reply = std::min(reply_time(first), reply_time(second));
+  EXPECT_EQ(l2_arrivals(0x20000)[0] + test_l1d->process_interval, l2_arrivals(0x20100)[0]);
+  EXPECT_LT(l2_arrivals(0x20100)[0], first_reply);
+  EXPECT_GT(l2_arrivals(0x20200)[0], first_reply);
+  EXPECT_GT(reply_time(third), first_reply);
+  EXPECT_EQ((uint32_t)0, test_l1d->get_num_mshrs_used());
+}
+
 }
 }
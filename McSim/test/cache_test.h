@@ -32,6 +32,25 @@ class CacheL1ForTest : public CacheL1 {
   uint64_t get_num_ev_coherency() { return num_ev_coherency; }
   uint64_t get_num_ev_capacity() { return num_ev_capacity; }
   uint64_t get_num_coherency_access() { return num_coherency_access; }
+  uint64_t get_num_nack() { return num_nack; }
+  uint64_t get_num_mshr_merged() { return num_mshr_merged; }
+  uint64_t get_num_mshr_stalls() { return num_mshr_stalls; }
+  uint32_t get_num_mshrs_used() { return mshrs.size(); }
+  void reset_tags(uint32_t num_ways_, replacement_policy policy = rp_lru) {
+    num_ways    = num_ways_;
+    replacement = policy;
+    init_tags();
+  }
+  void put_line(uint32_t set, uint32_t way, uint64_t tag) {
+    tags[set*num_ways + way] = tag;
+    states[set*num_ways + way] = cs_exclusive;
+  }
+  uint32_t get_way(uint32_t set, uint64_t tag) { return find_way(set, tag); }
+  uint32_t get_lru_way(uint32_t set) { return lru_way(set); }
+  uint8_t get_age(uint32_t set, uint32_t way) { return ages[set*num_ways + way]; }
+  using Cache::victim_way;
+  using Cache::fill;
+  using Cache::touch;
 };
 
 class CacheL2ForTest : public CacheL2 {
@@ -41,6 +60,25 @@ class CacheL2ForTest : public CacheL2 {
   ~CacheL2ForTest() { }
   uint64_t get_num_rd_access() { return num_rd_access; }
   uint64_t get_num_rd_miss() { return num_rd_miss; }
+  // (arrival time, address) of the requests from the L1s
+  void add_req_event(uint64_t event_time, LocalQueueElement * lqe, Component * from) override {
+    requests.push_back(std::make_pair(event_time, lqe->address));
+    CacheL2::add_req_event(event_time, lqe, from);
+  }
+  using CacheL2::add_req_event;
+  std::vector<std::pair<uint64_t, uint64_t>> requests;
+};
+
+// stands for the LSU of a core; it keeps the replies from the L1
+class ReplyRecorder : public Component {
+ public:
+  explicit ReplyRecorder(McSim * mcsim_) : Component(ct_o3core, 0, mcsim_) { }
+  void add_rep_event(uint64_t event_time, LocalQueueElement * lqe, Component * from) override {
+    replies.push_back(std::make_pair(event_time, lqe));
+  }
+  using Component::add_rep_event;
+  uint32_t process_event(uint64_t curr_time) override { return 0; }
+  std::vector<std::pair<uint64_t, LocalQueueElement *>> replies;
 };
 
 class CacheTest : public ::testing::Test {
@@ -80,6 +118,62 @@ class CacheTest : public ::testing::Test {
     void clear_geq() { test_o3core->geq->event_queue.clear(); }
 };
 
+// the L1D of core 0 has two MSHRs and the L2 four (test-mshr.toml)
+class CacheMshrTest : public ::testing::Test {
+  protected:
+    static std::unique_ptr<PinPthread::PthreadTimingSimulator> test_pts;
+    static CacheL1ForTest* test_l1d;
+    static CacheL2ForTest* test_l2;
+    static ReplyRecorder* test_lsu;
+
+    static void SetUpTestSuite() {
+      test_pts = std::make_unique<PinPthread::PthreadTimingSimulator>("../Apps/md/test/test-mshr.toml");
+
+      test_l1d = new CacheL1ForTest(ct_cachel1d, 0, test_pts->mcsim);
+      test_l2  = new CacheL2ForTest(ct_cachel2, 0, test_pts->mcsim);
+      test_lsu = new ReplyRecorder(test_pts->mcsim);
+
+      auto temp_cachel1d = test_pts->mcsim->l1ds[0];
+      auto temp_cachel2  = test_pts->mcsim->l2s[0];
+      test_pts->mcsim->l1ds[0] = test_l1d;
+      test_pts->mcsim->l2s[0]  = test_l2;
+
+      test_pts->mcsim->connect_comps();
+      delete temp_cachel1d;
+      delete temp_cachel2;
+    }
+
+    virtual void TearDown() override {
+      for (auto && reply : test_lsu->replies) delete reply.second;
+      test_lsu->replies.clear();
+      test_l2->requests.clear();
+    }
+
+    // a read from the LSU at curr_time
+    LocalQueueElement * read(uint64_t curr_time, uint64_t address) {
+      auto lqe = new LocalQueueElement(test_lsu, et_read, address, 0);
+      test_l1d->add_req_event(curr_time, lqe);
+      return lqe;
+    }
+    // when the L2 got the requests to the line of address, in order
+    std::vector<uint64_t> l2_arrivals(uint64_t address) const {
+      std::vector<uint64_t> times;
+      for (auto && request : test_l2->requests) {
+        if ((request.second >> test_l2->set_lsb) == (address >> test_l2->set_lsb)) {
+          times.push_back(request.first);
+        }
+      }
+      return times;
+    }
+    // when the LSU got the reply of lqe; 0 if not yet
+    uint64_t reply_time(const LocalQueueElement * lqe) const {
+      for (auto && reply : test_lsu->replies) {
+        if (reply.second == lqe) return reply.first;
+      }
+      return 0;
+    }
+};
+
 }
 }
 
@@ -0,0 +1,235 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "channel_test.h"
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace PinPthread {
+namespace ChannelTest {
+
+// pin and mcsim spend the time; pin sleeps so that the backend gets the core
+// even on a single cpu
+static void spend(std::chrono::nanoseconds time) {
+  auto until = std::chrono::steady_clock::now() + time;
+  while (std::chrono::steady_clock::now() < until) { }
+}
+
+
+PTSChannelTest::Traffic PTSChannelTest::send_instrs(uint64_t num_instrs, uint32_t o3queue_size) {
+  Traffic  traffic;
+  uint64_t num_received = 0;
+  bool     in_order     = true;
+  uint32_t num_requests = channel->request.seq;
+  uint32_t num_replies  = channel->reply.seq;
+
+  std::thread backend([&] {
+    uint32_t num_available_slot = o3queue_size;
+    auto drain_ring = [&]() -> uint64_t {
+      PTSRing & ring = channel->ring;
+      uint64_t num = ring.num_used();
+      for (uint64_t i = 0; i < num; i++) {
+        in_order = in_order && ring.slot(ring.tail + i)->ip == num_received + i;
+        spend(add_time);
+      }
+      num_received += num;
+      num_available_slot = (num_available_slot > num) ? num_available_slot - num : 0;
+      ring.consume(num);
+      return num;
+    };
+    while (true) {
+      num_requests = channel->request.wait(num_requests, [&] {
+          uint64_t num = drain_ring();
+          traffic.num_drained_ahead += num;
+          return num > 0; });
+      drain_ring();
+      if (channel->msg.type == pts_destructor) break;
+
+      // uint64_t_val tells how many instructions were sent before the request
+      in_order = in_order && channel->msg.uint64_t_val == num_received;
+      if (channel->msg.type == pts_resume_simulation) {
+        num_available_slot = o3queue_size;
+      }
+      channel->msg.uint32_t_val = num_available_slot;
+      traffic.num_requests++;
+      channel->reply.ring();
+    }
+  });
+
+  auto sync = [&](pts_msg_type type, uint64_t num_sent) {
+    channel->msg.type         = type;
+    channel->msg.uint64_t_val = num_sent;
+    channel->request.ring();
+    num_replies = channel->reply.wait(num_replies);
+  };
+
+  PTSRing & ring = channel->ring;
+  PTSBatch  batch;
+  PTSCredit credit;
+  batch.max_piled       = max_piled;
+  batch.max_unpublished = publish_size;
+  for (uint64_t sent = 0; sent < num_instrs; sent++) {
+    batch.next(ring)->ip = sent;
+    if (batch.pile(ring, sent + 1 < num_instrs, credit.num_available_slot) == false) continue;
+
+    uint32_t num = batch.send(ring);
+    if (run_ahead == true && credit.is_exact == true && batch.has_room_for_next(ring) == true) {
+      credit.take(num);
+      channel->request.nudge();
+    } else {
+      channel->msg.uint32_t_val = num;
+      sync(pts_add_instruction, sent + 1);
+      credit.reply(channel->msg.uint32_t_val);
+    }
+    if (pin_time.count() > 0) std::this_thread::sleep_for(pin_time);
+
+    if (credit.num_available_slot <= 1) {
+      sync(pts_resume_simulation, sent + 1);
+      credit.is_exact = false;
+    }
+  }
+  channel->msg.type = pts_destructor;
+  channel->request.ring();
+  backend.join();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(num_received, num_instrs);
+  return traffic;
+}
+
+
+TEST_F(PTSChannelTest, WrapAround) {
+  // an o3queue of 1000 takes batches of 1 (for the room) and 999, and a
+  // resume; a batch may be as large as the ring, so the frontend cannot run
+  // ahead.  the last 152 instructions need no resume.
+  EXPECT_EQ(send_instrs(3 * instr_ring_size, 1000).num_requests, 3 * 49 + 2);
+  EXPECT_EQ(channel->ring.head, 3 * instr_ring_size);
+  EXPECT_EQ(channel->ring.tail, 3 * instr_ring_size);
+}
+
+TEST_F(PTSChannelTest, PublishWithinBatch) {
+  // with room for 10 in the o3queue, the batch is sent at the 10th instruction
+  // whatever max_unpublished is; every 4 of them are published before that
+  PTSRing & ring = channel->ring;
+  PTSBatch  batch;
+  batch.max_piled       = 1024;
+  batch.max_unpublished = 4;
+  for (uint32_t i = 0; i < 9; i++) {
+    batch.next(ring)->ip = i;
+    EXPECT_FALSE(batch.pile(ring, true, 10));
+    EXPECT_EQ(ring.head, (i + 1) / 4 * 4);
+  }
+  batch.next(ring)->ip = 9;
+  EXPECT_TRUE(batch.pile(ring, true, 10));
+  EXPECT_EQ(ring.head, 8u);
+  EXPECT_EQ(batch.last(ring)->ip, 9u);
+  EXPECT_EQ(batch.send(ring), 10u);
+  EXPECT_EQ(ring.head, 10u);
+  for (uint32_t i = 0; i < 10; i++) {
+    EXPECT_EQ(ring.slot(i)->ip, i);
+  }
+
+  // a batch is also sent when it cannot be piled further or is full
+  batch.next(ring)->ip = 10;
+  EXPECT_TRUE(batch.pile(ring, false, 10));
+  EXPECT_EQ(batch.send(ring), 1u);
+  batch.max_piled = 2;
+  EXPECT_FALSE(batch.pile(ring, true, 10));
+  EXPECT_TRUE(batch.pile(ring, true, 10));
+  EXPECT_EQ(batch.send(ring), 2u);
+  EXPECT_EQ(ring.head, 13u);
+}
+
+TEST_F(PTSChannelTest, PublishAhead) {
+  // publishing within a batch does not change the requests
+  max_piled = 100;
+  uint64_t num_requests = send_instrs(3 * instr_ring_size, 1000).num_requests;
+  publish_size = 16;
+  EXPECT_EQ(send_instrs(3 * instr_ring_size, 1000).num_requests, num_requests);
+  EXPECT_EQ(channel->ring.head, 6 * instr_ring_size);
+  EXPECT_EQ(channel->ring.tail, 6 * instr_ring_size);
+}
+
+TEST_F(PTSChannelTest, RunAhead) {
+  // an o3queue of 128 takes batches of 1 (for the room), 32, 32, 32, and 31;
+  // with the room known after the first, only it and the resume are requests
+  max_piled = 32;
+  run_ahead = false;
+  EXPECT_EQ(send_instrs(128 * 100, 128).num_requests, 6 * 100u);
+  run_ahead = true;
+  EXPECT_EQ(send_instrs(128 * 100, 128).num_requests, 2 * 100u);
+
+  // a batch as large as the ring has to be drained before the next one
+  max_piled = instr_ring_size;
+  EXPECT_EQ(send_instrs(4 * instr_ring_size, 4 * instr_ring_size).num_requests, 6u);
+}
+
+TEST_F(PTSChannelTest, SleepingBackend) {
+  // the backend runs out of spins and sleeps on the futex
+  uint32_t num_requests = 0;
+  std::thread backend([&] {
+    num_requests = channel->request.wait(num_requests);
+    channel->reply.ring();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  channel->request.ring();
+  EXPECT_EQ(channel->reply.wait(0), 1u);
+  backend.join();
+  EXPECT_EQ(num_requests, 1u);
+}
+
+// requests and instructions per second with an o3queue of 128 entries (the
+// sample configs).  a batch stops at that room, so pts.instr_batch_size above
+// it sends the same batches.
+TEST_F(PTSChannelTest, Throughput) {
+  const uint64_t num_instrs = 1 << 14;
+
+  for (bool ahead : {false, true}) {
+    run_ahead = ahead;
+    uint64_t num_requests = 0;
+    for (uint32_t batch_size : {1u, 32u, 128u, 1024u}) {
+      max_piled = batch_size;
+      auto start = std::chrono::steady_clock::now();
+      Traffic traffic = send_instrs(num_instrs, 128);
+      double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (batch_size == 1024) EXPECT_EQ(traffic.num_requests, num_requests);
+      num_requests = traffic.num_requests;
+      std::cout << "  -- " << (run_ahead ? "run-ahead" : "a request per batch")
+        << ", pts.instr_batch_size = " << batch_size << " : "
+        << num_instrs / static_cast<double>(num_requests) << " instrs/request, "
+        << num_instrs / sec / 1e6 << " M instrs/sec" << std::endl;
+    }
+  }
+}
+
+// pin spends 50us after each batch of 32, and mcsim 1us on each instruction.
+// running ahead, the backend adds a batch while pin works on the next one.
+TEST_F(PTSChannelTest, Overlap) {
+  const uint64_t num_instrs = 128 * 50;
+  max_piled = 32;
+  pin_time  = std::chrono::microseconds(50);
+  add_time  = std::chrono::microseconds(1);
+
+  double sec[2];
+  for (bool ahead : {false, true}) {
+    run_ahead = ahead;
+    auto start = std::chrono::steady_clock::now();
+    Traffic traffic = send_instrs(num_instrs, 128);
+    sec[ahead] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  -- " << (run_ahead ? "run-ahead" : "a request per batch") << " : "
+      << traffic.num_requests << " requests, " << traffic.num_drained_ahead
+      << " instrs added before a request, " << sec[ahead] * 1e3 << " ms" << std::endl;
+    if (run_ahead == true) {
+      EXPECT_GT(traffic.num_drained_ahead, num_instrs / 2);
+    } else {
+      EXPECT_EQ(traffic.num_drained_ahead, 0u);
+    }
+  }
+  std::cout << "  -- run-ahead takes " << sec[1] / sec[0] * 100 << "% of the time" << std::endl;
+}
+}
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CHANNEL_TEST_H_
+#define CHANNEL_TEST_H_
+
+#include "gtest/gtest.h"
+
+#include "../PTS.h"
+#include "../PTSChannel.h"
+
+#include <sys/mman.h>
+
+#include <chrono>
+
+namespace PinPthread {
+namespace ChannelTest {
+
+class PTSChannelTest : public ::testing::Test {
+  protected:
+    // shared the same way as the mmaped file between mcsim and the pintool
+    virtual void SetUp() override {
+      void * pmmap = mmap(0, sizeof(PTSChannel), PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      ASSERT_NE(pmmap, MAP_FAILED);
+      channel = reinterpret_cast<PTSChannel *>(pmmap);
+    }
+    virtual void TearDown() override { munmap(channel, sizeof(PTSChannel)); }
+
+    // what send_instrs saw
+    struct Traffic {
+      uint64_t num_requests      = 0;  // round trips, pts_destructor aside
+      uint64_t num_drained_ahead = 0;  // instructions added before a request came
+    };
+
+    // sends num_instrs instructions of a hardware thread as the pintool does,
+    // and resumes simulation whenever the o3queue of o3queue_size entries is
+    // (about to be) full; the backend thread frees the entries on resuming
+    // and checks that the instructions arrive in order and are all added
+    // before it serves a request.  the frontend spends pin_time after each
+    // batch and the backend add_time on each instruction.
+    Traffic send_instrs(uint64_t num_instrs, uint32_t o3queue_size);
+
+    bool     run_ahead    = true;  // with PTSCredit, or a request per batch
+    uint32_t max_piled    = instr_ring_size;
+    uint32_t publish_size = instr_ring_size;
+    std::chrono::nanoseconds pin_time{0};
+    std::chrono::nanoseconds add_time{0};
+
+    PTSChannel * channel;
+};
+
+}
+}
+
+#endif // CHANNEL_TEST_H_
@@ -5,6 +5,7 @@
 #include "coherence_test.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 
@@ -63,12 +64,12 @@ TEST_F(CoherenceTest, Case1) {
   auto l1_tags_set = test_l1ds[0]->get_tags(l1_set);
   auto l2_tags_set = test_l2s[0]->get_tags(l2_set);
 
-  if (l1_tags_set[0]->first == l1_tag) {
-    EXPECT_EQ(l1_tags_set[0]->second, cs_invalid);
+  if (l1_tags_set.tag[0] == l1_tag) {
+    EXPECT_EQ(l1_tags_set.state[0], cs_invalid);
   }
-  if (l2_tags_set[0]->tag == l2_tag) {
-    EXPECT_EQ(l2_tags_set[0]->type, cs_invalid);
-    EXPECT_EQ(l2_tags_set[0]->type_l1l2, cs_invalid);
+  if (l2_tags_set.tag[0] == l2_tag) {
+    EXPECT_EQ(l2_tags_set.type[0], cs_invalid);
+    EXPECT_EQ(l2_tags_set.entry[0].type_l1l2, cs_invalid);
   }
 
   auto it = test_dir->search_dir(TEST_ADDR_D);
@@ -78,24 +79,42 @@ TEST_F(CoherenceTest, Case1) {
   set_rob_entry((test_cores[0]->get_o3rob())[0], TEST_ADDR_D, 0);
   test_cores[0]->set_o3rob_head(0);
   test_cores[0]->set_o3rob_size(1);
+  test_cores[0]->rebuild_deps();
   test_pts->mcsim->global_q->add_event(0, test_cores[0]);
   test_pts->mcsim->global_q->process_event();
 
 
-  EXPECT_EQ(l1_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_tags_set[0]->second, cs_exclusive);
+  EXPECT_EQ(l1_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_tags_set.state[0], cs_exclusive);
 
-  EXPECT_EQ(l2_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_tags_set[0]->type_l1l2, cs_exclusive);
-  EXPECT_EQ(l2_tags_set[0]->type, cs_exclusive);
+  EXPECT_EQ(l2_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_tags_set.entry[0].type_l1l2, cs_exclusive);
+  EXPECT_EQ(l2_tags_set.type[0], cs_exclusive);
 
   it = test_dir->search_dir(TEST_ADDR_D);
   EXPECT_NE(it, test_dir->get_dir_end());
-  EXPECT_EQ(it->second.type, cs_exclusive);
+  EXPECT_EQ(it->type, cs_exclusive);
 
   // check transient state
-  EXPECT_EQ(test_dir->cs_type[0], cs_tr_to_e);
-  EXPECT_EQ(test_dir->cs_type[1], cs_exclusive);  // (I) -> tr_to_e -> E
+  EXPECT_EQ(std::vector<coherence_state_type>({cs_tr_to_e, cs_exclusive}),  // (I) -> tr_to_e -> E
+            changes_from(test_dir->cs_type, cs_invalid));
+
+  // the L1 prefetches the next two lines and the L2 the next four.  the L1
+  // prefetch of line + 2 finds the L2 prefetch of it on the way; it is
+  // nacked and dropped.
+  auto line = [](UINT64 i) { return TEST_ADDR_D + (i << test_l1ds[0]->set_lsb); };
+  EXPECT_EQ((uint64_t)2, test_l1ds[0]->num_prefetch_requests);
+  EXPECT_EQ((uint64_t)4, test_l2s[0]->num_prefetch_requests);
+  EXPECT_EQ((uint64_t)1, test_l1ds[0]->num_nack);
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[0], line(1)));
+  EXPECT_EQ(cs_invalid, l1_state(test_l1ds[0], line(2)));
+  EXPECT_EQ(std::make_pair(cs_exclusive, cs_exclusive), l2_line(test_l2s[0], line(1)));
+  for (UINT64 i = 2; i <= 4; i++) {
+    EXPECT_EQ(std::make_pair(cs_exclusive, cs_invalid), l2_line(test_l2s[0], line(i)));
+    ASSERT_NE(nullptr, test_dir->search_dir(line(i)));
+    EXPECT_EQ(cs_exclusive, test_dir->search_dir(line(i))->type);
+  }
+  EXPECT_EQ(std::make_pair(cs_invalid, cs_invalid), l2_line(test_l2s[0], line(5)));
 }
 
 TEST_F(CoherenceTest, Case2) {
@@ -104,27 +123,28 @@ TEST_F(CoherenceTest, Case2) {
   auto l1_1_tags_set = test_l1ds[1]->get_tags(l1_set);
   auto l2_tags_set   = test_l2s[0]->get_tags(l2_set);
 
-  EXPECT_EQ(l1_1_tags_set[0]->second, cs_invalid);
+  EXPECT_EQ(l1_1_tags_set.state[0], cs_invalid);
 
   set_rob_entry((test_cores[1]->get_o3rob())[0], TEST_ADDR_D, 1200);
   test_cores[1]->set_o3rob_head(0);
   test_cores[1]->set_o3rob_size(1);
+  test_cores[1]->rebuild_deps();
 
   test_pts->mcsim->global_q->add_event(1200, test_cores[1]);
   test_pts->mcsim->global_q->process_event();
 
-  EXPECT_EQ(l1_0_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_0_tags_set[0]->second, cs_exclusive);
-  EXPECT_EQ(l1_1_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_1_tags_set[0]->second, cs_exclusive);
+  EXPECT_EQ(l1_0_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_0_tags_set.state[0], cs_exclusive);
+  EXPECT_EQ(l1_1_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_1_tags_set.state[0], cs_exclusive);
 
-  EXPECT_EQ(l2_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_tags_set[0]->type_l1l2, cs_shared);
-  EXPECT_EQ(l2_tags_set[0]->type, cs_exclusive);
+  EXPECT_EQ(l2_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_tags_set.entry[0].type_l1l2, cs_shared);
+  EXPECT_EQ(l2_tags_set.type[0], cs_exclusive);
 
   auto it = test_dir->search_dir(TEST_ADDR_D);
   EXPECT_NE(it, test_dir->get_dir_end());
-  EXPECT_EQ(it->second.type, cs_exclusive);
+  EXPECT_EQ(it->type, cs_exclusive);
 }
 
 TEST_F(CoherenceTest, Case3) {
@@ -135,38 +155,39 @@ TEST_F(CoherenceTest, Case3) {
   auto l2_0_tags_set = test_l2s[0]->get_tags(l2_set);
   auto l2_1_tags_set = test_l2s[1]->get_tags(l2_set);
 
-  if (l1_2_tags_set[0]->first == l1_tag) {
-    EXPECT_EQ(l1_2_tags_set[0]->second, cs_invalid);
+  if (l1_2_tags_set.tag[0] == l1_tag) {
+    EXPECT_EQ(l1_2_tags_set.state[0], cs_invalid);
   }
-  if (l2_1_tags_set[0]->tag == l2_tag) {
-    EXPECT_EQ(l2_1_tags_set[0]->type, cs_invalid);
-    EXPECT_EQ(l2_1_tags_set[0]->type_l1l2, cs_invalid);
+  if (l2_1_tags_set.tag[0] == l2_tag) {
+    EXPECT_EQ(l2_1_tags_set.type[0], cs_invalid);
+    EXPECT_EQ(l2_1_tags_set.entry[0].type_l1l2, cs_invalid);
   }
 
   set_rob_entry((test_cores[2]->get_o3rob())[0], TEST_ADDR_D, 2400);
   test_cores[2]->set_o3rob_head(0);
   test_cores[2]->set_o3rob_size(1);
+  test_cores[2]->rebuild_deps();
 
   test_pts->mcsim->global_q->add_event(2400, test_cores[2]);
   test_pts->mcsim->global_q->process_event();
 
-  EXPECT_EQ(l1_0_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_0_tags_set[0]->second, cs_exclusive);
-  EXPECT_EQ(l1_1_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_1_tags_set[0]->second, cs_exclusive);
-  EXPECT_EQ(l1_2_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_2_tags_set[0]->second, cs_exclusive);
+  EXPECT_EQ(l1_0_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_0_tags_set.state[0], cs_exclusive);
+  EXPECT_EQ(l1_1_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_1_tags_set.state[0], cs_exclusive);
+  EXPECT_EQ(l1_2_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_2_tags_set.state[0], cs_exclusive);
 
-  EXPECT_EQ(l2_0_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_0_tags_set[0]->type_l1l2, cs_shared);
-  EXPECT_EQ(l2_0_tags_set[0]->type, cs_shared);
+  EXPECT_EQ(l2_0_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_0_tags_set.entry[0].type_l1l2, cs_shared);
+  EXPECT_EQ(l2_0_tags_set.type[0], cs_shared);
 
-  EXPECT_EQ(l2_1_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_1_tags_set[0]->type_l1l2, cs_exclusive);
-  EXPECT_EQ(l2_1_tags_set[0]->type, cs_shared);
+  EXPECT_EQ(l2_1_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_1_tags_set.entry[0].type_l1l2, cs_exclusive);
+  EXPECT_EQ(l2_1_tags_set.type[0], cs_shared);
 
-  EXPECT_EQ(test_dir->cs_type[0], cs_tr_to_s);
-  EXPECT_EQ(test_dir->cs_type[1], cs_shared);    // (E) -> tr_to_s -> S
+  EXPECT_EQ(std::vector<coherence_state_type>({cs_tr_to_s, cs_shared}),  // (E) -> tr_to_s -> S
+            changes_from(test_dir->cs_type, cs_exclusive));
 }
 
 TEST_F(CoherenceTest, Case4) {
@@ -178,34 +199,35 @@ TEST_F(CoherenceTest, Case4) {
   auto l2_0_tags_set = test_l2s[0]->get_tags(l2_set);
   auto l2_1_tags_set = test_l2s[1]->get_tags(l2_set);
 
-  EXPECT_EQ(l1_3_tags_set[0]->second, cs_invalid);
+  EXPECT_EQ(l1_3_tags_set.state[0], cs_invalid);
 
   set_rob_entry((test_cores[3]->get_o3rob())[0], TEST_ADDR_D, 3600, false); // write event
   test_cores[3]->set_o3rob_head(0);
   test_cores[3]->set_o3rob_size(1);
+  test_cores[3]->rebuild_deps();
 
   test_pts->mcsim->global_q->add_event(3600, test_cores[3]);
   test_pts->mcsim->global_q->process_event();
   
-  if (l1_0_tags_set[0]->first == l1_tag) {
-    EXPECT_EQ(l1_0_tags_set[0]->second, cs_invalid);
+  if (l1_0_tags_set.tag[0] == l1_tag) {
+    EXPECT_EQ(l1_0_tags_set.state[0], cs_invalid);
   }
-  if (l1_1_tags_set[0]->first == l1_tag) {
-    EXPECT_EQ(l1_1_tags_set[0]->second, cs_invalid);
+  if (l1_1_tags_set.tag[0] == l1_tag) {
+    EXPECT_EQ(l1_1_tags_set.state[0], cs_invalid);
   }
-  if (l1_2_tags_set[0]->first == l1_tag) {
-    EXPECT_EQ(l1_2_tags_set[0]->second, cs_invalid);
+  if (l1_2_tags_set.tag[0] == l1_tag) {
+    EXPECT_EQ(l1_2_tags_set.state[0], cs_invalid);
   }
-  EXPECT_EQ(l1_3_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_3_tags_set[0]->second, cs_modified);
+  EXPECT_EQ(l1_3_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_3_tags_set.state[0], cs_modified);
 
-  if (l2_0_tags_set[0]->tag == l2_tag) {
-    EXPECT_EQ(l2_0_tags_set[0]->type_l1l2, cs_invalid);
-    EXPECT_EQ(l2_0_tags_set[0]->type, cs_invalid);
+  if (l2_0_tags_set.tag[0] == l2_tag) {
+    EXPECT_EQ(l2_0_tags_set.entry[0].type_l1l2, cs_invalid);
+    EXPECT_EQ(l2_0_tags_set.type[0], cs_invalid);
   }
-  EXPECT_EQ(l2_1_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_1_tags_set[0]->type_l1l2, cs_modified);
-  EXPECT_EQ(l2_1_tags_set[0]->type, cs_modified);
+  EXPECT_EQ(l2_1_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_1_tags_set.entry[0].type_l1l2, cs_modified);
+  EXPECT_EQ(l2_1_tags_set.type[0], cs_modified);
 
   EXPECT_EQ(test_dir->cs_type[0], cs_tr_to_m);
   EXPECT_EQ(test_dir->cs_type[1], cs_modified);    // (S) -> tr_to_m -> M
@@ -221,17 +243,18 @@ TEST_F(CoherenceTest, Case5) {
   set_rob_entry((test_cores[1]->get_o3rob())[0], TEST_ADDR_D, 4800);
   test_cores[1]->set_o3rob_head(0);
   test_cores[1]->set_o3rob_size(1);
+  test_cores[1]->rebuild_deps();
 
   test_pts->mcsim->global_q->add_event(4800, test_cores[1]);
   test_pts->mcsim->global_q->process_event();
 
-  EXPECT_EQ(l1_1_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_3_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l2_0_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_1_tags_set[0]->tag, l2_tag);
+  EXPECT_EQ(l1_1_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_3_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l2_0_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_1_tags_set.tag[0], l2_tag);
 
-  EXPECT_EQ(l1_1_tags_set[0]->second, cs_exclusive);
-  EXPECT_EQ(l1_3_tags_set[0]->second, cs_exclusive);
+  EXPECT_EQ(l1_1_tags_set.state[0], cs_exclusive);
+  EXPECT_EQ(l1_3_tags_set.state[0], cs_exclusive);
 
   EXPECT_EQ(test_l2s[0]->cs_type[0], cs_invalid);
   EXPECT_EQ(test_l2s[0]->cs_type[1], cs_shared);          // (I) -> I -> S
@@ -260,19 +283,20 @@ TEST_F(CoherenceTest, Case6) {
   set_rob_entry((test_cores[1]->get_o3rob())[0], test_address2, 6000);
   test_cores[1]->set_o3rob_head(0);
   test_cores[1]->set_o3rob_size(1);
+  test_cores[1]->rebuild_deps();
 
   test_pts->mcsim->global_q->add_event(6000, test_cores[1]);
   test_pts->mcsim->global_q->process_event();
 
-  EXPECT_NE(l1_1_tags_set[0]->first, l1_tag);  // evicted
-  EXPECT_NE(l2_0_tags_set[0]->tag, l2_tag);    // evicted
+  EXPECT_NE(l1_1_tags_set.tag[0], l1_tag);  // evicted
+  EXPECT_NE(l2_0_tags_set.tag[0], l2_tag);    // evicted
 
-  EXPECT_EQ(l2_1_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_1_tags_set[0]->type_l1l2, cs_exclusive);
-  EXPECT_EQ(l2_1_tags_set[0]->type, cs_shared);
+  EXPECT_EQ(l2_1_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_1_tags_set.entry[0].type_l1l2, cs_exclusive);
+  EXPECT_EQ(l2_1_tags_set.type[0], cs_shared);
 
-  EXPECT_EQ(test_dir->cs_type[0], cs_tr_to_e);
-  EXPECT_EQ(test_dir->cs_type[1], cs_exclusive);  // (I) -> tr_to_e -> E
+  EXPECT_EQ(std::vector<coherence_state_type>({cs_tr_to_e, cs_exclusive}),  // (I) -> tr_to_e -> E
+            changes_from(test_dir->cs_type, cs_invalid));
 
 /*
   auto test_l1_3 = test_mcsim->l1ds[3];
@@ -285,40 +309,215 @@ TEST_F(CoherenceTest, Case6) {
   test_mcsim->global_q->add_event(6000, test_mcsim->o3cores[1]);
   test_mcsim->global_q->process_event();
 
-  EXPECT_EQ(l1_1_tags_set[0]->first, l1_tag);
-  EXPECT_EQ(l1_1_tags_set[0]->second, cs_modified);
+  EXPECT_EQ(l1_1_tags_set.tag[0], l1_tag);
+  EXPECT_EQ(l1_1_tags_set.state[0], cs_modified);
 
-  if (l1_3_tags_set[0]->first == l1_tag) {
-    EXPECT_EQ(l1_3_tags_set[0]->second, cs_invalid);
+  if (l1_3_tags_set.tag[0] == l1_tag) {
+    EXPECT_EQ(l1_3_tags_set.state[0], cs_invalid);
   }
 
-  EXPECT_EQ(l2_0_tags_set[0]->tag, l2_tag);
-  EXPECT_EQ(l2_0_tags_set[0]->type_l1l2, cs_modified);
-  EXPECT_EQ(l2_0_tags_set[0]->type, cs_modified);
+  EXPECT_EQ(l2_0_tags_set.tag[0], l2_tag);
+  EXPECT_EQ(l2_0_tags_set.entry[0].type_l1l2, cs_modified);
+  EXPECT_EQ(l2_0_tags_set.type[0], cs_modified);
 
-  if (l2_1_tags_set[0]->tag == l2_tag) {
-    EXPECT_EQ(l2_1_tags_set[0]->type_l1l2, cs_invalid);
-    EXPECT_EQ(l2_1_tags_set[0]->type, cs_invalid);
+  if (l2_1_tags_set.tag[0] == l2_tag) {
+    EXPECT_EQ(l2_1_tags_set.entry[0].type_l1l2, cs_invalid);
+    EXPECT_EQ(l2_1_tags_set.type[0], cs_invalid);
   }
 
   auto it = test_dir->dir.find(test_address >> test_dir->set_lsb);
   EXPECT_NE(it, test_dir->get_dir_end());
-  EXPECT_EQ(it->second.type, cs_modified);
+  EXPECT_EQ(it->type, cs_modified);
 */
 }
 
+TEST_F(CoherenceTest, PrefetchedLines) {
+  // lines prefetched into the L1 and the L2 of core 0 follow the protocol
+  UINT64 const test_address = 0x86C8;
+  auto line = [&](UINT64 i) { return test_address + (i << test_l1ds[0]->set_lsb); };
+  for (UINT64 i = 0; i <= 2; i++) {
+    ASSERT_EQ((uint32_t)0, test_pts->mcsim->global_q->which_mc(line(i)));
+  }
+  auto access = [&](UINT32 core, UINT64 address, UINT64 time, bool isread) {
+    set_rob_entry((test_cores[core]->get_o3rob())[0], address, time, isread);
+    test_cores[core]->set_o3rob_head(0);
+    test_cores[core]->set_o3rob_size(1);
+    test_cores[core]->rebuild_deps();
+    test_pts->mcsim->global_q->add_event(time, test_cores[core]);
+    test_pts->mcsim->global_q->process_event();
+  };
+
+  access(0, line(0), 7200, true);
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[0], line(1)));
+  EXPECT_EQ(std::make_pair(cs_exclusive, cs_exclusive), l2_line(test_l2s[0], line(1)));
+  EXPECT_EQ(std::make_pair(cs_exclusive, cs_invalid), l2_line(test_l2s[0], line(2)));
+
+  // lines only the L2 prefetched hit there: the demand read of core 1 and
+  // the L1 prefetch of the line after it
+  const uint64_t num_l2_prefetch_hits = test_l2s[0]->num_prefetch_hits;
+  access(1, line(2), 8400, true);
+  EXPECT_EQ(num_l2_prefetch_hits + 2, test_l2s[0]->num_prefetch_hits);
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[1], line(2)));
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[1], line(3)));
+  EXPECT_EQ(std::make_pair(cs_exclusive, cs_exclusive), l2_line(test_l2s[0], line(2)));
+
+  // a write from the other L2 invalidates the prefetched copies
+  access(2, line(1), 9600, false);
+  EXPECT_EQ(cs_invalid, l1_state(test_l1ds[0], line(1)));
+  EXPECT_EQ(cs_invalid, l2_line(test_l2s[0], line(1)).first);
+  EXPECT_EQ(cs_modified, l1_state(test_l1ds[2], line(1)));
+  EXPECT_EQ(std::make_pair(cs_modified, cs_modified), l2_line(test_l2s[1], line(1)));
+  ASSERT_NE(nullptr, test_dir->search_dir(line(1)));
+  EXPECT_EQ(cs_modified, test_dir->search_dir(line(1))->type);
+}
+
+TEST_F(CoherenceTest, FunctionalWarming) {
+  // the same protocol as the cases above, but with no events
+  UINT64 const test_address = 0x46C8;  // a directory 0 line not used above
+  ASSERT_EQ((uint32_t)0, test_pts->mcsim->global_q->which_mc(test_address));
+  clear_geq();
+
+  auto warm = [&](UINT32 htid, UINT64 raddr, UINT64 waddr) {
+    PTSInstr instr{htid, 0, waddr, 8, raddr, 0, 8, 0x401640, 0,
+      false, false, false, false, false, 0, 0, 0, 0, 0, 0, 0, 0};
+    test_pts->mcsim->warm_instructions(&instr, 1, 0, 0);
+  };
+
+  // I to E
+  warm(0, test_address, 0);
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[0], test_address));
+  EXPECT_EQ(std::make_pair(cs_exclusive, cs_exclusive), l2_line(test_l2s[0], test_address));
+  ASSERT_NE(nullptr, test_dir->search_dir(test_address));
+  EXPECT_EQ(cs_exclusive, test_dir->search_dir(test_address)->type);
+
+  // a read from the other L2 makes the line shared in both
+  warm(2, test_address, 0);
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[2], test_address));
+  EXPECT_EQ(cs_shared, l2_line(test_l2s[0], test_address).first);
+  EXPECT_EQ(cs_shared, l2_line(test_l2s[1], test_address).first);
+  EXPECT_EQ(cs_shared, test_dir->search_dir(test_address)->type);
+  EXPECT_EQ((uint32_t)2, test_dir->search_dir(test_address)->sharedl2.size());
+
+  // a write invalidates the other copies
+  warm(1, 0, test_address);
+  EXPECT_EQ(cs_invalid, l1_state(test_l1ds[0], test_address));
+  EXPECT_EQ(cs_modified, l1_state(test_l1ds[1], test_address));
+  EXPECT_EQ(cs_invalid, l1_state(test_l1ds[2], test_address));
+  EXPECT_EQ(std::make_pair(cs_modified, cs_modified), l2_line(test_l2s[0], test_address));
+  EXPECT_EQ(cs_invalid, l2_line(test_l2s[1], test_address).first);
+  EXPECT_EQ(cs_modified, test_dir->search_dir(test_address)->type);
+  EXPECT_EQ((uint32_t)1, test_dir->search_dir(test_address)->sharedl2.size());
+
+  // a read from the same L2 leaves the writer with a shared copy
+  warm(0, test_address, 0);
+  EXPECT_EQ(cs_shared, l1_state(test_l1ds[1], test_address));
+  EXPECT_EQ(cs_exclusive, l1_state(test_l1ds[0], test_address));
+  EXPECT_EQ(std::make_pair(cs_modified, cs_shared), l2_line(test_l2s[0], test_address));
+
+  EXPECT_TRUE(test_pts->mcsim->global_q->event_queue.empty());
+}
+
+TEST_F(CoherenceTest, MeshAndRingRouting) {
+  // 8 tiles on a 2 x 4 mesh
+  Mesh2DForTest mesh(test_pts->mcsim, 8);
+  ASSERT_EQ((uint32_t)2, mesh.width);
+  EXPECT_EQ((uint32_t)Mesh2D::mesh_local, mesh.route(5, 5));
+  EXPECT_EQ((uint32_t)Mesh2D::mesh_east,  mesh.route(0, 7));  // x first
+  EXPECT_EQ((uint32_t)Mesh2D::mesh_south, mesh.route(1, 7));
+  EXPECT_EQ((uint32_t)Mesh2D::mesh_west,  mesh.route(7, 0));
+  EXPECT_EQ((uint32_t)Mesh2D::mesh_north, mesh.route(6, 0));
+  EXPECT_EQ((uint32_t)3, mesh.neighbor(1, Mesh2D::mesh_south));
+  EXPECT_EQ((uint32_t)8, mesh.neighbor(1, Mesh2D::mesh_east));   // no link
+  EXPECT_EQ((uint32_t)8, mesh.neighbor(6, Mesh2D::mesh_south));
+
+  RingForTest ring(test_pts->mcsim, 8);
+  EXPECT_EQ((uint32_t)Ring::ring_local, ring.route(3, 3));
+  EXPECT_EQ((uint32_t)Ring::ring_cw,  ring.route(6, 1));
+  EXPECT_EQ((uint32_t)Ring::ring_ccw, ring.route(1, 6));
+  EXPECT_EQ((uint32_t)Ring::ring_cw,  ring.route(0, 4));  // a tie
+  EXPECT_EQ((uint32_t)0, ring.neighbor(7, Ring::ring_cw));
+  EXPECT_EQ((uint32_t)7, ring.neighbor(0, Ring::ring_ccw));
+}
+
+TEST_F(CoherenceTest, RingLinkContention) {
+  // hop_t 20, to_l2_t 10, and a flit per 10 ticks; packets of 4 flits
+  RingForTest ring(test_pts->mcsim, 8);
+  std::vector<NoCNodeForTest *> nodes;
+  for (UINT32 i = 0; i < 8; i++) nodes.push_back(new NoCNodeForTest(test_pts->mcsim, i));
+  LocalQueueElement a, b1, b2, alone;
+
+  // alone, 2 hops of (4 - 1) * 10 + 20, and 30 + 10 from the local port
+  const UINT64 t0 = 100000000;
+  ring.inject(t0, &alone, nodes[0], nodes[2], 4, NoC::noc_rep);
+  test_pts->mcsim->global_q->process_event();
+  ASSERT_EQ((size_t)1, nodes[2]->arrivals.size());
+  EXPECT_EQ(t0 + 140, nodes[2]->arrivals[0].first);
+  nodes[2]->arrivals.clear();
+
+  // a (0 -> 2) reaches router 1 as b1 and b2 (1 -> 2) start there; the cw
+  // link of router 1 takes them round robin over its input ports
+  const UINT64 t1 = 200000000;
+  ring.inject(t1,      &a,  nodes[0], nodes[2], 4, NoC::noc_rep);
+  ring.inject(t1 + 50, &b1, nodes[1], nodes[2], 4, NoC::noc_rep);
+  ring.inject(t1 + 50, &b2, nodes[1], nodes[2], 4, NoC::noc_rep);
+  test_pts->mcsim->global_q->process_event();
+  ASSERT_EQ((size_t)3, nodes[2]->arrivals.size());
+  EXPECT_EQ(&b1, nodes[2]->arrivals[0].second);
+  EXPECT_EQ(t1 + 140, nodes[2]->arrivals[0].first);
+  EXPECT_EQ(&a,  nodes[2]->arrivals[1].second);   // 40 behind b1 on the link
+  EXPECT_EQ(t1 + 180, nodes[2]->arrivals[1].first);
+  EXPECT_EQ(&b2, nodes[2]->arrivals[2].second);
+  EXPECT_EQ(t1 + 220, nodes[2]->arrivals[2].first);
+  EXPECT_EQ((UINT64)0, ring.num_credit_stalls);
+
+  for (auto && node : nodes) delete node;
+}
+
+TEST_F(CoherenceTest, RingBackpressure) {
+  // 0 -> 1 and 2 -> 1 fill router 1 twice as fast as it ejects
+  RingForTest ring(test_pts->mcsim, 8);
+  ASSERT_EQ((uint32_t)3, ring.buffer_sz);
+  std::vector<NoCNodeForTest *> nodes;
+  for (UINT32 i = 0; i < 3; i++) nodes.push_back(new NoCNodeForTest(test_pts->mcsim, i));
+  std::vector<LocalQueueElement> lqes(16);
+
+  const UINT64 t0 = 300000000;
+  for (UINT32 i = 0; i < 8; i++) {
+    ring.inject(t0, &lqes[i],     nodes[0], nodes[1], 4, NoC::noc_rep);
+    ring.inject(t0, &lqes[i + 8], nodes[2], nodes[1], 4, NoC::noc_rep);
+  }
+  test_pts->mcsim->global_q->process_event();
+
+  // all arrive, in order per source and a packet per 40 ticks
+  ASSERT_EQ((size_t)16, nodes[1]->arrivals.size());
+  UINT32 next[2] = {0, 8};
+  for (UINT32 i = 0; i < 16; i++) {
+    const UINT32 src = (nodes[1]->arrivals[i].second < &lqes[8]) ? 0 : 1;
+    EXPECT_EQ(&lqes[next[src]++], nodes[1]->arrivals[i].second);
+    if (i > 0) {
+      EXPECT_EQ(nodes[1]->arrivals[i - 1].first + 40, nodes[1]->arrivals[i].first);
+    }
+  }
+  // but the routers 0 and 2 keep the ones router 1 has no room for; a
+  // packet from the local port leaves a slot free
+  EXPECT_EQ((UINT64)ring.buffer_sz - 1, ring.max_buffered);
+  EXPECT_LT((UINT64)0, ring.num_credit_stalls);
+
+  for (auto && node : nodes) delete node;
+}
+
 UINT32 CacheL2ForTest::process_event(UINT64 curr_time) {
   auto res = CacheL2::process_event(curr_time);
 
   for (uint i = 0; i < num_ways; ++i) {
-    if (tags[address.first][i]->tag == address.second) {
+    if (tags[address.first*num_ways + i] == address.second) {
       if (cs_type.empty() ||
-          cs_type.back() != tags[address.first][i]->type) {
-        cs_type.push_back(tags[address.first][i]->type);
+          cs_type.back() != states[address.first*num_ways + i]) {
+        cs_type.push_back(states[address.first*num_ways + i]);
       }
       if (cs_type_l1l2.empty() ||
-          cs_type_l1l2.back() != tags[address.first][i]->type_l1l2) {
-        cs_type_l1l2.push_back(tags[address.first][i]->type_l1l2);
+          cs_type_l1l2.back() != lines[address.first*num_ways + i].type_l1l2) {
+        cs_type_l1l2.push_back(lines[address.first*num_ways + i].type_l1l2);
       }
       break;
     } else if (i == num_ways - 1) {  // not in L2 cache
@@ -340,12 +539,13 @@ void CacheL2ForTest::set_address(UINT64 address_) {
 UINT32 DirectoryForTest::process_event(UINT64 curr_time) {
   auto res = Directory::process_event(curr_time);
 
-  if (dir.find(address) != dir.end()) {
+  auto d_entry = dir.find(address);
+  if (d_entry != nullptr) {
     // if there's no recorded coherence state yet,
     // the last recorded coherence state had changed,
     if (cs_type.empty() ||
-        cs_type.back() != dir.find(address)->second.type) {  
-      cs_type.push_back(dir.find(address)->second.type);  // save the state
+        cs_type.back() != d_entry->type) {  
+      cs_type.push_back(d_entry->type);  // save the state
     }
   } else {  // not in directory
     cs_type.push_back(cs_invalid);
@@ -358,11 +558,38 @@ void DirectoryForTest::set_address(UINT64 address_) {
   cs_type.clear();
 }
 
-std::map<UINT64, PinPthread::Directory::DirEntry>::iterator DirectoryForTest::search_dir(UINT64 addr) {
+PinPthread::Directory::DirEntry * DirectoryForTest::search_dir(UINT64 addr) {
   return dir.find(addr >> set_lsb);
 }
-std::map<UINT64, PinPthread::Directory::DirEntry>::iterator DirectoryForTest::get_dir_end() {
-  return dir.end();
+PinPthread::Directory::DirEntry * DirectoryForTest::get_dir_end() {
+  return nullptr;
+}
+
+std::vector<coherence_state_type> CoherenceTest::changes_from(
+    const std::vector<coherence_state_type> & states, coherence_state_type before) {
+  auto first = std::find_if(states.begin(), states.end(),
+      [&](coherence_state_type cs) { return cs != before; });
+  return std::vector<coherence_state_type>(first, states.end());
+}
+
+coherence_state_type CoherenceTest::l1_state(CacheL1ForTest * l1, UINT64 address) {
+  auto set = l1->get_tags((address >> l1->set_lsb) % l1->num_sets);
+  for (UINT32 way = 0; way < l1->num_ways; way++) {
+    if (set.tag[way] == (address >> l1->set_lsb) / l1->num_sets && set.state[way] != cs_invalid) {
+      return set.state[way];
+    }
+  }
+  return cs_invalid;
+}
+
+std::pair<coherence_state_type, coherence_state_type> CoherenceTest::l2_line(CacheL2ForTest * l2, UINT64 address) {
+  auto set = l2->get_tags((address >> l2->set_lsb) % l2->num_sets);
+  for (UINT32 way = 0; way < l2->num_ways; way++) {
+    if (set.tag[way] == (address >> l2->set_lsb) / l2->num_sets && set.type[way] != cs_invalid) {
+      return std::make_pair(set.type[way], set.entry[way].type_l1l2);
+    }
+  }
+  return std::make_pair(cs_invalid, cs_invalid);
 }
 
 void CoherenceTest::set_rob_entry(O3ROB & o3rob_entry, UINT64 _memaddr, UINT64 ready_time, bool isread) {
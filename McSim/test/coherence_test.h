@@ -36,7 +36,11 @@ class CacheL1ForTest : public CacheL1 {
   explicit CacheL1ForTest(component_type type_, UINT32 num_, McSim * mcsim_):
     CacheL1(type_, num_, mcsim_) { }
   ~CacheL1ForTest() { }
-  l1_tag_pair** get_tags(UINT32 set) { return tags[set]; }
+  // tag and coherence state of way w in a set are tag[w] and state[w]
+  struct Set { const uint64_t * tag; const coherence_state_type * state; };
+  Set get_tags(UINT32 set) { return Set{&tags[set*num_ways], &states[set*num_ways]}; }
+  using CacheL1::num_prefetch_requests;
+  using CacheL1::num_nack;
 };
 
 class CacheL2ForTest : public CacheL2 {
@@ -48,7 +52,14 @@ class CacheL2ForTest : public CacheL2 {
   void set_address(UINT64);
   std::vector<coherence_state_type> cs_type;
   std::vector<coherence_state_type> cs_type_l1l2;
-  L2Entry** get_tags(UINT32 set) { return tags[set]; }
+  struct Set {
+    const uint64_t * tag; const coherence_state_type * type; const L2Entry * entry;
+  };
+  Set get_tags(UINT32 set) {
+    return Set{&tags[set*num_ways], &states[set*num_ways], &lines[set*num_ways]};
+  }
+  using CacheL2::num_prefetch_requests;
+  using CacheL2::num_prefetch_hits;
  private:
   std::pair<UINT32, UINT32> address;           // <set, tag>
 };
@@ -61,12 +72,44 @@ class DirectoryForTest : public Directory {
   UINT32 process_event(UINT64 curr_time) override;
   void set_address(UINT64);
   std::vector<coherence_state_type> cs_type;
-  std::map<UINT64, PinPthread::Directory::DirEntry>::iterator search_dir(UINT64);
-  std::map<UINT64, PinPthread::Directory::DirEntry>::iterator get_dir_end();
+  PinPthread::Directory::DirEntry * search_dir(UINT64);
+  PinPthread::Directory::DirEntry * get_dir_end();
  private:
   UINT64 address;
 };
 
+// the routing functions of the mesh and the ring
+class Mesh2DForTest : public Mesh2D {
+ public:
+  explicit Mesh2DForTest(McSim * mcsim_, UINT32 num_nodes_):
+    Mesh2D(ct_crossbar, 0, mcsim_, num_nodes_) { }
+  using Mesh2D::route;
+  using Mesh2D::neighbor;
+};
+
+class RingForTest : public Ring {
+ public:
+  explicit RingForTest(McSim * mcsim_, UINT32 num_nodes_):
+    Ring(ct_crossbar, 0, mcsim_, num_nodes_) { }
+  using Ring::route;
+  using Ring::neighbor;
+  using Ring::inject;
+  using Ring::max_buffered;
+  using Ring::num_credit_stalls;
+};
+
+// a node of a NoC that records what arrives at it
+class NoCNodeForTest : public Component {
+ public:
+  explicit NoCNodeForTest(McSim * mcsim_, UINT32 num_) : Component(ct_cachel2, num_, mcsim_) { }
+  void add_rep_event(UINT64 event_time, LocalQueueElement * lqe, Component * from) override {
+    arrivals.push_back(std::make_pair(event_time, lqe));
+  }
+  using Component::add_rep_event;
+  UINT32 process_event(UINT64 curr_time) override { return 0; }
+  std::vector<std::pair<UINT64, LocalQueueElement *>> arrivals;
+};
+
 class CoherenceTest : public ::testing::Test {
   protected:
     static std::unique_ptr<PinPthread::PthreadTimingSimulator> test_pts;
@@ -123,6 +166,14 @@ class CoherenceTest : public ::testing::Test {
     }
 
     void clear_geq() { test_pts->mcsim->global_q->event_queue.clear(); }
+    // the recorded states from the first one that is not 'before'; prefetches
+    // of other lines make a component process events before the watched line
+    // changes, and each of those events records 'before' again
+    static std::vector<coherence_state_type> changes_from(
+        const std::vector<coherence_state_type> & states, coherence_state_type before);
+    static coherence_state_type l1_state(CacheL1ForTest * l1, UINT64 address);
+    // (type, type_l1l2) of the line
+    static std::pair<coherence_state_type, coherence_state_type> l2_line(CacheL2ForTest * l2, UINT64 address);
     void set_rob_entry(O3ROB & o3rob_entry, UINT64 _memaddr, UINT64 ready_time, bool isread = true);
 };
 
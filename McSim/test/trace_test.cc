@@ -0,0 +1,83 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "trace_test.h"
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+#include <fstream>
+
+#include "snappy.h"
+
+namespace PinPthread {
+namespace TraceTest {
+
+void TraceReaderTest::SetUp() {
+  trace_name = "/tmp/" + std::to_string(getpid()) + "_trace_test.snappy";
+  std::ofstream trace_file(trace_name.c_str(), std::ios::binary);
+
+  std::vector<PTSInstrTrace> instrs(GROUP_SIZE);
+  std::string compressed;
+  size_t offset = 0;
+  for (size_t slice = 1; slice <= NUM_SLICES; slice++) {
+    for (uint32_t i = 0; i < GROUP_SIZE; i++) {
+      instrs[i] = PTSInstrTrace();
+      instrs[i].ip    = (slice - 1) * GROUP_SIZE + i + 1;
+      instrs[i].raddr = (i % 2 == 0) ? 0x1000 + instrs[i].ip : 0;
+    }
+    size_t compressed_length = snappy::Compress(
+        reinterpret_cast<char *>(instrs.data()), sizeof(PTSInstrTrace) * GROUP_SIZE, &compressed);
+    trace_file.write(reinterpret_cast<char *>(&slice), sizeof(size_t));
+    trace_file.write(reinterpret_cast<char *>(&compressed_length), sizeof(size_t));
+    trace_file.write(compressed.data(), compressed_length);
+    offset += 2*sizeof(size_t) + compressed_length;
+  }
+
+  PTSTraceFooter footer;
+  footer.offset_           = offset;
+  footer.total_slice_      = NUM_SLICES;
+  footer.instr_group_size_ = GROUP_SIZE;
+  footer.magic_number_     = kTraceMagicNumber;
+  trace_file.write(reinterpret_cast<char *>(&footer), sizeof(PTSTraceFooter));
+}
+
+
+TEST_F(TraceReaderTest, ReadAll) {
+  TraceReader reader(trace_name);
+
+  for (uint64_t ip = 1; ip <= GROUP_SIZE * NUM_SLICES; ip++) {
+    const PTSInstrTrace * instr = reader.next();
+    ASSERT_NE(nullptr, instr);
+    EXPECT_EQ(ip, instr->ip);
+    EXPECT_EQ((ip % 2 == 1) ? 0x1000 + ip : 0, instr->raddr);
+  }
+  EXPECT_EQ(nullptr, reader.next());
+  EXPECT_EQ(nullptr, reader.next());
+}
+
+TEST_F(TraceReaderTest, Skip) {
+  TraceReader reader(trace_name);
+
+  reader.skip(1);                 // within the first slice
+  EXPECT_EQ((uint64_t)2, reader.next()->ip);
+  reader.skip(GROUP_SIZE + 1);    // to the middle of the next slice
+  EXPECT_EQ((uint64_t)GROUP_SIZE + 4, reader.next()->ip);
+  reader.skip(GROUP_SIZE * NUM_SLICES);  // past the end
+  EXPECT_EQ(nullptr, reader.next());
+
+  TraceReader reader2(trace_name);
+  reader2.skip(GROUP_SIZE * 2);   // whole slices
+  EXPECT_EQ((uint64_t)GROUP_SIZE * 2 + 1, reader2.next()->ip);
+}
+
+TEST_F(TraceReaderTest, Repeat) {
+  TraceReader reader(trace_name, true);
+
+  reader.skip(GROUP_SIZE * NUM_SLICES - 1);
+  EXPECT_EQ((uint64_t)GROUP_SIZE * NUM_SLICES, reader.next()->ip);
+  EXPECT_EQ((uint64_t)1, reader.next()->ip);  // starts over
+}
+
+}
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2010-present Jung Ho Ahn and other contributors. All rights
+// reserved. Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef TRACE_TEST_H_
+#define TRACE_TEST_H_
+
+#include "gtest/gtest.h"
+
+#include "../PTSTrace.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace PinPthread {
+namespace TraceTest {
+
+class TraceReaderTest : public ::testing::Test {
+  protected:
+    static const uint32_t GROUP_SIZE = 4;  // instructions per slice
+    static const uint32_t NUM_SLICES = 3;
+
+    // writes a trace in the format of TraceGen; instruction i has ip = i + 1
+    virtual void SetUp() override;
+    virtual void TearDown() override { remove(trace_name.c_str()); }
+
+    std::string trace_name;
+};
+
+}
+}
+
+#endif // TRACE_TEST_H_
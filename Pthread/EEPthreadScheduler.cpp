@@ -90,7 +90,7 @@ void PthreadScheduler::PlayTraces(const string & trace_name, uint64_t trace_skip
       return;
     }
 
-    Footer* footer = new Footer;
+    PTSTraceFooter* footer = new PTSTraceFooter;
     PTSInstrTrace * instrs = new PTSInstrTrace[instr_group_size];
     const size_t maxCompressedLength = snappy::MaxCompressedLength(sizeof(PTSInstrTrace)*instr_group_size);
     size_t * compressed_length = new size_t;
@@ -102,10 +102,10 @@ void PthreadScheduler::PlayTraces(const string & trace_name, uint64_t trace_skip
     // read footer in trace file
     trace_file.seekg(0, ios::end);
     size_t total_size = trace_file.tellg();
-    size_t offset = total_size - sizeof(struct Footer);
+    size_t offset = total_size - sizeof(PTSTraceFooter);
 
     trace_file.seekg(offset, ios::beg);
-    trace_file.read(reinterpret_cast<char *>(footer), sizeof(struct Footer));
+    trace_file.read(reinterpret_cast<char *>(footer), sizeof(PTSTraceFooter));
 
     ASSERT(footer->magic_number_ == kTraceMagicNumber,
            "[ERROR] Invalid magic number in trace file!\n");
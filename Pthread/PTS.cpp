@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -16,7 +17,8 @@
 namespace PinPthread {
 
 PthreadTimingSimulator::PthreadTimingSimulator(uint32_t _pid, uint32_t _total_num, char * _tmp_shared):
-  num_piled_instr(0), pid(_pid), total_num(_total_num), tmp_shared(_tmp_shared) {
+  pid(_pid), total_num(_total_num), tmp_shared(_tmp_shared),
+  num_replies(0) {
 
   // Shared memory
   if ((mmapfd = open(tmp_shared, O_RDWR, 0666)) < 0) {
@@ -24,14 +26,14 @@ PthreadTimingSimulator::PthreadTimingSimulator(uint32_t _pid, uint32_t _total_nu
     exit(1);
   }
 
-  maped = reinterpret_cast<char *>(mmap(0, sizeof(PTSMessage)+2, PROT_WRITE | PROT_READ, MAP_SHARED, mmapfd, 0));
+  maped = reinterpret_cast<char *>(mmap(0, sizeof(PTSChannel), PROT_WRITE | PROT_READ, MAP_SHARED, mmapfd, 0));
   if (maped == MAP_FAILED) {
     perror("mmap");
     exit(1);
   }
 
-  ptsmessage = new (maped) PTSMessage;
-  mmap_flag = reinterpret_cast<bool *>(maped + sizeof(PTSMessage));
+  channel    = reinterpret_cast<PTSChannel *>(maped);
+  ptsmessage = &(channel->msg);
 
 #ifdef LOG_TRACE
   string trace_header = string("#\n"
@@ -43,22 +45,23 @@ PthreadTimingSimulator::PthreadTimingSimulator(uint32_t _pid, uint32_t _total_nu
 #endif
 
   num_hthreads = get_num_hthreads();
-  num_available_slot = new uint32_t[num_hthreads];
-  for (uint32_t i = 0; i < num_hthreads; i++) {
-    num_available_slot[i] = 1;
-  }
+  credits = new PTSCredit[num_hthreads];
+  batch.max_piled = std::max<uint64_t>(1, std::min<uint64_t>(instr_ring_size,
+        get_param_uint64("pts.instr_batch_size", instr_batch_size)));
+  batch.max_unpublished = std::max<uint64_t>(1, std::min<uint64_t>(batch.max_piled,
+        get_param_uint64("pts.instr_publish_size", instr_publish_size)));
 }
 
 
 PthreadTimingSimulator::~PthreadTimingSimulator() {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type        = pts_destructor;
 
   // Shared memory
-  mmap_flag[0] = false;
-  munmap(maped, sizeof(PTSMessage)+2);
+  channel->request.ring();
+  munmap(maped, sizeof(PTSChannel));
 
-  delete[] num_available_slot;
+  delete[] credits;
 
 #ifdef LOG_TRACE
   InstTraceFile.close();
@@ -67,22 +70,25 @@ PthreadTimingSimulator::~PthreadTimingSimulator() {
 
 
 std::pair<uint32_t, uint64_t> PthreadTimingSimulator::resume_simulation(bool must_switch, bool killed) {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type     = pts_resume_simulation;
   ptsmessage->bool_val = must_switch;
   ptsmessage->killed   = killed;
 
   sync_with_mcsim();
 
+  // mcsim simulated, so the o3queues have more room than the credits tell
+  for (uint32_t i = 0; i < num_hthreads; i++) {
+    credits[i].is_exact = false;
+  }
   return std::pair<uint32_t, uint64_t>(ptsmessage->uint32_t_val, ptsmessage->uint64_t_val);
 }
 
 
 void PthreadTimingSimulator::sync_with_mcsim() {
   // shared memory
-  mmap_flag[0] = false;
-  while (mmap_flag[1]) { }
-  mmap_flag[1] = true;
+  channel->request.ring();
+  num_replies = channel->reply.wait(num_replies);
 }
 
 #ifdef LOG_TRACE
@@ -93,7 +99,7 @@ void PthreadTimingSimulator::record_inst (ADDRINT ip, ADDRINT addr, string op) {
 }
 
 void PthreadTimingSimulator::record_transfer (uint32_t num_inst) {
-  InstTraceFile << setw(12) << num_piled_instr << "                    transfer complete !!!" << endl;
+  InstTraceFile << setw(12) << num_inst << "                    transfer complete !!!" << endl;
 }
 #endif
 
@@ -116,9 +122,9 @@ bool PthreadTimingSimulator::add_instruction(
     uint32_t rw0, uint32_t rw1, uint32_t rw2, uint32_t rw3,
     bool     can_be_piled) {
   // can_be_piled = false;
-  assert(num_piled_instr < instr_batch_size);
+  assert(batch.num_piled < batch.max_piled);
   ptsmessage->type         = pts_add_instruction;
-  PTSInstr   * ptsinstr    = &(ptsmessage->val.instr[num_piled_instr]);
+  PTSInstr   * ptsinstr    = batch.next(channel->ring);
   ptsinstr->hthreadid_ = hthreadid_;
   ptsinstr->curr_time_ = curr_time_;
   ptsinstr->waddr      = waddr;
@@ -159,29 +165,33 @@ bool PthreadTimingSimulator::add_instruction(
   }
 #endif
 
-  if (num_piled_instr > 0 && (ptsmessage->val.instr[num_piled_instr-1]).hthreadid_ != hthreadid_) {
-    cout << "  ++ [" << std::setw(12) << curr_time_ << "]:  " 
-      << (ptsmessage->val.instr[num_piled_instr-1]).hthreadid_ << "  " << hthreadid_ << endl;
+  if (batch.num_piled > 0 && batch.last(channel->ring)->hthreadid_ != hthreadid_) {
+    cout << "  ++ [" << std::setw(12) << curr_time_ << "]:  "
+      << batch.last(channel->ring)->hthreadid_ << "  " << hthreadid_ << endl;
     exit(1);
   }
 
-  num_piled_instr++;
-  ptsmessage->uint32_t_val = num_piled_instr;
-
-  if (can_be_piled == false || num_piled_instr >= instr_batch_size ||
-    num_piled_instr >= num_available_slot[hthreadid_]/* || isbarrier == true*/) {
-
-    sync_with_mcsim();
+  // mcsim adds what is published while this frontend keeps running
+  PTSCredit & credit = credits[hthreadid_];
+  if (batch.pile(channel->ring, can_be_piled, credit.num_available_slot) == true) {
+    uint32_t num = batch.send(channel->ring);
 #ifdef LOG_TRACE
-    record_transfer(ptsmessage->uint32_t_val);
+    record_transfer(num);
 #endif
-
-    num_piled_instr    = 0;
-    // return value -- how many more available slots to put instructions,
-    // 0 means that that we have to resume simulation
-    num_available_slot[hthreadid_] = ptsmessage->uint32_t_val;
-
-    return (num_available_slot[hthreadid_] <= 1 ? true : false);
+    if (credit.is_exact == true && batch.has_room_for_next(channel->ring) == true) {
+      // run ahead; mcsim would reply the room we already know
+      credit.take(num);
+      channel->request.nudge();
+    } else {
+      ptsmessage->uint32_t_val = num;
+      sync_with_mcsim();
+
+      // return value -- how many more available slots to put instructions,
+      // 0 means that that we have to resume simulation
+      credit.reply(ptsmessage->uint32_t_val);
+    }
+
+    return (credit.num_available_slot <= 1 ? true : false);
   } else {
     return false;
   }
@@ -192,7 +202,7 @@ void PthreadTimingSimulator::set_stack_n_size(
     int32_t pth_id,
     ADDRINT stack,
     ADDRINT stacksize) {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type          = pts_set_stack_n_size;
   ptsmessage->uint32_t_val  = pth_id;
   ptsmessage->stack_val     = stack;
@@ -203,7 +213,7 @@ void PthreadTimingSimulator::set_stack_n_size(
 
 
 void PthreadTimingSimulator::set_active(int32_t pth_id, bool is_active) {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type         = pts_set_active;
   ptsmessage->uint32_t_val = pth_id;
   ptsmessage->bool_val     = is_active;
@@ -213,7 +223,7 @@ void PthreadTimingSimulator::set_active(int32_t pth_id, bool is_active) {
 
 
 uint32_t PthreadTimingSimulator::get_num_hthreads() {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type        = pts_get_num_hthreads;
 
   sync_with_mcsim();
@@ -223,10 +233,10 @@ uint32_t PthreadTimingSimulator::get_num_hthreads() {
 
 
 uint64_t PthreadTimingSimulator::get_param_uint64(const std::string & str, uint64_t def) {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type         = pts_get_param_uint64;
   ptsmessage->uint64_t_val = def;
-  strcpy(ptsmessage->val.str, str.c_str());
+  strcpy(ptsmessage->str, str.c_str());
 
   sync_with_mcsim();
 
@@ -235,10 +245,10 @@ uint64_t PthreadTimingSimulator::get_param_uint64(const std::string & str, uint6
 
 
 bool PthreadTimingSimulator::get_param_bool(const std::string & str, bool def_value) {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type     = pts_get_param_bool;
   ptsmessage->bool_val = def_value;
-  strcpy(ptsmessage->val.str, str.c_str());
+  strcpy(ptsmessage->str, str.c_str());
 
   sync_with_mcsim();
 
@@ -247,7 +257,7 @@ bool PthreadTimingSimulator::get_param_bool(const std::string & str, bool def_va
 
 
 uint64_t PthreadTimingSimulator::get_curr_time() {
-  if (num_piled_instr) send_instr_batch();
+  if (batch.num_piled) send_instr_batch();
   ptsmessage->type         = pts_get_curr_time;
 
   sync_with_mcsim();
@@ -259,16 +269,16 @@ uint64_t PthreadTimingSimulator::get_curr_time() {
 void PthreadTimingSimulator::send_instr_batch() {
   assert(ptsmessage->type == pts_add_instruction);
 
-  sync_with_mcsim();
+  uint32_t hthreadid_ = batch.last(channel->ring)->hthreadid_;
+  ptsmessage->uint32_t_val = batch.send(channel->ring);
 #ifdef LOG_TRACE
   record_transfer(ptsmessage->uint32_t_val);
 #endif
+  sync_with_mcsim();
 
   // return value -- how many more available slots to put instructions,
   // 0 means that that we have to resume simulation
-  PTSInstr * ptsinstr = &(ptsmessage->val.instr[num_piled_instr-1]);
-  num_available_slot[ptsinstr->hthreadid_] = ptsmessage->uint32_t_val;
-  num_piled_instr     = 0;
+  credits[hthreadid_].reply(ptsmessage->uint32_t_val);
 }
 
 }  // namespace PinPthread
@@ -28,7 +28,7 @@
 #include "pin.H"
 #include "PthreadUtil.h"
 #include "snappy.h"
-#include "McSim/PTSInterface.h"
+#include "McSim/PTSChannel.h"
 
 const uint32_t instr_group_size = 100000;
 
@@ -36,26 +36,6 @@ typedef int * INT_PTR;
 typedef void * VOID_PTR;
 typedef char * CHAR_PTR;
 
-struct PTSInstrTrace {
-  uint64_t waddr;
-  uint32_t wlen;
-  uint64_t raddr;
-  uint64_t raddr2;
-  uint32_t rlen;
-  uint64_t ip;
-  uint32_t category;
-  bool     isbranch;
-  bool     isbranchtaken;
-  uint32_t rr0;
-  uint32_t rr1;
-  uint32_t rr2;
-  uint32_t rr3;
-  uint32_t rw0;
-  uint32_t rw1;
-  uint32_t rw2;
-  uint32_t rw3;
-};
-
 
 namespace PinPthread {
 
@@ -91,9 +71,9 @@ class PthreadTimingSimulator {
   bool     get_param_bool(const string & idx_, bool def_value);
   uint64_t get_curr_time();
 
-  uint32_t           num_piled_instr;      // in this object
+  PTSBatch           batch;                // piled in this object
   uint32_t           num_hthreads;
-  uint32_t         * num_available_slot;   // in the timing simulator
+  PTSCredit        * credits;              // of each hthread in the timing simulator
 
  private:
   // shared memory interface to commnunicate with mcsim
@@ -105,8 +85,9 @@ class PthreadTimingSimulator {
   uint32_t        pid;
   uint32_t        total_num;
   char          * tmp_shared;
+  PTSChannel    * channel;
   PTSMessage    * ptsmessage;
-  volatile bool * mmap_flag;
+  uint32_t        num_replies;  // from mcsim so far
 
 #ifdef LOG_TRACE
   std::ofstream InstTraceFile;
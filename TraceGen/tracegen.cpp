@@ -9,6 +9,7 @@
 #include "snappy.h"
 
 #include "pin.H"
+#include "McSim/PTSInterface.h"
 
 using namespace std;
 
@@ -40,31 +41,6 @@ bool     tracing;
 
 static const uint32_t instr_group_size = 100000;
 
-// Trace file magic number
-static const uint64_t kTraceMagicNumber = 0x1628efca19620db1ull;
-
-// TODO: define PTSInstrTrace somewhere else!
-// Currently, it is also defined in PTS.h, which is bad!
-struct PTSInstrTrace {
-  uint64_t waddr;
-  uint32_t wlen;
-  uint64_t raddr;
-  uint64_t raddr2;
-  uint32_t rlen;
-  uint64_t ip;
-  uint32_t category;
-  bool     isbranch;
-  bool     isbranchtaken;
-  uint32_t rr0;
-  uint32_t rr1;
-  uint32_t rr2;
-  uint32_t rr3;
-  uint32_t rw0;
-  uint32_t rw1;
-  uint32_t rw2;
-  uint32_t rw3;
-};
-
 PTSInstrTrace instrs[instr_group_size];
 const size_t maxCompressedLength = snappy::MaxCompressedLength(
                                    sizeof(PTSInstrTrace) * instr_group_size);
@@ -73,15 +49,6 @@ size_t * compressed_length;
 size_t * slice_count;
 size_t * offset;
 
-// Trace file footer
-struct Footer {
-  size_t offset_;
-  size_t total_slice_;
-  uint32_t instr_group_size_;
-  uint64_t magic_number_ = 0;
-};
-
-
 VOID Init(uint32_t argc, char ** argv) {
   tracing    = false;
 
@@ -243,7 +210,7 @@ VOID ProcessMemIns(
       tracing = false;
 
       // footer
-      Footer* footer = new Footer;
+      PTSTraceFooter* footer = new PTSTraceFooter;
       {
         footer->magic_number_ = kTraceMagicNumber;
         footer->total_slice_  = *slice_count;
@@ -251,7 +218,7 @@ VOID ProcessMemIns(
         footer->instr_group_size_ = instr_group_size;
       }
 
-      curr_file.write(reinterpret_cast<char *>(footer), sizeof(struct Footer));
+      curr_file.write(reinterpret_cast<char *>(footer), sizeof(PTSTraceFooter));
       curr_file.close();
 
       *slice_count = 0;